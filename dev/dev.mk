@@ -12,7 +12,8 @@ obj-$(CONFIG_EMBEDDED_NODE) += \
 	dev/sfp.o \
 	dev/devicelist.o \
 	dev/rxts_calibrator.o \
-	dev/flash.o
+	dev/flash.o \
+	dev/flash-spi.o
 
 obj-$(CONFIG_WR_NODE) += \
 	dev/temperature.o \
@@ -25,6 +26,7 @@ obj-$(CONFIG_LEGACY_EEPROM) += dev/eeprom.o
 obj-$(CONFIG_SDB_STORAGE) += dev/sdb-storage.o
 
 obj-$(CONFIG_DAC_LOG) += dev/dac_log.o
+obj-$(CONFIG_TELEMETRY) += dev/telemetry.o
 obj-$(CONFIG_W1) +=		dev/w1.o	dev/w1-hw.o	dev/w1-shell.o
 obj-$(CONFIG_W1) +=		dev/w1-temp.o	dev/w1-eeprom.o
 obj-$(CONFIG_W1) +=		dev/temp-w1.o
@@ -33,7 +35,7 @@ obj-$(CONFIG_FAKE_TEMPERATURES) += dev/fake-temp.o
 
 # Filter rules are selected according to configuration, but we may
 # have more than one. Note: the filename is reflected in symbol names,
-# so they are hardwired in ../Makefile (and ../tools/pfilter-builder too)
+# so they are hardwired in ../Makefile (and in the rule files, tools/*.pf)
 obj-y += $(pfilter-y:.bin=.o)
 
 rules-%.o: rules-%.bin
@@ -42,8 +44,8 @@ rules-%.o: rules-%.bin
 # sdbfs image
 obj-y += $(sdbfsimg-y:.bin=.o)
 
-sdbfs-default.o: tools/sdbfs-default.bin
+sdbfs-%.o: tools/sdbfs-%.bin
 	$(OBJCOPY) -I binary  $(OBJCOPY-TARGET-y) $< $@
 
-$(pfilter-y): tools
-	tools/pfilter-builder
+$(pfilter-y): rules-%.bin: tools/rules-%.pf tools
+	tools/pfilter-builder -o $@ $<
@@ -367,6 +367,30 @@ int storage_init_show(void)
 	return 0;
 }
 
+/* No whole-file access (nor compiled scripts): use storage_init_readcmd */
+int storage_init_read(uint8_t *buf, int size)
+{
+	return -1;
+}
+
+int storage_init_write(const uint8_t *buf, int len)
+{
+	return -1;
+}
+
+#ifdef CONFIG_PFILTER_UPLOAD
+/* No room for a rule-set in the legacy layout */
+int storage_pfilter_read(uint32_t *buf, int size)
+{
+	return -1;
+}
+
+int storage_pfilter_write(const uint32_t *buf, int len)
+{
+	return -1;
+}
+#endif
+
 int storage_init_readcmd(uint8_t *buf, uint8_t bufsize, uint8_t next)
 {
 	static uint16_t ptr;
@@ -397,6 +421,7 @@ int storage_init_readcmd(uint8_t *buf, uint8_t bufsize, uint8_t next)
 
 #ifdef CONFIG_W1
 #include <w1.h>
+#include <boot.h>
 /*
  * The "persistent mac" thing was part of onewire.c, and it's not something
  * I can understand, I admit.
@@ -418,6 +443,7 @@ int get_persistent_mac(uint8_t portnum, uint8_t * mac)
 	uint64_t rom;
 
 	pp_printf("%s: Using W1 serial number\n", __func__);
+	boot_w1_scan();
 	for (i = 0; i < W1_MAX_DEVICES; i++) {
 		class = w1_class(wrpc_w1_bus.devs + i);
 		if (class != 0x28 && class != 0x42)
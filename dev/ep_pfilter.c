@@ -16,7 +16,10 @@
  */
 
 #include <wrc.h>
+#include <string.h>
+#include <errno.h>
 #include <shell.h>
+#include <storage.h>
 #include <endpoint.h>
 #include <hw/endpoint_regs.h>
 
@@ -52,55 +55,39 @@ static uint32_t swap32(uint32_t v)
 	return res;
 }
 
-void pfilter_init_default(void)
+/*
+ * Make sure the file starts with the magic number and is in our
+ * byte order: the builder writes it in the order of the host.
+ */
+static int pfilter_fix_endianness(uint32_t *vini, uint32_t *vend)
+{
+	uint32_t *v, m = vini[0];
+
+	if (m != PFILTER_MAGIC)
+		for (v = vini; v < vend; v++)
+			*v = swap32(*v);
+	if (vini[0] != PFILTER_MAGIC) {
+		pp_printf("pfilter: wrong magic number (got 0x%x)\n", m);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* Patch the local values in a rule-set, load it, and restore it */
+static void pfilter_load(struct rule_set *s)
 {
-	struct rule_set *s;
 	uint8_t mac[6];
 	char buf[20];
-	uint32_t m, *vini, *vend, *v, *v_vlan = NULL;
+	uint32_t *vini, *vend, *v, *v_vlan = NULL;
 	uint64_t cmd_word;
 	int i;
-	static int inited;
 	uint32_t latency_ethtype = CONFIG_LATENCY_ETHTYPE;
+	uint32_t latency_mask = 0; /* instructions patched below */
 
-	/* If vlan, use rule-set 1, else rule-set 0 */
-	s = rule_sets + (wrc_vlan_number != 0);
-	if (!s->ini) {
-		pp_printf("no pfilter rule-set!\n");
-		return;
-	}
 	vini = s->ini;
 	vend = s->end;
+	v = vini + 1;
 
-	/*
-	 * The array of words starts with 0x11223344 so we
-	 * can fix endianness. Do it.
-	 */
-	v = vini;
-	m = v[0];
-	if (m != 0x11223344)
-		for (v = vini; v < vend; v++)
-			*v = swap32(*v);
-	v = vini;
-	if (v[0] != 0x11223344) {
-		pp_printf("pfilter: wrong magic number (got 0x%x)\n", m);
-		return;
-	}
-	v++;
-
-	/*
-	 * First time: be extra-careful that the rule-set is ok. But if
-	 * we change MAC address, this is re-called, and v[] is already changed
-	 */
-	if (!inited) {
-		if (   (((v[2] >> 13) & 0xffff) != 0x1234)
-		    || (((v[4] >> 13) & 0xffff) != 0x5678)
-		    || (((v[6] >> 13) & 0xffff) != 0x9abc)) {
-			pp_printf("pfilter: wrong rule-set, can't apply\n");
-			return;
-		}
-		inited++;
-	}
 	/*
 	 * Patch the local MAC address in place,
 	 * in the first three instructions after NOP
@@ -121,11 +108,12 @@ void pfilter_init_default(void)
 	 */
 	if (latency_ethtype == 0)
 		latency_ethtype = 0x88f7; /* reuse PTPv2 type: turn into NOP */
-	for (v = vini + 1; v < vend; v += 2) {
+	for (i = 0, v = vini + 1; v < vend; v += 2, i++) {
 		if (((*v >> 13) & 0xffff) == 0xcafe
-		    && (*v & 0x7) == OR) {
+		    && (*v & 0x7) == OR && i < PFILTER_MAX_CODE_SIZE) {
 			pfilter_verbose("fixing latency eth_type: use 0x%x\n",
 					latency_ethtype);
+			latency_mask |= 1 << i;
 			*v &= ~(0xffff << 13);
 			*v |= latency_ethtype << 13;
 		}
@@ -161,7 +149,16 @@ void pfilter_init_default(void)
 		EP->PFCR0 = cr0;
 	}
 
-	/* Restore the 0xaaa vlan number, so we can re-patch next time */
+	/*
+	 * Restore the 0xcafe ethtype and the 0xaaa vlan number, so we can
+	 * re-patch next time (and an uploaded rule-set is saved as it came)
+	 */
+	for (i = 0, v = vini + 1; v < vend; v += 2, i++) {
+		if (latency_mask & (1 << i)) {
+			*v &= ~(0xffff << 13);
+			*v |= 0xcafe << 13;
+		}
+	}
 	if (v_vlan) {
 		*v_vlan &= ~(0xffff << 13);
 		*v_vlan |= 0x0aaa << 13;
@@ -179,3 +176,191 @@ void pfilter_init_default(void)
 
 	EP->PFCR0 = EP_PFCR0_ENABLE;
 }
+
+#ifdef CONFIG_PFILTER_UPLOAD
+
+int pfilter_source = PFILTER_BUILTIN;
+uint32_t pfilter_staged[PFILTER_MAX_WORDS];
+int pfilter_staged_len;
+
+/* The uploaded rule-set, as checked when it was applied */
+static uint32_t pfilter_words[PFILTER_MAX_WORDS];
+static struct rule_set pfilter_uploaded = {
+	pfilter_words,
+	pfilter_words,
+};
+
+/*
+ * Check a rule-set before it reaches the hardware: the magic number,
+ * the place-holders of the MAC address at instructions 1 to 3 (we
+ * patch them blindly), and what pfilter_check() in lib/pfilter.c
+ * verifies in the builder. Returns the length in words, up to FIN.
+ */
+static int pfilter_validate(uint32_t *v, int n)
+{
+	static const uint16_t mac_marker[] = {
+		PFILTER_MAC_0, PFILTER_MAC_1, PFILTER_MAC_2
+	};
+	uint64_t ir;
+	int pc;
+
+	if (n < 1 || n > PFILTER_MAX_WORDS) {
+		pp_printf("pfilter: wrong length %i\n", n);
+		return -EINVAL;
+	}
+	if (pfilter_fix_endianness(v, v + n) < 0)
+		return -EINVAL;
+	for (pc = 0; 2 * pc + 2 < n; pc++) {
+		ir = v[2 * pc + 1] | ((uint64_t)v[2 * pc + 2] << 32);
+		if (ir >> 36)
+			break;
+		if (pc >= 1 && pc <= 3 && ((ir & (PFILTER_FIN | PFILTER_LOGIC))
+			    || PFILTER_CMP_VALUE(ir) != mac_marker[pc - 1])) {
+			pp_printf("pfilter: no MAC address at %i\n", pc);
+			return -EINVAL;
+		}
+		if (ir & PFILTER_FIN)
+			return 2 * pc + 3;
+		if (ir & PFILTER_LOGIC)
+			continue;
+		/* a comparison can't look ahead of the frame */
+		if (PFILTER_CMP_RD(ir) == 0 || PFILTER_CMP_OFFSET(ir) > pc)
+			break;
+	}
+	if (2 * pc + 2 < n)
+		pp_printf("pfilter: wrong instruction %i\n", pc);
+	else
+		pp_printf("pfilter: no FIN instruction\n");
+	return -EINVAL;
+}
+
+static int pfilter_activate(int source)
+{
+	int n;
+
+	n = pfilter_validate(pfilter_staged, pfilter_staged_len);
+	if (n < 0)
+		return n;
+	memcpy(pfilter_words, pfilter_staged, n * sizeof(*pfilter_words));
+	pfilter_uploaded.end = pfilter_words + n;
+	pfilter_source = source;
+	return 0;
+}
+
+/* At boot, prefer the rule-set saved in storage, if any */
+static void pfilter_restore(void)
+{
+	int ret;
+
+	ret = storage_pfilter_read(pfilter_staged, sizeof(pfilter_staged));
+	if (ret < (int)sizeof(uint32_t) || pfilter_staged[0] == 0xffffffff)
+		return; /* no file, or an erased one */
+	pfilter_staged_len = ret / sizeof(uint32_t);
+	if (pfilter_activate(PFILTER_STORED) < 0) {
+		pp_printf("pfilter: stored rule-set ignored\n");
+		return;
+	}
+	pp_printf("pfilter: using the stored rule-set\n");
+}
+
+int pfilter_get_active(uint32_t **words)
+{
+	struct rule_set *s = rule_sets + (wrc_vlan_number != 0);
+
+	if (pfilter_source != PFILTER_BUILTIN)
+		s = &pfilter_uploaded;
+	*words = s->ini;
+	return s->end - s->ini;
+}
+
+int pfilter_apply(void)
+{
+	int ret;
+
+	ret = pfilter_activate(PFILTER_UPLOADED);
+	if (ret == 0)
+		pfilter_init_default();
+	return ret;
+}
+
+int pfilter_use_builtin(void)
+{
+	pfilter_source = PFILTER_BUILTIN;
+	pfilter_init_default();
+	return 0;
+}
+
+int pfilter_save(void)
+{
+	struct rule_set *s = &pfilter_uploaded;
+
+	if (pfilter_source == PFILTER_BUILTIN) {
+		pp_printf("pfilter: the built-in rule-set is active\n");
+		return -EINVAL;
+	}
+	if (storage_pfilter_write(s->ini, (s->end - s->ini)
+				  * sizeof(uint32_t)) < 0)
+		return -EIO;
+	pfilter_source = PFILTER_STORED;
+	return 0;
+}
+
+int pfilter_erase(void)
+{
+	if (storage_pfilter_write(NULL, 0) < 0)
+		return -EIO;
+	if (pfilter_source == PFILTER_STORED)
+		pfilter_source = PFILTER_UPLOADED;
+	return 0;
+}
+
+#endif /* CONFIG_PFILTER_UPLOAD */
+
+void pfilter_init_default(void)
+{
+	struct rule_set *s;
+	uint32_t *v;
+	static int inited;
+
+#ifdef CONFIG_PFILTER_UPLOAD
+	static int restored;
+
+	if (!restored) {
+		pfilter_restore();
+		restored++;
+	}
+	if (pfilter_source != PFILTER_BUILTIN) {
+		pfilter_load(&pfilter_uploaded);
+		return;
+	}
+#endif
+	/* If vlan, use rule-set 1, else rule-set 0 */
+	s = rule_sets + (wrc_vlan_number != 0);
+	if (!s->ini) {
+		pp_printf("no pfilter rule-set!\n");
+		return;
+	}
+
+	/*
+	 * The array of words starts with 0x11223344 so we
+	 * can fix endianness. Do it.
+	 */
+	if (pfilter_fix_endianness(s->ini, s->end) < 0)
+		return;
+	v = s->ini + 1;
+
+	/*
+	 * First time: be extra-careful that the rule-set is ok. But if
+	 * we change MAC address, this is re-called, and v[] is already changed
+	 */
+	if (!inited) {
+		if (   (((v[2] >> 13) & 0xffff) != 0x1234)
+		    || (((v[4] >> 13) & 0xffff) != 0x5678)
+		    || (((v[6] >> 13) & 0xffff) != 0x9abc)) {
+			pp_printf("pfilter: wrong rule-set, can't apply\n");
+			return;
+		}
+		inited++;
+	}
+	pfilter_load(s);
+}
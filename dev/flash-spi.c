@@ -0,0 +1,64 @@
+/*
+ * This work is part of the White Rabbit project
+ *
+ * Copyright (C) 2013 CERN (www.cern.ch)
+ * Author: Theodor Stana <t.stana@cern.ch>
+ *
+ * Released according to the GNU LGPL, version 2.1 or any later version.
+ */
+#include <wrc.h>
+#include <flash.h>
+#include <syscon.h>
+
+/*
+ * Delay function - limit SPI clock speed to 10 MHz
+ */
+static void delay(void)
+{
+	int i;
+
+	for (i = 0; i < (int)(CPU_CLOCK/10000000); i++)
+		asm volatile ("nop");
+}
+
+/*
+ * Chip select is only changed at the start and end of a command,
+ * not for every byte, and no clock cycles are sent while deselected.
+ */
+void flash_spi_select(int on)
+{
+	gpio_out(GPIO_SPI_SCLK, 0);
+	gpio_out(GPIO_SPI_NCS, !on);
+	delay();
+}
+
+/*
+ * Bit-bang SPI transfer function
+ */
+uint8_t flash_spi_xfer(uint8_t val)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		gpio_out(GPIO_SPI_SCLK, 0);
+		gpio_out(GPIO_SPI_MOSI, val >> 7);
+		delay();
+		gpio_out(GPIO_SPI_SCLK, 1);
+		val <<= 1;
+		val |= gpio_in(GPIO_SPI_MISO);
+		delay();
+	}
+	gpio_out(GPIO_SPI_SCLK, 0);
+
+	return val;
+}
+
+/*
+ * Init function (just set the SPI pins for idle)
+ */
+void flash_spi_init(void)
+{
+	gpio_out(GPIO_SPI_NCS, 1);
+	gpio_out(GPIO_SPI_SCLK, 0);
+	gpio_out(GPIO_SPI_MOSI, 0);
+}
@@ -6,6 +6,7 @@
  *
  * Released according to the GNU LGPL, version 2.1 or any later version.
  */
+#include <string.h>
 #include <wrc.h>
 #include <flash.h>
 #include <types.h>
@@ -14,80 +15,131 @@
 #define SDBFS_BIG_ENDIAN
 #include <libsdbfs.h>
 
+/* Commands of M25P-like SPI flash chips */
+#define FLASH_WREN		0x06
+#define FLASH_PP		0x02
+#define FLASH_FAST_READ		0x0b
+#define FLASH_RDSR		0x05
+#define FLASH_SE		0xd8
+#define FLASH_BE		0xc7
+#define FLASH_SR_WIP		0x01
+
 /*
- * Delay function - limit SPI clock speed to 10 MHz
+ * Small reads are served from a cache of aligned lines, filled with a
+ * single FAST_READ each: sdbfs reads one record (64 bytes) at a time,
+ * and the storage code reads the init script byte by byte. So adjacent
+ * small reads cost one command. Writes and erases drop the lines they
+ * touch; larger reads bypass the cache.
  */
-static void delay(void)
+#define FLASH_LINE		64
+#define FLASH_NLINES		CONFIG_FLASH_CACHE_LINES
+#define FLASH_NOLINE		0xffffffff
+
+#if FLASH_NLINES
+static struct flash_line {
+	uint32_t addr;
+	uint8_t data[FLASH_LINE];
+} flash_cache[FLASH_NLINES];
+static int flash_victim;
+#endif
+
+/* Select the chip and send command and address: the caller deselects */
+static void flash_cmd(uint8_t cmd, uint32_t addr)
 {
-	int i;
+	flash_spi_select(1);
+	flash_spi_xfer(cmd);
+	flash_spi_xfer((addr & 0xFF0000) >> 16);
+	flash_spi_xfer((addr & 0xFF00) >> 8);
+	flash_spi_xfer((addr & 0xFF));
+}
 
-	for (i = 0; i < (int)(CPU_CLOCK/10000000); i++)
-		asm volatile ("nop");
+static void flash_wren(void)
+{
+	flash_spi_select(1);
+	flash_spi_xfer(FLASH_WREN);
+	flash_spi_select(0);
 }
 
-/*
- * Bit-bang SPI transfer function
- */
-static uint8_t bbspi_transfer(int cspin, uint8_t val)
+/* The status register is output continuously: a single command */
+static void flash_wait(void)
 {
-	int i;
+	flash_spi_select(1);
+	flash_spi_xfer(FLASH_RDSR);
+	while (flash_spi_xfer(0) & FLASH_SR_WIP)
+		;
+	flash_spi_select(0);
+}
 
-	gpio_out(GPIO_SPI_NCS, cspin);
-	delay();
-	for (i = 0; i < 8; i++) {
-		gpio_out(GPIO_SPI_SCLK, 0);
-		if (val & 0x80) {
-			gpio_out(GPIO_SPI_MOSI, 1);
-		} else {
-			gpio_out(GPIO_SPI_MOSI, 0);
-		}
-		delay();
-		gpio_out(GPIO_SPI_SCLK, 1);
-		val <<= 1;
-		val |= gpio_in(GPIO_SPI_MISO);
-		delay();
-	}
+static void flash_read_raw(uint32_t addr, uint8_t *buf, int count)
+{
+	flash_cmd(FLASH_FAST_READ, addr);
+	flash_spi_xfer(0); /* dummy byte */
+	while (count--)
+		*buf++ = flash_spi_xfer(0);
+	flash_spi_select(0);
+}
+
+#if FLASH_NLINES
+static void flash_cache_drop(uint32_t addr, uint32_t count)
+{
+	struct flash_line *l;
 
-	gpio_out(GPIO_SPI_SCLK, 0);
+	for (l = flash_cache; l < flash_cache + FLASH_NLINES; l++)
+		if (l->addr < addr + count && l->addr + FLASH_LINE > addr)
+			l->addr = FLASH_NOLINE;
+}
 
-	return val;
+static struct flash_line *flash_cache_get(uint32_t addr)
+{
+	struct flash_line *l;
+
+	addr &= ~(FLASH_LINE - 1);
+	for (l = flash_cache; l < flash_cache + FLASH_NLINES; l++)
+		if (l->addr == addr)
+			return l;
+	l = flash_cache + flash_victim;
+	if (++flash_victim == FLASH_NLINES)
+		flash_victim = 0;
+	flash_read_raw(addr, l->data, FLASH_LINE);
+	l->addr = addr;
+	return l;
 }
+#else
+static inline void flash_cache_drop(uint32_t addr, uint32_t count)
+{}
+#endif
 
 /*
  * Init function (just set the SPI pins for idle)
  */
 void flash_init(void)
 {
-	gpio_out(GPIO_SPI_NCS, 1);
-	gpio_out(GPIO_SPI_SCLK, 0);
-	gpio_out(GPIO_SPI_MOSI, 0);
+	flash_spi_init();
+	flash_cache_drop(0, FLASH_NOLINE);
 }
 
 /*
- * Write data to flash chip
+ * Write data to flash chip: one page program for each page touched
  */
 int flash_write(uint32_t addr, uint8_t *buf, int count)
 {
-	int i;
-
-	bbspi_transfer(1, 0);
-	bbspi_transfer(0, 0x06);
-	bbspi_transfer(1, 0);
-	bbspi_transfer(0, 0x02);
-	bbspi_transfer(0, (addr & 0xFF0000) >> 16);
-	bbspi_transfer(0, (addr & 0xFF00) >> 8);
-	bbspi_transfer(0, (addr & 0xFF));
-	for (i = 0; i < count; i++) {
-		bbspi_transfer(0, buf[i]);
+	int i, n, ret = count;
+
+	flash_cache_drop(addr, count);
+	for (; count; addr += n, buf += n, count -= n) {
+		/* the chip wraps at the end of the page: split there */
+		n = FLASH_PAGESIZE - (addr & (FLASH_PAGESIZE - 1));
+		if (n > count)
+			n = count;
+		flash_wren();
+		flash_cmd(FLASH_PP, addr);
+		for (i = 0; i < n; i++)
+			flash_spi_xfer(buf[i]);
+		flash_spi_select(0);
+		/* make sure the write is complete */
+		flash_wait();
 	}
-	bbspi_transfer(1, 0);
-
-	/* make sure the write is complete */
-	while (flash_rsr() & 0x01) {
-		/* do nothing */
-		}
-
-	return count;
+	return ret;
 }
 
 /*
@@ -95,19 +147,23 @@ int flash_write(uint32_t addr, uint8_t *buf, int count)
  */
 int flash_read(uint32_t addr, uint8_t *buf, int count)
 {
-	int i;
-
-	bbspi_transfer(1, 0);
-	bbspi_transfer(0, 0x0b);
-	bbspi_transfer(0, (addr & 0xFF0000) >> 16);
-	bbspi_transfer(0, (addr & 0xFF00) >> 8);
-	bbspi_transfer(0, (addr & 0xFF));
-	bbspi_transfer(0, 0);
-	for (i = 0; i < count; i++) {
-		buf[i] = bbspi_transfer(0, 0);
+#if FLASH_NLINES
+	struct flash_line *l;
+	int off, n, done;
+
+	if (count < FLASH_LINE) {
+		for (done = 0; done < count; done += n) {
+			l = flash_cache_get(addr + done);
+			off = (addr + done) & (FLASH_LINE - 1);
+			n = FLASH_LINE - off;
+			if (n > count - done)
+				n = count - done;
+			memcpy(buf + done, l->data + off, n);
+		}
+		return count;
 	}
-	bbspi_transfer(1, 0);
-
+#endif
+	flash_read_raw(addr, buf, count);
 	return count;
 }
 
@@ -125,8 +181,7 @@ int flash_erase(uint32_t addr, int count)
 
 	for (i = 0; i < sectors; ++i) {
 		flash_serase(addr + i*storage_cfg.blocksize);
-		while (flash_rsr() & 0x01)
-			;
+		flash_wait();
 	}
 
 	return count;
@@ -137,14 +192,11 @@ int flash_erase(uint32_t addr, int count)
  */
 void flash_serase(uint32_t addr)
 {
-	bbspi_transfer(1, 0);
-	bbspi_transfer(0, 0x06);
-	bbspi_transfer(1, 0);
-	bbspi_transfer(0, 0xD8);
-	bbspi_transfer(0, (addr & 0xFF0000) >> 16);
-	bbspi_transfer(0, (addr & 0xFF00) >> 8);
-	bbspi_transfer(0, (addr & 0xFF));
-	bbspi_transfer(1, 0);
+	flash_cache_drop(addr & ~(storage_cfg.blocksize - 1),
+			 storage_cfg.blocksize);
+	flash_wren();
+	flash_cmd(FLASH_SE, addr);
+	flash_spi_select(0);
 }
 
 /*
@@ -153,11 +205,11 @@ void flash_serase(uint32_t addr)
 void
 flash_berase(void)
 {
-	bbspi_transfer(1, 0);
-	bbspi_transfer(0, 0x06);
-	bbspi_transfer(1, 0);
-	bbspi_transfer(0, 0xc7);
-	bbspi_transfer(1, 0);
+	flash_cache_drop(0, FLASH_NOLINE);
+	flash_wren();
+	flash_spi_select(1);
+	flash_spi_xfer(FLASH_BE);
+	flash_spi_select(0);
 }
 
 /*
@@ -167,10 +219,10 @@ uint8_t flash_rsr(void)
 {
 	uint8_t retval;
 
-	bbspi_transfer(1, 0);
-	bbspi_transfer(0, 0x05);
-	retval = bbspi_transfer(0, 0);
-	bbspi_transfer(1, 0);
+	flash_spi_select(1);
+	flash_spi_xfer(FLASH_RDSR);
+	retval = flash_spi_xfer(0);
+	flash_spi_select(0);
 	return retval;
 }
 
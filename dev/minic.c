@@ -27,6 +27,7 @@
 #define F_COUNTER_MASK ((1<<F_COUNTER_BITS)-1)
 
 #define RX_STATUS_ERROR(d) ((d) & (1<<1) ? 1 : 0)
+#define RX_STATUS_CLASS(d) (((d) >> 8) & 0xff)
 #define RXOOB_TS_INCORRECT (1<<11)
 
 #define RX_OOB_SIZE 3	/* as the number of FIFO data words */
@@ -122,6 +123,10 @@ int minic_rx_frame(struct wr_ethhdr *hdr, uint8_t * payload, uint32_t buf_size,
 	uint64_t sec;
 	uint32_t counter_r, counter_f, counter_ppsg;
 	int cntr_diff;
+#ifdef CONFIG_PFILTER_UPLOAD
+	uint8_t rx_class = 0;
+	int i;
+#endif
 
 
 	/* check if there is something in the Rx FIFO to be retrieved */
@@ -164,6 +169,12 @@ int minic_rx_frame(struct wr_ethhdr *hdr, uint8_t * payload, uint32_t buf_size,
 
 			break;
 		}
+#ifdef CONFIG_PFILTER_UPLOAD
+		else if (rx_type == WRF_STATUS) {
+			/* our own status: the classes the filter set */
+			rx_class = RX_STATUS_CLASS(rx_data);
+		}
+#endif
 	} while (!rx_empty && rx_type != WRF_OOB);
 
 	/* Receive OOB, if it's there */
@@ -212,6 +223,11 @@ int minic_rx_frame(struct wr_ethhdr *hdr, uint8_t * payload, uint32_t buf_size,
 
 	/* Increment Rx counter for statistics */
 	minic.rx_count++;
+#ifdef CONFIG_PFILTER_UPLOAD
+	for (i = 0; i < 8; i++)
+		if (rx_class & (1 << i))
+			minic.rx_class[i]++;
+#endif
 
 	if (minic_readl(MINIC_REG_MCR) & MINIC_MCR_RX_FULL)
 		pp_printf("Warning: Minic Rx fifo full, expect wrong frames\n");
@@ -114,6 +114,12 @@ void __attribute__((weak)) shw_pps_gen_get_time(uint64_t * seconds,
 		*nanoseconds = ns_cnt * NS_PER_CLOCK;
 }
 
+/* Returns the raw refclk cycle counter, wrapping every second */
+uint32_t shw_pps_gen_get_cycles(void)
+{
+	return ppsg_read(CNTR_NSEC) & 0xFFFFFFFUL;
+}
+
 /* Returns 1 when the adjustment operation is not yet finished */
 int shw_pps_gen_busy()
 {
@@ -32,6 +32,12 @@
    - transition phase value is in the middle between the rising and falling
      edges.
    
+   The scan stops as soon as both transitions are found: their phases don't
+   change after that, so the result is the same as scanning the whole range.
+   A coarse or bisecting search doesn't pay here: the phase shifter moves at
+   a fixed rate, so the time depends on the distance covered, not on the
+   number of samples.
+
    This calibration procedure is fast enough to be run on slave nodes whenever
    the link goes up. For master mode, the core must be run at least once as a
    slave to calibrate itself and store the current transition phase value in
@@ -151,45 +157,42 @@ int rxts_calibration_update(uint32_t *t24p_value)
 	lookup_transition(&det_rising, flip, cal_cur_phase, 1);
 	lookup_transition(&det_falling, flip, cal_cur_phase, 0);
 
-	if (cal_cur_phase >= CAL_SCAN_RANGE) {
-		if (det_rising.state != TD_DONE || det_falling.state != TD_DONE) 
-		{
+	/* Both transitions found: scanning further wouldn't change them */
+	if (det_rising.state != TD_DONE || det_falling.state != TD_DONE) {
+		if (cal_cur_phase >= CAL_SCAN_RANGE) {
 			wrc_verbose("RXTS calibration error.\n");
 			return -1;
 		}
+		cal_cur_phase += CAL_SCAN_STEP;
+		spll_set_phase_shift(0, cal_cur_phase);
+		return 0;
+	}
 
-		/* normalize */
-		while (det_falling.trans_phase >= REF_CLOCK_PERIOD_PS)
-			det_falling.trans_phase -= REF_CLOCK_PERIOD_PS;
-		while (det_rising.trans_phase >= REF_CLOCK_PERIOD_PS)
-			det_rising.trans_phase -= REF_CLOCK_PERIOD_PS;
-
-		/* Use falling edge as second sample of rising edge */
-		if (det_falling.trans_phase > det_rising.trans_phase)
-			ttrans = det_falling.trans_phase - REF_CLOCK_PERIOD_PS/2;
-		else if(det_falling.trans_phase < det_rising.trans_phase)
-			ttrans = det_falling.trans_phase + REF_CLOCK_PERIOD_PS/2;
-		ttrans += det_rising.trans_phase;
-		ttrans /= 2;
-
-		/*normalize ttrans*/
-		if(ttrans < 0) ttrans += REF_CLOCK_PERIOD_PS;
-		if(ttrans >= REF_CLOCK_PERIOD_PS) ttrans -= REF_CLOCK_PERIOD_PS;
-
+	/* normalize */
+	while (det_falling.trans_phase >= REF_CLOCK_PERIOD_PS)
+		det_falling.trans_phase -= REF_CLOCK_PERIOD_PS;
+	while (det_rising.trans_phase >= REF_CLOCK_PERIOD_PS)
+		det_rising.trans_phase -= REF_CLOCK_PERIOD_PS;
 
-		wrc_verbose("RXTS calibration: R@%dps, F@%dps, transition@%dps\n",
-			  det_rising.trans_phase, det_falling.trans_phase,
-			  ttrans);
+	/* Use falling edge as second sample of rising edge */
+	if (det_falling.trans_phase > det_rising.trans_phase)
+		ttrans = det_falling.trans_phase - REF_CLOCK_PERIOD_PS/2;
+	else if(det_falling.trans_phase < det_rising.trans_phase)
+		ttrans = det_falling.trans_phase + REF_CLOCK_PERIOD_PS/2;
+	ttrans += det_rising.trans_phase;
+	ttrans /= 2;
 
-		*t24p_value = (uint32_t)ttrans;
-		return 1;
-	}
+	/*normalize ttrans*/
+	if(ttrans < 0) ttrans += REF_CLOCK_PERIOD_PS;
+	if(ttrans >= REF_CLOCK_PERIOD_PS) ttrans -= REF_CLOCK_PERIOD_PS;
 
-	cal_cur_phase += CAL_SCAN_STEP;
 
-	spll_set_phase_shift(0, cal_cur_phase);
+	wrc_verbose("RXTS calibration: R@%dps, F@%dps, transition@%dps "
+		    "(scanned %dps)\n", det_rising.trans_phase,
+		    det_falling.trans_phase, ttrans, cal_cur_phase);
 
-	return 0;
+	*t24p_value = (uint32_t)ttrans;
+	return 1;
 }
 
 /* legacy function for 'calibration force' command */
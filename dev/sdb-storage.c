@@ -22,6 +22,7 @@
 #define SDBFS_BIG_ENDIAN
 #include <libsdbfs.h>
 #include <flash.h>
+#include <boot.h>
 
 /*
  * This source file is a drop-in replacement of the legacy one: it manages
@@ -32,6 +33,7 @@
 #define SDB_DEV_MAC	0x6d61632d /* mac- (address) */
 #define SDB_DEV_SFP	0x7366702d /* sfp- (database) */
 #define SDB_DEV_CALIB	0x63616c69 /* cali (bration) */
+#define SDB_DEV_PFILTER	0x7066696c /* pfil (ter) */
 
 /* constants for scanning I2C EEPROMs */
 #define EEPROM_START_ADR 0
@@ -183,6 +185,9 @@ static void storage_sdb_list(struct sdbfs *fs)
 		new = 0;
 	}
 }
+/* Room for the default files, and the bitstream in flash */
+static struct sdbfs_index wrc_sdb_index[SDBFS_REC + 3];
+
 /* The sdb filesystem itself, build-time initialized for i2c */
 static struct sdbfs wrc_sdb = {
 	.name = "eeprom",
@@ -190,6 +195,8 @@ static struct sdbfs wrc_sdb = {
 	.drvdata = &i2c_params,
 	.read = sdb_i2c_read,
 	.write = sdb_i2c_write,
+	.index = wrc_sdb_index,
+	.index_size = ARRAY_SIZE(wrc_sdb_index),
 };
 
 uint8_t has_eeprom = 0; /* modified at init time */
@@ -237,6 +244,7 @@ void storage_init(int chosen_i2cif, int chosen_i2c_addr)
 	/*
 	 * 2. Look for w1 first: if there is no eeprom it fails fast
 	 */
+	boot_w1_scan(); /* not done yet with fast boot */
 	for (i = 0; i < ARRAY_SIZE(entry_points_eeprom); i++) {
 		ret = w1_read_eeprom_bus(&wrpc_w1_bus, entry_points_eeprom[i],
 					 (void *)&magic, sizeof(magic));
@@ -299,6 +307,7 @@ found_exit:
 	has_eeprom = 1;
 	sdbfs_dev_create(&wrc_sdb);
 	storage_sdb_list(&wrc_sdb);
+	storage_sfpdb_reload();
 	return;
 }
 
@@ -335,6 +344,7 @@ int get_persistent_mac(uint8_t portnum, uint8_t *mac)
 	}
 	if (ret < 0) {
 		pp_printf("%s: Using W1 serial number\n", __func__);
+		boot_w1_scan();
 		for (i = 0; i < W1_MAX_DEVICES; i++) {
 			class = w1_class(wrpc_w1_bus.devs + i);
 			if (class != 0x28 && class != 0x42)
@@ -375,11 +385,235 @@ int set_persistent_mac(uint8_t portnum, uint8_t *mac)
 }
 
 /*
- * The SFP section is placed somewhere inside EEPROM (W1 or I2C), using sdbfs.
+ * Record log: the SFP database and the calibration file are written as
+ * an append-only log, so an update is a single write, without erasing
+ * the file (a whole flash sector). The file is split in two slots,
+ * each a whole number of erase blocks; the active slot starts with a
+ * header and records follow:
  *
- * Initially we have a count of SFP records
+ * - header: "SL", generation (1 byte), crc-8 of these 3 bytes
+ * - length of the payload (1 byte, 0xff is free space)
+ * - sequence number (1 byte, one more than the previous record)
+ * - payload
+ * - crc-8 of all the previous bytes of the record
+ *
+ * The latest record for a key wins. A bad crc or sequence number
+ * (e.g. a write interrupted by power loss) ends the log, and the next
+ * write compacts it: erase the other slot, write the live records
+ * there, and then its header, with the next generation. Until that
+ * header is written the old slot is the valid one, so a power loss
+ * during compaction loses nothing. Compaction is also run by the
+ * storage task when the slot is nearly full, so a later update doesn't
+ * pay for it. Files too small for two slots of "maxrec" records and one
+ * more (or for two erase blocks, in flash) have one slot, which is
+ * erased to compact. Files without a header are in the legacy format
+ * and are converted at the first write.
+ */
+#define SLOG_MAGIC	0x534c /* "SL" */
+#define SLOG_HDR	4
+#define SLOG_OVERHEAD	3
+#define SLOG_MAX_LEN	32
+#define SLOG_BATCH	128 /* bytes per write, when compacting */
+
+struct slog {
+	int base;		/* offset of the active slot */
+	int free;		/* offset of free space, 0 if not formatted */
+	int nrec;		/* records in the active slot */
+	int slot;		/* size of a slot: half the file, or all of it */
+	uint8_t gen;		/* of the active slot */
+	uint8_t seq;		/* of the last record */
+	uint8_t reclen;		/* payload size */
+	uint8_t maxrec;		/* live records, at most */
+};
+
+/*
+ * The crc-8 of a record or header. It is never 0xff, so a write that is
+ * cut before its last byte (still erased) is never taken as valid.
+ */
+static uint8_t slog_crc8(const uint8_t *p, int len)
+{
+	uint8_t crc = 0;
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+	}
+	return crc == 0xff ? 0xfe : crc;
+}
+
+/* Split the open file in slots: two if they are big enough */
+static void slog_geometry(struct slog *log)
+{
+	int bs = wrc_sdb.blocksize > 0 ? wrc_sdb.blocksize : 1;
+	int size = log->reclen + SLOG_OVERHEAD;
+
+	log->slot = wrc_sdb.f_len / 2 / bs * bs;
+	if (log->slot < SLOG_HDR + (log->maxrec + 1) * size)
+		log->slot = wrc_sdb.f_len;
+}
+
+/* Returns the generation of a valid slot header, -1 otherwise */
+static int slog_header(int off)
+{
+	uint8_t hdr[SLOG_HDR];
+
+	if (sdbfs_fread(&wrc_sdb, off, hdr, sizeof(hdr)) != sizeof(hdr))
+		return -1;
+	if ((hdr[0] << 8 | hdr[1]) != SLOG_MAGIC
+	    || slog_crc8(hdr, 3) != hdr[3])
+		return -1;
+	return hdr[2];
+}
+
+/*
+ * Scan the open file, calling "fn" for every valid record. Returns -1
+ * for a legacy file, 0 otherwise (an erased file is an empty log).
+ */
+static int slog_scan(struct slog *log, void (*fn)(void *payload))
+{
+	uint8_t rec[SLOG_MAX_LEN + SLOG_OVERHEAD];
+	uint32_t magic;
+	int off, size, end, gen0, gen1 = -1;
+
+	slog_geometry(log);
+	log->base = 0;
+	log->free = 0;
+	log->nrec = 0;
+	gen0 = slog_header(0);
+	if (log->slot < wrc_sdb.f_len)
+		gen1 = slog_header(log->slot);
+	if (gen0 < 0 && gen1 < 0) {
+		/* no log: an erased file is empty, anything else is legacy */
+		if (sdbfs_fread(&wrc_sdb, 0, &magic, sizeof(magic))
+		    != sizeof(magic))
+			return -1;
+		return magic == 0xffffffff ? 0 : -1;
+	}
+	/* two valid slots: the one with the following generation wins */
+	if (gen0 < 0 || (gen1 >= 0 && (int8_t)(gen1 - gen0) > 0))
+		log->base = log->slot;
+	log->gen = log->base ? gen1 : gen0;
+
+	size = log->reclen + SLOG_OVERHEAD;
+	end = log->base + log->slot;
+	for (off = log->base + SLOG_HDR; off + size <= end; off += size) {
+		if (sdbfs_fread(&wrc_sdb, off, rec, size) != size)
+			break;
+		if (rec[0] == 0xff)
+			break; /* free space */
+		if (rec[0] != log->reclen
+		    || (log->nrec && rec[1] != (uint8_t)(log->seq + 1))
+		    || slog_crc8(rec, size - 1) != rec[size - 1]) {
+			off = end; /* unusable: compact at next write */
+			break;
+		}
+		log->seq = rec[1];
+		log->nrec++;
+		fn(rec + 2);
+	}
+	log->free = off;
+	return 0;
+}
+
+/* Build the record after the last one, returns its size */
+static int slog_record(struct slog *log, uint8_t *rec, void *payload)
+{
+	int size = log->reclen + SLOG_OVERHEAD;
+
+	rec[0] = log->reclen;
+	rec[1] = log->nrec ? log->seq + 1 : 0;
+	memcpy(rec + 2, payload, log->reclen);
+	rec[size - 1] = slog_crc8(rec, size - 1);
+	log->seq = rec[1];
+	log->nrec++;
+	return size;
+}
+
+/* Returns 0 on success, -ENOSPC if the log must be compacted first */
+static int slog_append(struct slog *log, void *payload)
+{
+	uint8_t rec[SLOG_MAX_LEN + SLOG_OVERHEAD];
+	int size = log->reclen + SLOG_OVERHEAD;
+
+	if (!log->free || log->free + size > log->base + log->slot)
+		return -ENOSPC; /* no slot yet, or a full one */
+	slog_record(log, rec, payload);
+	if (sdbfs_fwrite(&wrc_sdb, log->free, rec, size) != size)
+		return -EIO;
+	log->free += size;
+	return 0;
+}
+
+/* Erase the open file: an empty log */
+static int slog_erase(struct slog *log)
+{
+	log->free = 0;
+	log->nrec = 0;
+	if (sdbfs_ferase(&wrc_sdb, 0, wrc_sdb.f_len) != wrc_sdb.f_len)
+		return -EIO;
+	return 0;
+}
+
+/*
+ * Write "n" records (spaced by "stride" in memory) to the slot that is
+ * not active, a buffer at a time: in flash each write is a page
+ * program. The header goes last, and only then the slot is active.
+ */
+static int slog_rewrite(struct slog *log, void *payloads, int stride, int n)
+{
+	uint8_t buf[SLOG_BATCH], gen;
+	int i, len, off, base, size = log->reclen + SLOG_OVERHEAD;
+
+	slog_geometry(log);
+	base = 0;
+	gen = log->free ? log->gen + 1 : 0;
+	if (log->slot < wrc_sdb.f_len) {
+		/* the other slot; or the second, as a legacy file is at 0 */
+		base = log->free && log->base ? 0 : log->slot;
+	}
+	log->nrec = 0; /* on error, the caller scans again */
+	if (sdbfs_ferase(&wrc_sdb, base, log->slot) != log->slot)
+		return -EIO;
+	off = base + SLOG_HDR;
+	for (i = 0, len = 0; i <= n; i++) {
+		if (i == n || len + size > sizeof(buf)) {
+			if (off + len > base + log->slot)
+				return -ENOSPC;
+			if (sdbfs_fwrite(&wrc_sdb, off, buf, len) != len)
+				return -EIO;
+			off += len;
+			len = 0;
+		}
+		if (i < n)
+			len += slog_record(log, buf + len,
+					   (uint8_t *)payloads + i * stride);
+	}
+	buf[0] = SLOG_MAGIC >> 8;
+	buf[1] = SLOG_MAGIC & 0xff;
+	buf[2] = gen;
+	buf[3] = slog_crc8(buf, 3);
+	if (sdbfs_fwrite(&wrc_sdb, base, buf, SLOG_HDR) != SLOG_HDR)
+		return -EIO;
+	log->base = base;
+	log->gen = gen;
+	log->free = off;
+	return 0;
+}
+
+/* True if the next append would need a compaction */
+static int slog_nearly_full(struct slog *log)
+{
+	return log->free + log->reclen + SLOG_OVERHEAD
+		> log->base + log->slot;
+}
+
+/*
+ * The SFP section is placed somewhere inside EEPROM (W1 or I2C), using sdbfs.
  *
- * For each sfp we have
+ * In the legacy format we have a count of SFP records (unused), then
+ * for each sfp we have
  *
  * - part number (16 bytes)
  * - alpha (4 bytes)
@@ -388,21 +622,58 @@ int set_persistent_mac(uint8_t portnum, uint8_t *mac)
  * - checksum (1 byte)  (low order 8 bits of the sum of all bytes)
  *
  * the total is 29 bytes for each sfp (ugly, but we are byte-oriented anyways
+ *
+ * The log format has a record for each sfp added or updated, with the
+ * first 28 bytes above. The default file has 512 bytes: two slots where
+ * a full database leaves room for four updates before compacting.
  */
+#define SFP_RECLEN (sizeof(struct s_sfpinfo) - 1)
 
+/*
+ * The database is small (SFPS_MAX entries) but reading it costs many
+ * flash or eeprom accesses, and it is looked up at every link-up and
+ * by snmp. So keep it in RAM: it is loaded at storage_init (or when
+ * first used after an error), writes go through to storage, and only
+ * an erase or an explicit reload drops it.
+ */
+static struct s_sfpinfo sfp_cache[SFPS_MAX];
+static int sfp_cache_count = -1; /* not loaded */
+static uint8_t sfp_cache_bad; /* bitmask: corrupted checksum */
+static struct slog sfp_log = {
+	.reclen = SFP_RECLEN,
+	.maxrec = SFPS_MAX,
+};
+static int sfp_legacy; /* the file is in the legacy format */
+static int sfp_compact_pending;
+
+static uint8_t sfp_chksum(struct s_sfpinfo *sfp)
+{
+	uint8_t *ptr = (uint8_t *)sfp;
+	uint8_t i, chksum = 0;
+
+	/* use sizeof() - 1 because we don't include checksum */
+	for (i = 0; i < sizeof(struct s_sfpinfo) - 1; ++i)
+		chksum = chksum + *(ptr++);
+	return chksum;
+}
 
 /* Erase SFB database in the memory */
 int32_t storage_sfpdb_erase(void)
 {
 	int ret;
 
+	sfp_cache_count = -1;
 	if (sdbfs_open_id(&wrc_sdb, SDB_VENDOR, SDB_DEV_SFP) < 0)
 		return -1;
-	ret = sdbfs_ferase(&wrc_sdb, 0, wrc_sdb.f_len);
-	if (ret == wrc_sdb.f_len)
-		ret = 1;
+	ret = slog_erase(&sfp_log);
 	sdbfs_close(&wrc_sdb);
-	return ret == 1 ? 0 : -1;
+	if (ret == 0) {
+		sfp_cache_count = 0;
+		sfp_cache_bad = 0;
+		sfp_legacy = 0;
+		sfp_compact_pending = 0;
+	}
+	return ret == 0 ? 0 : -1;
 }
 
 /* Dummy check if sfp information is correct by verifying it doesn't have
@@ -418,187 +689,244 @@ static int sfp_valid(struct s_sfpinfo *sfp)
 	return 1;
 }
 
-static int sfp_entry(struct s_sfpinfo *sfp, uint8_t oper, uint8_t pos)
+/* Returns the position in the cache, -1 if missing, -2 if corrupted */
+static int sfp_cache_find(struct s_sfpinfo *sfp)
 {
-	static uint8_t sfpcount = 0;
-	struct s_sfpinfo tempsfp;
-	int ret = -1;
-	uint8_t i, chksum = 0;
-	uint8_t *ptr;
+	int i;
+
+	for (i = 0; i < sfp_cache_count; ++i) {
+		if (sfp_cache_bad & (1 << i)) {
+			pp_printf("sfp: corrupted checksum\n");
+			return -2;
+		}
+		if (!strncmp(sfp_cache[i].pn, sfp->pn, 16))
+			return i;
+	}
+	return -1;
+}
+
+/* Called by slog_scan for each record: the latest one wins */
+static void sfp_log_record(void *payload)
+{
+	struct s_sfpinfo sfp;
+	int i;
+
+	memcpy(&sfp, payload, SFP_RECLEN);
+	sfp.chksum = sfp_chksum(&sfp);
+	i = sfp_cache_find(&sfp);
+	if (i < 0) {
+		if (sfp_cache_count == SFPS_MAX)
+			return;
+		i = sfp_cache_count++;
+	}
+	sfp_cache[i] = sfp;
+}
+
+/* Read the whole database, the first byte is the (unused) count */
+static void sfp_legacy_load(void)
+{
+	struct s_sfpinfo *sfp;
 	int sdb_offset;
 
-	if (pos >= SFPS_MAX)
-		return EE_RET_POSERR;	/* position outside the range */
+	for (sfp = sfp_cache; sfp < sfp_cache + SFPS_MAX; sfp++) {
+		sdb_offset = sizeof(uint8_t) + (sfp - sfp_cache) * sizeof(*sfp);
+		if (sdbfs_fread(&wrc_sdb, sdb_offset, sfp, sizeof(*sfp))
+		    != sizeof(*sfp))
+			break;
+		if (!sfp_valid(sfp))
+			break;
+		if (sfp_chksum(sfp) != sfp->chksum)
+			sfp_cache_bad |= 1 << (sfp - sfp_cache);
+	}
+	sfp_cache_count = sfp - sfp_cache;
+}
 
+int storage_sfpdb_reload(void)
+{
+	sfp_cache_count = -1;
+	sfp_cache_bad = 0;
 	if (sdbfs_open_id(&wrc_sdb, SDB_VENDOR, SDB_DEV_SFP) < 0)
 		return -1;
+	sfp_cache_count = 0;
+	sfp_legacy = slog_scan(&sfp_log, sfp_log_record) < 0;
+	if (sfp_legacy)
+		sfp_legacy_load();
+	sfp_compact_pending = slog_nearly_full(&sfp_log)
+		&& sfp_log.nrec > sfp_cache_count;
+	sdbfs_close(&wrc_sdb);
+	return sfp_cache_count;
+}
 
-	/* Read how many SFPs are in the database, but only in the first
-	 * call */
-	if (!pos) {
-		sfpcount = 0;
-		sdb_offset = sizeof(sfpcount);
-		while (sdbfs_fread(&wrc_sdb, sdb_offset, &tempsfp,
-					sizeof(tempsfp)) == sizeof(tempsfp)) {
-			if (!sfp_valid(&tempsfp))
-				break;
-			sfpcount++;
-			sdb_offset = sizeof(sfpcount) + sfpcount * sizeof(tempsfp);
-		}
-	}
+static int sfp_cache_get(void)
+{
+	if (sfp_cache_count < 0)
+		storage_sfpdb_reload();
+	return sfp_cache_count;
+}
 
-	if ((oper == SFP_ADD) && (sfpcount == SFPS_MAX)) {
-		/* no more space to add new SFPs */
-		ret = EE_RET_DBFULL;
-		goto out;
-	}
+/* Rewrite the file from the cache, in log format */
+static int sfp_compact(void)
+{
+	int count = sfp_cache_count;
 
-	if (!pos && (oper == SFP_GET) && sfpcount == 0) {
-		/* no SFPs in the database */
-		ret = 0;
-		goto out;
-	}
+	sfp_cache_count = -1; /* if we fail, read again later */
+	if (slog_rewrite(&sfp_log, sfp_cache, sizeof(*sfp_cache), count) < 0)
+		return -1;
+	sfp_cache_count = count;
+	sfp_cache_bad = 0;
+	sfp_legacy = 0;
+	sfp_compact_pending = 0;
+	return 0;
+}
 
-	if (oper == SFP_GET) {
-		sdb_offset = sizeof(sfpcount) + pos * sizeof(*sfp);
-		if (sdbfs_fread(&wrc_sdb, sdb_offset, sfp, sizeof(*sfp))
-				!= sizeof(*sfp))
-			goto out;
+/* Write through a cache entry: one record, unless we must compact */
+static int sfp_write(int pos)
+{
+	int ret;
 
-		ptr = (uint8_t *)sfp;
-		/* read sizeof() - 1 because we don't include checksum */
-		for (i = 0; i < sizeof(struct s_sfpinfo) - 1; ++i)
-			chksum = chksum + *(ptr++);
-		if (chksum != sfp->chksum) {
-			pp_printf("sfp: corrupted checksum\n");
-			goto out;
-		}
-	}
-	if (oper == SFP_ADD) {
-		/* count checksum */
-		ptr = (uint8_t *)sfp;
-		/* use sizeof() - 1 because we don't include checksum */
-		for (i = 0; i < sizeof(struct s_sfpinfo) - 1; ++i)
-			chksum = chksum + *(ptr++);
-		sfp->chksum = chksum;
-		/* add SFP at the end of DB */
-		sdb_offset = sizeof(sfpcount) + sfpcount * sizeof(*sfp);
-		if (sdbfs_fwrite(&wrc_sdb, sdb_offset, sfp, sizeof(*sfp))
-				!= sizeof(*sfp)) {
-			goto out;
-		}
-		sfpcount++;
-	}
-	ret = sfpcount;
-out:
+	if (sdbfs_open_id(&wrc_sdb, SDB_VENDOR, SDB_DEV_SFP) < 0)
+		return -1;
+	if (sfp_legacy)
+		ret = sfp_compact();
+	else
+		ret = slog_append(&sfp_log, sfp_cache + pos);
+	if (ret == -ENOSPC)
+		ret = sfp_compact();
+	if (!ret)
+		sfp_compact_pending = slog_nearly_full(&sfp_log)
+			&& sfp_log.nrec > sfp_cache_count;
 	sdbfs_close(&wrc_sdb);
-	return ret;
+	return ret < 0 ? -1 : 0;
 }
 
-static int storage_update_sfp(struct s_sfpinfo *sfp)
-{
-	int sfpcount = 1;
-	int temp;
-	int8_t i;
-	struct s_sfpinfo sfp_db[SFPS_MAX];
-	struct s_sfpinfo *dbsfp;
-
-	/* copy entries from flash to the memory, update entry if matched */
-	for (i = 0; i < sfpcount; ++i) {
-		dbsfp = &sfp_db[i];
-		sfpcount = sfp_entry(dbsfp, SFP_GET, i);
-		if (sfpcount <= 0)
-			return sfpcount;
-		if (!strncmp(dbsfp->pn, sfp->pn, 16)) {
-			/* update matched entry */
-			dbsfp->dTx = sfp->dTx;
-			dbsfp->dRx = sfp->dRx;
-			dbsfp->alpha = sfp->alpha;
-		}
+static int sfp_entry_add(struct s_sfpinfo *sfp)
+{
+	int count = sfp_cache_get();
+
+	if (count < 0)
+		return count;
+	if (count == SFPS_MAX)
+		return EE_RET_DBFULL; /* no more space to add new SFPs */
+
+	sfp->chksum = sfp_chksum(sfp);
+	sfp_cache[count] = *sfp;
+	sfp_cache_count++;
+	if (sfp_write(count) < 0) {
+		sfp_cache_count = -1; /* unknown state, read again later */
+		return -1;
 	}
+	return sfp_cache_count;
+}
 
-	/* erase entire database */
-	if (storage_sfpdb_erase() == EE_RET_I2CERR) {
-			pp_printf("Could not erase DB\n");
-			return -1;
-		}
-
-	/* add all SFPs */
-	for (i = 0; i < sfpcount; ++i) {
-		dbsfp = &sfp_db[i];
-		temp = sfp_entry(dbsfp, SFP_ADD, 0);
-		if (temp < 0) {
-			/* if error, return it */
-			return temp;
-		}
+static int storage_update_sfp(struct s_sfpinfo *sfp, int pos)
+{
+	struct s_sfpinfo *dbsfp = sfp_cache + pos;
+
+	dbsfp->dTx = sfp->dTx;
+	dbsfp->dRx = sfp->dRx;
+	dbsfp->alpha = sfp->alpha;
+	dbsfp->chksum = sfp_chksum(dbsfp);
+	if (sfp_write(pos) < 0) {
+		sfp_cache_count = -1;
+		return -1;
 	}
-	return i;
+	return sfp_cache_count;
 }
 
 int storage_get_sfp(struct s_sfpinfo *sfp, uint8_t oper, uint8_t pos)
 {
-	struct s_sfpinfo tmp_sfp;
+	int count, i;
+
+	if (pos >= SFPS_MAX)
+		return EE_RET_POSERR;	/* position outside the range */
+	count = sfp_cache_get();
+	if (count <= 0 && oper == SFP_GET)
+		return count;
 
 	if (oper == SFP_GET) {
 		/* Get SFP entry */
-		return sfp_entry(sfp, SFP_GET, pos);
+		if (pos >= count)
+			return -1;
+		if (sfp_cache_bad & (1 << pos)) {
+			pp_printf("sfp: corrupted checksum\n");
+			return -1;
+		}
+		*sfp = sfp_cache[pos];
+		return count;
 	}
 
-	/* storage_match_sfp replaces content of parameter, so do the copy
-	 * first */
-	tmp_sfp = *sfp;
-	if (!storage_match_sfp(&tmp_sfp)) { /* add a new sfp entry */
+	i = sfp_cache_find(sfp);
+	if (i == -2)
+		return -1;
+	if (i < 0) { /* add a new sfp entry */
 		pp_printf("Adding new SFP entry\n");
-		return sfp_entry(sfp, SFP_ADD, 0);
+		return sfp_entry_add(sfp);
 	}
 
 	pp_printf("Update existing SFP entry\n");
-	return storage_update_sfp(sfp);
+	return storage_update_sfp(sfp, i);
 }
 
 int storage_match_sfp(struct s_sfpinfo *sfp)
 {
-	uint8_t sfpcount = 1;
-	int8_t i;
-	struct s_sfpinfo dbsfp;
-
-	for (i = 0; i < sfpcount; ++i) {
-		sfpcount = sfp_entry(&dbsfp, SFP_GET, i);
-		if (sfpcount <= 0)
-			return sfpcount;
-		if (!strncmp(dbsfp.pn, sfp->pn, 16)) {
-			sfp->dTx = dbsfp.dTx;
-			sfp->dRx = dbsfp.dRx;
-			sfp->alpha = dbsfp.alpha;
-			return 1;
-		}
-	}
+	int i, count;
 
-	return 0;
+	count = sfp_cache_get();
+	if (count <= 0)
+		return count;
+	i = sfp_cache_find(sfp);
+	if (i == -2)
+		return -1;
+	if (i < 0)
+		return 0;
+	sfp->dTx = sfp_cache[i].dTx;
+	sfp->dRx = sfp_cache[i].dRx;
+	sfp->alpha = sfp_cache[i].alpha;
+	return 1;
 }
 
 /*
- * Phase transition ("calibration" file)
+ * Phase transition ("calibration" file). The legacy format is a single
+ * word, with the validity bit; the log has one record per write.
  */
 #define VALIDITY_BIT 0x80000000
+static struct slog calib_log = {
+	.reclen = sizeof(uint32_t),
+	.maxrec = 1,
+};
+static uint32_t calib_value;
+static int calib_compact_pending;
+
+static void calib_log_record(void *payload)
+{
+	memcpy(&calib_value, payload, sizeof(calib_value));
+}
+
 int storage_phtrans(uint32_t *valp, uint8_t write)
 {
-	int ret = -1;
+	int ret = -1, legacy;
 	uint32_t value;
 
 	if (sdbfs_open_id(&wrc_sdb, SDB_VENDOR, SDB_DEV_CALIB) < 0)
 		return -1;
+	calib_value = 0xffffffff;
+	legacy = slog_scan(&calib_log, calib_log_record) < 0;
 	if (write) {
-		sdbfs_ferase(&wrc_sdb, 0, wrc_sdb.f_len);
 		value = *valp | VALIDITY_BIT;
-		if (sdbfs_fwrite(&wrc_sdb, 0, &value, sizeof(value))
-		    != sizeof(value))
+		ret = legacy ? -ENOSPC : slog_append(&calib_log, &value);
+		if (ret == -ENOSPC)
+			ret = slog_rewrite(&calib_log, &value, 0, 1);
+		if (ret < 0)
 			goto out;
+		calib_compact_pending = slog_nearly_full(&calib_log)
+			&& calib_log.nrec > 1;
 		ret = 1;
 	} else {
-		if (sdbfs_fread(&wrc_sdb, 0, &value, sizeof(value))
-		    != sizeof(value))
+		if (legacy && sdbfs_fread(&wrc_sdb, 0, &calib_value,
+					  sizeof(calib_value))
+		    != sizeof(calib_value))
 			goto out;
+		value = calib_value;
 		*valp = value & ~VALIDITY_BIT;
 		ret = (value & VALIDITY_BIT) != 0;
 	}
@@ -607,6 +935,42 @@ out:
 	return ret;
 }
 
+/* Compact nearly-full logs when idle, so updates remain one write */
+static int storage_poll(void)
+{
+	static uint32_t lastt;
+	uint32_t value;
+	int ret;
+
+	if (task_not_yet(&lastt, 10 * TICS_PER_SECOND))
+		return 0;
+	if (sfp_compact_pending && sfp_cache_count >= 0) {
+		if (sdbfs_open_id(&wrc_sdb, SDB_VENDOR, SDB_DEV_SFP) < 0)
+			return 0;
+		sfp_compact();
+		sdbfs_close(&wrc_sdb);
+		return 1;
+	}
+	if (calib_compact_pending) {
+		calib_compact_pending = 0;
+		ret = storage_phtrans(&value, 0);
+		if (ret < 0)
+			return 0;
+		if (sdbfs_open_id(&wrc_sdb, SDB_VENDOR, SDB_DEV_CALIB) < 0)
+			return 0;
+		value |= VALIDITY_BIT;
+		slog_rewrite(&calib_log, &value, 0, ret > 0);
+		sdbfs_close(&wrc_sdb);
+		return 1;
+	}
+	return 0;
+}
+
+DEFINE_WRC_TASK(storage) = {
+	.name = "storage",
+	.job = storage_poll,
+};
+
 /*
  * The init script area consist of 2-byte size field and a set of
  * shell commands separated with '\n' character.
@@ -633,16 +997,18 @@ int storage_init_erase(void)
 	return ret == 1 ? 0 : -1;
 }
 
+#define INIT_LINE_LEN 80 /* a whole shell line */
+
 /*
  * Appends a new shell command at the end of boot script
  */
 int storage_init_add(const char *args[])
 {
 	int len, i;
-	uint8_t separator = ' ';
 	uint16_t used, readback;
 	int ret = -1;
 	uint8_t byte;
+	char line[INIT_LINE_LEN];
 
 	if (sdbfs_open_id(&wrc_sdb, SDB_VENDOR, SDB_DEV_INIT) < 0)
 		return -1;
@@ -658,24 +1024,22 @@ int storage_init_add(const char *args[])
 	if (used > 256 /* 0xffff or wrong */)
 		used = 0;
 
-	i = 1; /* args[0] is "add" */
-	while (args[i] != NULL) {
-		len = strlen(args[i]);
-		if (sdbfs_fwrite(&wrc_sdb, sizeof(used) + used,
-				 (void *)args[i], len) != len)
-			goto out;
-		used += len;
-		if (args[i+1] != NULL)	/* next one is another word of the same command */
-			separator = ' ';
-		else			/* no more words, end command with '\n' */
-			separator = '\n';
-		if (sdbfs_fwrite(&wrc_sdb, sizeof(used) + used,
-				&separator, sizeof(separator))
-		    != sizeof(separator))
+	/*
+	 * Build the whole command, words separated by ' ' and ended by
+	 * '\n', so it is a single write (in flash, a page program)
+	 */
+	len = 0;
+	for (i = 1; args[i] != NULL; i++) { /* args[0] is "add" */
+		if (len + strlen(args[i]) + 1 > sizeof(line))
 			goto out;
-		++used;
-		++i;
+		strcpy(line + len, args[i]);
+		len += strlen(args[i]);
+		line[len++] = args[i + 1] ? ' ' : '\n';
 	}
+	if (sdbfs_fwrite(&wrc_sdb, sizeof(used) + used, line, len) != len)
+		goto out;
+	used += len;
+
 	/* and finally update the size of the script */
 	if (sdbfs_fwrite(&wrc_sdb, 0, &used, sizeof(used)) != sizeof(used))
 		goto out;
@@ -718,6 +1082,74 @@ out:
 	return ret;
 }
 
+/* The whole file, in a single read: the boot script parses it in RAM */
+int storage_init_read(uint8_t *buf, int size)
+{
+	int ret;
+
+	if (sdbfs_open_id(&wrc_sdb, SDB_VENDOR, SDB_DEV_INIT) < 0)
+		return -1;
+	if (size > wrc_sdb.f_len)
+		size = wrc_sdb.f_len;
+	ret = sdbfs_fread(&wrc_sdb, 0, buf, size);
+	sdbfs_close(&wrc_sdb);
+	return ret;
+}
+
+/* Replace the whole file, e.g. with a compiled script */
+int storage_init_write(const uint8_t *buf, int len)
+{
+	int ret = -1;
+
+	if (sdbfs_open_id(&wrc_sdb, SDB_VENDOR, SDB_DEV_INIT) < 0)
+		return -1;
+	if (len > wrc_sdb.f_len)
+		goto out;
+	if (sdbfs_ferase(&wrc_sdb, 0, wrc_sdb.f_len) != wrc_sdb.f_len)
+		goto out;
+	if (sdbfs_fwrite(&wrc_sdb, 0, (void *)buf, len) != len)
+		goto out;
+	ret = 0;
+out:
+	sdbfs_close(&wrc_sdb);
+	return ret;
+}
+
+#ifdef CONFIG_PFILTER_UPLOAD
+/* The stored rule-set, as a whole: an erased file reads as all-ones */
+int storage_pfilter_read(uint32_t *buf, int size)
+{
+	int ret;
+
+	if (sdbfs_open_id(&wrc_sdb, SDB_VENDOR, SDB_DEV_PFILTER) < 0)
+		return -1;
+	if (size > wrc_sdb.f_len)
+		size = wrc_sdb.f_len;
+	ret = sdbfs_fread(&wrc_sdb, 0, buf, size);
+	sdbfs_close(&wrc_sdb);
+	return ret;
+}
+
+/* Replace the rule-set; a length of 0 only erases it */
+int storage_pfilter_write(const uint32_t *buf, int len)
+{
+	int ret = -1;
+
+	if (sdbfs_open_id(&wrc_sdb, SDB_VENDOR, SDB_DEV_PFILTER) < 0)
+		return -1;
+	if (len > wrc_sdb.f_len)
+		goto out;
+	if (sdbfs_ferase(&wrc_sdb, 0, wrc_sdb.f_len) != wrc_sdb.f_len)
+		goto out;
+	if (len && sdbfs_fwrite(&wrc_sdb, 0, (void *)buf, len) != len)
+		goto out;
+	ret = 0;
+out:
+	sdbfs_close(&wrc_sdb);
+	return ret;
+}
+#endif
+
 int storage_init_readcmd(uint8_t *buf, uint8_t bufsize, uint8_t next)
 {
 	int i = 0, ret = -1;
@@ -757,23 +1189,42 @@ int storage_read_hdl_cfg(void)
 	return 0;
 }
 
+#ifdef CONFIG_PFILTER_UPLOAD
+extern uint32_t _binary_tools_sdbfs_pfilter_bin_start[];
+#define sdbfs_image _binary_tools_sdbfs_pfilter_bin_start
+#else
 extern uint32_t _binary_tools_sdbfs_default_bin_start[];
-extern uint32_t _binary_tools_sdbfs_default_bin_end[];
+#define sdbfs_image _binary_tools_sdbfs_default_bin_start
+#endif
 
 static inline unsigned long SDB_ALIGN(unsigned long x, int blocksize)
 {
 	return (x + (blocksize - 1)) & ~(blocksize - 1);
 }
 
+/*
+ * In flash, each file takes a block, but the record logs need two, so
+ * that one of their slots is erased while the other stays valid.
+ */
+#define SDBFS_FLASH_BLOCKS (SDBFS_REC + 2)
+
+static int sdbfs_is_log(struct sdb_device *d)
+{
+	return d->sdb_component.product.device_id == SDB_DEV_SFP
+		|| d->sdb_component.product.device_id == SDB_DEV_CALIB;
+}
+
 int storage_sdbfs_erase(int mem_type, uint32_t base_adr, uint32_t blocksize,
 		uint8_t i2c_adr)
 {
 	if (!HAS_GENSDBFS || (mem_type == MEM_FLASH && blocksize == 0))
 		return -EINVAL;
 
+	sfp_cache_count = -1;
+	sdbfs_index_invalidate(&wrc_sdb);
 	if (mem_type == MEM_FLASH) {
 		pp_printf("Erasing Flash(0x%x)...\n", base_adr);
-		sdb_flash_erase(NULL, base_adr, SDBFS_REC * blocksize);
+		sdb_flash_erase(NULL, base_adr, SDBFS_FLASH_BLOCKS * blocksize);
 	} else if (mem_type == MEM_EEPROM) {
 		pp_printf("Erasing EEPROM %d (0x%x)...\n", i2c_adr, base_adr);
 		i2c_params.ifnum = WRPC_FMC_I2C;
@@ -793,10 +1244,9 @@ int storage_sdbfs_erase(int mem_type, uint32_t base_adr, uint32_t blocksize,
 int storage_gensdbfs(int mem_type, uint32_t base_adr, uint32_t blocksize,
 		uint8_t i2c_adr)
 {
-	struct sdb_device *sdbfs =
-		(struct sdb_device *) _binary_tools_sdbfs_default_bin_start;
-	struct sdb_interconnect *sdbfs_dir = (struct sdb_interconnect *)
-		_binary_tools_sdbfs_default_bin_start;
+	struct sdb_device *sdbfs = (struct sdb_device *)sdbfs_image;
+	struct sdb_interconnect *sdbfs_dir =
+		(struct sdb_interconnect *)sdbfs_image;
 	/* struct sdb_device sdbfs_buf[SDBFS_REC]; */
 	int i;
 	char buf[19] = {0};
@@ -808,6 +1258,7 @@ int storage_gensdbfs(int mem_type, uint32_t base_adr, uint32_t blocksize,
 
 	if (mem_type == MEM_FLASH && blocksize == 0)
 		return -EINVAL;
+	sdbfs_index_invalidate(&wrc_sdb);
 
 	/* first file starts after the SDBFS description */
 	cur_adr = base_adr + SDB_ALIGN(SDBFS_REC*sizeof(struct sdb_device),
@@ -817,6 +1268,8 @@ int storage_gensdbfs(int mem_type, uint32_t base_adr, uint32_t blocksize,
 		/* relocate each file depending on base address and block size*/
 		size = sdbfs[i].sdb_component.addr_last -
 			sdbfs[i].sdb_component.addr_first;
+		if (mem_type == MEM_FLASH && sdbfs_is_log(sdbfs + i))
+			size = 2 * blocksize - 1;
 		sdbfs[i].sdb_component.addr_first = cur_adr;
 		sdbfs[i].sdb_component.addr_last  = cur_adr + size;
 		cur_adr = SDB_ALIGN(cur_adr + (size + 1), blocksize);
@@ -836,13 +1289,11 @@ int storage_gensdbfs(int mem_type, uint32_t base_adr, uint32_t blocksize,
 	size = sizeof(struct sdb_device);
 	if (mem_type == MEM_FLASH) {
 		pp_printf("Formatting SDBFS in Flash(0x%x)...\n", base_adr);
-		/* each file is in a separate block, therefore erase SDBFS_REC
-		 * number of blocks */
-		sdb_flash_erase(NULL, base_adr, SDBFS_REC * blocksize);
-		for (i = 0; i < SDBFS_REC; ++i) {
-			sdb_flash_write(NULL, base_adr + i*size, &sdbfs[i],
-					size);
-		}
+		/* each file is in a separate block (the logs in two),
+		 * therefore erase SDBFS_FLASH_BLOCKS blocks */
+		sdb_flash_erase(NULL, base_adr, SDBFS_FLASH_BLOCKS * blocksize);
+		/* the records are contiguous: program them together */
+		sdb_flash_write(NULL, base_adr, sdbfs, SDBFS_REC * size);
 		/*
 		pp_printf("Verification...");
 		sdb_flash_read(NULL, base_adr, sdbfs_buf, SDBFS_REC *
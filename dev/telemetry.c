@@ -0,0 +1,365 @@
+/*
+ * This work is part of the White Rabbit project
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#include <wrc.h>
+#include <wrpc.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <shell.h>
+#include <irq.h>
+#include <pps_gen.h>
+#include <telemetry.h>
+#include <ppsi/ppsi.h>
+#include "wr-api.h"
+#include <lib/ipv4.h>
+
+/* a tx-only socket: no queue is there */
+static struct wrpc_socket __static_tlm_socket = {
+	.queue.buff = NULL,
+	.queue.size = 0,
+};
+static struct wrpc_socket *tlm_socket;
+static struct wr_udp_addr tlm_addr;
+static unsigned char tlm_mac[6];
+static int tlm_configured;
+
+static char *tlm_names[] = TLM_CHANNEL_NAMES;
+
+static struct telemetry_chan {
+	uint16_t decim;
+	uint16_t skip;
+	uint16_t index;
+	/* state of the packed encoder, for the current buffer */
+	uint16_t pindex;
+	uint16_t pstep;
+	int32_t pvalue;
+} tlm_chan[TLM_NCHANNELS];
+
+uint32_t telemetry_mask;
+
+/* alternate between two buffers, like the daclog */
+struct telemetry_buf {
+	unsigned char udp[UDP_END];
+	struct telemetry_hdr hdr;
+	union {
+		struct telemetry_sample s[TLM_NSAMPLES];
+		uint8_t data[TLM_NSAMPLES * sizeof(struct telemetry_sample)];
+	};
+	int used;		/* bytes of data, for the packed format */
+	uint32_t seen;		/* channels already in data */
+};
+
+static struct telemetry_buf tlm_buf[2];
+static int tlm_ready[2], tlm_bindex, tlm_packed;
+static uint32_t tlm_sequence, tlm_dropped;
+
+/* compression statistics, since "telemetry pack on" */
+static uint32_t tlm_pk_samples, tlm_pk_bytes, tlm_pk_cycles;
+
+static uint8_t *tlm_varint(uint8_t *p, uint32_t v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+/* At most TLM_PK_MAXLEN bytes and no loop over the buffer: bounded time */
+static void tlm_pack(struct telemetry_buf *b, struct telemetry_chan *c,
+		     int channel, int32_t value)
+{
+	uint8_t *tag = b->data + b->used;
+	uint8_t *p = tag + 1;
+	uint16_t step;
+	uint32_t zz;
+
+	*tag = channel;
+	if (!(b->seen & (1 << channel))) {
+		b->seen |= 1 << channel;
+		*tag |= TLM_PK_INDEX;
+		p = tlm_varint(p, c->index);
+		c->pstep = 0;
+		c->pvalue = 0;
+	} else {
+		step = c->index - c->pindex;
+		if (step != c->pstep) {
+			*tag |= TLM_PK_INDEX;
+			p = tlm_varint(p, step);
+			c->pstep = step;
+		}
+	}
+	c->pindex = c->index;
+
+	zz = tlm_zigzag(value - c->pvalue);
+	c->pvalue = value;
+	if (zz < TLM_PK_DELTA_VARINT) {
+		*tag |= zz << TLM_PK_DELTA_SHIFT;
+	} else {
+		*tag |= TLM_PK_DELTA_VARINT << TLM_PK_DELTA_SHIFT;
+		p = tlm_varint(p, zz - TLM_PK_DELTA_VARINT);
+	}
+	b->used = p - b->data;
+}
+
+/* Called in interrupt context (or with interrupts disabled) */
+void __telemetry_put(int channel, int32_t value)
+{
+	struct telemetry_chan *c = tlm_chan + channel;
+	struct telemetry_buf *b = tlm_buf + tlm_bindex;
+	struct telemetry_sample *s;
+	uint32_t t0, t1;
+	int full;
+
+	c->index++;
+	if (++c->skip < c->decim)
+		return;
+	c->skip = 0;
+
+	if (tlm_ready[tlm_bindex]) {
+		tlm_dropped++; /* both buffers are waiting for the network */
+		return;
+	}
+	if (!b->hdr.nsamples) {
+		/* the format is chosen for a whole packet */
+		b->hdr.ticks = timer_get_tics();
+		b->hdr.version = tlm_packed ? TLM_VERSION_PACKED : TLM_VERSION;
+		b->used = 0;
+		b->seen = 0;
+	}
+	b->hdr.nsamples++;
+	if (b->hdr.version == TLM_VERSION_PACKED) {
+		t0 = shw_pps_gen_get_cycles();
+		tlm_pack(b, c, channel, value);
+		t1 = shw_pps_gen_get_cycles();
+		if (t1 < t0) /* the counter wrapped at the second */
+			t1 += REF_CLOCK_FREQ_HZ;
+		tlm_pk_cycles += t1 - t0;
+		tlm_pk_samples++;
+		full = b->used > sizeof(b->data) - TLM_PK_MAXLEN;
+	} else {
+		s = b->s + b->hdr.nsamples - 1;
+		s->channel = channel;
+		s->index = c->index;
+		s->value = value;
+		full = b->hdr.nsamples == TLM_NSAMPLES;
+	}
+	if (full) {
+		tlm_ready[tlm_bindex] = 1;
+		tlm_bindex = !tlm_bindex;
+	}
+}
+
+extern struct pp_instance ppi_static;
+
+/* The servo runs in task context: sample it when it updates */
+static void tlm_poll_servo(void)
+{
+	static uint32_t update_count;
+	struct wr_data *wrp = (void *)(ppi_static.ext_data);
+	struct wr_servo_state *s = &wrp->servo_state;
+	int64_t offset;
+
+	if (!(telemetry_mask & (1 << TLM_SERVO)))
+		return;
+	if (s->update_count == update_count)
+		return;
+	update_count = s->update_count;
+
+	/* picoseconds, saturated to 32 bits */
+	offset = s->offset;
+	if (offset > INT_MAX)
+		offset = INT_MAX;
+	if (offset < INT_MIN)
+		offset = INT_MIN;
+	disable_irq();
+	__telemetry_put(TLM_SERVO, offset);
+	enable_irq();
+}
+
+static void tlm_init(void)
+{
+	int i;
+
+	tlm_socket = ptpd_netif_create_socket(&__static_tlm_socket, NULL,
+					      PTPD_SOCK_UDP, TLM_PORT);
+	tlm_addr.sport = tlm_addr.dport = htons(TLM_PORT);
+	for (i = 0; i < TLM_NCHANNELS; i++)
+		tlm_chan[i].decim = 1;
+}
+
+static int tlm_poll(void)
+{
+	struct wr_sockaddr addr;
+	struct telemetry_buf *b;
+	uint64_t sec;
+	uint32_t nsec;
+	int i, len;
+
+	if (!tlm_configured)
+		return 0;
+	tlm_poll_servo();
+
+	/* slow channels: don't keep samples more than one second */
+	i = tlm_bindex;
+	if (!tlm_ready[i] && tlm_buf[i].hdr.nsamples &&
+	    timer_get_tics() - tlm_buf[i].hdr.ticks > TICS_PER_SECOND) {
+		disable_irq();
+		if (!tlm_ready[i] && tlm_buf[i].hdr.nsamples) {
+			tlm_ready[i] = 1;
+			tlm_bindex = !i;
+		}
+		enable_irq();
+	}
+
+	/* if both are ready, the current one is the older */
+	i = tlm_bindex;
+	if (!tlm_ready[i])
+		i = !i;
+	if (!tlm_ready[i])
+		return 0;
+	b = tlm_buf + i;
+
+	shw_pps_gen_get_time(&sec, &nsec);
+	b->hdr.magic = TLM_MAGIC;
+	b->hdr.sequence = tlm_sequence++;
+	b->hdr.dropped = tlm_dropped;
+	b->hdr.tai_sec = sec;
+	b->hdr.tai_nsec = nsec;
+	if (b->hdr.version == TLM_VERSION_PACKED) {
+		len = offsetof(struct telemetry_buf, data[b->used]);
+		tlm_pk_bytes += b->used;
+	} else {
+		len = offsetof(struct telemetry_buf, s[b->hdr.nsamples]);
+	}
+
+	/* format and send */
+	getIP((void *)&tlm_addr.saddr); /* if we have no ip yet, 0 is ok */
+	fill_udp((void *)b, len, &tlm_addr);
+	memcpy(&addr.mac, tlm_mac, 6);
+	ptpd_netif_sendto(tlm_socket, &addr, b, len, 0);
+
+	b->hdr.nsamples = 0;
+	tlm_ready[i] = 0;
+	return 1;
+}
+
+DEFINE_WRC_TASK(telemetry) = {
+	.name = "telemetry",
+	.init = tlm_init,
+	.job = tlm_poll,
+};
+
+static int tlm_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < TLM_NCHANNELS; i++)
+		if (!strcmp(name, tlm_names[i]))
+			return i;
+	return -1;
+}
+
+static void tlm_show(void)
+{
+	char b1[32], b2[32];
+	int i, ratio, cycles;
+
+	if (tlm_configured)
+		pp_printf("destination %s, %s, port %i\n",
+			  format_ip(b1, (void *)&tlm_addr.daddr),
+			  format_mac(b2, tlm_mac), ntohs(tlm_addr.dport));
+	else
+		pp_printf("destination not set\n");
+	pp_printf("sent %i packets, dropped %i samples\n",
+		  tlm_sequence, tlm_dropped);
+	if (tlm_packed && tlm_pk_bytes) {
+		/* ratio and cycles in hundredths; refclk is cpu clock or 2x */
+		ratio = (uint64_t)tlm_pk_samples * sizeof(struct telemetry_sample)
+			* 100 / tlm_pk_bytes;
+		cycles = (uint64_t)tlm_pk_cycles * CPU_CLOCK * 100
+			/ REF_CLOCK_FREQ_HZ / tlm_pk_samples;
+		pp_printf("packed: %i samples, %i bytes sent, ratio %i.%02i, "
+			  "%i.%02i cycles per sample\n", tlm_pk_samples,
+			  tlm_pk_bytes, ratio / 100, ratio % 100,
+			  cycles / 100, cycles % 100);
+	}
+	for (i = 0; i < TLM_NCHANNELS; i++)
+		pp_printf("  %s\t%s decim %i\n", tlm_names[i],
+			  telemetry_mask & (1 << i) ? "on " : "off",
+			  tlm_chan[i].decim);
+}
+
+static int cmd_telemetry(const char *args[])
+{
+	int i, ch, v;
+
+	if (!args[0]) {
+		tlm_show();
+		return 0;
+	}
+	if (!strcmp(args[0], "dest") && args[2]) {
+		tlm_configured = 0;
+		decode_ip(args[1], (void *)&tlm_addr.daddr);
+		decode_mac(args[2], tlm_mac);
+		v = TLM_PORT;
+		if (args[3])
+			fromdec(args[3], &v);
+		tlm_addr.dport = htons(v);
+		/* restart from empty buffers, as a full one is not reset */
+		disable_irq();
+		for (i = 0; i < 2; i++) {
+			tlm_buf[i].hdr.nsamples = 0;
+			tlm_buf[i].used = 0;
+			tlm_ready[i] = 0;
+		}
+		tlm_bindex = 0;
+		enable_irq();
+		tlm_configured = 1;
+		return 0;
+	}
+	if (!strcmp(args[0], "pack") && args[1]) {
+		disable_irq();
+		tlm_packed = !strcmp(args[1], "on");
+		tlm_pk_samples = tlm_pk_bytes = tlm_pk_cycles = 0;
+		enable_irq();
+		return 0;
+	}
+	if (!strcmp(args[0], "off") && args[1] && !strcmp(args[1], "all")) {
+		telemetry_mask = 0;
+		return 0;
+	}
+	if ((!strcmp(args[0], "on") || !strcmp(args[0], "off")) && args[1]) {
+		ch = tlm_find(args[1]);
+		if (ch < 0) {
+			pp_printf("unknown channel \"%s\"\n", args[1]);
+			return -EINVAL;
+		}
+		if (args[0][1] == 'f') {
+			telemetry_mask &= ~(1 << ch);
+			return 0;
+		}
+		v = 1;
+		if (args[2])
+			fromdec(args[2], &v);
+		if (v < 1 || v > 0xffff)
+			return -EINVAL;
+		tlm_chan[ch].decim = v;
+		tlm_chan[ch].skip = 0;
+		telemetry_mask |= 1 << ch;
+		return 0;
+	}
+	pp_printf("use: telemetry [dest <ip> <mac> [<port>]]\n"
+		  "     telemetry on <channel> [<decimation>]\n"
+		  "     telemetry off <channel>|all\n");
+	return -EINVAL;
+}
+
+DEFINE_WRC_COMMAND(telemetry) = {
+	.name = "telemetry",
+	.exec = cmd_telemetry,
+};
@@ -108,6 +108,7 @@ DEFINE_WRC_TASK(temp) = {
 	.name = "temperature",
 	.init = wrc_temp_init,
 	.job = wrc_temp_refresh,
+	.flags = WRC_TASK_LATE_INIT,
 };
 
 /*
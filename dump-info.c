@@ -1,6 +1,8 @@
 #include <sys/types.h>
 #include <ppsi/ppsi.h>
 #include <softpll_ng.h>
+#include <boot.h>
+#include <wrc_diags.h>
 
 #include "dump-info.h"
 
@@ -204,6 +206,7 @@ struct dump_info  dump_info[] = {
 	DUMP_FIELD(int, helper.tag_d0),
 	DUMP_FIELD(int, helper.ref_src),
 	DUMP_FIELD(int, helper.sample_n),
+	DUMP_FIELD(int, helper.switching),
 	/* FIXME: missing helper.pi etc.. */
 	DUMP_FIELD(int, ext.enabled),
 	DUMP_FIELD(int, ext.align_state),
@@ -226,6 +229,7 @@ struct dump_info  dump_info[] = {
 	DUMP_FIELD(int, mpll.sample_n),
 	DUMP_FIELD(int, mpll.dac_index),
 	DUMP_FIELD(int, mpll.enabled),
+	DUMP_FIELD(int, mpll.switching),
 
 #undef DUMP_STRUCT
 #define DUMP_STRUCT struct spll_fifo_log
@@ -260,6 +264,51 @@ struct dump_info  dump_info[] = {
 	DUMP_FIELD_SIZE(char, build_time, 16),
 	DUMP_FIELD_SIZE(char, build_by, 32),
 
+#undef DUMP_STRUCT
+#define DUMP_STRUCT struct boot_info
+
+	DUMP_HEADER("boot"),
+	DUMP_FIELD(uint32_t, done),
+	DUMP_FIELD(uint32_t, fast),
+	DUMP_FIELD(uint32_t, usec[BOOT_START]),
+	DUMP_FIELD(uint32_t, usec[BOOT_W1]),
+	DUMP_FIELD(uint32_t, usec[BOOT_STORAGE]),
+	DUMP_FIELD(uint32_t, usec[BOOT_MAC]),
+	DUMP_FIELD(uint32_t, usec[BOOT_ENDPOINT]),
+	DUMP_FIELD(uint32_t, usec[BOOT_PTP]),
+	DUMP_FIELD(uint32_t, usec[BOOT_CALIB]),
+	DUMP_FIELD(uint32_t, usec[BOOT_INIT]),
+	DUMP_FIELD(uint32_t, usec[BOOT_TASKS]),
+	DUMP_FIELD(uint32_t, usec[BOOT_SCRIPT]),
+	DUMP_FIELD(uint32_t, usec[BOOT_LINK]),
+	DUMP_FIELD(uint32_t, usec[BOOT_DEFERRED]),
+	DUMP_FIELD(uint32_t, usec[BOOT_TRACK]),
+
+#undef DUMP_STRUCT
+#define DUMP_STRUCT struct wrc_diags_shm
+
+	DUMP_HEADER("diags"),
+	DUMP_FIELD(uint32_t, sequence),
+	DUMP_FIELD(uint32_t, ver),
+	DUMP_FIELD(uint32_t, sstat),
+	DUMP_FIELD(uint32_t, pstat),
+	DUMP_FIELD(uint32_t, ptpstat),
+	DUMP_FIELD(uint32_t, astat),
+	DUMP_FIELD(uint32_t, txfcnt),
+	DUMP_FIELD(uint32_t, rxfcnt),
+	DUMP_FIELD(uint32_t, sec_msb),
+	DUMP_FIELD(uint32_t, sec_lsb),
+	DUMP_FIELD(uint32_t, ns),
+	DUMP_FIELD(uint32_t, mu_msb),
+	DUMP_FIELD(uint32_t, mu_lsb),
+	DUMP_FIELD(uint32_t, dms_msb),
+	DUMP_FIELD(uint32_t, dms_lsb),
+	DUMP_FIELD(int, asym),
+	DUMP_FIELD(int, cko),
+	DUMP_FIELD(int, setp),
+	DUMP_FIELD(uint32_t, ucnt),
+	DUMP_FIELD(uint32_t, temp),
+
 	DUMP_HEADER("end"),
 
 };
@@ -1,14 +1,175 @@
+/*
+ * A simulated SPI flash chip (M25P-like) for the host process, with a
+ * timing model: the driver in dev/flash.c runs unchanged on top of it,
+ * and the "flashstat" command reports the bus time it used. So the
+ * effect of driver changes (e.g. CONFIG_FLASH_CACHE_LINES) can be
+ * measured without hardware.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <shell.h>
 #include "flash.h"
 
+#define FF_SIZE		(16 << 20)
+#define FF_SECTOR	65536
+#define FF_NS_BIT	100ULL		/* 10MHz, like dev/flash-spi.c */
+#define FF_NS_SELECT	200ULL		/* chip select setup and hold */
+#define FF_NS_PP	700000ULL	/* typical times from datasheets */
+#define FF_NS_SE	600000000ULL
+#define FF_NS_BE	80000000000ULL
 
-void    flash_init(void)
-{}
+#define FF_SR_WIP	0x01
+#define FF_SR_WEL	0x02
 
-int     flash_write(uint32_t addr, uint8_t *buf, int count)
-{ return 0; }
+static uint8_t ff_mem[FF_SIZE];
 
-int     flash_read(uint32_t addr, uint8_t *buf, int count)
-{ return 0; }
+static struct {
+	int selected;
+	int pos;		/* bytes since select */
+	uint8_t cmd;
+	uint32_t addr;
+	int wel;		/* write enable latch */
+	uint64_t busy_until;
+} ff;
 
-int     flash_erase(uint32_t addr, int count)
-{ return 0; }
+static struct {
+	uint64_t ns;		/* simulated time */
+	uint64_t busy_ns;	/* spent polling a busy chip */
+	unsigned long commands, bytes, reads, programs, erases;
+} ff_stats;
+
+void flash_spi_init(void)
+{
+	memset(ff_mem, 0xff, sizeof(ff_mem));
+}
+
+static int ff_busy(void)
+{
+	return ff_stats.ns < ff.busy_until;
+}
+
+/* Program and erase take effect when the chip is deselected */
+static void ff_execute(void)
+{
+	uint32_t addr = ff.addr & (FF_SIZE - 1);
+
+	switch (ff.cmd) {
+	case 0x06: /* write enable */
+		if (ff.pos == 1)
+			ff.wel = 1;
+		return;
+	case 0x02: /* page program: done while shifting */
+		if (!ff.wel || ff.pos < 5)
+			return;
+		ff.busy_until = ff_stats.ns + FF_NS_PP;
+		ff_stats.programs++;
+		break;
+	case 0xd8: /* sector erase */
+		if (!ff.wel || ff.pos != 4)
+			return;
+		memset(ff_mem + (addr & ~(FF_SECTOR - 1)), 0xff, FF_SECTOR);
+		ff.busy_until = ff_stats.ns + FF_NS_SE;
+		ff_stats.erases++;
+		break;
+	case 0xc7: /* bulk erase */
+		if (!ff.wel || ff.pos != 1)
+			return;
+		memset(ff_mem, 0xff, sizeof(ff_mem));
+		ff.busy_until = ff_stats.ns + FF_NS_BE;
+		ff_stats.erases++;
+		break;
+	default:
+		return;
+	}
+	ff.wel = 0;
+}
+
+void flash_spi_select(int on)
+{
+	if (on == ff.selected)
+		return;
+	ff_stats.ns += FF_NS_SELECT;
+	ff.selected = on;
+	if (on) {
+		ff.pos = 0;
+		ff_stats.commands++;
+		return;
+	}
+	if (ff.pos && !ff_busy())
+		ff_execute();
+}
+
+uint8_t flash_spi_xfer(uint8_t val)
+{
+	uint32_t addr;
+	uint8_t ret = 0xff;
+	int pos = ff.pos++;
+
+	ff_stats.ns += 8 * FF_NS_BIT;
+	ff_stats.bytes++;
+	if (!ff.selected)
+		return ret;
+	if (pos == 0) {
+		ff.cmd = val;
+		ff.addr = 0;
+		if (val == 0x03 || val == 0x0b)
+			ff_stats.reads++;
+		return ret;
+	}
+	if (ff.cmd == 0x05) { /* read status, repeated while selected */
+		if (ff_busy())
+			ff_stats.busy_ns += 8 * FF_NS_BIT;
+		return (ff_busy() ? FF_SR_WIP : 0) | (ff.wel ? FF_SR_WEL : 0);
+	}
+	if (ff_busy())
+		return ret; /* the chip ignores everything else */
+	if (pos < 4) {
+		ff.addr = (ff.addr << 8) | val;
+		return ret;
+	}
+	pos -= 4;
+	switch (ff.cmd) {
+	case 0x0b: /* fast read: one dummy byte */
+		if (!pos)
+			break;
+		pos--;
+		/* fall through */
+	case 0x03:
+		ret = ff_mem[(ff.addr + pos) & (FF_SIZE - 1)];
+		break;
+	case 0x02: /* page program, wraps within the page */
+		if (!ff.wel)
+			break;
+		addr = (ff.addr & ~(FLASH_PAGESIZE - 1))
+			| ((ff.addr + pos) & (FLASH_PAGESIZE - 1));
+		ff_mem[addr & (FF_SIZE - 1)] &= val;
+		break;
+	}
+	return ret;
+}
+
+static int cmd_flashstat(const char *args[])
+{
+	if (args[0] && !strcmp(args[0], "reset")) {
+		memset(&ff_stats, 0, sizeof(ff_stats));
+		ff.busy_until = 0;
+		return 0;
+	}
+	if (args[0])
+		return -EINVAL;
+	printf("fake flash: %lu commands, %lu bytes, %lu reads, "
+	       "%lu page programs, %lu erases\n", ff_stats.commands,
+	       ff_stats.bytes, ff_stats.reads, ff_stats.programs,
+	       ff_stats.erases);
+	printf("bus time %llu us, %llu us of them waiting for the chip\n",
+	       (unsigned long long)ff_stats.ns / 1000,
+	       (unsigned long long)ff_stats.busy_ns / 1000);
+	return 0;
+}
+
+DEFINE_WRC_COMMAND(flashstat) = {
+	.name = "flashstat",
+	.exec = cmd_flashstat,
+};
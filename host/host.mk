@@ -4,6 +4,7 @@ obj-$(CONFIG_HOST_PROCESS) += \
 	host/fake-i2c.o \
 	host/fake-w1.o \
 	host/fake-flash.o \
+	dev/flash.o \
 	host/fake-hw.o \
 	host/ptp.o \
 	host/spll.o \
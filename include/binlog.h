@@ -0,0 +1,68 @@
+/*
+ * This work is part of the White Rabbit project
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#ifndef __BINLOG_H__
+#define __BINLOG_H__
+
+#include <stdint.h>
+
+/*
+ * Deferred-format log: binlog() stores the address of the format
+ * string and the raw arguments in a ring buffer, a task drains the
+ * ring later. Format strings live in the ".binlog" section, that is
+ * kept in the ELF file but not loaded, so the address is an offset in
+ * that section. tools/wrpc-binlog rebuilds the text from the ELF file.
+ *
+ * Up to BINLOG_MAX_ARGS arguments are allowed, each stored as 32 bits
+ * (so 64-bit values are truncated). A "%s" is only decoded if the
+ * string is constant, because the decoder reads it from the ELF file.
+ */
+#define BINLOG_MAX_ARGS	10
+
+/*
+ * A record is a header word, the timer tick and the arguments. The
+ * header is the format offset in bits 0-23 and the number of
+ * arguments in bits 24-31. Records are sent in network byte order.
+ */
+#define BINLOG_ID_MASK	0x00ffffff
+#define BINLOG_NARGS_SHIFT 24
+#define BINLOG_ID_LOST	0x00ffffff /* one argument: records lost */
+#define BINLOG_PORT	1052
+
+/* Count and convert the arguments, this is the usual preprocessor trick */
+#define __BL_N(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, N, ...) N
+#define __BL_COUNT(...) \
+	__BL_N(0, ##__VA_ARGS__, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define __BL_ARG(x) ((uint32_t)(unsigned long)(x))
+#define __BL_MAP0()
+#define __BL_MAP1(a) __BL_ARG(a)
+#define __BL_MAP2(a, ...) __BL_ARG(a), __BL_MAP1(__VA_ARGS__)
+#define __BL_MAP3(a, ...) __BL_ARG(a), __BL_MAP2(__VA_ARGS__)
+#define __BL_MAP4(a, ...) __BL_ARG(a), __BL_MAP3(__VA_ARGS__)
+#define __BL_MAP5(a, ...) __BL_ARG(a), __BL_MAP4(__VA_ARGS__)
+#define __BL_MAP6(a, ...) __BL_ARG(a), __BL_MAP5(__VA_ARGS__)
+#define __BL_MAP7(a, ...) __BL_ARG(a), __BL_MAP6(__VA_ARGS__)
+#define __BL_MAP8(a, ...) __BL_ARG(a), __BL_MAP7(__VA_ARGS__)
+#define __BL_MAP9(a, ...) __BL_ARG(a), __BL_MAP8(__VA_ARGS__)
+#define __BL_MAP10(a, ...) __BL_ARG(a), __BL_MAP9(__VA_ARGS__)
+#define __BL_CAT(a, b) a ## b
+#define __BL_MAP(n, ...) __BL_CAT(__BL_MAP, n)(__VA_ARGS__)
+
+#ifdef CONFIG_BINLOG
+void __binlog_write(const char *fmt, const uint32_t *args, int nargs);
+
+#define binlog(fmt, ...) ({						\
+	static const char __bl_fmt[]					\
+		__attribute__((section(".binlog"))) = fmt;		\
+	uint32_t __bl_args[] = {					\
+		0, __BL_MAP(__BL_COUNT(__VA_ARGS__), ##__VA_ARGS__)};	\
+	__binlog_write(__bl_fmt, __bl_args + 1,				\
+		       sizeof(__bl_args) / sizeof(__bl_args[0]) - 1);	\
+})
+#else
+#define binlog(fmt, ...) ({})
+#endif
+
+#endif /* __BINLOG_H__ */
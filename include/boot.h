@@ -0,0 +1,49 @@
+/*
+ * This work is part of the White Rabbit project
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#ifndef __BOOT_H__
+#define __BOOT_H__
+
+#include <stdint.h>
+
+/*
+ * Boot milestones: each one is timestamped the first time it is
+ * reached, in microseconds since BOOT_START. The "boot" command prints
+ * them, and wrpc-dump finds boot_info through crt0 (BOOT_PADDR).
+ */
+enum boot_milestone {
+	BOOT_START = 0,		/* uart and timer are up */
+	BOOT_W1,		/* w1 bus scanned */
+	BOOT_STORAGE,		/* sdbfs found (or not) */
+	BOOT_MAC,		/* mac address known */
+	BOOT_ENDPOINT,		/* endpoint enabled */
+	BOOT_PTP,		/* ppsi initialized */
+	BOOT_CALIB,		/* t24p read */
+	BOOT_INIT,		/* end of wrc_initialize() */
+	BOOT_TASKS,		/* all task init functions called */
+	BOOT_SCRIPT,		/* init script executed */
+	BOOT_LINK,		/* first link up */
+	BOOT_DEFERRED,		/* fast boot: all deferred work done */
+	BOOT_TRACK,		/* first time in WR_TRACK_PHASE */
+	BOOT_N
+};
+
+struct boot_info {
+	uint32_t done;		/* bit mask of milestones reached */
+	uint32_t fast;		/* built with CONFIG_FAST_BOOT */
+	uint32_t usec[BOOT_N];
+};
+extern struct boot_info boot_info;
+
+#ifdef CONFIG_FAST_BOOT
+#  define IS_FAST_BOOT 1
+#else
+#  define IS_FAST_BOOT 0
+#endif
+
+void boot_mark(int milestone);
+void boot_w1_scan(void); /* once: early, or when first needed */
+
+#endif /* __BOOT_H__ */
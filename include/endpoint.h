@@ -7,6 +7,7 @@
 #define __ENDPOINT_H
 
 #include <stdint.h>
+#include <pfilter.h>
 
 typedef enum {
 	AND = 0,
@@ -34,4 +35,24 @@ int ep_sfp_enable(int ena);
 
 void pfilter_init_default(void);
 
+#ifdef CONFIG_PFILTER_UPLOAD
+/* Where the active rule-set comes from */
+enum pfilter_source {
+	PFILTER_BUILTIN = 1,
+	PFILTER_UPLOADED,
+	PFILTER_STORED,
+};
+extern int pfilter_source;
+
+/* Uploads are staged as 32-bit words of the file, then applied */
+extern uint32_t pfilter_staged[PFILTER_MAX_WORDS];
+extern int pfilter_staged_len;
+
+int pfilter_get_active(uint32_t **words); /* returns the length */
+int pfilter_apply(void);
+int pfilter_use_builtin(void);
+int pfilter_save(void);
+int pfilter_erase(void);
+#endif
+
 #endif
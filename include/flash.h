@@ -12,6 +12,12 @@
 #include "types.h"
 
 #define FLASH_BLOCKSIZE 65536
+#define FLASH_PAGESIZE	256 /* a page program can't cross this boundary */
+
+/* SPI access: bit-banged on gpio (dev/flash-spi.c) or simulated (host) */
+void	flash_spi_init(void);
+void	flash_spi_select(int on);
+uint8_t	flash_spi_xfer(uint8_t val);
 
 /* Flash interface functions */
 void	flash_init(void);
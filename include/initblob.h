@@ -0,0 +1,55 @@
+/*
+ * This work is part of the White Rabbit project
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#ifndef __INITBLOB_H__
+#define __INITBLOB_H__
+
+#include <stdint.h>
+
+/*
+ * A compiled init script, as stored in the "wr-init" file by "init
+ * compile" or by tools/wrpc-initc. The text script has a 16-bit size
+ * followed by the lines; the compiled one has:
+ *
+ *   0-1: size of the records, big-endian
+ *   2:   INITBLOB_MARK, so older binaries see an empty text script
+ *   3:   INITBLOB_VERSION
+ *   4-:  records, ended by the size or by an erased (0xff) byte
+ *
+ * Each record is an opcode, the length of the data and the data.
+ * For INITBLOB_TEXT the data is a text line, for the shell tokenizer;
+ * otherwise the opcode is the index of the command in INITBLOB_NAMES,
+ * and the data are its arguments, each one terminated by a 0 byte. So
+ * the boot script passes them to the command without parsing the text.
+ */
+#define INITBLOB_MARK		0xff
+#define INITBLOB_VERSION	1
+#define INITBLOB_HDR		4
+#define INITBLOB_TEXT		0x00
+#define INITBLOB_END		0xff
+#define INITBLOB_MAX_SIZE	256	/* the "wr-init" file */
+#define INITBLOB_MAX_ARGS	8	/* like the shell */
+
+/* Opcodes are indexes here: only append (and fix the count) */
+#define INITBLOB_NCMDS		21
+#define INITBLOB_NAMES {						\
+	NULL, "ptp", "mode", "vlan", "ip", "sfp", "calibration",	\
+	"ptrack", "syslog", "ltest", "verbose", "mac", "stat",		\
+	"refresh", "snmp", "lldp", "telemetry", "binlog", "diag",	\
+	"sleep", "delays",						\
+}
+
+static inline int initblob_is_compiled(const uint8_t *buf, int len)
+{
+	return len >= INITBLOB_HDR && buf[2] == INITBLOB_MARK
+		&& buf[3] == INITBLOB_VERSION;
+}
+
+/* Returns the size of the compiled script, or -1 if it doesn't fit */
+int initblob_compile(const char *text, int len, uint8_t *out, int size);
+int initblob_opcode(const char *name, int len); /* INITBLOB_TEXT if none */
+const char *initblob_name(int op);
+
+#endif /* __INITBLOB_H__ */
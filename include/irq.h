@@ -8,6 +8,8 @@
 
 #ifdef unix
   static inline void clear_irq(void) {}
+  static inline unsigned int irq_save(void) { return 0; }
+  static inline void irq_restore(unsigned int ie) {}
 #else
 static inline void clear_irq(void)
 {
@@ -15,6 +17,21 @@ static inline void clear_irq(void)
 	asm volatile ("wcsr ip, %0"::"r" (val));
 }
 
+/* Disable interrupts, returning the previous state: usable in irq context */
+static inline unsigned int irq_save(void)
+{
+	unsigned int ie;
+
+	asm volatile ("rcsr %0, ie":"=r" (ie));
+	asm volatile ("wcsr ie, %0"::"r" (ie & ~1));
+	return ie;
+}
+
+static inline void irq_restore(unsigned int ie)
+{
+	asm volatile ("wcsr ie, %0"::"r" (ie));
+}
+
 #endif
 
 void disable_irq(void);
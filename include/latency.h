@@ -0,0 +1,25 @@
+/*
+ * This work is part of the White Rabbit project
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stdint.h>
+
+/* Summary of one reporting interval for a (prio, size) pair, in ns */
+struct latency_stats {
+	uint32_t prio;
+	uint32_t size;
+	uint32_t n;
+	uint32_t lost;		/* missing at the receiver */
+	uint32_t overflow;	/* dropped by our full receive queue */
+	uint32_t p50, p90, p99, p999;
+	uint32_t max;
+};
+
+/* Returns 0 if the probe index is not valid, used by snmp to walk rows */
+int latency_get_stats(int probe, struct latency_stats *s);
+
+#endif /* __LATENCY_H__ */
@@ -42,6 +42,9 @@ struct wr_ethhdr_vlan {
 
 struct wr_minic {
 	int tx_count, rx_count;
+#ifdef CONFIG_PFILTER_UPLOAD
+	uint32_t rx_class[8]; /* frames per class, from the packet filter */
+#endif
 };
 
 extern struct wr_minic minic;
@@ -0,0 +1,67 @@
+/*
+ * This work is part of the White Rabbit project
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#ifndef __PFILTER_H__
+#define __PFILTER_H__
+
+#include <stdint.h>
+
+/*
+ * The instructions of the endpoint packet filter, as built by
+ * tools/pfilter-builder (where the instruction set is documented) and
+ * loaded by dev/ep_pfilter.c. A rule-set file is PFILTER_MAGIC followed by
+ * the 36-bit instructions, each one as two 32-bit words, LSB first, in
+ * the byte order of the builder; it ends with FIN.
+ */
+#define PFILTER_MAGIC		0x11223344
+#define PFILTER_MAX_CODE_SIZE	32	/* FIN included, for 64-byte frames */
+#define PFILTER_MAX_WORDS	(1 + 2 * PFILTER_MAX_CODE_SIZE) /* a file */
+
+#define PFILTER_FIN		(1ULL << 35)
+#define PFILTER_LOGIC		(1ULL << 34)
+
+/* Fields of CMP: rd = rd <op> ((word[offset] & mask) == value) */
+#define PFILTER_OP(ir)		((int)(ir) & 0x7)
+#define PFILTER_CMP_RD(ir)	((int)((ir) >> 3) & 0xf)
+#define PFILTER_CMP_OFFSET(ir)	((int)((ir) >> 7) & 0x3f)
+#define PFILTER_CMP_VALUE(ir)	((int)((ir) >> 13) & 0xffff)
+#define PFILTER_CMP_NIBBLES(ir)	((int)((ir) >> 29) & 0xf) /* one per nibble */
+
+/* Fields of LOGIC: rd = (ra <op> rb) <op2> rc */
+#define PFILTER_LOGIC_RD(ir)	((int)(((ir) >> 3) & 0xf) \
+				 | (int)(((ir) >> 3) & 0x10))
+#define PFILTER_LOGIC_RA(ir)	((int)((ir) >> 8) & 0x1f)
+#define PFILTER_LOGIC_RB(ir)	((int)((ir) >> 13) & 0x1f)
+#define PFILTER_LOGIC_RC(ir)	((int)((ir) >> 18) & 0x1f)
+#define PFILTER_LOGIC_OP2(ir)	((int)((ir) >> 23) & 0x7)
+
+/* Registers: 0 reads as 0, a comparison can only write 1 to 15 */
+#define PFILTER_R_CMP_MAX	15
+#define PFILTER_R_GP_MAX	22
+#define PFILTER_R_DROP		23
+#define PFILTER_R_CLASS(n)	(24 + (n))
+
+/* The result of pfilter_run() */
+#define PFILTER_DROP		0x100	/* the 8 low bits are the classes */
+
+/*
+ * Values the firmware patches at load time, so a rule-set can be built
+ * once: the local MAC address (the CMPs at addresses 1, 2 and 3), the
+ * latency ethtype (a CMP with OR), and the vlan number (a CMP at offset 7)
+ */
+#define PFILTER_MAC_0		0x1234
+#define PFILTER_MAC_1		0x5678
+#define PFILTER_MAC_2		0x9abc
+#define PFILTER_LATENCY_TYPE	0xcafe
+#define PFILTER_VLAN_NR		0x0aaa
+#define PFILTER_VLAN_OFFSET	7
+
+/* Returns the classes and PFILTER_DROP: registers 24-31 and 23 */
+int pfilter_run(const uint64_t *code, int n, const uint8_t *frame, int len);
+
+/* Returns the number of instructions before FIN, or -1 - pc of an error */
+int pfilter_check(const uint64_t *code, int n);
+
+#endif /* __PFILTER_H__ */
@@ -32,6 +32,9 @@ int shw_pps_gen_unmask_output(int unmask);
 /* Reads the current time and stores at <seconds,nanoseconds>. */
 void shw_pps_gen_get_time(uint64_t * seconds, uint32_t * nanoseconds);
 
+/* Reads the refclk cycle counter, that wraps every second */
+uint32_t shw_pps_gen_get_cycles(void);
+
 /* Sets the time to <seconds,nanoseconds>. */
 void shw_pps_gen_set_time(uint64_t seconds, uint32_t nanoseconds, int counter);
 
@@ -49,6 +49,7 @@ struct wr_sockaddr {
 struct sockq {
 	uint16_t head, tail, avail, size;
 	uint16_t n;
+	uint16_t dropped;	/* frames that found the queue full */
 	uint8_t *buff;
 };
 
@@ -40,6 +40,7 @@ int shell_interactive(void);
 extern int shell_is_interacting;
 
 void shell_boot_script(void);
+int shell_boot_script_step(void);
 void shell_show_build_init(void);
 
 #endif
@@ -68,6 +68,10 @@ void storage_init(int i2cif, int i2c_addr);
 int storage_sfpdb_erase(void);
 int storage_match_sfp(struct s_sfpinfo *sfp);
 int storage_get_sfp(struct s_sfpinfo *sfp, uint8_t add, uint8_t pos);
+#ifdef CONFIG_SDB_STORAGE
+/* The database is cached in RAM: read it again from storage */
+int storage_sfpdb_reload(void);
+#endif
 
 int storage_phtrans(uint32_t *val, uint8_t write);
 
@@ -75,6 +79,13 @@ int storage_init_erase(void);
 int storage_init_add(const char *args[]);
 int storage_init_show(void);
 int storage_init_readcmd(uint8_t *buf, uint8_t bufsize, uint8_t next);
+int storage_init_read(uint8_t *buf, int size);
+int storage_init_write(const uint8_t *buf, int len);
+#ifdef CONFIG_PFILTER_UPLOAD
+/* Lengths are in bytes, as for the init script */
+int storage_pfilter_read(uint32_t *buf, int size);
+int storage_pfilter_write(const uint32_t *buf, int len);
+#endif
 
 struct storage_config {
 	int memtype;
@@ -88,7 +99,12 @@ extern struct storage_config storage_cfg;
 #define MEM_FLASH     0
 #define MEM_EEPROM    1
 #define MEM_1W_EEPROM 2
+/* Files in the default image, and the directory: see tools/sdbfs.README */
+#ifdef CONFIG_PFILTER_UPLOAD
+#define SDBFS_REC 6
+#else
 #define SDBFS_REC 5
+#endif
 
 int storage_read_hdl_cfg(void);
 
@@ -0,0 +1,98 @@
+/*
+ * This work is part of the White Rabbit project
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <stdint.h>
+
+/*
+ * Telemetry streams samples of selected signals to a UDP collector
+ * (see tools/wrpc-telemetry). Every channel can be enabled and
+ * decimated at run time; samples are batched in packets with a
+ * sequence number and timestamps. All fields are big-endian.
+ */
+enum telemetry_channel {
+	TLM_HELPER_Y = 0,
+	TLM_HELPER_ERR,
+	TLM_MAIN_Y,
+	TLM_MAIN_ERR,
+	TLM_AUX_Y,
+	TLM_AUX_ERR,
+	TLM_PTRACK,
+	TLM_SERVO,
+	TLM_NCHANNELS
+};
+
+#define TLM_CHANNEL_NAMES { \
+	"hy", "herr", "my", "merr", "ay", "aerr", "ptrack", "servo" }
+
+#define TLM_MAGIC	0x57524c54 /* "WRLT" */
+#define TLM_VERSION	1	/* array of struct telemetry_sample */
+#define TLM_VERSION_PACKED 2	/* delta-encoded byte stream, see below */
+#define TLM_PORT	1051
+#define TLM_NSAMPLES	128
+
+struct telemetry_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t nsamples;
+	uint32_t sequence;	/* packet counter */
+	uint32_t dropped;	/* samples lost to full buffers, since start */
+	uint32_t ticks;		/* timer tick of the first sample */
+	uint32_t tai_sec;	/* time of transmission */
+	uint32_t tai_nsec;
+};
+
+struct telemetry_sample {
+	uint8_t channel;
+	uint8_t reserved;
+	uint16_t index;		/* undecimated sample counter of the channel */
+	int32_t value;
+};
+
+/*
+ * The packed format replaces the sample array with a byte stream.
+ * Each sample starts with a tag byte: the channel in bits 0-3, the
+ * zigzag-encoded delta from the previous value of the channel in
+ * bits 4-6 (7 means the delta minus 7 follows as a varint), and bit 7
+ * to say that an index varint follows. The first sample of a channel
+ * in a packet carries its absolute index and a delta from 0; later
+ * ones carry the index step when it differs from the previous step.
+ * Varints are little-endian groups of 7 bits, bit 7 set if more follow.
+ * So every packet can be decoded alone, and a sample is 1 to 9 bytes.
+ */
+#define TLM_PK_CHANNEL	0x0f
+#define TLM_PK_DELTA	0x70
+#define TLM_PK_DELTA_SHIFT 4
+#define TLM_PK_DELTA_VARINT 7
+#define TLM_PK_INDEX	0x80
+#define TLM_PK_MAXLEN	9
+
+static inline uint32_t tlm_zigzag(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t tlm_unzigzag(uint32_t v)
+{
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+#ifdef CONFIG_TELEMETRY
+extern uint32_t telemetry_mask;
+void __telemetry_put(int channel, int32_t value);
+
+/* Called from the softpll interrupt: only a test if disabled */
+static inline void telemetry_put(int channel, int32_t value)
+{
+	if (telemetry_mask & (1 << channel))
+		__telemetry_put(channel, value);
+}
+#else
+static inline void telemetry_put(int channel, int32_t value) {}
+#endif
+
+#endif /* __TELEMETRY_H__ */
@@ -31,20 +31,28 @@
 #define SNMP_IS_VERBOSE 0
 #endif
 
+/* Verbose messages may be deferred to the binary log, see binlog.h */
+#ifdef CONFIG_BINLOG_VERBOSE
+#include <binlog.h>
+#define __verbose_printf binlog
+#else
+#define __verbose_printf __debug_printf
+#endif
+
 #define pll_verbose(...) \
-	({if (PLL_IS_VERBOSE) __debug_printf(__VA_ARGS__);})
+	({if (PLL_IS_VERBOSE) __verbose_printf(__VA_ARGS__);})
 
 #define pfilter_verbose(...) \
-	({if (PFILTER_IS_VERBOSE) __debug_printf(__VA_ARGS__);})
+	({if (PFILTER_IS_VERBOSE) __verbose_printf(__VA_ARGS__);})
 
 #define wrc_verbose(...) \
-	({if (WRC_IS_VERBOSE) __debug_printf(__VA_ARGS__);})
+	({if (WRC_IS_VERBOSE) __verbose_printf(__VA_ARGS__);})
 
 #define net_verbose(...) \
-	({if (NET_IS_VERBOSE) __debug_printf(__VA_ARGS__);})
+	({if (NET_IS_VERBOSE) __verbose_printf(__VA_ARGS__);})
 
 #define snmp_verbose(...) \
-	({if (SNMP_IS_VERBOSE) __debug_printf(__VA_ARGS__);})
+	({if (SNMP_IS_VERBOSE) __verbose_printf(__VA_ARGS__);})
 
 
 #ifdef CONFIG_HOST_PROCESS
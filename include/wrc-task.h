@@ -17,12 +17,15 @@ struct wrc_task {
 	int *enable;		/* A global enable variable */
 	void (*init)(void);
 	int (*job)(void);
+	unsigned long flags;
 	/* And we keep statistics about cpu usage */
 	unsigned long nrun;
 	unsigned long seconds;
 	unsigned long nanos;
 	unsigned long max_run_ticks; /* in ticks */
 };
+/* With CONFIG_FAST_BOOT, init is called by the boot task (lib/boot.c) */
+#define WRC_TASK_LATE_INIT	0x01
 
 /* An helper for periodic tasks, relying on a static varible */
 static inline int __task_not_yet(uint32_t *lastt, unsigned period,
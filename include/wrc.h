@@ -33,6 +33,11 @@
 #undef ARRAY_SIZE
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
+/* Keep the compiler from moving memory accesses across this point */
+#ifndef barrier
+#define barrier() asm volatile("" ::: "memory")
+#endif
+
 /* Allow "if" at C language level, to avoid ifdef */
 #ifdef CONFIG_WR_SWITCH
 #  define is_wr_switch 1
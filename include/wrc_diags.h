@@ -0,0 +1,44 @@
+/*
+ * This work is part of the White Rabbit project
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#ifndef __WRC_DIAGS_H__
+#define __WRC_DIAGS_H__
+
+#include <stdint.h>
+
+/*
+ * The WDIAG registers, published in RAM too (CONFIG_WR_DIAG). The
+ * register bank needs a snapshot/valid handshake, and the firmware skips
+ * the refresh while the host holds a snapshot; this copy is protected by
+ * a sequence counter instead, so the firmware never waits for the host:
+ *
+ *   writer: sequence++ (odd), update the fields, sequence++ (even)
+ *   reader: read sequence, retry while odd; copy the fields; read
+ *           sequence again and retry the copy if it changed
+ *
+ * The same protocol applies to "sequence" in struct spll_stats. Fields
+ * are 32-bit words with the encoding of the registers (hw/wrc_diags_regs.h)
+ * so the host reads them with plain word accesses, in any byte order.
+ * wrpc-dump and wrpc-diags find wrc_diags through crt0 (DIAGS_PADDR).
+ */
+#define WRC_DIAGS_SHM_VER	1
+
+struct wrc_diags_shm {
+	uint32_t sequence;	/* odd while the firmware writes */
+	uint32_t ver;		/* WRC_DIAGS_SHM_VER */
+	uint32_t sstat;		/* servo: wr mode and state (slave only) */
+	uint32_t pstat;		/* link up and pll locked */
+	uint32_t ptpstat;
+	uint32_t astat;		/* aux channels, one bit each */
+	uint32_t txfcnt, rxfcnt;
+	uint32_t sec_msb, sec_lsb, ns;
+	uint32_t mu_msb, mu_lsb;	/* round trip, ps (slave only) */
+	uint32_t dms_msb, dms_lsb;	/* master to slave delay, ps */
+	uint32_t asym, cko, setp, ucnt;
+	uint32_t temp;		/* 16.16 fixed point, degrees C */
+};
+extern struct wrc_diags_shm wrc_diags;
+
+#endif /* __WRC_DIAGS_H__ */
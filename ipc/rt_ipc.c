@@ -26,13 +26,13 @@ static void clear_state(void)
 	int i;
 	for(i=0;i<RTS_PLL_CHANNELS;i++)
 	{
-	    pstate.channels[i].priority = 0;
+	    pstate.channels[i].priority = REF_NONE;
 	    pstate.channels[i].phase_setpoint = 0;
 	    pstate.channels[i].phase_loopback = 0;
 	    pstate.channels[i].flags = CHAN_REF_VALID;
     }
     pstate.flags = 0;
-    pstate.current_ref = 0;
+    pstate.current_ref = REF_NONE;
     pstate.mode = RTS_MODE_DISABLED;
     pstate.ipc_count = 0;
 }
@@ -65,6 +65,7 @@ int rts_set_mode(int mode)
 	};
 
 	pstate.mode = mode;
+	pstate.current_ref = REF_NONE;
 
 	for(i=0;options[i].desc != NULL;i++)
 		if(mode == options[i].mode_rt)
@@ -79,20 +80,81 @@ int rts_set_mode(int mode)
 	return 0;
 }
 
-/* Reference channel configuration (BC mode only) */
+/* The usable channel with the highest priority (lowest value), or REF_NONE */
+static int rts_best_channel(void)
+{
+	int i, n_ref, best = REF_NONE;
+
+	spll_get_num_channels(&n_ref, NULL);
+	for (i = 0; i < n_ref && i < RTS_PLL_CHANNELS; i++) {
+		if (pstate.channels[i].priority == REF_NONE)
+			continue;
+		if (best == REF_NONE || pstate.channels[i].priority
+		    < pstate.channels[best].priority)
+			best = i;
+	}
+	return best;
+}
+
+/*
+ * Lock to another channel: if the PLL is locked, switch the reference
+ * keeping the phase of the output, and move the phase setpoint to the new
+ * channel, otherwise relock from scratch.
+ */
+static void rts_switch_channel(int channel)
+{
+	int old = pstate.current_ref;
+
+	if (old != REF_NONE && !spll_switch_reference(channel)) {
+		pp_printf("RT [slave]: Switching from %d to %d (prio %d)\n",
+			  old, channel, pstate.channels[channel].priority);
+		pstate.channels[channel].phase_setpoint =
+			pstate.channels[old].phase_setpoint;
+	} else {
+		pp_printf("RT [slave]: Locking to: %d (prio %d)\n", channel,
+			  pstate.channels[channel].priority);
+		spll_init(SPLL_MODE_SLAVE, channel, 0);
+	}
+	pstate.current_ref = channel;
+}
+
+/*
+ * Reference channel configuration (BC mode only). The channel gets the
+ * priority and, like before priorities were used, it becomes the reference
+ * unless the current one has a higher priority. Priority REF_NONE removes
+ * the channel. If the reference is removed, or demoted below another
+ * channel, switch to the best one left.
+ */
 int rts_lock_channel(int channel, int priority)
 {
+	int n_ref, best, cur = pstate.current_ref;
+
 	if(pstate.mode != RTS_MODE_BC)
 	{
         pp_printf("trying to lock while not in slave mode,..\n");
 		return -1;
     }
+	spll_get_num_channels(&n_ref, NULL);
+	if (channel < 0 || channel >= n_ref || channel >= RTS_PLL_CHANNELS)
+		return -1;
 
-
-	pp_printf("RT [slave]: Locking to: %d (prio %d)\n", channel, priority);
-	spll_init(SPLL_MODE_SLAVE, channel, 0);
-    pstate.current_ref = channel;
-
+	pstate.channels[channel].priority = priority;
+	if (channel != cur) {
+		if (priority != REF_NONE && (cur == REF_NONE
+		    || priority <= pstate.channels[cur].priority))
+			rts_switch_channel(channel);
+		return 0;
+	}
+
+	best = rts_best_channel();
+	if (best == REF_NONE) {
+		/* no reference left: keep the current state (holdover) */
+		pp_printf("RT [slave]: No reference left after %d\n", channel);
+		return 0;
+	}
+	/* on a tie, the current reference stays */
+	if (pstate.channels[best].priority < priority)
+		rts_switch_channel(best);
 	return 0;
 }
 
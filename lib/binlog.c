@@ -0,0 +1,227 @@
+/*
+ * This work is part of the White Rabbit project
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#include <wrc.h>
+#include <wrpc.h>
+#include <string.h>
+#include <errno.h>
+#include <shell.h>
+#include <irq.h>
+#include <binlog.h>
+#include "ipv4.h"
+
+#define BL_SIZE		CONFIG_BINLOG_SIZE
+#define BL_MASK		(BL_SIZE - 1)
+#define BL_UART_BURST	4	/* records per task run, the uart is slow */
+#define BL_UDP_WORDS	100	/* payload of a udp packet */
+
+#if (BL_SIZE & BL_MASK)
+#error "CONFIG_BINLOG_SIZE must be a power of two"
+#endif
+
+enum bl_sink {
+	BL_SINK_OFF = 0,
+	BL_SINK_UART,
+	BL_SINK_SYSLOG,
+	BL_SINK_UDP,
+};
+static char *bl_sink_names[] = {"off", "uart", "syslog", "udp"};
+
+static uint32_t bl_ring[BL_SIZE];
+static unsigned int bl_head, bl_tail; /* free-running */
+static uint32_t bl_count, bl_dropped, bl_lost;
+static int bl_sink;
+
+/* May be called in interrupt context */
+void __binlog_write(const char *fmt, const uint32_t *args, int nargs)
+{
+	unsigned int ie, h;
+	int i;
+
+	ie = irq_save();
+	h = bl_head;
+	if (BL_SIZE - (h - bl_tail) < nargs + 2 + (bl_lost ? 3 : 0)) {
+		bl_dropped++;
+		bl_lost++;
+		irq_restore(ie);
+		return;
+	}
+	if (bl_lost) {
+		bl_ring[h++ & BL_MASK] = BINLOG_ID_LOST
+			| (1 << BINLOG_NARGS_SHIFT);
+		bl_ring[h++ & BL_MASK] = timer_get_tics();
+		bl_ring[h++ & BL_MASK] = bl_lost;
+		bl_lost = 0;
+	}
+	bl_ring[h++ & BL_MASK] = ((unsigned long)fmt & BINLOG_ID_MASK)
+		| (nargs << BINLOG_NARGS_SHIFT);
+	bl_ring[h++ & BL_MASK] = timer_get_tics();
+	for (i = 0; i < nargs; i++)
+		bl_ring[h++ & BL_MASK] = args[i];
+	bl_head = h;
+	bl_count++;
+	irq_restore(ie);
+}
+
+/* Number of words of the oldest record, 0 if empty */
+static int bl_record_len(void)
+{
+	if (bl_tail == bl_head)
+		return 0;
+	return 2 + (bl_ring[bl_tail & BL_MASK] >> BINLOG_NARGS_SHIFT);
+}
+
+/* Print the record as a "@BL" line of hex words, for the decoder */
+static int bl_format(char *buf, int len)
+{
+	char *p = buf;
+	int i;
+
+	p += pp_sprintf(p, "@BL");
+	for (i = 0; i < len; i++)
+		p += pp_sprintf(p, " %x", bl_ring[(bl_tail + i) & BL_MASK]);
+	return p - buf;
+}
+
+#ifdef CONFIG_IP
+/* a tx-only socket: no queue is there */
+static struct wrpc_socket __static_bl_socket = {
+	.queue.buff = NULL,
+	.queue.size = 0,
+};
+static struct wrpc_socket *bl_socket;
+static struct wr_udp_addr bl_addr;
+static unsigned char bl_mac[6];
+
+static struct bl_udp_buf {
+	unsigned char hdr[UDP_END];
+	uint32_t data[BL_UDP_WORDS + 2 + BINLOG_MAX_ARGS];
+} bl_udp;
+
+static int bl_send_udp(void)
+{
+	static uint32_t lastt;
+	struct wr_sockaddr addr;
+	int i, len, n = 0;
+
+	/* wait for a full packet, but not more than one second */
+	if (bl_head - bl_tail < BL_UDP_WORDS &&
+	    task_not_yet(&lastt, TICS_PER_SECOND))
+		return 0;
+	while (n < BL_UDP_WORDS && (len = bl_record_len())) {
+		for (i = 0; i < len; i++)
+			bl_udp.data[n++] = htonl(bl_ring[bl_tail++ & BL_MASK]);
+	}
+	if (!n)
+		return 0;
+	len = UDP_END + n * sizeof(uint32_t);
+	getIP((void *)&bl_addr.saddr); /* if we have no ip yet, 0 is ok */
+	fill_udp((void *)&bl_udp, len, &bl_addr);
+	memcpy(&addr.mac, bl_mac, 6);
+	ptpd_netif_sendto(bl_socket, &addr, &bl_udp, len, 0);
+	return 1;
+}
+#else
+static int bl_send_udp(void)
+{
+	return 0;
+}
+#endif
+
+static void bl_init(void)
+{
+#ifdef CONFIG_IP
+	bl_socket = ptpd_netif_create_socket(&__static_bl_socket, NULL,
+					     PTPD_SOCK_UDP, BINLOG_PORT);
+	bl_addr.sport = htons(BINLOG_PORT);
+#endif
+}
+
+/* A low-priority drain: a few records per run, or one packet */
+static int bl_poll(void)
+{
+	char buf[32 + 9 * (2 + BINLOG_MAX_ARGS)];
+	int i, len;
+
+	switch (bl_sink) {
+	case BL_SINK_UART:
+	case BL_SINK_SYSLOG:
+		for (i = 0; i < BL_UART_BURST; i++) {
+			len = bl_record_len();
+			if (!len)
+				break;
+			bl_format(buf, len);
+			bl_tail += len;
+#ifdef CONFIG_SYSLOG
+			if (bl_sink == BL_SINK_SYSLOG) {
+				syslog_report(buf);
+				continue;
+			}
+#endif
+			pp_printf("%s\n", buf);
+		}
+		return i != 0;
+	case BL_SINK_UDP:
+		return bl_send_udp();
+	}
+	return 0;
+}
+
+DEFINE_WRC_TASK(binlog) = {
+	.name = "binlog",
+	.init = bl_init,
+	.job = bl_poll,
+};
+
+static int cmd_binlog(const char *args[])
+{
+	int i;
+
+	if (!args[0]) {
+		pp_printf("sink %s, %i records, %i dropped, "
+			  "%i of %i words used\n", bl_sink_names[bl_sink],
+			  bl_count, bl_dropped, bl_head - bl_tail, BL_SIZE);
+		return 0;
+	}
+#ifdef CONFIG_IP
+	if (!strcmp(args[0], "udp") && args[2]) {
+		bl_sink = BL_SINK_OFF;
+		decode_ip(args[1], (void *)&bl_addr.daddr);
+		decode_mac(args[2], bl_mac);
+		i = BINLOG_PORT;
+		if (args[3])
+			fromdec(args[3], &i);
+		bl_addr.dport = htons(i);
+		bl_sink = BL_SINK_UDP;
+		return 0;
+	}
+#endif
+	for (i = 0; i < ARRAY_SIZE(bl_sink_names); i++) {
+		if (i == BL_SINK_UDP)
+			continue;
+#ifndef CONFIG_SYSLOG
+		if (i == BL_SINK_SYSLOG)
+			continue;
+#endif
+		if (!strcmp(args[0], bl_sink_names[i])) {
+			bl_sink = i;
+			return 0;
+		}
+	}
+	if (!strcmp(args[0], "flush")) {
+		disable_irq();
+		bl_tail = bl_head;
+		enable_irq();
+		return 0;
+	}
+	pp_printf("use: binlog [off|uart|syslog|flush]\n"
+		  "     binlog udp <ip> <mac> [<port>]\n");
+	return -EINVAL;
+}
+
+DEFINE_WRC_COMMAND(binlog) = {
+	.name = "binlog",
+	.exec = cmd_binlog,
+};
@@ -0,0 +1,171 @@
+/*
+ * This work is part of the White Rabbit project
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#include <wrc.h>
+#include <wrpc.h>
+#include <string.h>
+#include <w1.h>
+#include <shell.h>
+#include <boot.h>
+#include "board.h"
+#include "endpoint.h"
+#include "pps_gen.h"
+
+struct boot_info boot_info = {
+	.fast = IS_FAST_BOOT,
+};
+
+static char *boot_names[BOOT_N] = {
+	[BOOT_START] = "start",
+	[BOOT_W1] = "w1-scan",
+	[BOOT_STORAGE] = "storage",
+	[BOOT_MAC] = "mac-address",
+	[BOOT_ENDPOINT] = "endpoint",
+	[BOOT_PTP] = "ptp-init",
+	[BOOT_CALIB] = "calibration",
+	[BOOT_INIT] = "init-done",
+	[BOOT_TASKS] = "tasks-init",
+	[BOOT_SCRIPT] = "init-script",
+	[BOOT_LINK] = "link-up",
+	[BOOT_DEFERRED] = "deferred-done",
+	[BOOT_TRACK] = "track-phase",
+};
+
+/* Time of the previous milestone */
+static uint32_t boot_tics, boot_cycles, boot_usec;
+static uint32_t boot_ep_tics;
+
+void boot_mark(int milestone)
+{
+	uint32_t tics, cycles = 0, usec;
+	int ns;
+
+	if (boot_info.done & (1 << milestone))
+		return;
+	tics = timer_get_tics();
+	if (!IS_HOST_PROCESS)
+		cycles = shw_pps_gen_get_cycles();
+	if (boot_info.done) {
+		/*
+		 * Use the refclk counter for sub-ms resolution, but it
+		 * wraps every second and it may be adjusted by ptp: if
+		 * it disagrees with the timer, trust the timer.
+		 */
+		usec = (tics - boot_tics) * 1000;
+		ns = cycles - boot_cycles;
+		if (ns < 0)
+			ns += REF_CLOCK_FREQ_HZ;
+		ns *= REF_CLOCK_PERIOD_PS / 1000;
+		if (!IS_HOST_PROCESS && abs(ns / 1000 - usec) < 2000)
+			usec = ns / 1000;
+		boot_usec += usec;
+	}
+	boot_info.usec[milestone] = boot_usec;
+	boot_info.done |= 1 << milestone;
+	boot_tics = tics;
+	boot_cycles = cycles;
+}
+
+void boot_w1_scan(void)
+{
+	if (boot_info.done & (1 << BOOT_W1))
+		return;
+	w1_scan_bus(&wrpc_w1_bus);
+	boot_mark(BOOT_W1);
+}
+
+static void boot_init(void)
+{
+	boot_ep_tics = timer_get_tics();
+}
+
+/* Fast boot: do the deferred work one step per run */
+static int boot_deferred(void)
+{
+	struct wrc_task *t;
+
+	if (!(boot_info.done & (1 << BOOT_ENDPOINT))) {
+		/* keep the link down for 200ms, see wrc_initialize() */
+		if (time_before(timer_get_tics(), boot_ep_tics + 200))
+			return 0;
+		ep_enable(1, 1);
+		boot_mark(BOOT_ENDPOINT);
+		return 1;
+	}
+	if (!(boot_info.done & (1 << BOOT_SCRIPT)) && shell_boot_script_step())
+		return 1;
+	if (!(boot_info.done & (1 << BOOT_W1))) {
+		boot_w1_scan();
+		return 1;
+	}
+	for_each_task(t) {
+		if (!(t->flags & WRC_TASK_LATE_INIT))
+			continue;
+		if (t->init)
+			t->init();
+		t->flags &= ~WRC_TASK_LATE_INIT;
+		return 1;
+	}
+	boot_mark(BOOT_DEFERRED);
+	return 1;
+}
+
+static int boot_poll(void)
+{
+	/* for servo-state (accesses ppsi internal variables) */
+	extern struct pp_instance *ppi;
+	struct wr_servo_state *s;
+
+	if (!(boot_info.done & (1 << BOOT_DEFERRED)))
+		return boot_deferred();
+	if (IS_HOST_PROCESS || (boot_info.done & (1 << BOOT_TRACK)))
+		return 0;
+	s = &((struct wr_data *)ppi->ext_data)->servo_state;
+	if (s->state != WR_TRACK_PHASE)
+		return 0;
+	boot_mark(BOOT_TRACK);
+	return 1;
+}
+
+DEFINE_WRC_TASK(boot) = {
+	.name = "boot",
+	.init = boot_init,
+	.job = boot_poll,
+};
+
+static int cmd_boot(const char *args[])
+{
+	uint32_t printed = 0, prev = 0, u;
+	int i, m;
+
+	pp_printf("fast boot: %s\n", boot_info.fast ? "on" : "off");
+	/* in time order: with fast boot, some milestones move later */
+	for (;;) {
+		m = -1;
+		for (i = 0; i < BOOT_N; i++) {
+			if (!(boot_info.done & ~printed & (1 << i)))
+				continue;
+			if (m < 0 || boot_info.usec[i] < boot_info.usec[m])
+				m = i;
+		}
+		if (m < 0)
+			break;
+		u = boot_info.usec[m];
+		pp_printf("%6i.%03i ms  +%6i.%03i  %s\n", u / 1000, u % 1000,
+			  (u - prev) / 1000, (u - prev) % 1000, boot_names[m]);
+		printed |= 1 << m;
+		prev = u;
+	}
+	for (i = 0; i < BOOT_N; i++)
+		if (!(boot_info.done & (1 << i)))
+			pp_printf("         -              -    %s\n",
+				  boot_names[i]);
+	return 0;
+}
+
+DEFINE_WRC_COMMAND(boot) = {
+	.name = "boot",
+	.exec = cmd_boot,
+};
@@ -0,0 +1,103 @@
+/*
+ * This work is part of the White Rabbit project
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+
+/*
+ * The init script compiler, used both by "init compile" and by the
+ * host tool (tools/wrpc-initc), so it only relies on string functions.
+ */
+#include <string.h>
+#include <strings.h>
+#include <initblob.h>
+
+static const char *initblob_names[INITBLOB_NCMDS] = INITBLOB_NAMES;
+
+const char *initblob_name(int op)
+{
+	if (op <= INITBLOB_TEXT || op >= INITBLOB_NCMDS)
+		return NULL;
+	return initblob_names[op];
+}
+
+int initblob_opcode(const char *name, int len)
+{
+	int i;
+
+	for (i = 1; i < INITBLOB_NCMDS; i++)
+		if (initblob_names[i] && strlen(initblob_names[i]) == len
+		    && !strncasecmp(initblob_names[i], name, len))
+			return i;
+	return INITBLOB_TEXT;
+}
+
+static int initblob_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+/* One line, already without separators: returns the record size */
+static int initblob_line(const char *line, int len, uint8_t *rec, int size)
+{
+	const char *tok[INITBLOB_MAX_ARGS + 1];
+	int toklen[INITBLOB_MAX_ARGS + 1];
+	int i, n = 0, pos = 0, first, op;
+
+	/* split like the shell does: spaces, up to INITBLOB_MAX_ARGS */
+	while (n < INITBLOB_MAX_ARGS) {
+		while (pos < len && initblob_space(line[pos]))
+			pos++;
+		if (pos == len)
+			break;
+		tok[n] = line + pos;
+		while (pos < len && !initblob_space(line[pos]))
+			pos++;
+		toklen[n] = pos - (tok[n] - line);
+		n++;
+	}
+	if (!n || tok[0][0] == '#')
+		return 0;
+	if (size < 2)
+		return -1;
+
+	op = initblob_opcode(tok[0], toklen[0]);
+	/* text records keep the command name, space-separated */
+	first = (op == INITBLOB_TEXT) ? 0 : 1;
+	pos = 2;
+	for (i = first; i < n; i++) {
+		if (pos + toklen[i] + 1 > size || pos + toklen[i] + 1 > 257)
+			return -1;
+		memcpy(rec + pos, tok[i], toklen[i]);
+		pos += toklen[i];
+		rec[pos++] = (op == INITBLOB_TEXT && i < n - 1) ? ' ' : 0;
+	}
+	rec[0] = op;
+	rec[1] = pos - 2;
+	return pos;
+}
+
+int initblob_compile(const char *text, int len, uint8_t *out, int size)
+{
+	int start, end, pos = INITBLOB_HDR, n;
+
+	if (size < INITBLOB_HDR)
+		return -1;
+	for (start = 0; start < len; start = end + 1) {
+		for (end = start; end < len; end++)
+			if (text[end] == '\n' || text[end] == ';' || !text[end])
+				break;
+		n = initblob_line(text + start, end - start, out + pos,
+				  size - pos);
+		if (n < 0)
+			return -1;
+		pos += n;
+		if (end < len && !text[end])
+			break;
+	}
+	out[0] = (pos - INITBLOB_HDR) >> 8;
+	out[1] = pos - INITBLOB_HDR;
+	out[2] = INITBLOB_MARK;
+	out[3] = INITBLOB_VERSION;
+	return pos;
+}
@@ -8,10 +8,14 @@
  */
 #include <wrc.h>
 #include <wrpc.h>
+#include <errno.h>
 #include <ptpd_netif.h>
 #include <shell.h>
+#include <latency.h>
 #include "ipv4.h"
 #include <endpoint.h> /* get_mac_addr() */
+#include <minic.h> /* struct wr_ethhdr */
+#include <pps_gen.h> /* shw_pps_gen_get_cycles() */
 #include <ppsi/jiffies.h> /* time_before() */
 
 #define jiffies timer_get_tics()
@@ -24,12 +28,98 @@ static int lat_verbose = 0;
 static int lat_verbose = 1;
 #endif
 
-static unsigned long prios[] = {7, 6, 0}; /* the prio for the 3 frames */
+/*
+ * A "tuple" is a set of probe frames, one for each combination of
+ * priority and size, repeated "burst" times, followed by a report
+ * frame that carries the departure timestamps of the probes.
+ */
+#define LAT_MAX_LIST	8	/* priorities or sizes */
+#define LAT_MAX_FRAMES	16	/* probe frames in a tuple */
+#define LAT_NSLOTS	8	/* (prio, size) pairs measured by the receiver */
+#define LAT_MIN_SIZE	46	/* payload of a minimum-size frame */
+#define LAT_MAX_SIZE	1500	/* MTU */
+#define LAT_MAX_GAP	10000	/* usecs */
+#define LAT_REPORT_PRIO	0
+
+#define LAT_TYPE_PROBE	0x10
+#define LAT_TYPE_REPORT	0x11
+
+/* Frames are sent lazily in native byte order */
+struct latency_hdr {
+	uint32_t type;
+	uint32_t sequence;
+	uint16_t index;		/* position of a probe in the tuple */
+	uint16_t nframes;	/* number of probes (report only) */
+	uint16_t prio;
+	uint16_t size;		/* payload size of a probe */
+};
+
+struct latency_txts {
+	uint16_t prio;
+	uint16_t size;
+	uint32_t sec;		/* low bits, the receiver has the rest */
+	int32_t nsec;
+};
+
+struct latency_report {
+	struct latency_hdr hdr;
+	struct latency_txts ts[LAT_MAX_FRAMES];
+};
+
+/* Sender configuration, changed by the ltest command */
+static int lat_prios[LAT_MAX_LIST] = {7, 6};
+static int lat_nprios = 2;
+static int lat_sizes[LAT_MAX_LIST] = {LAT_MIN_SIZE};
+static int lat_nsizes = 1;
+static int lat_burst = 1;
+static int lat_gap_us;
+
+/*
+ * Log-linear histogram of the latency: values below LAT_HIST_SUB ns have
+ * one bucket each, then every power of two is split in LAT_HIST_SUB
+ * buckets (12.5% resolution). The last bucket collects everything
+ * above 2^26 ns (67ms).
+ */
+#define LAT_HIST_SUB		8
+#define LAT_HIST_NBUCKETS	(LAT_HIST_SUB * 24)
+
+struct latency_hist {
+	uint32_t bucket[LAT_HIST_NBUCKETS];
+	uint32_t n;
+	uint32_t max;
+};
+
+/* Receiver results, keyed by (prio, size) */
+static struct latency_slot {
+	uint8_t used;
+	uint8_t prio;
+	uint16_t size;
+	uint32_t lost;
+	uint32_t overflow;
+	struct latency_hist hist;
+} lat_slot[LAT_NSLOTS];
+
+static struct latency_stats lat_last[LAT_NSLOTS]; /* previous interval */
+static uint32_t lat_noslot; /* samples with no free slot, all intervals */
 
 static int ltest_fake_delay_ns;
 
-/* latency probe: we need to enqueue 3 short frames: 64*3+overhead = 256 */
-static uint8_t __latency_queue[256];
+/*
+ * The receive queue must hold a whole tuple, as the report comes last.
+ * net.c truncates frames to its buffer, and queues each of them with
+ * its size, timestamp and header. The ltest command refuses tuples that
+ * don't fit (the receivers run the same code).
+ */
+#define LAT_QUEUE_SIZE	4096
+#define LAT_RX_MAX	(NET_MAX_SKBUF_SIZE - 32)
+
+static int lat_queue_bytes(int size)
+{
+	return min(size, LAT_RX_MAX) + 2 + sizeof(struct hw_timestamp)
+		+ sizeof(struct wr_ethhdr);
+}
+
+static uint8_t __latency_queue[LAT_QUEUE_SIZE];
 static struct wrpc_socket *latency_socket, __static_latency_socket = {
 	.queue.buff = __latency_queue,
 	.queue.size = sizeof(__latency_queue),
@@ -48,14 +138,6 @@ static void latency_init(void)
 						  PTPD_SOCK_RAW_ETHERNET, 0);
 }
 
-static struct latency_frame {
-	uint32_t type;   /* 1, 2, 3 */
-	uint32_t sequence;
-	struct wr_timestamp ts[2];
-} frame;
-
-static uint32_t prev_sequence, prev_type;
-
 static void ts_sub(struct wr_timestamp *t2, struct wr_timestamp *t1,
 		      struct wr_timestamp *res)
 {
@@ -72,20 +154,130 @@ static void ts_sub(struct wr_timestamp *t2, struct wr_timestamp *t1,
 	res->nsec = resll;
 }
 
-static void latency_warning(void) {
-	if (!lat_verbose)
-		return;
-	pp_printf("lat: unexpected %i.%i after %i.%i\n",
-		  frame.sequence, frame.type, prev_sequence, prev_type);
+static int lat_hist_bucket(uint32_t ns)
+{
+	int e = 0;
+
+	if (ns < LAT_HIST_SUB)
+		return ns;
+	while (ns >= 2 * LAT_HIST_SUB) {
+		ns >>= 1;
+		e++;
+	}
+	ns += e * LAT_HIST_SUB;
+	return ns < LAT_HIST_NBUCKETS ? ns : LAT_HIST_NBUCKETS - 1;
+}
+
+/* The highest value that falls in bucket b */
+static uint32_t lat_hist_upper(int b)
+{
+	int e;
+
+	if (b < LAT_HIST_SUB)
+		return b;
+	e = b / LAT_HIST_SUB - 1;
+	return ((LAT_HIST_SUB + b % LAT_HIST_SUB + 1) << e) - 1;
+}
+
+static uint32_t lat_hist_percentile(struct latency_hist *h, int permille)
+{
+	uint32_t target, acc = 0;
+	int b;
+
+	if (!h->n)
+		return 0;
+	/* rounded up, so p99.9 of few samples is the max sample */
+	target = h->n - h->n * (1000 - permille) / 1000;
+	for (b = 0; b < LAT_HIST_NBUCKETS - 1; b++) {
+		acc += h->bucket[b];
+		if (acc >= target)
+			break;
+	}
+	return min(lat_hist_upper(b), h->max);
+}
+
+static void lat_hist_add(struct latency_hist *h, int32_t ns)
+{
+	if (ns < 0)
+		ns = 0;
+	h->bucket[lat_hist_bucket(ns)]++;
+	h->n++;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+/* Summarize the running interval of a slot */
+static void lat_slot_stats(struct latency_slot *slot, struct latency_stats *s)
+{
+	struct latency_hist *h = &slot->hist;
+
+	s->prio = slot->prio;
+	s->size = slot->size;
+	s->lost = slot->lost;
+	s->overflow = slot->overflow;
+	s->n = h->n;
+	s->p50 = lat_hist_percentile(h, 500);
+	s->p90 = lat_hist_percentile(h, 900);
+	s->p99 = lat_hist_percentile(h, 990);
+	s->p999 = lat_hist_percentile(h, 999);
+	s->max = h->max;
+}
+
+static struct latency_slot *lat_slot_get(int prio, int size)
+{
+	struct latency_slot *slot, *free = NULL;
+
+	for (slot = lat_slot; slot < lat_slot + LAT_NSLOTS; slot++) {
+		if (!slot->used) {
+			if (!free)
+				free = slot;
+			continue;
+		}
+		if (slot->prio == prio && slot->size == size)
+			return slot;
+	}
+	if (!free)
+		return NULL;
+	memset(free, 0, sizeof(*free));
+	memset(lat_last + (free - lat_slot), 0, sizeof(*lat_last));
+	free->used = 1;
+	free->prio = prio;
+	free->size = size;
+	return free;
+}
+
+static int lat_format_stats(char *buf, struct latency_stats *s)
+{
+	return pp_sprintf(buf, "prio %i size %4i: %i samples, %i lost, "
+			  "%i overflow, p50 %i p90 %i p99 %i p99.9 %i max %i\n",
+			  s->prio, s->size, s->n, s->lost, s->overflow,
+			  s->p50, s->p90, s->p99, s->p999, s->max);
 }
 
-/* report once a minute */
-static void latency_report(struct wr_timestamp *lat)
+/* Rows are the slots in use, so the snmp walk finds no holes */
+int latency_get_stats(int probe, struct latency_stats *s)
+{
+	int i;
+
+	for (i = 0; i < LAT_NSLOTS; i++) {
+		if (!lat_slot[i].used)
+			continue;
+		if (!probe--) {
+			*s = lat_last[i];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* close the interval once a minute, reporting to syslog */
+static void latency_report(void)
 {
 	static unsigned long nextj;
-	static unsigned long min[2], max[2], tot[2], n;
+	struct latency_slot *slot;
+	struct latency_stats *s;
 	char buf[128];
-	int i;
+	int i, any = 0;
 
 	if (!nextj) {
 		unsigned char mac[6];
@@ -96,163 +288,245 @@ static void latency_report(struct wr_timestamp *lat)
 		pp_printf("%s: first sending at %li\n", __func__, nextj);
 	}
 
-	n++;
-	for (i = 0; i < 2; i++) {
-		if (!min[i] || lat[i].nsec < min[i])
-			min[i] = lat[i].nsec;
-		if ( lat[i].nsec > max[i])
-			max[i] = lat[i].nsec;
-		tot[i] += lat[i].nsec;
-	}
-
 	if (time_before(jiffies, nextj))
 		return;
 	nextj += 60 * TICS_PER_SECOND;
 
-	if (!n)
-		return;
+	for (i = 0; i < LAT_NSLOTS; i++) {
+		slot = lat_slot + i;
+		s = lat_last + i;
+		if (!slot->used)
+			continue;
+		lat_slot_stats(slot, s);
+		/* a silent slot is released, the sender changed config */
+		if (!s->n && !s->lost && !s->overflow) {
+			slot->used = 0;
+			continue;
+		}
+		memset(&slot->hist, 0, sizeof(slot->hist));
+		slot->lost = 0;
+		slot->overflow = 0;
+		any++;
+		if (HAS_SYSLOG && !lat_verbose) {
+			lat_format_stats(buf + pp_sprintf(buf, "ltest: "), s);
+			syslog_report(buf);
+		}
+	}
 
-	pp_sprintf(buf, "ltest: %li samples, "
-		   "min %li %li, avg %li %li, max %li %li\n",
-		   n, min[0], min[1], tot[0]/n, tot[1]/n, max[0], max[1]);
-	n = min[0] = min[1] = max[0] = max[1] = tot[0] = tot[1] = 0;
-	syslog_report(buf);
+	if (HAS_SYSLOG && !lat_verbose && any && lat_noslot) {
+		pp_sprintf(buf, "ltest: %i samples with no free slot\n",
+			   lat_noslot);
+		syslog_report(buf);
+	}
 }
 
-static int latency_poll_rx(void)
-{
-	static struct wr_timestamp ts[2];
-	static int nframes;
-	static unsigned lost;
-	struct wr_timestamp ts_tmp, lat[2];
-	struct wr_sockaddr addr;
-	int i, j;
-
-	i = ptpd_netif_recvfrom(latency_socket, &addr,
-				  &frame, sizeof(frame), &ts_tmp);
-	if (i < sizeof(frame))
-		return 0;
-
-	/* check sequence and type is ok */
-	switch(frame.type) {
-	case 1:
-		if (frame.sequence != prev_sequence + 1 || prev_type != 3)
-			latency_warning();
-		ts[0] = ts_tmp; /* 0 is always valid, it's a new set */
-		nframes = 1;
-		ts[1].sec = 0; /* but still incomplete info */
+/* The receiver collects probe departure and arrival times */
+static union {
+	struct latency_hdr hdr;
+	struct latency_report report;
+} lat_rxbuf;
 
-		break;
-
-	case 2:
-		if (frame.sequence != prev_sequence || prev_type != 1) {
-			latency_warning();
-		} else {
-			ts[1] = ts_tmp;
-			nframes++;
-		}
-		break;
+static struct {
+	uint32_t sequence;
+	uint32_t received;	/* bitmask of probe indexes */
+	uint16_t dropped;	/* by the socket queue, at the last report */
+	struct wr_timestamp ts[LAT_MAX_FRAMES];
+} lat_rx;
 
-	case 3:
-		if (frame.sequence != prev_sequence || prev_type != 2) {
-			latency_warning();
-		} else {
-			nframes++;
-		}
-		break;
+static void latency_rx_probe(struct latency_hdr *h, struct wr_timestamp *ts)
+{
+	if (h->sequence != lat_rx.sequence) {
+		lat_rx.sequence = h->sequence;
+		lat_rx.received = 0;
 	}
+	if (h->index >= LAT_MAX_FRAMES)
+		return;
+	lat_rx.ts[h->index] = *ts;
+	lat_rx.received |= 1 << h->index;
+}
 
-	/* count lost frames */
-	i = prev_sequence * 3 + prev_type - 1; /* type: 1..3 -> 0..2 */
-	j = frame.sequence * 3 + frame.type - 2;
-	if (HAS_SYSLOG && j != i) {
+static void latency_rx_report(struct latency_report *r)
+{
+	static uint32_t prev_sequence, lost;
+	static int running;
+	struct latency_slot *slots[LAT_MAX_FRAMES];
+	struct latency_txts *e;
+	struct wr_timestamp *rx, tx, lat;
+	int i, missing = 0, nframes = r->hdr.nframes;
+	uint16_t dropped;
+
+	if (nframes > LAT_MAX_FRAMES)
+		nframes = LAT_MAX_FRAMES;
+	if (r->hdr.sequence != lat_rx.sequence)
+		lat_rx.received = 0; /* all probes lost */
+
+	/* whole tuples lost: count their probes with this configuration */
+	if (running && r->hdr.sequence != prev_sequence + 1)
+		missing = r->hdr.sequence - prev_sequence - 1;
+	prev_sequence = r->hdr.sequence;
+	running = 1;
+
+	/* frames our queue dropped since the last report: not the network */
+	dropped = latency_socket->queue.dropped - lat_rx.dropped;
+	lat_rx.dropped = latency_socket->queue.dropped;
+
+	if (HAS_SYSLOG && missing) {
 		char buf[64];
 
-		lost += (j - i);
-		pp_sprintf(buf, "ltest: lost %i frames, total %i\n",
-			   j - i, lost);
+		lost += missing;
+		pp_sprintf(buf, "ltest: lost %i tuples, total %i\n",
+			   missing, lost);
 		syslog_report(buf);
 	}
 
-	prev_sequence = frame.sequence;
-	prev_type = frame.type;
-	if (frame.type != 3 || nframes != 3)
-		return 1;
-
-
-	net_verbose("ts_rx 1: %9li.%09i.%03i\n", (long)ts[0].sec,
-		    ts[0].nsec, ts[0].phase);
-	net_verbose("ts_tx 1: %9li.%09i.%03i\n", (long)frame.ts[0].sec,
-		    frame.ts[0].nsec, frame.ts[0].phase);
+	for (i = 0; i < nframes; i++) {
+		e = r->ts + i;
+		slots[i] = lat_slot_get(e->prio, e->size);
+		if (!slots[i]) {
+			lat_noslot++;
+			continue;
+		}
+		if (missing > 0)
+			slots[i]->lost += missing;
+		if (!(lat_rx.received & (1 << i))) {
+			if (dropped) {
+				dropped--;
+				slots[i]->overflow++;
+			} else {
+				slots[i]->lost++;
+			}
+			continue;
+		}
 
-	net_verbose("ts_rx 2: %9li.%09i.%03i\n", (long)ts[1].sec,
-		    ts[1].nsec, ts[1].phase);
-	net_verbose("ts_tx 2: %9li.%09i.%03i\n", (long)frame.ts[1].sec,
-		    frame.ts[1].nsec, frame.ts[1].phase);
+		rx = lat_rx.ts + i;
+		tx.sec = rx->sec - (int32_t)((uint32_t)rx->sec - e->sec);
+		tx.nsec = e->nsec;
+		tx.phase = 0;
+		net_verbose("ts_rx %i: %9li.%09i.%03i\n", i, (long)rx->sec,
+			    rx->nsec, rx->phase);
+		net_verbose("ts_tx %i: %9li.%09i.%03i\n", i, (long)tx.sec,
+			    tx.nsec, tx.phase);
+		ts_sub(rx, &tx, &lat);
+		if (lat.sec)
+			continue; /* not synchronized for sure */
+
+		lat_hist_add(&slots[i]->hist, lat.nsec);
+		if (lat_verbose)
+			pp_printf("lat: %9i %i %4i %6i.%03i\n",
+				  r->hdr.sequence, e->prio, e->size,
+				  lat.nsec, lat.phase);
+	}
+	lat_rx.received = 0;
+}
 
-	ts_sub(ts + 0, frame.ts + 0, lat + 0);
-	ts_sub(ts + 1, frame.ts + 1, lat + 1);
+static int latency_poll_rx(void)
+{
+	struct wr_timestamp ts;
+	struct wr_sockaddr addr;
+	int len;
 
-	if (lat[0].sec || lat[1].sec)
-		return 1; /* not synchronized for sure */
+	len = ptpd_netif_recvfrom(latency_socket, &addr,
+				  &lat_rxbuf, sizeof(lat_rxbuf), &ts);
+	if (len < (int)sizeof(struct latency_hdr))
+		return 0;
 
-	if (lat_verbose) {
-		pp_printf("lat: %9i %6i.%03i %6i.%03i\n",
-			  frame.sequence,
-			  lat[0].nsec, lat[0].phase,
-			  lat[1].nsec, lat[1].phase);
-		return 1;
-	} else {
-		latency_report(lat);
+	switch(lat_rxbuf.hdr.type) {
+	case LAT_TYPE_PROBE:
+		latency_rx_probe(&lat_rxbuf.hdr, &ts);
+		break;
+	case LAT_TYPE_REPORT:
+		latency_rx_report(&lat_rxbuf.report);
+		break;
+	default:
+		if (lat_verbose)
+			pp_printf("lat: unexpected type %i\n",
+				  lat_rxbuf.hdr.type);
 	}
 	return 1;
 }
 
+/* The sender: probes are sent from a zeroed buffer of the maximum size */
+static uint32_t lat_txbuf[LAT_MAX_SIZE / sizeof(uint32_t)];
+static struct latency_report lat_report;
 
+/*
+ * A tuple is sent one frame per task run, so the gap between probes
+ * doesn't block the other tasks: lat_tx_next is the next probe (or the
+ * report, at lat_tx_n), and -1 when no tuple is running.
+ */
+static int lat_tx_next = -1, lat_tx_n;
+static uint32_t lat_tx_cycles; /* when the previous frame was sent */
+
+static int lat_tx_gap_done(void)
+{
+	uint32_t now;
+
+	if (!lat_gap_us)
+		return 1;
+	now = shw_pps_gen_get_cycles();
+	if (now < lat_tx_cycles) /* the counter wrapped at the second */
+		now += REF_CLOCK_FREQ_HZ;
+	return now - lat_tx_cycles >=
+		lat_gap_us * (REF_CLOCK_FREQ_HZ / 1000) / 1000;
+}
 
 static int latency_poll_tx(void)
 {
 	static uint32_t sequence;
 	static uint32_t lasts;
-
-	/*
-	 * Send three frames -- lazily in native byte order. Possibly
-	 * subtract a fake delay, to trigger reporting.
-	 */
-	memset(&frame, 0, sizeof(frame));
-	frame.sequence = sequence++;
-
-	frame.type = 1;
-	latency_socket->prio = prios[0];
-	ptpd_netif_sendto(latency_socket, &latency_addr, &frame, sizeof(frame),
-			  frame.ts + 0);
-	frame.ts[0].nsec -= ltest_fake_delay_ns;
-	if (frame.ts[0].nsec < 0) {
-		frame.ts[0].nsec += 1000 * 1000 * 1000;
-		frame.ts[0].sec --;
+	struct latency_hdr *h = (void *)lat_txbuf;
+	struct latency_txts *e;
+	struct wr_timestamp ts;
+	int k;
+
+	if (lat_tx_next < 0) {
+		lat_tx_n = lat_burst * lat_nprios * lat_nsizes;
+		lat_tx_next = 0;
+	} else if (!lat_tx_gap_done()) {
+		return 0;
 	}
-
-	frame.type = 2;
-	latency_socket->prio = prios[1];
-	ptpd_netif_sendto(latency_socket, &latency_addr, &frame, sizeof(frame),
-			  frame.ts + 1);
-	frame.ts[1].nsec -= ltest_fake_delay_ns;
-	if (frame.ts[1].nsec < 0) {
-		frame.ts[1].nsec += 1000 * 1000 * 1000;
-		frame.ts[1].sec --;
+	k = lat_tx_next++;
+
+	/* Send all probes, then the report */
+	if (k < lat_tx_n) {
+		h->type = LAT_TYPE_PROBE;
+		h->sequence = sequence;
+		h->index = k;
+		h->prio = lat_prios[(k / lat_nsizes) % lat_nprios];
+		h->size = lat_sizes[k % lat_nsizes];
+		latency_socket->prio = h->prio;
+		ptpd_netif_sendto(latency_socket, &latency_addr, lat_txbuf,
+				  h->size, &ts);
+		lat_tx_cycles = shw_pps_gen_get_cycles();
+
+		/* Possibly subtract a fake delay, to trigger reporting */
+		ts.nsec -= ltest_fake_delay_ns;
+		if (ts.nsec < 0) {
+			ts.nsec += 1000 * 1000 * 1000;
+			ts.sec--;
+		}
+		e = lat_report.ts + k;
+		e->prio = h->prio;
+		e->size = h->size;
+		e->sec = ts.sec;
+		e->nsec = ts.nsec;
+		return 1;
 	}
 
-	frame.type = 3;
-	latency_socket->prio = prios[2];
-	ptpd_netif_sendto(latency_socket, &latency_addr, &frame, sizeof(frame),
-			  NULL);
+	lat_report.hdr.type = LAT_TYPE_REPORT;
+	lat_report.hdr.sequence = sequence++;
+	lat_report.hdr.nframes = k;
+	latency_socket->prio = LAT_REPORT_PRIO;
+	ptpd_netif_sendto(latency_socket, &latency_addr, &lat_report,
+			  offsetof(struct latency_report, ts[k]), NULL);
 	ltest_fake_delay_ns = 0;
+	lat_tx_next = -1;
 
 	/* Every 10s remind we are sending ltest */
 	if (!lasts) {
-		lasts = frame.ts->sec;
-	} else if (frame.ts->sec - lasts >= 10) {
-		lasts = frame.ts->sec;
+		lasts = lat_report.ts[k - 1].sec;
+	} else if (lat_report.ts[k - 1].sec - lasts >= 10) {
+		lasts = lat_report.ts[k - 1].sec;
 		pp_printf("latency: seq %9i sent @ %9i\n",
 			  sequence, lasts);
 	}
@@ -265,11 +539,13 @@ static uint32_t latency_period_ms;
 
 static int latency_poll(void)
 {
-	if (!latency_period_ms)
+	if (!latency_period_ms) {
+		latency_report();
 		return latency_poll_rx();
+	}
 
-	/* Periodically send the frames */
-	if (task_not_yet(&lastt, latency_period_ms))
+	/* Periodically send the frames, finishing a running tuple first */
+	if (lat_tx_next < 0 && task_not_yet(&lastt, latency_period_ms))
 		return 0;
 	return latency_poll_tx();
 }
@@ -281,9 +557,77 @@ DEFINE_WRC_TASK(uptime) = {
 };
 
 
+static void ltest_hist(void)
+{
+	struct latency_stats s;
+	char buf[128];
+	int i;
+
+	for (i = 0; i < LAT_NSLOTS; i++) {
+		if (!lat_slot[i].used)
+			continue;
+		lat_slot_stats(lat_slot + i, &s);
+		lat_format_stats(buf, &s);
+		pp_printf("current %s", buf);
+		lat_format_stats(buf, lat_last + i);
+		pp_printf("last    %s", buf);
+	}
+	if (lat_noslot)
+		pp_printf("%i samples with no free slot\n", lat_noslot);
+}
+
+/* Parse a comma-separated list, such as "7,6,0"; return its length */
+static int ltest_parse_list(const char *s, int *list, int lo, int hi)
+{
+	int n = 0, v;
+
+	while (s && n < LAT_MAX_LIST) {
+		s = fromdec(s, &v);
+		if (v < lo || v > hi)
+			return -1;
+		list[n++] = v;
+		if (*s != ',')
+			break;
+		s++;
+	}
+	return n;
+}
+
+/* A tuple must fit both the report and the receive queue */
+static int ltest_check(int nprios, const int *sizes, int nsizes, int burst)
+{
+	int i, n = nprios * nsizes * burst, bytes = 0;
+
+	if (n > LAT_MAX_FRAMES) {
+		pp_printf("Too many frames (max %i)\n", LAT_MAX_FRAMES);
+		return -EINVAL;
+	}
+	for (i = 0; i < nsizes; i++)
+		bytes += lat_queue_bytes(sizes[i]);
+	bytes = bytes * nprios * burst + lat_queue_bytes(
+		sizeof(struct latency_hdr) + n * sizeof(struct latency_txts));
+	if (bytes > sizeof(__latency_queue)) {
+		pp_printf("Too many bytes (%i, max %i)\n", bytes,
+			  (int)sizeof(__latency_queue));
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static void ltest_show_list(const char *name, int *list, int n)
+{
+	int i;
+
+	pp_printf("%s ", name);
+	for (i = 0; i < n; i++)
+		pp_printf("%s%i", i ? "," : "", list[i]);
+}
+
 static int cmd_ltest(const char *args[])
 {
-	int v = 0, v1 = 0;
+	int list[LAT_MAX_LIST];
+	int v = 0, v1 = 0, n;
+	int nprios = lat_nprios, nsizes = lat_nsizes, burst = lat_burst;
 
 	if (args[1]) {
 		fromdec(args[1], &v1); /* ms */
@@ -295,14 +639,55 @@ static int cmd_ltest(const char *args[])
 			lat_verbose = 0;
 		else if (!strcmp(args[0], "fake"))
 			fromdec(args[1], &ltest_fake_delay_ns);
+		else if (!strcmp(args[0], "hist")) {
+			ltest_hist();
+			return 0;
+		}
+		else if (!strcmp(args[0], "prio") || !strcmp(args[0], "size")) {
+			if (args[0][0] == 'p')
+				n = nprios = ltest_parse_list(args[1], list,
+							      0, 7);
+			else
+				n = nsizes = ltest_parse_list(args[1], list,
+							      LAT_MIN_SIZE,
+							      LAT_MAX_SIZE);
+			if (n <= 0)
+				return -EINVAL;
+			if (ltest_check(nprios, args[0][0] == 'p' ? lat_sizes
+					: list, nsizes, burst))
+				return -EINVAL;
+			if (args[0][0] == 'p') {
+				memcpy(lat_prios, list, sizeof(list));
+				lat_nprios = n;
+			} else {
+				memcpy(lat_sizes, list, sizeof(list));
+				lat_nsizes = n;
+			}
+			lat_tx_next = -1; /* abort a running tuple */
+		}
+		else if (!strcmp(args[0], "burst")) {
+			if (v1 < 1 || ltest_check(nprios, lat_sizes, nsizes, v1))
+				return -EINVAL;
+			lat_burst = v1;
+			lat_tx_next = -1;
+		}
+		else if (!strcmp(args[0], "gap")) {
+			if (v1 < 0 || v1 > LAT_MAX_GAP)
+				return -EINVAL;
+			lat_gap_us = v1;
+		}
 		else {
 			fromdec(args[0], &v);
 			latency_period_ms = v * 1000 + v1;
 			lastt = 0; /* reset, so it fires immediately */
+			lat_tx_next = -1;
 		}
 	}
-	pp_printf("%i.%03i (%s)\n", latency_period_ms / 1000,
+	pp_printf("%i.%03i (%s) ", latency_period_ms / 1000,
 		  latency_period_ms % 1000, lat_verbose ? "verbose" : "quiet");
+	ltest_show_list("prio", lat_prios, lat_nprios);
+	ltest_show_list(" size", lat_sizes, lat_nsizes);
+	pp_printf(" burst %i gap %ius\n", lat_burst, lat_gap_us);
 	return 0;
 }
 
@@ -310,4 +695,3 @@ DEFINE_WRC_COMMAND(ltest) = {
 	.name = "ltest",
 	.exec = cmd_ltest,
 };
-
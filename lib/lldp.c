@@ -279,4 +279,5 @@ DEFINE_WRC_TASK(lldp) = {
 	.name = "lldp",
 	.init = lldp_init,
 	.job = lldp_poll,
+	.flags = WRC_TASK_LATE_INIT,
 };
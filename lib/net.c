@@ -88,6 +88,7 @@ struct wrpc_socket *ptpd_netif_create_socket(struct wrpc_socket *sock,
 	sock->queue.head = sock->queue.tail = 0;
 	sock->queue.avail = sock->queue.size;
 	sock->queue.n = 0;
+	sock->queue.dropped = 0;
 
 	return sock;
 }
@@ -372,6 +373,7 @@ static int update_rx_queues(void)
 	    sizeof(struct wr_ethhdr) + recvd + sizeof(struct hw_timestamp) + 2;
 
 	if (q->avail < q_required) {
+		q->dropped++;
 		net_verbose
 		    ("%s: queue for socket full; [avail %d required %d]\n",
 		     __FUNCTION__, q->avail, q_required);
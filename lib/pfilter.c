@@ -0,0 +1,81 @@
+/*
+ * This work is part of the White Rabbit project
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+
+/*
+ * A model of the endpoint packet filter, for the host tools: the
+ * builder checks what it generates and pfilter-sim runs rule-sets over
+ * captured frames. See tools/pfilter-builder.c for the instruction set.
+ */
+#include <pfilter.h>
+#include <endpoint.h>
+
+static int pfilter_op(int op, int a, int b)
+{
+	switch (op) {
+	case AND:	return a & b;
+	case NAND:	return !(a & b);
+	case OR:	return a | b;
+	case NOR:	return !(a | b);
+	case XOR:	return a ^ b;
+	case XNOR:	return !(a ^ b);
+	case MOV:	return a;
+	default:	return !a; /* NOT */
+	}
+}
+
+int pfilter_run(const uint64_t *code, int n, const uint8_t *frame, int len)
+{
+	uint8_t r[32] = {0,};
+	uint64_t ir;
+	int pc, i, off, word, mask, ret;
+
+	for (pc = 0; pc < n && !((ir = code[pc]) & PFILTER_FIN); pc++) {
+		if (ir & PFILTER_LOGIC) {
+			i = pfilter_op(PFILTER_OP(ir),
+				       r[PFILTER_LOGIC_RA(ir)],
+				       r[PFILTER_LOGIC_RB(ir)]);
+			r[PFILTER_LOGIC_RD(ir)] = pfilter_op(
+				PFILTER_LOGIC_OP2(ir), i,
+				r[PFILTER_LOGIC_RC(ir)]);
+		} else {
+			/* words past the end of the frame read as 0 */
+			off = PFILTER_CMP_OFFSET(ir) * 2;
+			word = (off < len ? frame[off] << 8 : 0)
+				| (off + 1 < len ? frame[off + 1] : 0);
+			for (i = 0, mask = 0; i < 4; i++)
+				if (PFILTER_CMP_NIBBLES(ir) & (1 << i))
+					mask |= 0xf << (4 * i);
+			i = (word & mask) == (PFILTER_CMP_VALUE(ir) & mask);
+			r[PFILTER_CMP_RD(ir)] = pfilter_op(PFILTER_OP(ir), i,
+						r[PFILTER_CMP_RD(ir)]);
+		}
+		r[0] = 0;
+	}
+	for (i = 0, ret = 0; i < 8; i++)
+		ret |= r[PFILTER_R_CLASS(i)] << i;
+	return r[PFILTER_R_DROP] ? ret | PFILTER_DROP : ret;
+}
+
+int pfilter_check(const uint64_t *code, int n)
+{
+	uint64_t ir;
+	int pc;
+
+	for (pc = 0; pc < n && pc < PFILTER_MAX_CODE_SIZE; pc++) {
+		ir = code[pc];
+		if (ir >> 36)
+			return -1 - pc;
+		if (ir & PFILTER_FIN)
+			return pc;
+		if (ir & PFILTER_LOGIC)
+			continue;
+		/* a comparison can't look ahead of the frame */
+		if (PFILTER_CMP_RD(ir) == 0
+		    || PFILTER_CMP_OFFSET(ir) > pc)
+			return -1 - pc;
+	}
+	return -1 - pc;
+}
@@ -31,6 +31,7 @@
 #include "syscon.h"
 
 #include "storage.h"
+#include "latency.h"
 
 #define ASN_BOOLEAN	((u_char)0x01)
 #define ASN_INTEGER	((u_char)0x02)
@@ -122,6 +123,14 @@
 #define applyFailedDBFull 202
 #define applyFailedInvalidPN 203
 
+/* defines for wrpcPfilterApply (the results are the ones above) */
+#define pfilterApplyStaged 1
+#define pfilterSaveToFlash 2
+#define pfilterEraseFlash 3
+#define pfilterUseBuiltin 4
+#define pfilterClearStaged 5
+#define applyFailedInvalid 201
+
 /* defines for wrpcTemperatureTable */
 #define TABLE_ROW 1
 #define TABLE_COL 0
@@ -213,6 +222,11 @@ struct snmp_oid_limb {
 static struct s_sfpinfo snmp_ptp_config;
 static int ptp_config_apply_status;
 static int ptp_restart_status;
+#ifdef CONFIG_PFILTER_UPLOAD
+static int pfilter_apply_status;
+static int pfilter_word_index;
+static uint32_t pfilter_word;
+#endif
 /* Keep the number of aux diag registers available in the FPGA bitstream */
 static uint32_t aux_diag_reg_ro_num;
 static uint32_t aux_diag_reg_rw_num;
@@ -254,12 +268,19 @@ static int get_servo(uint8_t *buf, struct snmp_oid *obj);
 static int get_port(uint8_t *buf, struct snmp_oid *obj);
 static int get_temp(uint8_t *buf, struct snmp_oid *obj);
 static int get_sfp(uint8_t *buf, struct snmp_oid *obj);
+#ifdef CONFIG_LATENCY_PROBE
+static int get_latency(uint8_t *buf, struct snmp_oid *obj);
+#endif
 static int get_aux_diag(uint8_t *buf, struct snmp_oid *obj);
 static int set_value(uint8_t *set_buff, struct snmp_oid *obj, void *p);
 static int set_pp(uint8_t *buf, struct snmp_oid *obj);
 static int set_p(uint8_t *buf, struct snmp_oid *obj);
 static int set_ptp_restart(uint8_t *buf, struct snmp_oid *obj);
 static int set_ptp_config(uint8_t *buf, struct snmp_oid *obj);
+#ifdef CONFIG_PFILTER_UPLOAD
+static int set_pfilter_apply(uint8_t *buf, struct snmp_oid *obj);
+static int set_pfilter_word(uint8_t *buf, struct snmp_oid *obj);
+#endif
 static int set_aux_diag(uint8_t *buf, struct snmp_oid *obj);
 static int data_aux_diag(uint8_t *buf, struct snmp_oid *obj, int mode);
 
@@ -276,6 +297,13 @@ static uint8_t oid_wrpcPtpConfigGroup[] =   {0x2B,6,1,4,1,96,101,1,6};
 static uint8_t oid_wrpcPortGroup[] =        {0x2B,6,1,4,1,96,101,1,7};
 /* Include wrpcSfpEntry into OID */
 static uint8_t oid_wrpcSfpTable[] =         {0x2B,6,1,4,1,96,101,1,8,1};
+#ifdef CONFIG_LATENCY_PROBE
+/* Include wrpcLatencyEntry into OID */
+static uint8_t oid_wrpcLatencyTable[] =     {0x2B,6,1,4,1,96,101,1,9,1};
+#endif
+#ifdef CONFIG_PFILTER_UPLOAD
+static uint8_t oid_wrpcPfilterGroup[] =     {0x2B,6,1,4,1,96,101,1,10};
+#endif
 /* In below OIDs zeros will be replaced in the snmp_init function by values
  * read from FPA */
 static uint8_t oid_wrpcAuxRoTable[] =       {0x2B,6,1,4,1,96,101,2,0,0,1,1};
@@ -306,6 +334,9 @@ static uint8_t oid_wrpcSpllMlock[] =             {6,0};
 static uint8_t oid_wrpcSpllHY[] =                {7,0};
 static uint8_t oid_wrpcSpllMY[] =                {8,0};
 static uint8_t oid_wrpcSpllDelCnt[] =            {9,0};
+static uint8_t oid_wrpcSpllRefFreq[] =           {10,0};
+static uint8_t oid_wrpcSpllDmtdFreq[] =          {11,0};
+static uint8_t oid_wrpcSpllExtFreq[] =           {12,0};
 
 /* wrpcPtpGroup */
 static uint8_t oid_wrpcPtpServoStateN[] =        { 5,0};
@@ -347,6 +378,37 @@ static uint8_t oid_wrpcSfpDeltaTx[] =            {3};
 static uint8_t oid_wrpcSfpDeltaRx[] =            {4};
 static uint8_t oid_wrpcSfpAlpha[] =              {5};
 
+#ifdef CONFIG_LATENCY_PROBE
+/* oid_wrpcLatencyTable */
+static uint8_t oid_wrpcLatencyPrio[] =           {2};
+static uint8_t oid_wrpcLatencySamples[] =        {3};
+static uint8_t oid_wrpcLatencyLost[] =           {4};
+static uint8_t oid_wrpcLatencyP50[] =            {5};
+static uint8_t oid_wrpcLatencyP90[] =            {6};
+static uint8_t oid_wrpcLatencyP99[] =            {7};
+static uint8_t oid_wrpcLatencyP999[] =           {8};
+static uint8_t oid_wrpcLatencyMax[] =            {9};
+static uint8_t oid_wrpcLatencySize[] =           {10};
+static uint8_t oid_wrpcLatencyOverflow[] =       {11};
+#endif
+
+#ifdef CONFIG_PFILTER_UPLOAD
+/* wrpcPfilterGroup */
+static uint8_t oid_wrpcPfilterSource[] =         {1,0};
+static uint8_t oid_wrpcPfilterApply[] =          {2,0};
+static uint8_t oid_wrpcPfilterWordIndex[] =      {3,0};
+static uint8_t oid_wrpcPfilterWord[] =           {4,0};
+static uint8_t oid_wrpcPfilterStagedLength[] =   {5,0};
+static uint8_t oid_wrpcPfilterRxClass0[] =       {6,0};
+static uint8_t oid_wrpcPfilterRxClass1[] =       {7,0};
+static uint8_t oid_wrpcPfilterRxClass2[] =       {8,0};
+static uint8_t oid_wrpcPfilterRxClass3[] =       {9,0};
+static uint8_t oid_wrpcPfilterRxClass4[] =       {10,0};
+static uint8_t oid_wrpcPfilterRxClass5[] =       {11,0};
+static uint8_t oid_wrpcPfilterRxClass6[] =       {12,0};
+static uint8_t oid_wrpcPfilterRxClass7[] =       {13,0};
+#endif
+
 /* NOTE: to have SNMP_GET_NEXT working properly this array has to be sorted by
 	 OIDs */
 /* wrpcVersionGroup */
@@ -384,6 +446,9 @@ static struct snmp_oid oid_array_wrpcSpllStatusGroup[] = {
 	OID_FIELD_VAR(   oid_wrpcSpllHY,             get_p,        NO_SET,   ASN_INTEGER,   &stats.H_y),
 	OID_FIELD_VAR(   oid_wrpcSpllMY,             get_p,        NO_SET,   ASN_INTEGER,   &stats.M_y),
 	OID_FIELD_VAR(   oid_wrpcSpllDelCnt,         get_p,        NO_SET,   ASN_COUNTER,   &stats.del_cnt),
+	OID_FIELD_VAR(   oid_wrpcSpllRefFreq,        get_p,        NO_SET,   ASN_INTEGER,   &spll_freq.hz[SPLL_OSC_REF]),
+	OID_FIELD_VAR(   oid_wrpcSpllDmtdFreq,       get_p,        NO_SET,   ASN_INTEGER,   &spll_freq.hz[SPLL_OSC_DMTD]),
+	OID_FIELD_VAR(   oid_wrpcSpllExtFreq,        get_p,        NO_SET,   ASN_INTEGER,   &spll_freq.hz[SPLL_OSC_EXT]),
 	{ 0, }
 };
 
@@ -440,6 +505,43 @@ static struct snmp_oid oid_array_wrpcSfpTable[] = {
 	{ 0, }
 };
 
+#ifdef CONFIG_LATENCY_PROBE
+/* wrpcLatencyTable */
+static struct snmp_oid oid_array_wrpcLatencyTable[] = {
+	OID_FIELD_VAR(   oid_wrpcLatencyPrio,    get_latency,    NULL,    ASN_UNSIGNED,  NULL),
+	OID_FIELD_VAR(   oid_wrpcLatencySamples, get_latency,    NULL,    ASN_UNSIGNED,  NULL),
+	OID_FIELD_VAR(   oid_wrpcLatencyLost,    get_latency,    NULL,    ASN_UNSIGNED,  NULL),
+	OID_FIELD_VAR(   oid_wrpcLatencyP50,     get_latency,    NULL,    ASN_UNSIGNED,  NULL),
+	OID_FIELD_VAR(   oid_wrpcLatencyP90,     get_latency,    NULL,    ASN_UNSIGNED,  NULL),
+	OID_FIELD_VAR(   oid_wrpcLatencyP99,     get_latency,    NULL,    ASN_UNSIGNED,  NULL),
+	OID_FIELD_VAR(   oid_wrpcLatencyP999,    get_latency,    NULL,    ASN_UNSIGNED,  NULL),
+	OID_FIELD_VAR(   oid_wrpcLatencyMax,     get_latency,    NULL,    ASN_UNSIGNED,  NULL),
+	OID_FIELD_VAR(   oid_wrpcLatencySize,    get_latency,    NULL,    ASN_UNSIGNED,  NULL),
+	OID_FIELD_VAR(   oid_wrpcLatencyOverflow, get_latency,   NULL,    ASN_UNSIGNED,  NULL),
+	{ 0, }
+};
+#endif
+
+#ifdef CONFIG_PFILTER_UPLOAD
+/* wrpcPfilterGroup */
+static struct snmp_oid oid_array_wrpcPfilterGroup[] = {
+	OID_FIELD_VAR(   oid_wrpcPfilterSource,      get_p,        NO_SET,   ASN_INTEGER,   &pfilter_source),
+	OID_FIELD_VAR(   oid_wrpcPfilterApply,       get_p,        set_pfilter_apply, ASN_INTEGER, &pfilter_apply_status),
+	OID_FIELD_VAR(   oid_wrpcPfilterWordIndex,   get_p,        set_p,    ASN_INTEGER,   &pfilter_word_index),
+	OID_FIELD_VAR(   oid_wrpcPfilterWord,        get_p,        set_pfilter_word, ASN_UNSIGNED, &pfilter_word),
+	OID_FIELD_VAR(   oid_wrpcPfilterStagedLength,get_p,        NO_SET,   ASN_INTEGER,   &pfilter_staged_len),
+	OID_FIELD_VAR(   oid_wrpcPfilterRxClass0,    get_p,        NO_SET,   ASN_COUNTER,   &minic.rx_class[0]),
+	OID_FIELD_VAR(   oid_wrpcPfilterRxClass1,    get_p,        NO_SET,   ASN_COUNTER,   &minic.rx_class[1]),
+	OID_FIELD_VAR(   oid_wrpcPfilterRxClass2,    get_p,        NO_SET,   ASN_COUNTER,   &minic.rx_class[2]),
+	OID_FIELD_VAR(   oid_wrpcPfilterRxClass3,    get_p,        NO_SET,   ASN_COUNTER,   &minic.rx_class[3]),
+	OID_FIELD_VAR(   oid_wrpcPfilterRxClass4,    get_p,        NO_SET,   ASN_COUNTER,   &minic.rx_class[4]),
+	OID_FIELD_VAR(   oid_wrpcPfilterRxClass5,    get_p,        NO_SET,   ASN_COUNTER,   &minic.rx_class[5]),
+	OID_FIELD_VAR(   oid_wrpcPfilterRxClass6,    get_p,        NO_SET,   ASN_COUNTER,   &minic.rx_class[6]),
+	OID_FIELD_VAR(   oid_wrpcPfilterRxClass7,    get_p,        NO_SET,   ASN_COUNTER,   &minic.rx_class[7]),
+	{ 0, }
+};
+#endif
+
 static struct snmp_oid oid_array_wrpcAuxRoTable[] = {
 	OID_FIELD_VAR(NULL, get_aux_diag, NO_SET, ASN_UNSIGNED, AUX_DIAG_RO),
 	{ 0, }
@@ -461,6 +563,12 @@ static struct snmp_oid_limb oid_limb_array[] = {
 	OID_LIMB_FIELD(oid_wrpcPtpConfigGroup,   func_group, oid_array_wrpcPtpConfigGroup),
 	OID_LIMB_FIELD(oid_wrpcPortGroup,        func_group, oid_array_wrpcPortGroup),
 	OID_LIMB_FIELD(oid_wrpcSfpTable,         func_table, oid_array_wrpcSfpTable),
+#ifdef CONFIG_LATENCY_PROBE
+	OID_LIMB_FIELD(oid_wrpcLatencyTable,     func_table, oid_array_wrpcLatencyTable),
+#endif
+#ifdef CONFIG_PFILTER_UPLOAD
+	OID_LIMB_FIELD(oid_wrpcPfilterGroup,     func_group, oid_array_wrpcPfilterGroup),
+#endif
 #ifdef CONFIG_SNMP_AUX_DIAG
 	OID_LIMB_FIELD(oid_wrpcAuxRoTable,       func_aux_diag, oid_array_wrpcAuxRoTable),
 	OID_LIMB_FIELD(oid_wrpcAuxRwTable,       func_aux_diag, oid_array_wrpcAuxRwTable),
@@ -1099,6 +1207,37 @@ static int get_sfp(uint8_t *buf, struct snmp_oid *obj)
 	return 0;
 }
 
+#ifdef CONFIG_LATENCY_PROBE
+static int get_latency(uint8_t *buf, struct snmp_oid *obj)
+{
+	struct latency_stats s;
+	uint32_t *p;
+	int row;
+	int col;
+
+	row = obj->oid_match[TABLE_ROW];
+	col = obj->oid_match[TABLE_COL];
+	snmp_verbose("%s: row%d, col%d\n", __func__, row, col);
+	if (!latency_get_stats(row - 1, &s))
+		return 0;
+
+	switch (col) {
+	case 2: p = &s.prio; break;
+	case 3: p = &s.n; break;
+	case 4: p = &s.lost; break;
+	case 5: p = &s.p50; break;
+	case 6: p = &s.p90; break;
+	case 7: p = &s.p99; break;
+	case 8: p = &s.p999; break;
+	case 9: p = &s.max; break;
+	case 10: p = &s.size; break;
+	case 11: p = &s.overflow; break;
+	default: return 0;
+	}
+	return get_value(buf, obj->asn, p);
+}
+#endif
+
 static int set_aux_diag(uint8_t *buf, struct snmp_oid *obj)
 {
 	return data_aux_diag(buf, obj, SNMP_SET);
@@ -1335,6 +1474,69 @@ static int set_ptp_config(uint8_t *buf, struct snmp_oid *obj)
 	return ret;
 }
 
+#ifdef CONFIG_PFILTER_UPLOAD
+static int set_pfilter_apply(uint8_t *buf, struct snmp_oid *obj)
+{
+	int ret;
+	int32_t *apply_mode;
+
+	apply_mode = obj->p;
+	ret = set_value(buf, obj, apply_mode);
+	if (ret <= 0)
+		return ret;
+	switch (*apply_mode) {
+	case pfilterApplyStaged:
+		if (pfilter_apply() < 0)
+			*apply_mode = applyFailedInvalid;
+		else
+			*apply_mode = applySuccessful;
+		break;
+	case pfilterSaveToFlash:
+		if (pfilter_save() < 0)
+			*apply_mode = applyFailed;
+		else
+			*apply_mode = applySuccessful;
+		break;
+	case pfilterEraseFlash:
+		if (pfilter_erase() < 0)
+			*apply_mode = applyFailed;
+		else
+			*apply_mode = applySuccessful;
+		break;
+	case pfilterUseBuiltin:
+		pfilter_use_builtin();
+		*apply_mode = applySuccessful;
+		break;
+	case pfilterClearStaged:
+		memset(pfilter_staged, 0, sizeof(pfilter_staged));
+		pfilter_staged_len = 0;
+		pfilter_word_index = 0;
+		*apply_mode = applySuccessful;
+		break;
+	default:
+		*apply_mode = applyFailed;
+	}
+	return ret;
+}
+
+/* Store a word of the staged rule-set, and move to the next one */
+static int set_pfilter_word(uint8_t *buf, struct snmp_oid *obj)
+{
+	int ret, i = pfilter_word_index;
+
+	if (i < 0 || i >= PFILTER_MAX_WORDS)
+		return -SNMP_ERR_BADVALUE;
+	ret = set_value(buf, obj, obj->p);
+	if (ret <= 0)
+		return ret;
+	pfilter_staged[i] = pfilter_word;
+	if (pfilter_staged_len < i + 1)
+		pfilter_staged_len = i + 1;
+	pfilter_word_index = i + 1;
+	return ret;
+}
+#endif
+
 /*
  * Perverse...  snmpwalk does getnext anyways.
  *
@@ -1502,6 +1704,10 @@ static int snmp_respond(uint8_t *buf)
 		set_pp(NULL, NULL);
 		set_ptp_config(NULL, NULL);
 		set_ptp_restart(NULL, NULL);
+#ifdef CONFIG_PFILTER_UPLOAD
+		set_pfilter_apply(NULL, NULL);
+		set_pfilter_word(NULL, NULL);
+#endif
 		set_aux_diag(NULL, NULL);
 		func_aux_diag(NULL, 0, NULL, 0);
 		oid_array_wrpcAuxRwTable[0].oid_len = 0;
@@ -1682,4 +1888,5 @@ DEFINE_WRC_TASK(snmp) = {
 	.enable = &link_status,
 	.init = snmp_init,
 	.job = snmp_poll,
+	.flags = WRC_TASK_LATE_INIT,
 };
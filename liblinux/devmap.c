@@ -98,6 +98,7 @@ struct mapping_desc *dev_map(struct mapping_args *map_args, uint32_t map_length)
 			return NULL;
 		}
 		desc->is_be = 1; /* VME Bus is big endian */
+		desc->snap_width = 4; /* single cycles, no D64 */
 		desc->args = map_args;
 		return desc;
 	}
@@ -127,6 +128,8 @@ struct mapping_desc *dev_map(struct mapping_args *map_args, uint32_t map_length)
 	 * the endianess (could be get from the path's resource)
 	 */
 	desc->is_be = 0; /* default set to little endian */
+	desc->snap_width = 8; /* one 2-dword TLP on PCIe */
+	desc->args = map_args;
 	return desc;
 
 out_mmap:
@@ -159,6 +162,50 @@ void dev_unmap(struct mapping_desc *desc)
 	free(desc);
 }
 
+/**
+ * It copies a window of registers (or device memory) into host memory,
+ * with the widest aligned reads the mapping allows (snap_width), so a
+ * refresh costs a few bus round trips instead of one per register. The
+ * 32-bit words are then converted to host byte order in the copy.
+ * Don't use it on registers with read side effects (e.g. FIFOs).
+ * @param[in] desc descriptor token from dev_map()
+ * @param[in] offset start of the window from desc->base, 4-byte aligned
+ * @param[in] len length of the window in bytes, a multiple of 4
+ * @param[out] buf destination, 4-byte aligned
+ *
+ * @return the number of bus reads, or -1 and errno set to EINVAL
+ */
+int dev_snapshot(struct mapping_desc *desc, uint32_t offset, uint32_t len,
+		 void *buf)
+{
+	volatile void *src = desc->base + offset;
+	uint32_t *dst = buf;
+	uint64_t val64;
+	uint32_t val32, pos, i;
+	int n = 0;
+
+	if ((offset | len | (uintptr_t)buf) & 3) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (pos = 0; pos < len; n++) {
+		if (desc->snap_width == 8 && len - pos >= 8
+		    && !((uintptr_t)(src + pos) & 7)) {
+			val64 = *(volatile uint64_t *)(src + pos);
+			memcpy(buf + pos, &val64, 8);
+			pos += 8;
+		} else {
+			val32 = *(volatile uint32_t *)(src + pos);
+			memcpy(buf + pos, &val32, 4);
+			pos += 4;
+		}
+	}
+	/* the copy has the layout of the device: swap words in place */
+	for (i = 0; i < len / 4; i++)
+		dst[i] = iomemr32(desc->is_be, dst[i]);
+	return n;
+}
+
 
 #ifdef SUPPORT_CERN_VMEBRIDGE
 
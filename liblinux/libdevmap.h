@@ -24,6 +24,7 @@ struct mapping_desc {
 	int map_pa_length; /* mapped length is page aligned */
 	volatile void *base; /* address of the concerned memory region */
 	int is_be; /* tells the device endianess */
+	int snap_width; /* widest read of dev_snapshot(), in bytes (4 or 8) */
 	struct mapping_args *args;
 };
 
@@ -34,6 +35,8 @@ struct mapping_desc {
 extern struct mapping_desc *dev_map(struct mapping_args *map_args,
 				    uint32_t map_length);
 extern void dev_unmap(struct mapping_desc *dev);
+extern int dev_snapshot(struct mapping_desc *dev, uint32_t offset,
+			uint32_t len, void *buf);
 extern struct mapping_args *dev_parse_mapping_args(int argc, char *argv[]);
 extern const char * const dev_mapping_help();
 extern const char * const dev_get_version();
@@ -24,6 +24,8 @@
 #include "lib/ipv4.h"
 #include "shell.h"
 #include "revision.h"
+#include "wrc_diags.h"
+#include "pp-decimal.h"
 
 #define WRC_DIAG_REFRESH_PERIOD (1 * TICS_PER_SECOND)
 
@@ -33,27 +35,21 @@ struct pp_instance *ppi = &ppi_static;
 const char *ptp_unknown_str= "unknown";
 
 static void wrc_mon_std_servo(void);
-int wrc_wr_diags(void);
 
-#define PRINT64_FACTOR	1000000000LL
+/* No __div64_32 and no sprintf: the digits come from pp-decimal.h */
 static char* print64(uint64_t x, int align)
 {
-	uint32_t h_half, l_half;
+	char tmp[20], *p;
 	static char buf[2*10+1];	//2x 32-bit value + \0
-
-	if (x < PRINT64_FACTOR)
-		if (align)
-			sprintf(buf, "%20u", (uint32_t)x);
-		else
-			sprintf(buf, "%u", (uint32_t)x);
-	else {
-		l_half = __div64_32(&x, PRINT64_FACTOR);
-		h_half = (uint32_t) x;
-		if (align)
-			sprintf(buf, "%11u%09u", h_half, l_half);
-		else
-			sprintf(buf, "%u%09u", h_half, l_half);
-	}
+	int i = 0;
+
+	p = pp_u64dec(tmp, x);
+	if (align)
+		while (i < (int)sizeof(tmp) - (p - tmp))
+			buf[i++] = ' ';
+	while (p > tmp)
+		buf[i++] = *--p;
+	buf[i] = '\0';
 	return buf;
 }
 
@@ -392,8 +388,40 @@ DEFINE_WRC_TASK(stats) = {
 	.job = wrc_log_stats,
 };
 
+#ifdef CONFIG_WR_DIAG
+struct wrc_diags_shm wrc_diags = {
+	.ver = WRC_DIAGS_SHM_VER,
+};
+
+/* The registers, unless the host holds a snapshot of valid data */
+static void wrc_diags_write_regs(struct wrc_diags_shm *d, int slave)
+{
+	if (wdiag_get_valid() && wdiag_get_snapshot())
+		return;
+
+	/* ***************** lock data from reading by user **************** */
+	wdiag_set_valid(0);
+	wdiags_write_cnts(d->txfcnt, d->rxfcnt);
+	wdiags_write_time((uint64_t)d->sec_msb << 32 | d->sec_lsb, d->ns);
+	wdiags_write_port_state(d->pstat & SYSC_WDIAG_PSTAT_LINK,
+				d->pstat & SYSC_WDIAG_PSTAT_LOCKED);
+	wdiags_write_ptp_state(SYSC_WDIAG_PTPSTAT_PTPSTATE_R(d->ptpstat));
+	if (slave)
+		wdiags_write_servo_state(
+			d->sstat & SYSC_WDIAG_SSTAT_WR_MODE,
+			SYSC_WDIAG_SSTAT_SERVOSTATE_R(d->sstat),
+			(uint64_t)d->mu_msb << 32 | d->mu_lsb,
+			(uint64_t)d->dms_msb << 32 | d->dms_lsb,
+			d->asym, d->cko, d->setp, d->ucnt);
+	wdiags_write_aux_state(SYSC_WDIAG_ASTAT_AUX_R(d->astat));
+	wdiags_write_temp(d->temp);
+	/* **************** unlock data from reading by user  ************** */
+	wdiag_set_valid(1);
+}
+
 int wrc_wr_diags(void)
 {
+	struct wrc_diags_shm *d = &wrc_diags;
 	struct hal_port_state ps;
 	static uint32_t last_jiffies;
 	int tx, rx;
@@ -401,38 +429,44 @@ int wrc_wr_diags(void)
 	uint32_t nsec;
 	int n_out;
 	uint32_t aux_stat=0;
-	int temp=0, valid=0, snapshot=0,i;
-
-	valid    = wdiag_get_valid();
-	snapshot = wdiag_get_snapshot();
-
-	/* if the data is snapshot and there is already valid data, do not
-	 * refresh */
-	if(valid & snapshot)
-	      return 0;
+	int temp=0, i;
 
-	/* ***************** lock data from reading by user **************** */
 	if (!last_jiffies)
 		last_jiffies = timer_get_tics() - 1 -  WRC_DIAG_REFRESH_PERIOD;
 	/* stats update condition */
 	if (time_before(timer_get_tics(), last_jiffies + WRC_DIAG_REFRESH_PERIOD))
 		return 0;
 	last_jiffies = timer_get_tics();
-	
-	/* ***************** lock data from reading by user **************** */
-	wdiag_set_valid(0);
-	
-	/* frame statistics */
+
+	/* collect first, so the sequence stays odd for a few stores only */
 	minic_get_stats(&tx, &rx);
-	wdiags_write_cnts(tx,rx);
+	shw_pps_gen_get_time(&sec, &nsec);
+	wrpc_get_port_state(&ps, NULL);
+
+	/* auxiliar channels (if any) */
+	spll_get_num_channels(NULL, &n_out);
+	if (n_out > 8) n_out = 8; /* hardware limit. */
+	for(i = 0; i < n_out; i++) {
+		aux_stat |= (0x1 & spll_get_aux_status(i)) << i;
+	}
+	temp = wrc_temp_get("pcb");
+
+	/* ************ begin update: readers retry, see wrc_diags.h ******* */
+	d->sequence++;
+	barrier();
+
+	/* frame statistics */
+	d->txfcnt = tx;
+	d->rxfcnt = rx;
 
 	/* local time */
-	shw_pps_gen_get_time(&sec, &nsec);
-	wdiags_write_time(sec, nsec);
-	
+	d->sec_msb = sec >> 32;
+	d->sec_lsb = sec;
+	d->ns = nsec;
+
 	/* port state (from hal) */
-	wrpc_get_port_state(&ps, NULL);
-	wdiags_write_port_state((ps.state  ? 1 : 0), (ps.locked ? 1 : 0));
+	d->pstat = (ps.state ? SYSC_WDIAG_PSTAT_LINK : 0)
+		| (ps.locked ? SYSC_WDIAG_PSTAT_LOCKED : 0);
 
 	/* port PTP State (from ppsi)
 	* see:
@@ -457,15 +491,12 @@ int wrc_wr_diags(void)
 	106: WRS_RESP_CALIB_REQ
 	107: WRS_WR_LINK_ON
 	*/
-	wdiags_write_ptp_state((uint8_t )ppi->state);
+	d->ptpstat = SYSC_WDIAG_PTPSTAT_PTPSTATE_W((uint8_t)ppi->state);
 
 	/* servo state (if slave)s */
 	if(ptp_mode == WRC_MODE_SLAVE){
 		struct wr_servo_state *ss =
 			&((struct wr_data *)ppi->ext_data)->servo_state;
-		int32_t asym   = (int32_t)(ss->picos_mu-2LL * ss->delta_ms);
-		int wr_mode    = (ss->flags & WR_FLAG_VALID) ? 1 : 0;
-		int servostate =  ss->state;
 		/* see ppsi/proto-ext-whiterabbit/wr-constants.c:
 		0: WR_UNINITIALIZED = 0,
 		1: WR_SYNC_NSEC,
@@ -473,31 +504,32 @@ int wrc_wr_diags(void)
 		3: WR_SYNC_PHASE,
 		4: WR_TRACK_PHASE,
 		5: WR_WAIT_OFFSET_STABLE */
-		
-		wdiags_write_servo_state(wr_mode, servostate, ss->picos_mu,
-					 ss->delta_ms, asym, ss->offset,
-					 ss->cur_setpoint,ss->update_count);
+		d->sstat = ((ss->flags & WR_FLAG_VALID) ?
+			    SYSC_WDIAG_SSTAT_WR_MODE : 0)
+			| SYSC_WDIAG_SSTAT_SERVOSTATE_W(ss->state);
+		d->mu_msb = (uint64_t)ss->picos_mu >> 32;
+		d->mu_lsb = ss->picos_mu;
+		d->dms_msb = (uint64_t)ss->delta_ms >> 32;
+		d->dms_lsb = ss->delta_ms;
+		d->asym = (int32_t)(ss->picos_mu-2LL * ss->delta_ms);
+		d->cko = ss->offset;
+		d->setp = ss->cur_setpoint;
+		d->ucnt = ss->update_count;
 	}
-	
-	/* auxiliar channels (if any) */
-	spll_get_num_channels(NULL, &n_out);
-	if (n_out > 8) n_out = 8; /* hardware limit. */
-	for(i = 0; i < n_out; i++) {
-		aux_stat |= (0x1 & spll_get_aux_status(i)) << i;
-	}
-	wdiags_write_aux_state(aux_stat);
-	
+
+	d->astat = SYSC_WDIAG_ASTAT_AUX_W(aux_stat);
+
 	/* temperature */
-	temp = wrc_temp_get("pcb");
-	wdiags_write_temp(temp);
+	d->temp = temp;
 
-	/* **************** unlock data from reading by user  ************** */
-	wdiag_set_valid(1);
-	
+	barrier();
+	d->sequence++;
+	/* ************************** end update *************************** */
+
+	wrc_diags_write_regs(d, ptp_mode == WRC_MODE_SLAVE);
 	return 1;
 }
 
-#ifdef CONFIG_WR_DIAG
 DEFINE_WRC_TASK(diags) = {
 	.name = "diags",
 	.job = wrc_wr_diags,
@@ -0,0 +1,241 @@
+/*
+ * Host check and benchmark of the vsprintf flavours (not built by default)
+ *
+ *    make bench-printf && ./bench-printf [<iterations>]
+ *
+ * The Makefile builds full, xint and mini in the same program, renaming
+ * pp_vsprintf. First, random numbers and formats are printed by each
+ * flavour and compared to what the libc prints (full), or to what the
+ * flavour is documented to print (xint, mini). Then the time of a
+ * "stats"-like line of ~25 fields is measured for each flavour.
+ *
+ * The timing is for the host: on a CPU with no divider (like the lm32)
+ * the division-free conversion is a bigger win.
+ *
+ * public domain
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+extern int pp_vsprintf_full(char *buf, const char *fmt, va_list args);
+extern int pp_vsprintf_xint(char *buf, const char *fmt, va_list args);
+extern int pp_vsprintf_mini(char *buf, const char *fmt, va_list args);
+
+static int (*flavour)(char *buf, const char *fmt, va_list args);
+
+static int pp_sprintf(char *s, const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	ret = flavour(s, fmt, args);
+	va_end(args);
+	return ret;
+}
+
+static int errors;
+
+static void compare(const char *fmt, const char *got, const char *want)
+{
+	if (!strcmp(got, want))
+		return;
+	if (errors++ < 20)
+		printf("  \"%s\": got \"%s\", want \"%s\"\n", fmt, got, want);
+}
+
+/* Values of all sizes, with more of the interesting ones */
+static uint64_t random_value(void)
+{
+	uint64_t v;
+
+	v = (uint64_t)random() << 33 ^ (uint64_t)random() << 11 ^ random();
+	switch (random() % 4) {
+	case 0:
+		return v >> (random() % 64);
+	case 1: /* around a power of 10 */
+		for (v = 1; random() % 20; v *= 10)
+			if (v > UINT64_MAX / 10)
+				break;
+		return v + random() % 3 - 1;
+	default:
+		return v;
+	}
+}
+
+/*
+ * The full flavour, against the libc. The kernel-derived code is known
+ * to differ for "#" with 0 or octal, for "0" with a precision, and for
+ * a precision of 0 with a value of 0: these are not generated.
+ */
+static void check_full(int n)
+{
+	static const char *quals[] = {"", "h", "l", "ll"};
+	char fmt[32], got[128], want[128], *f;
+	uint64_t v, tv;
+	int i, conv, qual, width, prec;
+
+	flavour = pp_vsprintf_full;
+	for (i = 0; i < n; i++) {
+		v = random_value();
+		conv = "diuxXo"[random() % 6];
+		qual = random() % 4;
+#ifndef CONFIG_PRINTF_64BIT
+		if (qual == 3)
+			qual = 2; /* "ll" is not parsed */
+#endif
+		/* the value as printed, for the cases we avoid */
+		if (qual == 0)
+			tv = (unsigned int)v;
+		else if (qual == 1)
+			tv = (unsigned short)v;
+		else
+			tv = v;
+		width = random() % 3 ? -1 : random() % 25;
+		prec = random() % 3 ? -1 : random() % 25;
+		f = fmt;
+		*f++ = '%';
+		if (random() % 4 == 0)
+			*f++ = '-';
+		if (random() % 4 == 0)
+			*f++ = '+';
+		if (random() % 4 == 0)
+			*f++ = ' ';
+		if (random() % 4 == 0 && tv && conv != 'o')
+			*f++ = '#';
+		if (random() % 2 == 0 && prec < 0)
+			*f++ = '0';
+		if (width >= 0)
+			f += sprintf(f, "%i", width);
+		if (prec == 0 && !tv)
+			prec = 1;
+		if (prec >= 0)
+			f += sprintf(f, ".%i", prec);
+		f += sprintf(f, "%s%c", quals[qual], conv);
+
+		switch (qual) {
+		case 0:
+			pp_sprintf(got, fmt, (int)v);
+			sprintf(want, fmt, (int)v);
+			break;
+		case 1:
+			pp_sprintf(got, fmt, (int)v);
+			sprintf(want, fmt, (int)v);
+			break;
+		case 2:
+			pp_sprintf(got, fmt, (long)v);
+			sprintf(want, fmt, (long)v);
+			break;
+		case 3:
+			pp_sprintf(got, fmt, (long long)v);
+			sprintf(want, fmt, (long long)v);
+			break;
+		}
+		compare(fmt, got, want);
+	}
+	pp_sprintf(got, "%c%-4c%s %5s %.3s", 'a', 'b', "foo", "bar", "verylong");
+	compare("strings", got, "ab   foo   bar ver");
+}
+
+/* xint: "0" and a width, d, i, x and o (u is the same as i) */
+static void check_xint(int n)
+{
+	char fmt[16], got[64], want[64];
+	int i, v;
+
+	flavour = pp_vsprintf_xint;
+	for (i = 0; i < n; i++) {
+		v = random_value();
+		sprintf(fmt, "%%%s%i%c", random() % 2 ? "0" : "",
+			(int)(random() % 15), "dixo"[random() % 4]);
+		pp_sprintf(got, fmt, v);
+		sprintf(want, fmt, v);
+		compare(fmt, got, want);
+	}
+	pp_sprintf(got, "%c %s %i", 'a', "foo", 0);
+	compare("strings", got, "a foo 0");
+}
+
+/* mini: all integers are "<%08x>" */
+static void check_mini(int n)
+{
+	char got[64], want[64];
+	int i, v;
+
+	flavour = pp_vsprintf_mini;
+	for (i = 0; i < n; i++) {
+		v = random_value();
+		pp_sprintf(got, "%5i", v);
+		sprintf(want, "<%08x>", v);
+		compare("%5i", got, want);
+	}
+}
+
+/* Like the "stat" line of the wrpc monitor */
+static int stats_line(char *buf, int i)
+{
+	return pp_sprintf(buf, "lnk:%d rx:%d tx:%d lock:%d ptp:%s sv:%d "
+		"ss:'%s' aux0:%x sec:%d nsec:%d mu:%u dms:%u dtxm:%d drxm:%d "
+		"dtxs:%d drxs:%d asym:%d crtt:%u cko:%d setp:%d ucnt:%d "
+		"hd:%d md:%d ad:%d temp: %d.%04d C",
+		1, 123456 + i, 234567 + i, 1, "slave", 1, "TRACK_PHASE",
+		0x3, 1700000000 + i, 123456789 - i, 1234567 + i, 617283 + i,
+		231000, 220000, 228000, 214000, -12 + i % 25, 1145567 + i,
+		-i % 20, 12345 + i, 3400 + i, 32768 - i % 100, 31000 + i % 33,
+		30000, 45, 4375);
+}
+
+/* The best of a few rounds, as the host is not idle */
+static void bench(const char *name, int n)
+{
+	struct timespec t0, t1;
+	char buf[512];
+	double ns, best = 0;
+	int i, round, len = 0;
+
+	for (round = 0; round < 5; round++) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (i = 0, len = 0; i < n; i++)
+			len += stats_line(buf, i);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+		if (!round || ns < best)
+			best = ns;
+	}
+	printf("  %-6s %8.1f ns per line, %3i bytes\n", name, best / n,
+	       len / n);
+}
+
+static int libc_vsprintf(char *buf, const char *fmt, va_list args)
+{
+	return vsprintf(buf, fmt, args);
+}
+
+int main(int argc, char **argv)
+{
+	int n = 100000;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+	srandom(1);
+	printf("checking %i random prints per flavour\n", n);
+	check_full(n);
+	check_xint(n);
+	check_mini(n);
+	printf("  %i errors\n", errors);
+
+	printf("stats line, %i times\n", n);
+	flavour = pp_vsprintf_full;
+	bench("full", n);
+	flavour = pp_vsprintf_xint;
+	bench("xint", n);
+	flavour = pp_vsprintf_mini;
+	bench("mini", n);
+	flavour = libc_vsprintf;
+	bench("libc", n);
+	return errors != 0;
+}
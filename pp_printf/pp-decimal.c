@@ -0,0 +1,13 @@
+/*
+ * The digit pairs of pp-decimal.h: one copy, whoever includes the header
+ *
+ * public domain
+ */
+#include <pp-decimal.h>
+
+const char pp_digit_pairs[200] =
+	"00010203040506070809" "10111213141516171819"
+	"20212223242526272829" "30313233343536373839"
+	"40414243444546474849" "50515253545556575859"
+	"60616263646566676869" "70717273747576777879"
+	"80818283848586878889" "90919293949596979899";
@@ -0,0 +1,86 @@
+/*
+ * Decimal conversion without division, for vsprintf-full and vsprintf-xint
+ *
+ * Many small CPUs (like the lm32, as built for wrpc) have a multiplier
+ * but no divider, so "value % 10" and "value / 10" are library calls
+ * that loop over the bits, and __div64_32 is even slower. Here the
+ * division by 100 is made of shifts and adds, and two digits at a
+ * time come from a table.
+ *
+ * Digits are written from the least significant one, like the "tmp"
+ * buffer in vsprintf-full; the functions return the end of them.
+ *
+ * public domain
+ */
+#ifndef __PP_DECIMAL_H__
+#define __PP_DECIMAL_H__
+
+#include <stdint.h>
+
+/* "00" to "99", in pp-decimal.c */
+extern const char pp_digit_pairs[200];
+
+/* n / 100 for any 32-bit n (Hacker's Delight, divu100) */
+static inline uint32_t pp_divu100(uint32_t n)
+{
+	uint32_t q, r;
+
+	q = (n >> 1) + (n >> 3) + (n >> 6) - (n >> 10)
+		+ (n >> 12) + (n >> 13) - (n >> 16);
+	q = q + (q >> 20);
+	q = q >> 6;
+	r = n - q * 100;
+	return q + ((r + 28) >> 7);
+}
+
+static inline char *pp_u32dec(char *s, uint32_t v)
+{
+	uint32_t q;
+	const char *d;
+
+	while (v >= 100) {
+		q = pp_divu100(v);
+		d = pp_digit_pairs + 2 * (v - q * 100);
+		*s++ = d[1];
+		*s++ = d[0];
+		v = q;
+	}
+	d = pp_digit_pairs + 2 * v;
+	*s++ = d[1];
+	if (v >= 10)
+		*s++ = d[0];
+	return s;
+}
+
+/*
+ * For 64 bits, divide by 100 in 16-bit pieces, as done by hand: the
+ * partial dividend (remainder << 16 | piece) fits 32 bits. Once the
+ * high half is 0, go on with the 32-bit code.
+ */
+static inline char *pp_u64dec(char *s, uint64_t v)
+{
+	uint32_t h[4], hi = v >> 32, lo = v, r, q;
+	const char *d;
+	int i;
+
+	while (hi) {
+		h[0] = hi >> 16;
+		h[1] = hi & 0xffff;
+		h[2] = lo >> 16;
+		h[3] = lo & 0xffff;
+		for (i = 0, r = 0; i < 4; i++) {
+			h[i] |= r << 16;
+			q = pp_divu100(h[i]);
+			r = h[i] - q * 100;
+			h[i] = q;
+		}
+		d = pp_digit_pairs + 2 * r;
+		*s++ = d[1];
+		*s++ = d[0];
+		hi = h[0] << 16 | h[1];
+		lo = h[2] << 16 | h[3];
+	}
+	return pp_u32dec(s, lo);
+}
+
+#endif /* __PP_DECIMAL_H__ */
@@ -2,6 +2,7 @@
 # The Makefile in this directory is preserved from the upstream version
 
 obj-y += pp_printf/printf.o
+obj-y += pp_printf/pp-decimal.o
 
 ppprintf-$(CONFIG_PRINTF_FULL) += pp_printf/vsprintf-full.o
 ppprintf-$(CONFIG_PRINTF_MINI) += pp_printf/vsprintf-mini.o
@@ -17,6 +17,7 @@
 
 /* BEGIN OF HACKS */
 #include <pp-printf.h>
+#include <pp-decimal.h>
 
 /* <linux/types.h> -- but if we typedef we get redefined type when hosted */
 #define u8		uint8_t
@@ -26,45 +27,19 @@
 #define noinline __attribute__((noinline))
 
 /*
- * We now have optional 64-bit support. It depends on __div64_32.
- * The suggested implementaion is the one by Bernardo Innocenti, found
- * in asm-generic in the kernel -- ARub
+ * We now have optional 64-bit support. It used to depend on __div64_32,
+ * but decimal conversion is now division-free: see pp-decimal.h
  */
 #ifdef CONFIG_PRINTF_64BIT
 
 #define NUMBER_TYPE uint64_t
 #define SIGNED_NUMBER_TYPE int64_t
-extern uint32_t __div64_32(uint64_t *n, uint32_t base);
 
-/* The unnecessary pointer compare is there
- * to check for type safety (n must be 64bit)
- */
-#define do_div(n,base) ({				\
-	uint32_t __base = (base);			\
-	uint32_t __rem;					\
-	(void)(((typeof((n)) *)0) == ((uint64_t *)0));	\
-	if (((n) >> 32) == 0) {				\
-		__rem = (uint32_t)(n) % __base;		\
-		(n) = (uint32_t)(n) / __base;		\
-	} else						\
-		__rem = __div64_32(&(n), __base);	\
-	__rem;						\
- })
-
-#else /* 32 bits (or native 64 bits): a reduced version of above */
+#else /* 32 bits (or native 64 bits) */
 
 #define NUMBER_TYPE unsigned long
 #define SIGNED_NUMBER_TYPE signed long
 
-#define do_div(n,base) ({				\
-	uint32_t __base = (base);			\
-	uint32_t __rem;					\
-	(void)(((typeof((n)) *)0) == ((unsigned long *)0)); \
-	__rem = (n) % __base;				\
-	(n) = (n) / __base;				\
-	__rem;						\
- })
-
 #endif /* CONFIG_PRINTF_64BIT */
 
 /* END OF HACKS */
@@ -110,7 +85,7 @@ static char *number(char *buf, NUMBER_TYPE num, int base, int size, int precisio
 	char sign;
 	char locase;
 	int need_pfx = ((type & SPECIAL) && base != 10);
-	int i;
+	int i, shift;
 
 	/* locase = 0 or 0x20. ORing digits or letters with 'locase'
 	 * produces same digits or (maybe lowercased) letters */
@@ -137,14 +112,20 @@ static char *number(char *buf, NUMBER_TYPE num, int base, int size, int precisio
 			size--;
 	}
 
-	/* generate full string in tmp[], in reverse order */
-	i = 0;
-	if (num == 0)
-		tmp[i++] = '0';
-	/* Generic code, for any base: */
-	else do {
-		tmp[i++] = (digits[do_div(num,base)] | locase);
-	} while (num != 0);
+	/* generate full string in tmp[], in reverse order, with no division */
+	if (base == 10) {
+		if (sizeof(num) > sizeof(uint32_t))
+			i = pp_u64dec(tmp, num) - tmp;
+		else
+			i = pp_u32dec(tmp, num) - tmp;
+	} else {
+		shift = (base == 16 ? 4 : 3);
+		i = 0;
+		do {
+			tmp[i++] = (digits[num & ((1 << shift) - 1)] | locase);
+			num >>= shift;
+		} while (num != 0);
+	}
 
 	/* printing 100 using %2d gives "100", not "00" */
 	if (i > precision)
@@ -5,39 +5,45 @@
  */
 #include <stdarg.h>
 #include <stdint.h>
+#include <pp-decimal.h>
 
 static const char hex[] = "0123456789abcdef";
 
 static int number(char *out, unsigned value, int base, int lead, int wid)
 {
-	char tmp[16];
-	int i = 16, ret, negative = 0;
+	char tmp[16], *p = tmp;
+	int ret, negative = 0, shift = (base == 16 ? 4 : 3);
 
 	if (wid == 0)
 		wid = 1;
+	if (wid > (int)sizeof(tmp))
+		wid = sizeof(tmp);
 
 	/* No error checking at all: it is as ugly as possible */
 	if ((signed)value < 0 && base == 10) {
 		negative = 1;
 		value = -value;
 	}
-	while (value && i) {
-		tmp[--i] = hex[value % base];
-		value /= base;
+	/* digits in reverse order; no division, it's slow on small CPUs */
+	if (base == 10) {
+		p = pp_u32dec(tmp, value);
+	} else {
+		do {
+			*p++ = hex[value & ((1 << shift) - 1)];
+			value >>= shift;
+		} while (value);
 	}
-	if (i == 16)
-		tmp[--i] = '0';
 	if (negative && lead == ' ') {
-		tmp[--i] = '-';
+		*p++ = '-';
 		negative = 0;
 	}
-	while (i > 16 - wid + negative)
-		tmp[--i] = lead;
+	while (p - tmp < wid - negative)
+		*p++ = lead;
 	if (negative)
-		tmp[--i] = '-';
-	ret = 16 - i;
-	while (i < 16)
-		*(out++) = tmp[i++];
+		*p++ = '-';
+	ret = p - tmp;
+	while (p > tmp)
+		*(out++) = *--p;
 	return ret;
 }
 
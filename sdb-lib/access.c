@@ -15,6 +15,10 @@ int sdbfs_fstat(struct sdbfs *fs, struct sdb_device *record_return)
 {
 	if (!fs->currentp)
 		return -ENOENT;
+	if (fs->f_record) { /* opened through the index */
+		fs->currentp = sdbfs_readentry(fs, fs->f_record);
+		fs->f_record = 0;
+	}
 	memcpy(record_return, fs->currentp, sizeof(*record_return));
 	return 0;
 }
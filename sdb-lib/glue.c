@@ -33,6 +33,7 @@ int sdbfs_dev_create(struct sdbfs *fs)
 		return -ENOTDIR;
 	}
 
+	sdbfs_index_invalidate(fs);
 	fs->next = sdbfs_list;
 	sdbfs_list = fs;
 
@@ -67,13 +68,13 @@ struct sdbfs *sdbfs_dev_find(const char *name)
  * function is also exported in order for "sdb-ls" to use it
  */
 
-static struct sdb_device *sdbfs_readentry(struct sdbfs *fs,
-					  unsigned long offset)
+struct sdb_device *sdbfs_readentry(struct sdbfs *fs, unsigned long offset)
 {
 	/*
 	 * This function reads an entry from a known good offset. It
 	 * returns the pointer to the entry, which may be stored in
 	 * the fs structure itself. Only touches fs->current_record.
+	 * It is exported for sdbfs_fstat() after an indexed open.
 	 */
 	if (fs->data || (fs->flags & SDBFS_F_ZEROBASED)) {
 		if (!(fs->flags & SDBFS_F_CONVERT32))
@@ -105,6 +106,7 @@ static struct sdb_device *scan_newdir(struct sdbfs *fs, int depth)
 	struct sdb_device *dev;
 	struct sdb_interconnect *intercon;
 
+	fs->r_offset = fs->this[depth];
 	dev = fs->currentp = sdbfs_readentry(fs, fs->this[depth]);
 	if (dev->sdb_component.product.record_type != sdb_type_interconnect)
 		return NULL;
@@ -172,6 +174,7 @@ scan:
 	}
 
 	/* so, read the next entry */
+	fs->r_offset = fs->this[depth];
 	dev = fs->currentp = sdbfs_readentry(fs, fs->this[depth]);
 	fs->this[depth] += sizeof(*dev);
 	fs->nleft[depth]--;
@@ -188,15 +191,93 @@ static void __open(struct sdbfs *fs)
 	fs->f_len = htonll(fs->currentp->sdb_component.addr_last)
 		+ 1 - htonll(fs->currentp->sdb_component.addr_first);
 	fs->read_offset = 0;
+	fs->f_record = 0;
+}
+
+/*
+ * The index is built at the first open, with a full scan, and is valid
+ * until sdbfs_index_invalidate(). The caller must invalidate it when
+ * the directory is rewritten, while writing files is fine.
+ */
+void sdbfs_index_invalidate(struct sdbfs *fs)
+{
+	fs->flags &= ~(SDBFS_F_INDEXED | SDBFS_F_INDEXFULL);
+	fs->index_count = 0;
+}
+
+static void sdbfs_index_build(struct sdbfs *fs)
+{
+	struct sdbfs_index *i;
+	struct sdb_device *d;
+
+	sdbfs_index_invalidate(fs);
+	fs->flags |= SDBFS_F_INDEXED;
+	if (!sdbfs_scan(fs, 1))
+		return; /* no directory: an empty index is right */
+	while ( (d = sdbfs_scan(fs, 0)) != NULL) {
+		if (fs->index_count == fs->index_size) {
+			/* a miss in the index will need a scan */
+			fs->flags |= SDBFS_F_INDEXFULL;
+			break;
+		}
+		i = fs->index + fs->index_count++;
+		i->vid = d->sdb_component.product.vendor_id;
+		i->did = d->sdb_component.product.device_id;
+		memcpy(i->name, d->sdb_component.product.name,
+		       sizeof(i->name));
+		i->record = fs->r_offset;
+		__open(fs);
+		i->f_offset = fs->f_offset;
+		i->f_len = fs->f_len;
+	}
+	fs->currentp = NULL;
+}
+
+/*
+ * Open by id or (if name is not NULL) by name, without reading the
+ * storage. Returns 0 or -ENOENT, or 1 if the caller must scan.
+ */
+static int sdbfs_index_open(struct sdbfs *fs, uint64_t vid, uint32_t did,
+			    const char *name, int len)
+{
+	struct sdbfs_index *i;
+	int n;
+
+	if (!fs->index)
+		return 1;
+	if (!(fs->flags & SDBFS_F_INDEXED))
+		sdbfs_index_build(fs);
+	for (n = 0, i = fs->index; n < fs->index_count; n++, i++) {
+		if (name) {
+			if (strncmp(name, i->name, len))
+				continue;
+			if (len < 19 && i->name[len] != ' ')
+				continue;
+		} else if (vid != i->vid || did != i->did) {
+			continue;
+		}
+		/* the record itself is only read by sdbfs_fstat() */
+		fs->currentp = &fs->current_record;
+		fs->f_record = i->record;
+		fs->f_offset = i->f_offset;
+		fs->f_len = i->f_len;
+		fs->read_offset = 0;
+		return 0;
+	}
+	return fs->flags & SDBFS_F_INDEXFULL ? 1 : -ENOENT;
 }
 
 int sdbfs_open_name(struct sdbfs *fs, const char *name)
 {
 	struct sdb_device *d;
 	int len = strlen(name);
+	int ret;
 
 	if (len > 19)
 		return -ENOENT;
+	ret = sdbfs_index_open(fs, 0, 0, name, len);
+	if (ret <= 0)
+		return ret;
 	sdbfs_scan(fs, 1); /* new scan: get the interconnect and igore it */
 	while ( (d = sdbfs_scan(fs, 0)) != NULL) {
 		if (strncmp(name, d->sdb_component.product.name, len))
@@ -213,7 +294,11 @@ int sdbfs_open_name(struct sdbfs *fs, const char *name)
 int sdbfs_open_id(struct sdbfs *fs, uint64_t vid, uint32_t did)
 {
 	struct sdb_device *d;
+	int ret;
 
+	ret = sdbfs_index_open(fs, vid, did, NULL, 0);
+	if (ret <= 0)
+		return ret;
 	sdbfs_scan(fs, 1); /* new scan: get the interconnect and igore it */
 	while ( (d = sdbfs_scan(fs, 0)) != NULL) {
 		if (vid != d->sdb_component.product.vendor_id)
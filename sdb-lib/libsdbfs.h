@@ -13,6 +13,21 @@
 #include <sdb.h> /* Please point your "-I" to some sensible place */
 
 #define SDBFS_DEPTH 4 /* Max number of subdirectory depth */
+
+/*
+ * Optional directory index: if the caller provides the array, the
+ * first open scans the whole tree and remembers where each file is,
+ * so later opens by id or name don't read the storage at all.
+ */
+struct sdbfs_index {
+	uint64_t vid;
+	uint32_t did;
+	char name[19];			/* space-padded, as in the record */
+	unsigned long record;		/* where the sdb record is */
+	unsigned long f_offset;
+	unsigned long f_len;
+};
+
 /*
  * Data structures: please not that the library intself doesn't use
  * malloc, so it's the caller who must deal withallocation/removal.
@@ -36,9 +51,16 @@ struct sdbfs {
 	int (*write)(struct sdbfs *fs, int offset, void *buf, int count);
 	int (*erase)(struct sdbfs *fs, int offset, int count);
 
+	/* The caller may offer an index (see above), or leave it NULL */
+	struct sdbfs_index *index;
+	int index_size;			/* entries allocated */
+
 	/* The following fields are library-private */
 	struct sdb_device *currentp;
 	struct sdb_device current_record;
+	unsigned long f_record;		/* not read yet, if opened by index */
+	unsigned long r_offset;		/* where currentp was read from */
+	int index_count;		/* entries used */
 	unsigned long f_len;
 	unsigned long f_offset;		/* start of file */
 	unsigned long read_offset;	/* current location */
@@ -54,6 +76,8 @@ struct sdbfs {
 #define SDBFS_F_VERBOSE		0x0001 /* not really used yet */
 #define SDBFS_F_CONVERT32	0x0002 /* swap SDB words as they are read */
 #define SDBFS_F_ZEROBASED	0x0004 /* zero is a valid data pointer */
+#define SDBFS_F_INDEXED		0x0008 /* the index is built */
+#define SDBFS_F_INDEXFULL	0x0010 /* ... but some files are missing */
 
 /* Defined in glue.c */
 int sdbfs_dev_create(struct sdbfs *fs);
@@ -65,6 +89,8 @@ int sdbfs_open_name(struct sdbfs *fs, const char *name);
 int sdbfs_open_id(struct sdbfs *fs, uint64_t vid, uint32_t did);
 int sdbfs_close(struct sdbfs *fs);
 struct sdb_device *sdbfs_scan(struct sdbfs *fs, int newscan);
+struct sdb_device *sdbfs_readentry(struct sdbfs *fs, unsigned long offset);
+void sdbfs_index_invalidate(struct sdbfs *fs);
 
 /* Defined in access.c */
 int sdbfs_fstat(struct sdbfs *fs, struct sdb_device *record_return);
@@ -13,20 +13,89 @@
 #include "storage.h"
 #include "syscon.h"
 #include "i2c.h"
+#include "initblob.h"
+
+static uint8_t init_buf[INITBLOB_MAX_SIZE];
+
+/* Print a compiled script as text; returns 0 if it is not compiled */
+static int init_show_compiled(int len)
+{
+	int pos, op, n, i;
+	char *data;
+
+	if (!initblob_is_compiled(init_buf, len))
+		return 0;
+	pp_printf("-- user-defined script (compiled) --\n");
+	n = (init_buf[0] << 8) | init_buf[1];
+	if (INITBLOB_HDR + n < len)
+		len = INITBLOB_HDR + n;
+	for (pos = INITBLOB_HDR; pos + 2 <= len; pos += 2 + n) {
+		op = init_buf[pos];
+		n = init_buf[pos + 1];
+		if (op == INITBLOB_END || pos + 2 + n > len)
+			break;
+		data = (char *)init_buf + pos + 2;
+		if (op == INITBLOB_TEXT) {
+			pp_printf("%s\n", data);
+			continue;
+		}
+		pp_printf("%s", initblob_name(op) ? initblob_name(op) : "?");
+		for (i = 0; i < n; i += strlen(data + i) + 1)
+			pp_printf(" %s", data + i);
+		pp_printf("\n");
+	}
+	return 1;
+}
+
+/* Replace the text script in storage with its compiled form */
+static int init_compile(void)
+{
+	static uint8_t out[INITBLOB_MAX_SIZE];
+	int len, i;
+
+	len = storage_init_read(init_buf, sizeof(init_buf));
+	if (len < 0)
+		return len;
+	if (initblob_is_compiled(init_buf, len)) {
+		pp_printf("Already compiled\n");
+		return 0;
+	}
+	/* the text ends at the first erased byte */
+	for (i = sizeof(uint16_t); i < len; i++)
+		if (init_buf[i] == 0xff)
+			break;
+	len = initblob_compile((char *)init_buf + sizeof(uint16_t),
+			       i - sizeof(uint16_t), out, sizeof(out));
+	if (len < 0)
+		return len;
+	pp_printf("%i bytes of text, %i compiled\n",
+		  i - (int)sizeof(uint16_t), len);
+	return storage_init_write(out, len);
+}
 
 static int cmd_init(const char *args[])
 {
+	int len;
+
 	if (args[0] && !strcasecmp(args[0], "erase")) {
 		if (storage_init_erase() < 0)
 			pp_printf("Could not erase init script\n");
 	} else if (args[1] && !strcasecmp(args[0], "add")) {
-		if (storage_init_add(args) < 0)
+		len = storage_init_read(init_buf, sizeof(init_buf));
+		if (initblob_is_compiled(init_buf, len))
+			pp_printf("The script is compiled, erase it first\n");
+		else if (storage_init_add(args) < 0)
 			pp_printf("Could not add the command\n");
 		else
 			pp_printf("OK.\n");
 	} else if (args[0] && !strcasecmp(args[0], "show")) {
 		shell_show_build_init();
-		storage_init_show();
+		len = storage_init_read(init_buf, sizeof(init_buf));
+		if (!init_show_compiled(len))
+			storage_init_show();
+	} else if (args[0] && !strcasecmp(args[0], "compile")) {
+		if (init_compile() < 0)
+			pp_printf("Could not compile the init script\n");
 	} else if (args[0] && !strcasecmp(args[0], "boot")) {
 		shell_boot_script();
 	}
@@ -0,0 +1,93 @@
+/*
+ * This work is part of the White Rabbit project
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+
+/*
+ * Upload a packet-filter rule-set, as the 32-bit words of the file
+ * written by tools/pfilter-builder ("pfilter-sim -s" prints the commands):
+ *
+ *   pfilter new
+ *   pfilter word <index> <hex> [<hex> ...]
+ *   pfilter apply
+ *   pfilter save | erase | default
+ */
+#include <wrc.h>
+#include <string.h>
+#include <errno.h>
+#include <shell.h>
+#include <endpoint.h>
+#include <minic.h>
+
+static const char *pfilter_source_names[] = {
+	[PFILTER_BUILTIN] = "built-in",
+	[PFILTER_UPLOADED] = "uploaded",
+	[PFILTER_STORED] = "stored",
+};
+
+static void pfilter_show(void)
+{
+	uint32_t *v;
+	int i, n;
+
+	n = pfilter_get_active(&v);
+	pp_printf("rule-set: %s, %i instructions\n",
+		  pfilter_source_names[pfilter_source], (n - 1) / 2);
+	for (i = 1; i + 1 < n; i += 2)
+		pp_printf("  %02i: %x.%08x\n", i / 2, v[i + 1], v[i]);
+	pp_printf("staged: %i words\n", pfilter_staged_len);
+	pp_printf("frames per class:");
+	for (i = 0; i < 8; i++)
+		pp_printf(" %i", minic.rx_class[i]);
+	pp_printf("\n");
+}
+
+static int pfilter_word(const char *args[])
+{
+	int i, idx, w;
+
+	if (!args[0] || !args[1])
+		return -EINVAL;
+	fromdec(args[0], &idx);
+	for (i = 1; args[i]; i++, idx++) {
+		if (idx < 0 || idx >= PFILTER_MAX_WORDS) {
+			pp_printf("word %i out of range\n", idx);
+			return -EINVAL;
+		}
+		fromhex(args[i], &w);
+		pfilter_staged[idx] = w;
+		if (pfilter_staged_len < idx + 1)
+			pfilter_staged_len = idx + 1;
+	}
+	return 0;
+}
+
+static int cmd_pfilter(const char *args[])
+{
+	if (!args[0] || !strcasecmp(args[0], "show")) {
+		pfilter_show();
+		return 0;
+	}
+	if (!strcasecmp(args[0], "new")) {
+		memset(pfilter_staged, 0, sizeof(pfilter_staged));
+		pfilter_staged_len = 0;
+		return 0;
+	}
+	if (!strcasecmp(args[0], "word"))
+		return pfilter_word(args + 1);
+	if (!strcasecmp(args[0], "apply"))
+		return pfilter_apply();
+	if (!strcasecmp(args[0], "save"))
+		return pfilter_save();
+	if (!strcasecmp(args[0], "erase"))
+		return pfilter_erase();
+	if (!strcasecmp(args[0], "default"))
+		return pfilter_use_builtin();
+	return -EINVAL;
+}
+
+DEFINE_WRC_COMMAND(pfilter) = {
+	.name = "pfilter",
+	.exec = cmd_pfilter,
+};
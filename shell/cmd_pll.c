@@ -55,7 +55,31 @@ static int cmd_pll(const char *args[])
 		pp_printf("%d\n", spll_get_dac(atoi(args[1])));
 	} else if(!strcasecmp(args[0], "checkvco"))
 		check_vco_frequencies();
-	else
+	else if (!strcasecmp(args[0], "stages")) {
+		if (args[1]) {
+			if (!args[2] || atoi(args[1]) < 0
+			    || atoi(args[1]) >= SPLL_LOOP_N
+			    || atoi(args[2]) < 0
+			    || atoi(args[2]) > SPLL_PI_MAX_STAGES)
+				return -EINVAL;
+			spll_pi_stages[atoi(args[1])] = atoi(args[2]);
+		}
+		pp_printf("helper %d, main %d, aux %d, ext %d\n",
+			  spll_pi_stages[SPLL_LOOP_HELPER],
+			  spll_pi_stages[SPLL_LOOP_MAIN],
+			  spll_pi_stages[SPLL_LOOP_AUX],
+			  spll_pi_stages[SPLL_LOOP_EXT]);
+	} else if (!strcasecmp(args[0], "freq")) {
+		if (args[1]) {
+			if (atoi(args[1]) < 0)
+				return -EINVAL;
+			spll_freq_monitor(atoi(args[1]));
+		}
+		pp_printf("REF %d Hz, DMTD %d Hz, EXT %d Hz (every %ds)\n",
+			  spll_freq.hz[SPLL_OSC_REF],
+			  spll_freq.hz[SPLL_OSC_DMTD],
+			  spll_freq.hz[SPLL_OSC_EXT], spll_freq.period);
+	} else
 		return -EINVAL;
 
 	return 0;
@@ -111,6 +111,16 @@ static int cmd_sfp(const char *args[])
 		pp_printf("SFP matched, dTx=%d dRx=%d alpha=%d\n",
 			sfp_deltaTx, sfp_deltaRx, sfp_alpha);
 		return ret;
+#ifdef CONFIG_SDB_STORAGE
+	} else if (!strcasecmp(args[0], "reload")) {
+		temp = storage_sfpdb_reload();
+		if (temp < 0) {
+			pp_printf("SFP database error (%d)\n", temp);
+			return -EFAULT;
+		}
+		pp_printf("%d SFPs in DB\n", temp);
+		return 0;
+#endif
 	} else if (args[1] && !strcasecmp(args[0], "ena")) {
 		ep_sfp_enable(atoi(args[1]));
 		return 0;
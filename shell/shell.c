@@ -18,6 +18,8 @@
 #include "syscon.h"
 #include "shell.h"
 #include "storage.h"
+#include "boot.h"
+#include "initblob.h"
 
 #define SH_MAX_LINE_LEN 80
 #define SH_MAX_ARGS 8
@@ -298,38 +300,164 @@ static int build_init_readcmd(uint8_t *cmd, int maxlen)
 	return i;
 }
 
-void shell_boot_script(void)
-{
-	uint8_t next = 0;
+/* The "wr-init" file, read at once: a text or compiled script */
+static uint8_t init_buf[INITBLOB_MAX_SIZE];
+static int init_len, init_pos;
 
-	if (!has_eeprom)
-		return;
+/* Next text line from init_buf, 0 at the end */
+static int init_text_line(char *line)
+{
+	int len = 0;
+	uint8_t c;
 
-	while (CONFIG_HAS_BUILD_INIT) {
-		cmd_len = build_init_readcmd((uint8_t *)cmd_buf,
-					SH_MAX_LINE_LEN);
-		if (!cmd_len)
+	if (init_pos >= init_len || init_buf[init_pos] == 0xff)
+		return 0;
+	while (init_pos < init_len && (c = init_buf[init_pos]) != 0xff) {
+		init_pos++;
+		if (c == '\n')
 			break;
-		pp_printf("executing: %s\n", cmd_buf);
-		shell_exec(cmd_buf);
+		if (len < SH_MAX_LINE_LEN)
+			line[len++] = c;
+	}
+	line[len] = 0;
+	return 1;
+}
+
+/* Run a compiled command: no tokenizer and one lookup per opcode */
+static int init_record(int op, const char *data, int len)
+{
+	static struct wrc_shell_cmd *cmds[INITBLOB_NCMDS];
+	const char *argv[INITBLOB_MAX_ARGS + 1];
+	struct wrc_shell_cmd *p;
+	int argc = 0, i = 0, rv;
+
+	if (!initblob_name(op) || (len && data[len - 1])) {
+		pp_printf("init: bad record (opcode %i)\n", op);
+		return -EINVAL;
 	}
+	if (!cmds[op])
+		for (p = __cmd_begin; p < __cmd_end; p++)
+			if (!strcasecmp(p->name, initblob_name(op)))
+				cmds[op] = p;
+	while (i < len && argc < INITBLOB_MAX_ARGS) {
+		argv[argc++] = data + i;
+		i += strlen(data + i) + 1;
+	}
+	argv[argc] = NULL;
+
+	pp_printf("executing: %s", initblob_name(op));
+	for (i = 0; i < argc; i++)
+		pp_printf(" %s", argv[i]);
+	pp_printf("\n");
+	p = cmds[op];
+	if (!p) {
+		pp_printf("Unrecognized command \"%s\".\n", initblob_name(op));
+		return -EINVAL;
+	}
+	shell_is_interacting = 1;
+	rv = p->exec(argv);
+	shell_is_interacting = 0;
+	if (rv < 0)
+		pp_printf("Command \"%s\": error %d\n", p->name, rv);
+	return rv;
+}
 
-	while (CONFIG_HAS_FLASH_INIT) {
-		cmd_len = storage_init_readcmd((uint8_t *)cmd_buf,
-					      SH_MAX_LINE_LEN, next);
-		if (cmd_len <= 0) {
-			if (next == 0)
-				pp_printf("Empty init script...\n");
+/* Execute one line of the init script, return 0 when all done */
+int shell_boot_script_step(void)
+{
+	static char line[SH_MAX_LINE_LEN + 1];
+	static int phase;
+	static uint8_t next;
+	int len, op;
+	char *data;
+
+	/* when deferred by fast boot, don't clobber a line being typed */
+	if (state == SH_INPUT && cmd_len)
+		return 1;
+
+	switch (phase) {
+	case 0:
+		if (!has_eeprom)
 			break;
+		if (CONFIG_HAS_BUILD_INIT) {
+			len = build_init_readcmd((uint8_t *)line,
+						 SH_MAX_LINE_LEN);
+			if (len)
+				goto exec;
 		}
-		cmd_buf[cmd_len - 1] = 0;
-
-		pp_printf("executing: %s\n", cmd_buf);
-		shell_exec(cmd_buf);
+		phase = 1;
+		/* fall through */
+	case 1:
+		if (!CONFIG_HAS_FLASH_INIT)
+			break;
+		if (!next) {
+			init_len = storage_init_read(init_buf,
+						     sizeof(init_buf));
+			init_pos = sizeof(uint16_t); /* text: after the size */
+			if (initblob_is_compiled(init_buf, init_len)) {
+				phase = 2;
+				init_pos = INITBLOB_HDR;
+				len = (init_buf[0] << 8) | init_buf[1];
+				if (init_pos + len < init_len)
+					init_len = init_pos + len;
+			}
+		}
+		if (phase == 2)
+			goto compiled;
+		if (init_len >= 0) {
+			len = init_text_line(line);
+		} else {
+			/* no whole-file access: line by line (legacy eeprom) */
+			len = storage_init_readcmd((uint8_t *)line,
+						   SH_MAX_LINE_LEN, next);
+			if (len > 0)
+				line[len - 1] = 0;
+		}
+		if (len > 0) {
+			next = 1;
+			goto exec;
+		}
+		if (next == 0)
+			pp_printf("Empty init script...\n");
+		break;
+	case 2:
+	compiled:
 		next = 1;
+		if (init_pos + 2 > init_len)
+			break;
+		op = init_buf[init_pos];
+		len = init_buf[init_pos + 1];
+		if (op == INITBLOB_END || init_pos + 2 + len > init_len)
+			break;
+		data = (char *)init_buf + init_pos + 2;
+		init_pos += 2 + len;
+		if (op != INITBLOB_TEXT) {
+			init_record(op, data, len);
+			return 1;
+		}
+		/* a command not known to the compiler: use the shell */
+		len = min(len, SH_MAX_LINE_LEN);
+		memcpy(line, data, len);
+		line[len] = 0;
+		goto exec;
 	}
+	/* done: be ready for "init boot" */
+	phase = 0;
+	next = 0;
+	boot_mark(BOOT_SCRIPT);
+	return 0;
+
+exec:
+	pp_printf("executing: %s\n", line);
+	shell_exec(line);
+	cmd_len = cmd_pos = 0;
+	return 1;
+}
 
-	return;
+void shell_boot_script(void)
+{
+	while (shell_boot_script_step())
+		;
 }
 
 void shell_show_build_init(void)
@@ -27,3 +27,4 @@ obj-$(CONFIG_CMD_LL) +=				shell/cmd_ll.o
 obj-$(CONFIG_FLASH_INIT) +=			shell/cmd_init.o
 obj-$(CONFIG_VLAN) +=				shell/cmd_vlan.o
 obj-$(CONFIG_AUX_DIAG) += 			shell/cmd_diag.o
+obj-$(CONFIG_PFILTER_UPLOAD) +=			shell/cmd_pfilter.o
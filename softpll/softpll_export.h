@@ -64,7 +64,7 @@
 struct spll_stats {
 	int magic;	/* 0x5b1157a7 = SPLLSTAT ?;)*/
 	int ver;	/* version of the structure */
-	int sequence;	/* sequence number, so the host can retry */
+	int sequence;	/* odd while updating, so the host can retry */
 	int mode;
 	int irq_cnt;
 	int seq_state;
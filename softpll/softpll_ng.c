@@ -375,6 +375,33 @@ void spll_init(int mode, int slave_ref_channel, int align_pps)
 	enable_irq();
 }
 
+int spll_switch_reference(int new_ref)
+{
+	struct softpll_state *s = (struct softpll_state *) &softpll;
+	int i, old_ref = s->mpll.id_ref;
+
+	if (s->mode != SPLL_MODE_SLAVE || s->seq_state != SEQ_READY
+	    || new_ref < 0 || new_ref >= spll_n_chan_ref)
+		return -1;
+	if (new_ref == old_ref)
+		return 0;
+
+	pll_verbose("softpll: switching reference %d -> %d\n",
+		    old_ref, new_ref);
+	spll_enable_tagger(new_ref, 1);
+
+	disable_irq();
+	helper_switch_reference(&s->helper, new_ref);
+	mpll_switch_reference(&s->mpll, new_ref);
+	for (i = 0; i < spll_n_chan_out - 1; i++)
+		mpll_switch_reference(&s->aux[i].pll.dmtd, new_ref);
+	enable_irq();
+
+	if (!(ptracker_mask & (1 << old_ref)))
+		spll_enable_tagger(old_ref, 0);
+	return 0;
+}
+
 void spll_shutdown()
 {
 	disable_irq();
@@ -629,6 +656,8 @@ void spll_set_dac(int index, int value)
 	}
 }
 
+static int spll_freq_update(void);
+
 int spll_update()
 {
 	int ret = 0;
@@ -639,9 +668,11 @@ int spll_update()
 			break;
 	}
 	ret += spll_update_aux_clocks();
+	ret += spll_freq_update();
 
-	/* store statistics */
+	/* store statistics: the sequence is odd meanwhile (see wrc_diags.h) */
 	stats.sequence++;
+	barrier();
 	stats.mode  = softpll.mode;
 	stats.irq_cnt = softpll.irq_count;
 	stats.seq_state = softpll.seq_state;
@@ -651,12 +682,43 @@ int spll_update()
 	stats.H_y = softpll.helper.pi.y;
 	stats.M_y = softpll.mpll.pi.y;
 	stats.del_cnt = softpll.delock_count;
+	barrier();
 	stats.sequence++;
 
 	return ret != 0;
 }
 
-static int spll_measure_frequency(int osc)
+/*
+ * Frequency meters. The core counts each clock over a 1s gate, all the
+ * time, so there is nothing to start: a measurement is waiting for a
+ * fresh count. Both the VCO test and the monitor run from spll_update()
+ * (the "spll-bh" task) and never block.
+ */
+struct spll_freq spll_freq = {
+	.period = 1,
+};
+static uint32_t spll_freq_tics;
+
+/* The VCO test: each step sets a DAC and waits for two gates */
+#define VCO_STEP_TICS (2 * TICS_PER_SECOND)
+#define VCO_NO_DAC -2
+static const struct {
+	int8_t dac;
+	int8_t osc;
+	uint16_t value;
+} vco_steps[] = {
+	{-1, SPLL_OSC_DMTD, 0},
+	{-1, SPLL_OSC_DMTD, 65535},
+	{0, SPLL_OSC_REF, 0},
+	{0, SPLL_OSC_REF, 65535},
+	{VCO_NO_DAC, SPLL_OSC_EXT, 0},
+};
+static int vco_step = -1;
+static int vco_hz[ARRAY_SIZE(vco_steps)];
+static unsigned int vco_irq; /* interrupt state before the test */
+static uint32_t vco_tics;
+
+static uint32_t spll_read_frequency(int osc)
 {
 	volatile uint32_t *reg;
 
@@ -674,8 +736,7 @@ static int spll_measure_frequency(int osc)
 			return 0;
 	}
 
-    timer_delay_ms(2000);
-    return (*reg ) & (0xfffffff);
+	return *reg;
 }
 
 static int calc_apr(int meas_min, int meas_max, int f_center )
@@ -704,25 +765,83 @@ static int calc_apr(int meas_min, int meas_max, int f_center )
 	return ppm_lo < ppm_hi ? ppm_lo : ppm_hi;
 }
 
+static void vco_step_start(void)
+{
+	if (vco_steps[vco_step].dac != VCO_NO_DAC)
+		spll_set_dac(vco_steps[vco_step].dac, vco_steps[vco_step].value);
+	vco_tics = timer_get_tics();
+}
+
+static int vco_step_update(void)
+{
+	int *f = vco_hz;
+
+	if (time_before(timer_get_tics(), vco_tics + VCO_STEP_TICS))
+		return 0;
+	f[vco_step] = spll_read_frequency(vco_steps[vco_step].osc) & 0xfffffff;
+
+	switch (vco_step) {
+	case 1:
+		pll_verbose("DMTD VCO:  Low=%d Hz Hi=%d Hz, APR = %d ppm.\n", f[0], f[1], calc_apr(f[0], f[1], 62500000));
+		break;
+	case 3:
+		pll_verbose("REF VCO:   Low=%d Hz Hi=%d Hz, APR = %d ppm.\n", f[2], f[3], calc_apr(f[2], f[3], REF_CLOCK_FREQ_HZ));
+		break;
+	case 4:
+		pll_verbose("EXT clock: Freq=%d Hz\n", f[4]);
+		break;
+	}
+	if (++vco_step == ARRAY_SIZE(vco_steps)) {
+		vco_step = -1;
+		irq_restore(vco_irq);
+		return 1;
+	}
+	vco_step_start();
+	return 1;
+}
+
+/* Starts the test and returns: spll_update() prints the results */
 void check_vco_frequencies()
 {
-	disable_irq();
+	if (vco_step >= 0) {
+		pll_verbose("SoftPLL VCO test already running\n");
+		return;
+	}
+	/*
+	 * The test detunes the oscillators: keep the PLL out of the way
+	 * until the last step, which restores the interrupt state.
+	 */
+	vco_irq = irq_save();
 
-	int f_min, f_max;
 	pll_verbose("SoftPLL VCO Frequency/APR test:\n");
+	vco_step = 0;
+	vco_step_start();
+}
 
-	spll_set_dac(-1, 0);
-	f_min = spll_measure_frequency(SPLL_OSC_DMTD);
-	spll_set_dac(-1, 65535);
-	f_max = spll_measure_frequency(SPLL_OSC_DMTD);
-	pll_verbose("DMTD VCO:  Low=%d Hz Hi=%d Hz, APR = %d ppm.\n", f_min, f_max, calc_apr(f_min, f_max, 62500000));
-
-	spll_set_dac(0, 0);
-	f_min = spll_measure_frequency(SPLL_OSC_REF);
-	spll_set_dac(0, 65535);
-	f_max = spll_measure_frequency(SPLL_OSC_REF);
-	pll_verbose("REF VCO:   Low=%d Hz Hi=%d Hz, APR = %d ppm.\n", f_min, f_max, calc_apr(f_min, f_max, REF_CLOCK_FREQ_HZ));
+/* Background monitor: the last valid count of each clock, 0 if none */
+static int spll_freq_update(void)
+{
+	uint32_t f;
+	int osc;
+
+	/* during the VCO test, the counts are not the working frequencies */
+	if (vco_step >= 0)
+		return vco_step_update();
+	if (!spll_freq.period
+	    || task_not_yet(&spll_freq_tics,
+			    spll_freq.period * TICS_PER_SECOND))
+		return 0;
+	for (osc = SPLL_OSC_REF; osc <= SPLL_OSC_EXT; osc++) {
+		f = spll_read_frequency(osc);
+		/* all three registers have VALID at bit 28 */
+		spll_freq.hz[osc] = (f & SPLL_F_REF_VALID) ? f & 0xfffffff : 0;
+	}
+	spll_freq.count++;
+	return 1;
+}
 
-	f_min = spll_measure_frequency(SPLL_OSC_EXT);
-	pll_verbose("EXT clock: Freq=%d Hz\n", f_min);
+void spll_freq_monitor(int period_s)
+{
+	spll_freq.period = period_s;
+	spll_freq_tics = 0;
 }
@@ -54,6 +54,11 @@ Initializes the SoftPLL to work in mode (mode). Extra parameters depend on choic
 void spll_init(int mode, int ref_channel, int align_pps);
 void spll_very_init(void);
 
+/* Slave mode: locks to another reference channel without re-locking,
+   keeping the phase of the outputs. Returns 0 on success, -1 if the PLL
+   is not locked in slave mode, so spll_init() is needed. */
+int spll_switch_reference(int ref_channel);
+
 /* Disables the SoftPLL and cleans up stuff */
 void spll_shutdown(void);
 
@@ -106,8 +111,18 @@ void spll_set_dac(int out_channel, int value);
 /* Returns current DAC sample value for output (out_channel) */
 int spll_get_dac(int out_channel);
 
+/* Starts the VCO test, spll_update() prints the results as they come */
 void check_vco_frequencies(void);
 
+/* Frequency monitor, updated by spll_update() every "period" seconds */
+struct spll_freq {
+	int hz[3];		/* per SPLL_OSC_*, 0 if not valid */
+	uint32_t count;		/* number of updates */
+	int period;		/* seconds, 0 = stopped */
+};
+extern struct spll_freq spll_freq;
+void spll_freq_monitor(int period_s);
+
 /*
  * Aux and main state:
  * used to be in .c file, but we need it here for memory dumping
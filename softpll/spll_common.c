@@ -14,26 +14,79 @@
 #include <wrc.h>
 #include "softpll_ng.h"
 
+/*
+ * Gain scheduling: while the lock detector counts good samples, the loop
+ * runs with a wider bandwidth, stepping down to the nominal gains before
+ * it declares lock. At stage (s) the loop has (2^s) times the bandwidth
+ * with the same damping: kp is multiplied by 2^s and ki by 4^s.
+ */
+int spll_pi_stages[SPLL_LOOP_N] = {
+	[SPLL_LOOP_HELPER] = CONFIG_SPLL_PI_STAGES_HELPER,
+	[SPLL_LOOP_MAIN] = CONFIG_SPLL_PI_STAGES_MAIN,
+	[SPLL_LOOP_AUX] = CONFIG_SPLL_PI_STAGES_AUX,
+	[SPLL_LOOP_EXT] = CONFIG_SPLL_PI_STAGES_EXT,
+};
+
+void pi_set_stages(spll_pi_t *pi, spll_lock_det_t *ld, int stages)
+{
+	if (stages < 0)
+		stages = 0;
+	if (stages > SPLL_PI_MAX_STAGES)
+		stages = SPLL_PI_MAX_STAGES;
+	/* the last part of the lock count runs with the nominal gains */
+	pi->stages = stages;
+	pi->stage_samples = ld->lock_samples / (stages + 1);
+	pi->stage = 0;
+}
+
+void pi_schedule(spll_pi_t *pi, spll_lock_det_t *ld)
+{
+	int stage = 0, n, ki_old, kp_old, ki_new, kp_new;
+
+	if (!pi->stages)
+		return;
+	if (!ld->locked) {
+		/* no division here: we run in interrupt context */
+		stage = pi->stages;
+		for (n = pi->stage_samples; stage && ld->lock_cnt >= n;
+		     n += pi->stage_samples)
+			stage--;
+	}
+	if (stage == pi->stage)
+		return;
+
+	/* bumpless transfer: rescale the integrator to keep the output */
+	ki_old = pi->ki * (1 << (2 * pi->stage));
+	kp_old = pi->kp * (1 << pi->stage);
+	ki_new = pi->ki * (1 << (2 * stage));
+	kp_new = pi->kp * (1 << stage);
+	pi->integrator = (pi->integrator * ki_old
+			  + pi->x * (kp_old - kp_new)) / ki_new;
+	pi->stage = stage;
+}
+
 int pi_update(spll_pi_t *pi, int x)
 {
 	int i_new, y;
 	pi->x = x;
 	i_new = pi->integrator + x;
 
-	y = ((i_new * pi->ki + x * pi->kp) >> PI_FRACBITS) + pi->bias;
+	y = ((i_new * pi->ki * (1 << (2 * pi->stage))
+	      + x * pi->kp * (1 << pi->stage)) >> PI_FRACBITS) + pi->bias;
 
 	/* clamping (output has to be in <y_min, y_max>) and
 	   anti-windup: stop the integrator if the output is already
 	   out of range and the output is going further away from
-	   y_min/y_max. */
+	   y_min/y_max. The integral term moves by (x * ki), and
+	   ki is negative in some loops. */
 	if (y < pi->y_min) {
 		y = pi->y_min;
-		if ((pi->anti_windup && (i_new > pi->integrator))
+		if ((pi->anti_windup && ((x > 0) == (pi->ki > 0)))
 		    || !pi->anti_windup)
 			pi->integrator = i_new;
 	} else if (y > pi->y_max) {
 		y = pi->y_max;
-		if ((pi->anti_windup && (i_new < pi->integrator))
+		if ((pi->anti_windup && ((x < 0) == (pi->ki > 0)))
 		    || !pi->anti_windup)
 			pi->integrator = i_new;
 	} else			/* No antiwindup/clamping? */
@@ -46,6 +99,7 @@ int pi_update(spll_pi_t *pi, int x)
 void pi_init(spll_pi_t *pi)
 {
 	pi->integrator = 0;
+	pi->stage = 0;
 	pi->y = pi->bias;
 }
 
@@ -37,6 +37,10 @@ typedef struct {
 	int y_min;		/* min/max output range, used by clapming and antiwindup algorithms */
 	int y_max;
 	int x, y;		/* Current input (x) and output value (y) */
+	/* gain scheduling, see pi_schedule() */
+	int stages;		/* number of wider-bandwidth stages, 0 = off */
+	int stage_samples;	/* lock detector samples per stage */
+	int stage;		/* current stage, 0 = nominal gains */
 } spll_pi_t;
 
 /* lock detector state */
@@ -53,6 +57,20 @@ typedef struct {
 /* initializes the PI controller state. Currently almost a stub. */
 void pi_init(spll_pi_t *pi);
 
+/* Loops for gain scheduling: index in spll_pi_stages[] */
+#define SPLL_LOOP_HELPER	0
+#define SPLL_LOOP_MAIN		1
+#define SPLL_LOOP_AUX		2
+#define SPLL_LOOP_EXT		3
+#define SPLL_LOOP_N		4
+#define SPLL_PI_MAX_STAGES	3
+extern int spll_pi_stages[SPLL_LOOP_N];
+
+/* Configures gain scheduling for a loop, after its lock detector */
+void pi_set_stages(spll_pi_t *pi, spll_lock_det_t *ld, int stages);
+/* Selects the gains for the lock detector state: call before pi_update() */
+void pi_schedule(spll_pi_t *pi, spll_lock_det_t *ld);
+
 /* Processes a single sample (x) with PI control algorithm
  (pi). Returns the value (y) to drive the actuator. */
 int pi_update(spll_pi_t *pi, int x);
@@ -31,6 +31,7 @@ void external_init(volatile struct spll_external_state *s, int ext_ref,
 
     helper_init(s->helper, idx);
     mpll_init(s->main, idx, spll_n_chan_ref);
+    pi_set_stages(&s->main->pi, &s->main->ld, spll_pi_stages[SPLL_LOOP_EXT]);
 
     s->align_state = ALIGN_STATE_EXT_OFF;
     s->enabled = 0;
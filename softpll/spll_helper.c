@@ -9,6 +9,7 @@
 
 /* spll_helper.c - implmentation of the Helper PLL servo algorithm. */
 
+#include <telemetry.h>
 #include "softpll_ng.h"
 
 void helper_init(struct spll_helper_state *s, int ref_channel)
@@ -25,6 +26,8 @@ void helper_init(struct spll_helper_state *s, int ref_channel)
 	s->ld.threshold = 200;
 	s->ld.lock_samples = 10000;
 	s->ld.delock_samples = 100;
+	pi_set_stages((spll_pi_t *)&s->pi, (spll_lock_det_t *)&s->ld,
+		      spll_pi_stages[SPLL_LOOP_HELPER]);
 	s->ref_src = ref_channel;
 }
 
@@ -37,6 +40,13 @@ int helper_update(struct spll_helper_state *s, int tag,
 		spll_debug(DBG_TAG | DBG_HELPER, tag, 0);
 		spll_debug(DBG_REF | DBG_HELPER, s->p_setpoint, 0);
 
+		if (s->tag_d0 < 0 && s->switching) {
+			/* New reference: keep the error where it was */
+			s->p_setpoint = tag - s->pi.x;
+			s->tag_d0 = tag;
+			s->switching = 0;
+		}
+
 		if (s->tag_d0 < 0) {
 			s->p_setpoint = tag;
 			s->tag_d0 = tag;
@@ -66,12 +76,15 @@ int helper_update(struct spll_helper_state *s, int tag,
 		s->p_setpoint += (1 << HPLL_N);
 		s->tag_d0 = tag;
 
+		pi_schedule((spll_pi_t *)&s->pi, (spll_lock_det_t *)&s->ld);
 		y = pi_update((spll_pi_t *)&s->pi, err);
 		SPLL->DAC_HPLL = y;
 
 		spll_debug(DBG_SAMPLE_ID | DBG_HELPER, s->sample_n++, 0);
 		spll_debug(DBG_Y | DBG_HELPER, y, 0);
 		spll_debug(DBG_ERR | DBG_HELPER, err, 1);
+		telemetry_put(TLM_HELPER_Y, y);
+		telemetry_put(TLM_HELPER_ERR, err);
 
 		if (ld_update((spll_lock_det_t *)&s->ld, err))
 			return SPLL_LOCKED;
@@ -89,6 +102,7 @@ void helper_start(struct spll_helper_state *s)
 	s->p_adder = 0;
 	s->sample_n = 0;
 	s->tag_d0 = -1;
+	s->switching = 0;
 
 	pi_init((spll_pi_t *)&s->pi);
 	ld_init((spll_lock_det_t *)&s->ld);
@@ -97,14 +111,17 @@ void helper_start(struct spll_helper_state *s)
 	spll_debug(DBG_EVENT | DBG_HELPER, DBG_EVT_START, 1);
 }
 
+/*
+ * Move the helper to another reference, without touching the PI and the
+ * lock detector: all the references come from the same grandmaster, so
+ * the DAC value is still right. The first tag of the new reference
+ * re-anchors the setpoint (see helper_update). Called with interrupts
+ * disabled; the caller enables the new tagger.
+ */
 void helper_switch_reference(struct spll_helper_state *s, int new_ref)
 {
-#if 0
-	disable_irq();
-	s->ref-src = 1;
+	s->ref_src = new_ref;
 	s->tag_d0 = -1;
-	s->p-addr = 0;
-	enable_irq();
-	spll_enable_tagger(s->ref_src, 1);
-#endif
+	s->p_adder = 0;
+	s->switching = 1;
 }
@@ -31,6 +31,7 @@ struct spll_helper_state {
 	int p_setpoint, tag_d0;
 	int ref_src;
 	int sample_n;
+	int switching;		/* reference changed, re-anchor the setpoint */
 	spll_pi_t pi;
 	spll_lock_det_t ld;
 };
@@ -10,6 +10,7 @@
 /* spll_main.c - Implementation of the main DDMTD PLL. */
 
 #include <wrc.h>
+#include <telemetry.h>
 #include "softpll_ng.h"
 
 #define MPLL_TAG_WRAPAROUND 100000000
@@ -40,6 +41,7 @@ void mpll_init(struct spll_main_state *s, int id_ref,
 #error "Please set CONFIG for wr switch or wr node"
 #endif
 	s->enabled = 0;
+	s->switching = 0;
 
 	/* Freqency branch lock detection */
 	s->ld.threshold = 1200;
@@ -48,6 +50,9 @@ void mpll_init(struct spll_main_state *s, int id_ref,
 	s->id_ref = id_ref;
 	s->id_out = id_out;
 	s->dac_index = id_out - spll_n_chan_ref;
+	pi_set_stages((spll_pi_t *)&s->pi, (spll_lock_det_t *)&s->ld,
+		      spll_pi_stages[s->dac_index ? SPLL_LOOP_AUX
+				     : SPLL_LOOP_MAIN]);
 
 	pll_verbose("ref %d out %d idx %x \n", s->id_ref, s->id_out, s->dac_index);
 
@@ -69,6 +74,7 @@ void mpll_start(struct spll_main_state *s)
 	s->phase_shift_current = 0;
 	s->sample_n = 0;
 	s->enabled = 1;
+	s->switching = 0;
 	pi_init((spll_pi_t *)&s->pi);
 	ld_init((spll_lock_det_t *)&s->ld);
 
@@ -77,6 +83,20 @@ void mpll_start(struct spll_main_state *s)
 	spll_debug(DBG_EVENT | DBG_MAIN, DBG_EVT_START, 1);
 }
 
+/*
+ * Lock to another reference keeping the PI state and the phase shift:
+ * the first pair of tags re-anchors adder_ref so that the error doesn't
+ * jump, so the output keeps its phase. The tagger of the new reference
+ * must already be enabled; called with interrupts disabled.
+ */
+void mpll_switch_reference(struct spll_main_state *s, int id_ref)
+{
+	s->id_ref = id_ref;
+	s->tag_ref = -1;
+	s->tag_ref_d = -1;
+	s->switching = 1;
+}
+
 void mpll_stop(struct spll_main_state *s)
 {
 	spll_enable_tagger(s->id_out, 0);
@@ -112,6 +132,11 @@ int mpll_update(struct spll_main_state *s, int tag, int source)
 	}
 
 	if (s->tag_ref >= 0 && s->tag_out >= 0) {
+		if (s->switching) {
+			s->adder_ref = s->pi.x + s->adder_out + s->tag_out
+				- s->tag_ref;
+			s->switching = 0;
+		}
 		err = s->adder_ref + s->tag_ref - s->adder_out - s->tag_out;
 
 #ifndef WITH_SEQUENCING
@@ -133,11 +158,18 @@ int mpll_update(struct spll_main_state *s, int tag, int source)
 
 #endif
 
+		pi_schedule((spll_pi_t *)&s->pi, (spll_lock_det_t *)&s->ld);
 		y = pi_update((spll_pi_t *)&s->pi, err);
 		SPLL->DAC_MAIN = SPLL_DAC_MAIN_VALUE_W(y)
 			| SPLL_DAC_MAIN_DAC_SEL_W(s->dac_index);
-		if (s->dac_index == 0)
+		if (s->dac_index == 0) {
 			spll_log_dac(y);
+			telemetry_put(TLM_MAIN_Y, y);
+			telemetry_put(TLM_MAIN_ERR, err);
+		} else if (s->dac_index == 1) {
+			telemetry_put(TLM_AUX_Y, y);
+			telemetry_put(TLM_AUX_ERR, err);
+		}
 
 		spll_debug(DBG_MAIN | DBG_REF, s->tag_ref + s->adder_ref, 0);
 		spll_debug(DBG_MAIN | DBG_TAG, s->tag_out + s->adder_out, 0);
@@ -29,6 +29,7 @@ struct spll_main_state {
 	int sample_n;
 	int dac_index;
 	int enabled;
+	int switching;		/* reference changed, re-anchor adder_ref */
 };
 
 void mpll_init(struct spll_main_state *s, int id_ref,
@@ -38,6 +39,8 @@ void mpll_stop(struct spll_main_state *s);
 
 void mpll_start(struct spll_main_state *s);
 
+void mpll_switch_reference(struct spll_main_state *s, int id_ref);
+
 int mpll_update(struct spll_main_state *s, int tag, int source);
 
 int mpll_set_phase_shift(struct spll_main_state *s,
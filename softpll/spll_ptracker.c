@@ -9,6 +9,7 @@
 
 /* spll_ptracker.c - implementation of phase trackers. */
 
+#include <telemetry.h>
 #include "softpll_ng.h"
 
 static int tag_ref = -1;
@@ -76,6 +77,8 @@ int ptrackers_update(struct spll_ptracker_state *ptrackers, int tag,
 		if (s->avg_count == s->n_avg) {
 			s->phase_val = s->acc / s->n_avg;
 			s->ready = 1;
+			if (source == 0)
+				telemetry_put(TLM_PTRACK, s->phase_val);
 			s->acc = 0;
 			s->avg_count = 0;
 		}
@@ -0,0 +1,146 @@
+/*
+ * Cost of a refresh of a register block, read one register at a time
+ * (iomemr32() per field, like the tools used to) or with dev_snapshot().
+ * Each read of a mapped resource is a bus round trip (a PCIe or VME
+ * transaction), so the tool reports the reads per refresh and the time
+ * per refresh; run it on the real device, a file gives the counts only.
+ *
+ * The block is read as is, without the snapshot handshakes of the diags
+ * or streamers: none of their registers has read side effects.
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+
+#include <libdevmap.h>
+
+#include <hw/wrc_diags_regs.h>
+#include <hw/wr_streamers.h>
+
+static struct block {
+	char *name;
+	uint32_t len;
+} blocks[] = {
+	{"diags", sizeof(struct WRC_DIAGS_WB)},
+	/* what wr-streamers reads for the statistics */
+	{"streamers", offsetof(struct WR_STREAMERS_WB, TX_CFG0)},
+};
+
+static int refreshes = 10000;
+
+static double now_us(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+/* One register at a time: returns the reads of one refresh */
+static int read_words(struct mapping_desc *desc, uint32_t len, uint32_t *buf)
+{
+	volatile uint32_t *p = desc->base;
+	int i;
+
+	for (i = 0; i < len / 4; i++)
+		buf[i] = iomemr32(desc->is_be, p[i]);
+	return len / 4;
+}
+
+static void run(struct mapping_desc *desc, char *name, int width,
+		uint32_t len, uint32_t *buf)
+{
+	double t;
+	int i, n = 0;
+
+	desc->snap_width = width;
+	t = now_us();
+	for (i = 0; i < refreshes; i++)
+		n = width ? dev_snapshot(desc, 0, len, buf)
+			: read_words(desc, len, buf);
+	t = now_us() - t;
+	printf("%-18s %6i %12.3f\n", name, n, t / refreshes);
+}
+
+static void help(char *prog)
+{
+	int i;
+
+	fprintf(stderr, "%s [options] <block>|<bytes>\n", prog);
+	fprintf(stderr, "  -n <refreshes> refreshes for each method "
+		"(default %i)\n", refreshes);
+	fprintf(stderr, "  blocks:");
+	for (i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++)
+		fprintf(stderr, " %s", blocks[i].name);
+	fprintf(stderr, "\n%s", dev_mapping_help());
+}
+
+int main(int argc, char *argv[])
+{
+	struct mapping_args *map_args;
+	struct mapping_desc *desc;
+	uint32_t len = 0, *buf;
+	int c, i, width;
+	char *end;
+
+	/* our option; dev_parse_mapping_args() then sees all of them */
+	opterr = 0;
+	while ((c = getopt(argc, argv, "o:f:n:")) != -1) {
+		if (c == 'n')
+			refreshes = atoi(optarg);
+	}
+	if (optind + 1 != argc || refreshes <= 0) {
+		help(argv[0]);
+		exit(1);
+	}
+	for (i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++)
+		if (!strcmp(argv[optind], blocks[i].name))
+			len = blocks[i].len;
+	if (!len) {
+		len = strtoul(argv[optind], &end, 0);
+		if (*end || !len || len & 3) {
+			fprintf(stderr, "%s: \"%s\": not a block nor a length "
+				"in bytes (multiple of 4)\n", argv[0],
+				argv[optind]);
+			exit(1);
+		}
+	}
+	optind = 1;
+
+	map_args = dev_parse_mapping_args(argc, argv);
+	if (!map_args) {
+		help(argv[0]);
+		exit(1);
+	}
+	desc = dev_map(map_args, len);
+	if (!desc) {
+		fprintf(stderr, "%s: mmap() failed: %s\n", argv[0],
+			strerror(errno));
+		free(map_args);
+		exit(1);
+	}
+	buf = malloc(len);
+	if (!buf) {
+		perror("malloc");
+		exit(1);
+	}
+	width = desc->snap_width;
+
+	printf("%i bytes, %i refreshes\n", len, refreshes);
+	printf("method              reads   us/refresh\n");
+	run(desc, "per register", 0, len, buf);
+	run(desc, "snapshot, 32-bit", 4, len, buf);
+	if (width == 8)
+		run(desc, "snapshot, 64-bit", 8, len, buf);
+
+	free(buf);
+	dev_unmap(desc);
+	return 0;
+}
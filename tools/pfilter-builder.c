@@ -172,354 +172,1221 @@
   and bitmasks 0x20 and 0x80 as I write this note.  Such values must
   be changed for consistency with the other configurations.
 
+
+
+  3. Rule files
+  -----------------------------------------
+
+  The rule-sets are written as rule files (tools/rules-novlan.pf and
+  tools/rules-vlan.pf), which this program compiles. A rule file has one
+  statement per line, and '#' starts a comment:
+
+      layout tagged            the fields below follow a vlan tag
+      let <name> = <expr>      name an expression, for later statements
+      class <n> = <expr>       set class <n> (0-7) if <expr> is true
+      drop = <expr>            drop the frame if <expr> is true
+
+  An expression combines tests with "!", "&", "^", "|" and parentheses,
+  with the precedence of C. A test is "<field> == <value>", or "!=":
+
+      w<n>           the 16-bit word <n> of the frame, as in CMP
+      dst, src       MAC addresses: aa:bb:cc:dd:ee:ff, or "local"
+      tpid           word 6, the ethertype of untagged frames
+      vlan           the vlan number (tagged layout only), or "ours"
+      ethertype      after the tag, if tagged; or "latency"
+      ip.proto, udp.sport, udp.dport
+
+  A number may have a mask, e.g. "udp.dport == 0x0100/0xff00", and a
+  mask is nibble-granular as explained above. The CONFIG_VLAN_* values
+  of .config can be used as numbers. "local", "ours" and "latency" are
+  placeholders patched by dev/ep_pfilter.c when the rule-set is loaded,
+  so one binary fits all boards; the local MAC address is required, as
+  the firmware checks it.
+
+  Identical tests are computed once. Comparisons feeding the same
+  and/or/xor are chained in one register; the rest is combined with
+  LOGIC2 and LOGIC3, which can absorb a two-operand subexpression. The
+  instructions are then scheduled as soon as their words have arrived,
+  longest dependency chain first, and registers are assigned last. The
+  program is checked against the rules with the model of lib/pfilter.c
+  on random frames; tools/pfilter-sim runs it over captured frames.
+
 */
 
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include <endpoint.h> /* for operations and type pfilter_op_t */
+#include <pfilter.h>
 
-#define PFILTER_MAX_CODE_SIZE      32
-
-#define pfilter_dbg(x, ...) /* nothing */
+#define PF_MAX_NODES	256
+#define PF_MAX_KIDS	16
+#define PF_MAX_LETS	64
+#define PF_MAX_INSNS	64	/* bits of a dependency mask */
+#define PF_MAX_VALUES	64
+#define PF_MAX_WORD	(PFILTER_MAX_CODE_SIZE - 2) /* CMP at pc < FIN */
 
 char *prgname;
+static char *src_name;
+static int src_line;
 
-extern volatile struct EP_WB *EP;
-
-static const uint64_t PF_MODE_LOGIC = (1ULL << 34);
-static const uint64_t PF_MODE_CMP = 0ULL;
-
-static int code_pos;
-static uint64_t code_buf[PFILTER_MAX_CODE_SIZE];
+static void pf_error(const char *fmt, ...)
+{
+	va_list args;
+
+	if (src_line)
+		fprintf(stderr, "%s:%i: ", src_name, src_line);
+	else
+		fprintf(stderr, "%s: ", src_name);
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(1);
+}
 
-enum pf_regs {
-	R_ZERO = 1024,
-	R_1, R_2, R_3, R_4, R_5, R_6, R_7, R_8, R_9, R_10,
-	R_11, R_12, R_13, R_14, R_15, R_16, R_17, R_18, R_19, R_20,
-	R_21, R_22,
-	R_DROP,
-	R_C0, R_C1, R_C2, R_C3, R_C4, R_C5, R_C6, R_C7
-};
-#define R_CLASS(x) (R_C0 + x)
-
-/* Give also "symbolic" names, to the roles of each register. */
-enum pf_symbolic_regs {
-
-	/* The first set is used for straight comparisons */
-	FRAME_BROADCAST = R_1,
-	FRAME_MAC_OK,
-	FRAME_MAC_PTP,
-	FRAME_OUR_VLAN,
-	FRAME_TYPE_IPV4,
-	FRAME_TYPE_PTP2,
-	FRAME_TYPE_LATENCY,
-	FRAME_TYPE_ARP,
-	FRAME_ICMP,
-	FRAME_UDP,
-	PORT_UDP_HOST,
-	PORT_UDP_ETHERBONE,
-	R_TMP,
-
-	/* These are results of logic over the previous bits  */
-	FRAME_IP_UNI,
-	FRAME_IP_OK, /* unicast or broadcast */
-
-	/* A temporary register, and the CPU target */
-	FRAME_FOR_CPU, /* must be last */
+/*
+ * The rules: a dag of comparisons and logic operations. Nodes are unique,
+ * so a test written twice is the same node (and computed once).
+ */
+enum pf_node_type {N_CMP, N_NOT, N_AND, N_OR, N_XOR};
+
+/* Comparisons patched by the firmware (see pfilter.h) */
+enum pf_special {S_NONE, S_MAC0, S_MAC1, S_MAC2, S_LATENCY, S_VLAN};
+
+struct pf_node {
+	int type;
+	int off, val, mask, special;	/* N_CMP */
+	int nkids, kids[PF_MAX_KIDS];	/* sorted, but for N_NOT */
+	int uses;			/* parents and outputs */
+	int est;			/* last word it needs */
+	int value;			/* register value, once computed */
 };
+static struct pf_node nodes[PF_MAX_NODES];
+static int n_nodes;
 
-int v1[R_C7 - (R_ZERO + 31)]; /* fails if we lost  a register */
-int v2[(R_ZERO + 31) - R_C7]; /* fails if we added a register */
-
-int v3[0 - ((int)FRAME_FOR_CPU > R_22)];
+static struct pf_let {
+	char name[32];
+	int node;
+} lets[PF_MAX_LETS];
+static int n_lets;
 
+/* Class 0-7 and drop, as register numbers */
+static int outputs[PFILTER_R_CLASS(8)];
+static int tagged;
 
+static int cmp_int(const void *a, const void *b)
+{
+	return *(int *)a - *(int *)b;
+}
 
-/* begins assembling a new packet filter program */
-static void pfilter_new(void)
+static int node_get(struct pf_node *t)
 {
-	code_pos = 0;
+	struct pf_node *p;
+	int i;
+
+	if (t->type != N_CMP && t->type != N_NOT)
+		qsort(t->kids, t->nkids, sizeof(int), cmp_int);
+	for (i = 0, p = nodes; i < n_nodes; i++, p++)
+		if (p->type == t->type && p->off == t->off
+		    && p->val == t->val && p->mask == t->mask
+		    && p->special == t->special && p->nkids == t->nkids
+		    && !memcmp(p->kids, t->kids, t->nkids * sizeof(int)))
+			return i;
+	if (n_nodes == PF_MAX_NODES)
+		pf_error("too many tests");
+	t->value = -1;
+	nodes[n_nodes] = *t;
+	return n_nodes++;
 }
 
-static void check_size(void)
+static int node_cmp(int off, int val, int mask, int special)
 {
-	if (code_pos == PFILTER_MAX_CODE_SIZE - 1) {
-		fprintf(stderr, "%s: microcode too big (max size: %d)\n",
-			prgname, PFILTER_MAX_CODE_SIZE);
-		exit(1);
-	}
+	struct pf_node t = {.type = N_CMP};
+	int i;
+
+	if (off > PF_MAX_WORD)
+		pf_error("word %i is too far for the program", off);
+	for (i = 0; i < 16; i += 4)
+		if (((mask >> i) & 0xf) != 0 && ((mask >> i) & 0xf) != 0xf)
+			pf_error("mask 0x%04x is not nibble-granular", mask);
+	if (val & ~mask)
+		pf_error("value 0x%x has bits out of mask 0x%04x", val, mask);
+	t.off = off;
+	t.val = val;
+	t.mask = mask;
+	t.special = special;
+	return node_get(&t);
 }
 
-static void check_reg_range(int val, int minval, int maxval, char *name)
+static int node_not(int kid)
 {
-	if (val < minval || val > maxval) {
-		fprintf(stderr, "%s: register \"%s\" out of range (%d to %d)",
-			prgname, name, minval, maxval);
-		exit(1);
-	}
+	struct pf_node t = {.type = N_NOT, .nkids = 1};
+
+	if (nodes[kid].type == N_NOT)
+		return nodes[kid].kids[0];
+	t.kids[0] = kid;
+	return node_get(&t);
 }
 
-static void pfilter_cmp(int offset, int value, int mask, pfilter_op_t op,
-			int rd)
+static int node_op(int type, int *kids, int n)
 {
-	uint64_t ir;
+	struct pf_node t = {.type = type, .nkids = n};
 
-	check_size();
+	if (n > PF_MAX_KIDS)
+		pf_error("more than %i terms", PF_MAX_KIDS);
+	memcpy(t.kids, kids, n * sizeof(int));
+	return node_get(&t);
+}
 
-	if (offset > code_pos) {
-		fprintf(stderr, "%s: comparison offset is bigger than current PC. Insert some nops before comparing",
-			prgname);
-		exit(1);
-	}
+/* The parser: one statement per line */
+enum pf_tok {T_END, T_NAME, T_NUM, T_MAC, T_EQ, T_NE, T_AND, T_OR, T_XOR,
+	     T_NOT, T_LPAR, T_RPAR, T_ASSIGN, T_SLASH};
 
-	check_reg_range(rd, R_1, R_15, "ra/rd");
-	rd -= R_ZERO;
+static char *pos;
+static int tok;
+static char tok_text[64];
+static uint64_t tok_num;
 
-	ir = (PF_MODE_CMP | ((uint64_t) offset << 7)
-	      | ((mask & 0x1) ? (1ULL << 29) : 0)
-	      | ((mask & 0x10) ? (1ULL << 30) : 0)
-	      | ((mask & 0x100) ? (1ULL << 31) : 0)
-	      | ((mask & 0x1000) ? (1ULL << 32) : 0))
-	    | op | (rd << 3);
+static void next(void)
+{
+	static char *ops = "&|^!()/";
+	char *end;
+	int i;
 
-	ir = ir | ((uint64_t) value & 0xffffULL) << 13;
+	while (isspace(*pos))
+		pos++;
+	if (!*pos || *pos == '#') {
+		tok = T_END;
+		return;
+	}
+	if (!strncmp(pos, "==", 2) || !strncmp(pos, "!=", 2)) {
+		tok = *pos == '=' ? T_EQ : T_NE;
+		pos += 2;
+		return;
+	}
+	if (*pos == '=') {
+		tok = T_ASSIGN;
+		pos++;
+		return;
+	}
+	if (strchr(ops, *pos)) {
+		tok = (int []){T_AND, T_OR, T_XOR, T_NOT, T_LPAR, T_RPAR,
+			       T_SLASH}[strchr(ops, *pos) - ops];
+		pos++;
+		return;
+	}
+	for (i = 0; isalnum(pos[i]) || strchr("_.:", pos[i]); i++)
+		if (i == sizeof(tok_text) - 1)
+			pf_error("name too long");
+	if (!i)
+		pf_error("unexpected '%c'", *pos);
+	memcpy(tok_text, pos, i);
+	tok_text[i] = '\0';
+	pos += i;
+	tok = T_NAME;
+	if (memchr(tok_text, ':', i)) {
+		/* a MAC address: six hex bytes */
+		tok_num = 0;
+		end = tok_text;
+		for (i = 0; i < 6; i++, end++) {
+			tok_num = (tok_num << 8)
+				| strtoul(end, &end, 16);
+			if (*end != (i == 5 ? '\0' : ':'))
+				pf_error("bad MAC address \"%s\"", tok_text);
+		}
+		tok = T_MAC;
+	} else if (isdigit(tok_text[0])) {
+		tok_num = strtoull(tok_text, &end, 0);
+		if (*end)
+			pf_error("bad number \"%s\"", tok_text);
+		tok = T_NUM;
+	}
+}
 
-	code_buf[code_pos++] = ir;
+static void expect(int t, char *what)
+{
+	if (tok != t)
+		pf_error("expected %s", what);
+	next();
 }
 
-static void pfilter_nop(void)
+/* Numbers from .config that rules may use */
+static struct pf_const {
+	char *name;
+	int val;
+} pf_consts[] = {
+	{"CONFIG_VLAN_1_FOR_CLASS7", CONFIG_VLAN_1_FOR_CLASS7},
+	{"CONFIG_VLAN_2_FOR_CLASS7", CONFIG_VLAN_2_FOR_CLASS7},
+	{"CONFIG_VLAN_FOR_CLASS6", CONFIG_VLAN_FOR_CLASS6},
+};
+
+/* Fields of the frame, as 16-bit words; -1 if not in the layout */
+static struct pf_field {
+	char *name;
+	int off, tagged_off;
+	int words;		/* 3 for MAC addresses */
+	int mask;
+	int special;		/* the placeholder allowed as value */
+} pf_fields[] = {
+	{"dst",		0,	0,	3, 0xffff, S_MAC0},
+	{"src",		3,	3,	3, 0xffff},
+	{"tpid",	6,	6,	1, 0xffff},
+	{"vlan",	-1,	7,	1, 0x0fff, S_VLAN},
+	{"ethertype",	6,	8,	1, 0xffff, S_LATENCY},
+	{"ip.proto",	11,	13,	1, 0x00ff},
+	{"udp.sport",	17,	19,	1, 0xffff},
+	{"udp.dport",	18,	20,	1, 0xffff},
+};
+
+static int parse_test(void)
 {
-	uint64_t ir;
-	check_size();
-	ir = PF_MODE_LOGIC;
-	code_buf[code_pos++] = ir;
+	struct pf_field *f = NULL, word = {tok_text, 0, 0, 1, 0xffff};
+	int i, eq, off, val, mask, special = S_NONE, kids[3];
+	uint64_t mac;
+	char *end;
+
+	for (i = 0; i < sizeof(pf_fields) / sizeof(pf_fields[0]); i++)
+		if (!strcmp(tok_text, pf_fields[i].name))
+			f = pf_fields + i;
+	if (!f && tok_text[0] == 'w' && isdigit(tok_text[1])) {
+		word.off = word.tagged_off = strtol(tok_text + 1, &end, 10);
+		if (!*end)
+			f = &word;
+	}
+	if (!f)
+		pf_error("unknown name \"%s\"", tok_text);
+	off = tagged ? f->tagged_off : f->off;
+	if (off < 0)
+		pf_error("no field \"%s\" in this layout", f->name);
+	next();
+	if (tok != T_EQ && tok != T_NE)
+		pf_error("expected == or != after \"%s\"", f->name);
+	eq = tok == T_EQ;
+	next();
+
+	mask = f->mask;
+	if (tok == T_NAME && !strcmp(tok_text, "local") && f->special == S_MAC0) {
+		mac = (uint64_t)PFILTER_MAC_0 << 32 | PFILTER_MAC_1 << 16
+			| PFILTER_MAC_2;
+		special = S_MAC0;
+	} else if (tok == T_NAME && !strcmp(tok_text, "latency")
+		   && f->special == S_LATENCY) {
+		val = PFILTER_LATENCY_TYPE;
+		special = S_LATENCY;
+	} else if (tok == T_NAME && !strcmp(tok_text, "ours")
+		   && f->special == S_VLAN) {
+		val = PFILTER_VLAN_NR;
+		special = S_VLAN;
+	} else if (tok == T_MAC && f->words == 3) {
+		mac = tok_num;
+	} else if (tok == T_NUM && f->words == 1) {
+		val = tok_num;
+	} else if (tok == T_NAME && f->words == 1) {
+		for (i = 0; i < sizeof(pf_consts) / sizeof(pf_consts[0]); i++)
+			if (!strcmp(tok_text, pf_consts[i].name))
+				break;
+		if (i == sizeof(pf_consts) / sizeof(pf_consts[0]))
+			pf_error("unknown value \"%s\"", tok_text);
+		val = pf_consts[i].val;
+	} else {
+		pf_error("bad value for \"%s\"", f->name);
+	}
+	next();
+	if (tok == T_SLASH && f->words == 1 && special == S_NONE) {
+		next();
+		if (tok != T_NUM)
+			pf_error("expected a mask");
+		mask &= tok_num;
+		next();
+	}
+	if (f->words == 1) {
+		if (val & ~f->mask)
+			pf_error("value 0x%x too big for \"%s\"", val, f->name);
+		i = node_cmp(off, val, mask, special);
+	} else {
+		for (i = 0; i < 3; i++)
+			kids[i] = node_cmp(off + i, (mac >> (32 - 16 * i))
+					   & 0xffff, mask,
+					   special ? S_MAC0 + i : S_NONE);
+		i = node_op(N_AND, kids, 3);
+	}
+	return eq ? i : node_not(i);
 }
 
-  // rd  = ra op rb
-static void pfilter_logic2(int rd, int ra, pfilter_op_t op, int rb)
+static int parse_expr(int level);
+
+static int parse_unary(void)
 {
-	uint64_t ir;
-	check_size();
-	check_reg_range(ra, R_ZERO, R_C7, "ra"); ra -= R_ZERO;
-	check_reg_range(rb, R_ZERO, R_C7, "rb"); rb -= R_ZERO;
-	check_reg_range(rd, R_1,    R_C7, "rd"); rd -= R_ZERO;
+	int i;
 
-	ir = ((uint64_t) ra << 8) | ((uint64_t) rb << 13) |
-	    (((uint64_t) rd & 0xf) << 3) | (((uint64_t) rd & 0x10) ? (1ULL << 7)
-					    : 0) | (uint64_t) op;
-	ir = ir | PF_MODE_LOGIC | (3ULL << 23);
-	code_buf[code_pos++] = ir;
+	if (tok == T_NOT) {
+		next();
+		return node_not(parse_unary());
+	}
+	if (tok == T_LPAR) {
+		next();
+		i = parse_expr(0);
+		expect(T_RPAR, "')'");
+		return i;
+	}
+	if (tok != T_NAME)
+		pf_error("expected a test or a name");
+	for (i = 0; i < n_lets; i++) {
+		if (!strcmp(tok_text, lets[i].name)) {
+			next();
+			return lets[i].node;
+		}
+	}
+	return parse_test();
 }
 
-static void pfilter_logic3(int rd, int ra, pfilter_op_t op, int rb,
-			   pfilter_op_t op2, int rc)
+/* Levels 0, 1, 2 are "|", "^", "&" */
+static int parse_expr(int level)
 {
-	uint64_t ir;
-	check_size();
-	check_reg_range(ra, R_ZERO, R_C7, "ra"); ra -= R_ZERO;
-	check_reg_range(rb, R_ZERO, R_C7, "rb"); rb -= R_ZERO;
-	check_reg_range(rc, R_ZERO, R_C7, "rc"); rc -= R_ZERO;
-	check_reg_range(rd, R_1,    R_C7, "rd"); rd -= R_ZERO;
+	static int toks[] = {T_OR, T_XOR, T_AND};
+	static int types[] = {N_OR, N_XOR, N_AND};
+	int kids[PF_MAX_KIDS], n = 0;
+
+	kids[n++] = level < 2 ? parse_expr(level + 1) : parse_unary();
+	while (tok == toks[level]) {
+		next();
+		if (n == PF_MAX_KIDS)
+			pf_error("more than %i terms", PF_MAX_KIDS);
+		kids[n++] = level < 2 ? parse_expr(level + 1) : parse_unary();
+	}
+	return n == 1 ? kids[0] : node_op(types[level], kids, n);
+}
 
-	ir = (ra << 8) | (rb << 13) | (rc << 18) | ((rd & 0xf) << 3) |
-	    ((rd & 0x10) ? (1 << 7) : 0) | op;
-	ir = ir | PF_MODE_LOGIC | (op2 << 23);
-	code_buf[code_pos++] = ir;
+static void parse_line(char *line)
+{
+	char name[sizeof(tok_text)];
+	int reg;
+
+	pos = line;
+	next();
+	if (tok == T_END)
+		return;
+	if (tok != T_NAME)
+		pf_error("expected a statement");
+	strcpy(name, tok_text);
+	next();
+
+	if (!strcmp(name, "layout")) {
+		if (tok != T_NAME || (strcmp(tok_text, "tagged")
+				      && strcmp(tok_text, "untagged")))
+			pf_error("expected \"tagged\" or \"untagged\"");
+		tagged = !strcmp(tok_text, "tagged");
+		next();
+	} else if (!strcmp(name, "let")) {
+		if (tok != T_NAME)
+			pf_error("expected a name");
+		if (n_lets == PF_MAX_LETS)
+			pf_error("too many names");
+		strcpy(lets[n_lets].name, tok_text);
+		next();
+		expect(T_ASSIGN, "'='");
+		lets[n_lets++].node = parse_expr(0);
+	} else if (!strcmp(name, "class") || !strcmp(name, "drop")) {
+		reg = PFILTER_R_DROP;
+		if (name[0] == 'c') {
+			if (tok != T_NUM || tok_num > 7)
+				pf_error("expected a class, 0 to 7");
+			reg = PFILTER_R_CLASS(tok_num);
+			next();
+		}
+		if (outputs[reg] && reg == PFILTER_R_DROP)
+			pf_error("drop set twice");
+		if (outputs[reg])
+			pf_error("class %i set twice",
+				 reg - PFILTER_R_CLASS(0));
+		expect(T_ASSIGN, "'='");
+		outputs[reg] = parse_expr(0) + 1;
+	} else {
+		pf_error("unknown statement \"%s\"", name);
+	}
+	if (tok != T_END)
+		pf_error("extra text at the end");
 }
 
-/* Terminates the microcode, creating the output file */
-static void pfilter_output(char *fname)
+static void parse_file(char *fname)
 {
-	uint32_t v1, v2;
-	int i;
+	char line[512];
 	FILE *f;
 
-	code_buf[code_pos++] = (1ULL << 35);	// insert FIN instruction
-
-	f = fopen(fname, "w");
+	src_name = fname;
+	f = fopen(fname, "r");
 	if (!f) {
-		fprintf(stderr, "%s: %s: %s\n", prgname, fname, strerror(errno));
+		fprintf(stderr, "%s: %s: %s\n", prgname, fname,
+			strerror(errno));
 		exit(1);
 	}
-
-	/* First write a magic word, so the target can check endianness */
-	v1 = 0x11223344;
-	fwrite(&v1, sizeof(v1), 1, f);
-
-	pfilter_dbg("Writing \"%s\"\n", fname);
-	for (i = 0; i < code_pos; i++) {
-		pfilter_dbg("   pos %02i: %x.%08x\n", i,
-			    (uint32_t)(code_buf[i] >> 32),
-			    (uint32_t)(code_buf[i]));
-		/* Explicitly write the LSB first */
-		v1 = code_buf[i];
-		v2 = code_buf[i] >> 32;
-		fwrite(&v1, sizeof(v1), 1, f);
-		fwrite(&v2, sizeof(v2), 1, f);
+	while (fgets(line, sizeof(line), f)) {
+		src_line++;
+		if (!strchr(line, '\n') && !feof(f))
+			pf_error("line too long");
+		parse_line(line);
 	}
 	fclose(f);
+	src_line = 0;
 }
 
-
-void pfilter_init_novlan(char *fname)
+/*
+ * Count the uses of what the outputs need, then merge an and/or in a
+ * parent of the same type if it has no other use: a & (b & c) is one
+ * node, so the comparisons may share a chain.
+ */
+static void count_uses(int n)
 {
-	pfilter_new();
-	pfilter_nop();
+	struct pf_node *p = nodes + n;
+	int i;
 
-	/*
-	 * Make three sets of comparisons over the destination address.
-	 * After these instructions, the whole Eth header is there
-	 */
+	if (p->uses++)
+		return;
+	p->est = p->type == N_CMP ? p->off : 0;
+	for (i = 0; i < p->nkids; i++) {
+		count_uses(p->kids[i]);
+		if (nodes[p->kids[i]].est > p->est)
+			p->est = nodes[p->kids[i]].est;
+	}
+}
 
-	/* Local frame, using fake MAC: 12:34:56:78:9a:bc */
-	pfilter_cmp(0, 0x1234, 0xffff, MOV, FRAME_MAC_OK);
-	pfilter_cmp(1, 0x5678, 0xffff, AND, FRAME_MAC_OK);
-	pfilter_cmp(2, 0x9abc, 0xffff, AND, FRAME_MAC_OK);
+static void merge_nodes(void)
+{
+	struct pf_node *p, *q;
+	int i, j, k, kids[PF_MAX_KIDS * PF_MAX_KIDS], n;
+
+	for (i = 0, p = nodes; i < n_nodes; i++, p++) {
+		if (!p->uses || (p->type != N_AND && p->type != N_OR))
+			continue;
+		for (j = n = 0; j < p->nkids; j++) {
+			q = nodes + p->kids[j];
+			if (q->type != p->type || q->uses != 1) {
+				kids[n++] = p->kids[j];
+				continue;
+			}
+			q->uses = 0;
+			for (k = 0; k < q->nkids; k++)
+				kids[n++] = q->kids[k];
+		}
+		/* a & a is a */
+		qsort(kids, n, sizeof(int), cmp_int);
+		for (j = k = 0; j < n; j++) {
+			if (k && kids[j] == kids[k - 1])
+				nodes[kids[j]].uses--;
+			else
+				kids[k++] = kids[j];
+		}
+		if (k > PF_MAX_KIDS)
+			pf_error("more than %i terms in an expression",
+				 PF_MAX_KIDS);
+		memcpy(p->kids, kids, k * sizeof(int));
+		p->nkids = k;
+	}
+}
 
-	/* Broadcast frame */
-	pfilter_cmp(0, 0xffff, 0xffff, MOV, FRAME_BROADCAST);
-	pfilter_cmp(1, 0xffff, 0xffff, AND, FRAME_BROADCAST);
-	pfilter_cmp(2, 0xffff, 0xffff, AND, FRAME_BROADCAST);
+/*
+ * Code generation. Instructions write values, that get registers at the
+ * end; value 0 is register 0, the outputs have their own register.
+ * Comparisons of a chain accumulate into one value in any order: the
+ * scheduler picks the order, and the first one gets MOV.
+ */
+struct pf_value {
+	int reg;
+	int cmp;		/* written by comparisons: registers 1-15 */
+	int est;		/* last word it needs */
+	int def, last;		/* live range, as addresses */
+};
+static struct pf_value values[PF_MAX_VALUES];
+static int n_values;
+
+struct pf_chain {
+	int op;			/* AND, OR or XOR */
+	int first_neg;		/* the first comparison is negated */
+	int neg;		/* the result is negated */
+	int done;		/* comparisons scheduled */
+};
+static struct pf_chain chains[PF_MAX_INSNS];
+static int n_chains;
+
+struct pf_insn {
+	int logic;
+	int op, op2;
+	int rd, ra, rb, rc;	/* values */
+	int node;		/* the comparison */
+	int chain;
+	int pin;		/* the address it must have, or 0 */
+	uint64_t deps;		/* instructions that must come before */
+	int height;		/* longest chain of dependents */
+	int pc;
+};
+static struct pf_insn insns[PF_MAX_INSNS];
+static int n_insns;
+static uint64_t writers[PF_MAX_VALUES];
+
+/* Operands of a logic operation: a value, or a pair "a op b" */
+struct pf_operand {
+	int a, op, b;		/* b < 0: just a */
+	int est;
+};
 
-	/* PTP UDP (end to end: 01:00:5e:00:01:81    224.0.1.129) */
-	pfilter_cmp(0, 0x0100, 0xffff, MOV, FRAME_MAC_PTP);
-	pfilter_cmp(1, 0x5e00, 0xffff, AND, FRAME_MAC_PTP);
-	pfilter_cmp(2, 0x0181, 0xffff, MOV, R_TMP);
+static int neg_op(int op)
+{
+	return op ^ 4; /* AND <-> NAND, OR <-> NOR, MOV <-> NOT... */
+}
 
-	/* PTP UDP (peer-to-p:  01:00:5e:00:00:6b    224.0.0.197) */
-	pfilter_cmp(2, 0x006b, 0xffff, OR, R_TMP);
+static int new_value(int cmp, int est)
+{
+	if (n_values == PF_MAX_VALUES)
+		pf_error("too many intermediate results");
+	values[n_values].cmp = cmp;
+	values[n_values].est = est;
+	return n_values++;
+}
 
-	pfilter_logic3(FRAME_MAC_OK, FRAME_MAC_PTP, AND, R_TMP, OR, FRAME_MAC_OK);
+static struct pf_insn *new_insn(void)
+{
+	if (n_insns == PF_MAX_INSNS)
+		pf_error("too many instructions");
+	return insns + n_insns++;
+}
 
-	/* Tagged is dropped. We'll invert the check in the vlan rule-set */
-	pfilter_cmp(6, 0x8100, 0xffff, MOV, R_TMP);
-	pfilter_logic2(R_DROP, R_TMP, MOV, R_ZERO);
+static void emit_cmp(int node, int value, int chain, uint64_t deps)
+{
+	struct pf_insn *i = new_insn();
+	struct pf_node *p = nodes + node;
+
+	i->node = node;
+	i->rd = value;
+	i->chain = chain;
+	i->deps = deps;
+	/* the firmware patches the local MAC address at 1, 2 and 3 */
+	if (p->special >= S_MAC0 && p->special <= S_MAC2)
+		i->pin = 1 + p->special - S_MAC0;
+	writers[value] |= 1ULL << (i - insns);
+}
 
-	/* Identify some Ethertypes used later -- type latency is 0xcafe */
-	pfilter_cmp(6, 0x88f7, 0xffff, MOV, FRAME_TYPE_PTP2);
-	pfilter_cmp(6, 0xcafe, 0xffff, OR, FRAME_TYPE_PTP2);
-	pfilter_cmp(6, 0x0800, 0xffff, MOV, FRAME_TYPE_IPV4);
-	pfilter_cmp(6, 0x0806, 0xffff, MOV, FRAME_TYPE_ARP);
+static int emit_logic(int rd, int ra, int op, int rb, int op2, int rc)
+{
+	struct pf_insn *i = new_insn();
+
+	i->logic = 1;
+	i->rd = rd;
+	i->ra = ra;
+	i->op = op;
+	i->rb = rb;
+	i->op2 = op2;
+	i->rc = rc;
+	i->chain = -1;
+	i->deps = writers[ra] | writers[rb] | writers[rc] | writers[rd];
+	writers[rd] |= 1ULL << (i - insns);
+	return i - insns;
+}
 
-	/* Mark one bits for ip-valid (unicast or broadcast) */
-	pfilter_logic3(FRAME_IP_OK, FRAME_BROADCAST, OR, FRAME_MAC_OK, AND, FRAME_TYPE_IPV4);
+static int gen_node(int n);
 
-	/* Ethernet = 14 bytes, Offset to type in IP: 8 bytes = 22/2 = 11 */
-	pfilter_cmp(11, 0x0001, 0x00ff, MOV, FRAME_ICMP);
-	pfilter_cmp(11, 0x0011, 0x00ff, MOV, FRAME_UDP);
-	pfilter_logic2(FRAME_UDP, FRAME_UDP, AND, FRAME_IP_OK);
+/* The comparison of a single-use leaf, or -1; *neg if under a not */
+static int leaf_of(int n, int *neg)
+{
+	struct pf_node *p = nodes + n;
 
-	/* For CPU: arp or icmp unicast or ptp (or latency) */
-	pfilter_logic2(FRAME_FOR_CPU, FRAME_TYPE_ARP, OR, FRAME_TYPE_PTP2);
-	pfilter_logic3(FRAME_FOR_CPU, FRAME_IP_OK, AND, FRAME_ICMP, OR, FRAME_FOR_CPU);
+	*neg = 0;
+	if (p->type == N_NOT && p->uses == 1 && p->value < 0) {
+		*neg = 1;
+		p = nodes + (n = p->kids[0]);
+	}
+	if (p->type == N_CMP && p->uses == 1 && p->value < 0)
+		return n;
+	return -1;
+}
 
-	/* Now look in UDP ports: at offset 18 (14 + 20 + 8 = 36) */
-	pfilter_cmp(18, 0x0000, 0xff00, MOV, PORT_UDP_HOST);	/* ports 0-255 */
-	pfilter_cmp(18, 0x0100, 0xff00, OR, PORT_UDP_HOST);	/* ports 256-511 */
+/* The and/or/xor of a single-use node, or -1; *neg if under a not */
+static int op_of(int n, int *neg)
+{
+	struct pf_node *p = nodes + n;
 
-	/* The CPU gets those ports in a proper UDP frame, plus the previous selections */
-	pfilter_logic3(R_CLASS(0), FRAME_UDP, AND, PORT_UDP_HOST, OR, FRAME_FOR_CPU);
+	*neg = 0;
+	if (p->type == N_NOT && p->uses == 1 && p->value < 0) {
+		*neg = 1;
+		p = nodes + (n = p->kids[0]);
+	}
+	if (p->type >= N_AND && p->uses == 1 && p->value < 0)
+		return n;
+	return -1;
+}
 
-	/* Etherbone is UDP at port 0xebd0, let's "or" in the last move */
-	pfilter_cmp(18, 0xebd0, 0xffff, MOV, PORT_UDP_ETHERBONE);
+static int collect(int n, int *neg, int dest, struct pf_operand *ops);
 
-	/* and now copy out fabric selections: 7 etherbone, 6 for anything else */
-	pfilter_logic2(R_CLASS(7), FRAME_UDP, AND, PORT_UDP_ETHERBONE);
-	pfilter_logic2(R_CLASS(6), FRAME_UDP, NAND, PORT_UDP_ETHERBONE);
+/*
+ * Combine the operands with the operation of node n into dest (a new
+ * value if < 0). Each instruction takes three values, or a pair and a
+ * value, or the previous result and two values or a pair.
+ */
+static int combine(int n, int neg, int dest, struct pf_operand *ops,
+		   int nops)
+{
+	struct pf_operand o, t;
+	int op = (int []){0, 0, AND, OR, XOR}[nodes[n].type];
+	int i, j, last = -1;
+
+	if (dest < 0)
+		dest = new_value(0, nodes[n].est);
+	/* first what arrives first */
+	for (i = 1; i < nops; i++)
+		for (j = i; j > 0 && ops[j].est < ops[j - 1].est; j--) {
+			t = ops[j];
+			ops[j] = ops[j - 1];
+			ops[j - 1] = t;
+		}
+	for (i = 0; i < nops; ) {
+		o = ops[i++];
+		if (o.b >= 0 && last >= 0) {
+			last = emit_logic(dest, o.a, o.op, o.b, op, dest);
+			continue;
+		}
+		if (o.b >= 0) {
+			/* a pair and the next single value, if any */
+			for (j = i; j < nops && ops[j].b >= 0; j++)
+				;
+			if (j == nops) {
+				last = emit_logic(dest, o.a, o.op, o.b, MOV, 0);
+				continue;
+			}
+			t = ops[j];
+			memmove(ops + j, ops + j + 1, (nops - j - 1) * sizeof(t));
+			nops--;
+			last = emit_logic(dest, o.a, o.op, o.b, op, t.a);
+			continue;
+		}
+		if (last >= 0) {
+			/* a pair that follows takes the next instruction */
+			if (i < nops && ops[i].b < 0)
+				last = emit_logic(dest, dest, op, o.a, op,
+						  ops[i++].a);
+			else
+				last = emit_logic(dest, dest, op, o.a, MOV, 0);
+			continue;
+		}
+		if (i + 1 < nops && ops[i].b < 0 && ops[i + 1].b < 0) {
+			last = emit_logic(dest, o.a, op, ops[i].a, op,
+					  ops[i + 1].a);
+			i += 2;
+		} else if (i < nops && ops[i].b < 0) {
+			last = emit_logic(dest, o.a, op, ops[i++].a, MOV, 0);
+		} else if (i < nops) {
+			last = emit_logic(dest, ops[i].a, ops[i].op, ops[i].b,
+					  op, o.a);
+			i++;
+		} else {
+			last = emit_logic(dest, o.a, MOV, 0, MOV, 0);
+		}
+	}
+	if (neg)
+		insns[last].op2 = neg_op(insns[last].op2);
+	return dest;
+}
 
-	/*
-	 * Note that earlier we used to be more strict in ptp ethtype (only proper multicast),
-	 * but since we want to accept peer-delay sooner than later, we'd better avoid the checks
-	 */
+/*
+ * The operands of node n: the single-use comparisons go in a chain, the
+ * single-use subexpressions of two operands become pairs, the rest are
+ * values. If all is a chain and dest is free, the chain is the result:
+ * then *neg is consumed and the return value is -1 - value.
+ */
+static int collect(int n, int *neg, int dest, struct pf_operand *ops)
+{
+	struct pf_node *p = nodes + n;
+	struct pf_operand sub[PF_MAX_KIDS + 1];
+	int leaves[PF_MAX_KIDS], nl = 0, negs[PF_MAX_KIDS], nn = 0;
+	int i, k, kneg, nops = 0, nsub, est = 0, v, c, first_neg = -1;
+	uint64_t deps = 0;
+
+	for (i = 0; i < p->nkids; i++) {
+		k = leaf_of(p->kids[i], &kneg);
+		if (k >= 0 && (!kneg || p->type == N_XOR)) {
+			*neg ^= kneg;
+			leaves[nl++] = k;
+			continue;
+		}
+		if (k >= 0) {
+			negs[nn++] = p->kids[i];
+			continue;
+		}
+		k = op_of(p->kids[i], &kneg);
+		if (k >= 0) {
+			nsub = collect(k, &kneg, -1, sub);
+			if (nsub == 2 && sub[0].b < 0 && sub[1].b < 0) {
+				ops[nops].a = sub[0].a;
+				ops[nops].b = sub[1].a;
+				ops[nops].op = (int []){0, 0, AND, OR, XOR}
+					[nodes[k].type];
+				if (kneg)
+					ops[nops].op = neg_op(ops[nops].op);
+				ops[nops++].est = nodes[k].est;
+				continue;
+			}
+			if (nsub < 0)
+				v = -1 - nsub;
+			else
+				v = combine(k, kneg, -1, sub, nsub);
+			nodes[k].value = v;
+		} else {
+			v = gen_node(p->kids[i]);
+		}
+		ops[nops].a = v;
+		ops[nops].b = -1;
+		ops[nops++].est = values[v].est;
+	}
 
 	/*
-	 * Also, please note that "streamer" ethtype 0xdbff and "etherbone" udp port 
-	 * 0xebd0 go to the fabric by being part of the "anything else" choice".
+	 * A negated comparison can start the chain (with NOT), if it doesn't
+	 * delay the others, nor the MAC address that has its own place
 	 */
-
-	pfilter_output(fname);
-
+	for (i = 0; i < nn; i++) {
+		k = nodes[negs[i]].kids[0];
+		if (first_neg < 0 || nodes[k].off < nodes[first_neg].off)
+			first_neg = k;
+	}
+	for (i = 0; i < nl && first_neg >= 0; i++)
+		if (nodes[leaves[i]].off < nodes[first_neg].off
+		    || nodes[leaves[i]].special == S_MAC0)
+			first_neg = -1;
+	for (i = 0; i < nn; i++) {
+		if (nodes[negs[i]].kids[0] == first_neg)
+			continue;
+		v = gen_node(negs[i]);
+		ops[nops].a = v;
+		ops[nops].b = -1;
+		ops[nops++].est = values[v].est;
+	}
+	if (!nl && first_neg < 0)
+		return nops;
+
+	/* the chain */
+	for (i = 0; i < nl; i++)
+		if (nodes[leaves[i]].est > est)
+			est = nodes[leaves[i]].est;
+	if (first_neg >= 0 && nodes[first_neg].est > est)
+		est = nodes[first_neg].est;
+	v = new_value(1, est);
+	c = n_chains++;
+	chains[c].op = (int []){0, 0, AND, OR, XOR}[p->type];
+	if (first_neg >= 0) {
+		chains[c].first_neg = 1;
+		emit_cmp(first_neg, v, c, 0);
+		deps = writers[v];
+	}
+	for (i = 0; i < nl; i++)
+		emit_cmp(leaves[i], v, c, deps);
+	if (!nops && dest < 0) {
+		chains[c].neg = *neg;
+		*neg = 0;
+		return -1 - v;
+	}
+	ops[nops].a = v;
+	ops[nops].b = -1;
+	ops[nops++].est = est;
+	return nops;
 }
 
-void pfilter_init_vlan(char *fname)
+/* Compute node n, with its own value or into dest */
+static int gen_op(int n, int neg, int dest)
 {
-	pfilter_new();
-	pfilter_nop();
+	struct pf_operand ops[PF_MAX_KIDS + 1];
+	int nops;
 
-	/*
-	 * This is a simplified set, for development,
-	 * to allow me write vlan support in software.
-	 * Mostly a subset of above set
-	 */
-
-	/* Local frame, using fake MAC: 12:34:56:78:9a:bc */
-	pfilter_cmp(0, 0x1234, 0xffff, MOV, FRAME_MAC_OK);
-	pfilter_cmp(1, 0x5678, 0xffff, AND, FRAME_MAC_OK);
-	pfilter_cmp(2, 0x9abc, 0xffff, AND, FRAME_MAC_OK);
+	nops = collect(n, &neg, dest, ops);
+	if (nops < 0)
+		return -1 - nops;
+	return combine(n, neg, dest, ops, nops);
+}
 
-	/* Broadcast frame */
-	pfilter_cmp(0, 0xffff, 0xffff, MOV, FRAME_BROADCAST);
-	pfilter_cmp(1, 0xffff, 0xffff, AND, FRAME_BROADCAST);
-	pfilter_cmp(2, 0xffff, 0xffff, AND, FRAME_BROADCAST);
+static int gen_node(int n)
+{
+	struct pf_node *p = nodes + n;
+	int k, kneg, v, c;
+
+	if (p->value >= 0)
+		return p->value;
+	if (p->type == N_CMP || (p->type == N_NOT && leaf_of(n, &kneg) >= 0)) {
+		/* a chain of one */
+		k = leaf_of(n, &kneg);
+		if (k < 0)
+			k = n;
+		v = new_value(1, nodes[k].est);
+		c = n_chains++;
+		chains[c].first_neg = kneg;
+		emit_cmp(k, v, c, 0);
+	} else if (p->type == N_NOT && op_of(n, &kneg) >= 0) {
+		v = gen_op(op_of(n, &kneg), 1, -1);
+	} else if (p->type == N_NOT) {
+		k = gen_node(p->kids[0]);
+		v = new_value(0, values[k].est);
+		emit_logic(v, k, NOT, 0, MOV, 0);
+	} else {
+		v = gen_op(n, 0, -1);
+	}
+	return p->value = v;
+}
 
-	/* PTP UDP (end to end: 01:00:5e:00:01:81    224.0.1.129) */
-	pfilter_cmp(0, 0x0100, 0xffff, MOV, FRAME_MAC_PTP);
-	pfilter_cmp(1, 0x5e00, 0xffff, AND, FRAME_MAC_PTP);
-	pfilter_cmp(2, 0x0181, 0xffff, MOV, R_TMP);
+static void gen_outputs(void)
+{
+	struct pf_node *p;
+	int r, n, v, kneg;
+
+	values[0].reg = 0;
+	n_values = 1;
+	/* first the and/or/xor, into their register: others may read it */
+	for (r = 0; r < PFILTER_R_CLASS(8); r++) {
+		if (!outputs[r])
+			continue;
+		n = outputs[r] - 1;
+		p = nodes + n;
+		if (p->type < N_AND || p->value >= 0)
+			continue;
+		v = new_value(0, p->est);
+		values[v].reg = r;
+		p->value = gen_op(n, 0, v);
+		outputs[r] = 0;
+	}
+	for (r = 0; r < PFILTER_R_CLASS(8); r++) {
+		if (!outputs[r])
+			continue;
+		n = outputs[r] - 1;
+		v = new_value(0, nodes[n].est);
+		values[v].reg = r;
+		if (op_of(n, &kneg) >= 0)
+			gen_op(op_of(n, &kneg), kneg, v);
+		else if (nodes[n].type == N_NOT)
+			emit_logic(v, gen_node(nodes[n].kids[0]), NOT, 0,
+				   MOV, 0);
+		else
+			emit_logic(v, gen_node(n), MOV, 0, MOV, 0);
+	}
+}
 
-	/* PTP UDP (peer-to-p:  01:00:5e:00:00:6b    224.0.0.197) */
-	pfilter_cmp(2, 0x006b, 0xffff, OR, R_TMP);
+/*
+ * List scheduling: at each address, of the instructions whose operands
+ * are ready (and whose word has arrived) take the one with the longest
+ * chain of dependents; a NOP if none.
+ */
+static int schedule(void)
+{
+	struct pf_insn *i, *best;
+	uint64_t done = 0;
+	int j, k, pc;
+
+	for (j = n_insns - 1; j >= 0; j--) {
+		i = insns + j;
+		i->height++;
+		for (k = 0; k < j; k++)
+			if (i->deps & (1ULL << k) && insns[k].height < i->height)
+				insns[k].height = i->height;
+	}
+	for (pc = 1; done != (n_insns == 64 ? ~0ULL : (1ULL << n_insns) - 1);
+	     pc++) {
+		best = NULL;
+		for (j = 0, i = insns; j < n_insns; j++, i++) {
+			if (done & (1ULL << j) || i->deps & ~done)
+				continue;
+			if (!i->logic && nodes[i->node].off > pc)
+				continue;
+			if (i->pin == pc) {
+				best = i;
+				break;
+			}
+			if (i->pin)
+				continue;
+			/* the firmware patches the latency ethtype if OR-ed */
+			if (!i->logic && nodes[i->node].special == S_LATENCY
+			    && !chains[i->chain].done)
+				continue;
+			if (!best || i->height > best->height)
+				best = i;
+		}
+		for (j = 0; pc <= 3 && j < n_insns; j++)
+			if (insns[j].pin == pc && insns + j != best)
+				pf_error("internal error: can't place the MAC");
+		if (!best && pc > PF_MAX_INSNS + PF_MAX_WORD)
+			pf_error("internal error: can't schedule");
+		if (!best)
+			continue;
+		best->pc = pc;
+		if (!best->logic)
+			chains[best->chain].done++;
+		done |= 1ULL << (best - insns);
+	}
+	return pc;
+}
 
-	pfilter_logic3(FRAME_MAC_OK, FRAME_MAC_PTP, AND, R_TMP, OR, FRAME_MAC_OK);
+/* Linear scan over the live ranges, comparisons need registers 1-15 */
+static int allocate(void)
+{
+	struct pf_insn *i;
+	struct pf_value *v;
+	int busy[PFILTER_R_GP_MAX + 1] = {0,}; /* value + 1 */
+	int j, k, r, max = 0;
+
+	for (k = 1; k < n_values; k++) {
+		values[k].def = PFILTER_MAX_CODE_SIZE;
+		values[k].last = 0;
+	}
+	for (j = 0, i = insns; j < n_insns; j++, i++) {
+		v = values + i->rd;
+		if (i->pc < v->def)
+			v->def = i->pc;
+		if (i->pc > v->last)
+			v->last = i->pc;
+		if (!i->logic)
+			continue;
+		for (k = 0; k < 3; k++) {
+			v = values + (k == 0 ? i->ra : k == 1 ? i->rb : i->rc);
+			if (i->pc > v->last)
+				v->last = i->pc;
+		}
+	}
+	for (j = 0; j < PFILTER_MAX_CODE_SIZE; j++) {
+		for (k = 1, v = values + 1; k < n_values; k++, v++) {
+			if (v->reg > PFILTER_R_GP_MAX || v->def != j)
+				continue;
+			/* what ends here can be overwritten here */
+			for (r = 1; r <= PFILTER_R_GP_MAX; r++)
+				if (busy[r] && values[busy[r] - 1].last <= j)
+					busy[r] = 0;
+			r = v->cmp ? 1 : PFILTER_R_CMP_MAX + 1;
+			for (; r <= PFILTER_R_GP_MAX && busy[r]; r++)
+				;
+			if (r > PFILTER_R_GP_MAX && !v->cmp)
+				for (r = 1; r <= PFILTER_R_CMP_MAX && busy[r];
+				     r++)
+					;
+			if (r > (v->cmp ? PFILTER_R_CMP_MAX
+				 : PFILTER_R_GP_MAX))
+				pf_error("out of registers");
+			busy[r] = k + 1;
+			v->reg = r;
+			if (r > max)
+				max = r;
+		}
+	}
+	return max;
+}
 
-	/* Untagged is dropped. */
-	pfilter_cmp(6, 0x8100, 0xffff, MOV, R_TMP);
-	pfilter_logic2(R_DROP, R_TMP, NOT, R_ZERO);
+static uint64_t encode(struct pf_insn *i)
+{
+	struct pf_node *p = nodes + i->node;
+	int rd = values[i->rd].reg;
+	uint64_t ir;
+	int k;
+
+	if (i->logic)
+		return PFILTER_LOGIC | (uint64_t)i->op
+			| (rd & 0xf) << 3 | (rd & 0x10) << 3
+			| values[i->ra].reg << 8 | values[i->rb].reg << 13
+			| values[i->rc].reg << 18 | (uint64_t)i->op2 << 23;
+	ir = (uint64_t)p->off << 7 | i->op | rd << 3
+		| (uint64_t)p->val << 13;
+	for (k = 0; k < 4; k++)
+		if (p->mask & (0xf << (4 * k)))
+			ir |= 1ULL << (29 + k);
+	return ir;
+}
 
-	/* Compare with our vlan (fake number 0xaaa) */
-	pfilter_cmp(7, 0x0aaa, 0x0fff, MOV, FRAME_OUR_VLAN);
+/* The ops of the comparisons, once the order of each chain is known */
+static void chain_ops(struct pf_insn **by_pc, int len)
+{
+	struct pf_chain *c;
+	struct pf_insn *i;
+	int pc, k, n[PF_MAX_INSNS] = {0,};
+
+	for (pc = 1; pc < len; pc++) {
+		if (!(i = by_pc[pc]) || i->logic)
+			continue;
+		c = chains + i->chain;
+		k = n[i->chain]++;
+		if (k == 0)
+			i->op = c->first_neg ? NOT : MOV;
+		else
+			i->op = c->op;
+		if (k == c->done - 1 && c->neg)
+			i->op = k ? neg_op(i->op) : (c->first_neg ? MOV : NOT);
+		if (nodes[i->node].special == S_LATENCY && i->op != OR)
+			pf_error("the latency ethertype must be or-ed with "
+				 "another test");
+		if (nodes[i->node].special == S_NONE
+		    && ((nodes[i->node].val == PFILTER_LATENCY_TYPE
+			 && i->op == OR)
+			|| (nodes[i->node].val == PFILTER_VLAN_NR
+			    && nodes[i->node].off == PFILTER_VLAN_OFFSET)))
+			pf_error("0x%x at word %i would be patched by the "
+				 "firmware", nodes[i->node].val,
+				 nodes[i->node].off);
+	}
+}
 
-	/* Identify some Ethertypes used later -- type latency is 0xcafe */
-	pfilter_cmp(8, 0x88f7, 0xffff, MOV, FRAME_TYPE_PTP2);
-	pfilter_cmp(8, 0xcafe, 0xffff, OR, FRAME_TYPE_PTP2);
-	pfilter_cmp(8, 0x0800, 0xffff, MOV, FRAME_TYPE_IPV4);
-	pfilter_cmp(8, 0x0806, 0xffff, MOV, FRAME_TYPE_ARP);
+/* Evaluate the rules themselves, to check the program */
+static int eval(int n, const uint8_t *frame)
+{
+	struct pf_node *p = nodes + n;
+	int i, v;
+
+	switch (p->type) {
+	case N_CMP:
+		return ((frame[2 * p->off] << 8 | frame[2 * p->off + 1])
+			& p->mask) == p->val;
+	case N_NOT:
+		return !eval(p->kids[0], frame);
+	}
+	v = eval(p->kids[0], frame);
+	for (i = 1; i < p->nkids; i++) {
+		if (p->type == N_AND)
+			v &= eval(p->kids[i], frame);
+		else if (p->type == N_OR)
+			v |= eval(p->kids[i], frame);
+		else
+			v ^= eval(p->kids[i], frame);
+	}
+	return v;
+}
 
-	/* Loose match: keep all bcast, all our mac and all ptp ... */
-	pfilter_logic3(FRAME_FOR_CPU,
-		FRAME_MAC_OK, OR, FRAME_BROADCAST, OR, FRAME_TYPE_PTP2);
+/* Random frames, made mostly of the words the rules look for */
+static void self_test(uint64_t *code, int len, int *out_nodes)
+{
+	uint8_t frame[PFILTER_MAX_CODE_SIZE * 2];
+	int i, j, k, w, want, got, cand[PF_MAX_NODES], nc;
+
+	srand(1);
+	for (i = 0; i < 20000; i++) {
+		for (w = 0; w < PFILTER_MAX_CODE_SIZE; w++) {
+			for (j = nc = 0; j < n_nodes; j++)
+				if (nodes[j].type == N_CMP
+				    && nodes[j].off == w)
+					cand[nc++] = j;
+			k = rand() & 0xffff;
+			if (nc && rand() % 4) {
+				j = cand[rand() % nc];
+				k = nodes[j].val | (k & ~nodes[j].mask);
+			}
+			frame[2 * w] = k >> 8;
+			frame[2 * w + 1] = k;
+		}
+		for (j = want = 0; j < PFILTER_R_CLASS(8); j++)
+			if (out_nodes[j] && eval(out_nodes[j] - 1, frame))
+				want |= j == PFILTER_R_DROP ? PFILTER_DROP
+					: 1 << (j - PFILTER_R_CLASS(0));
+		got = pfilter_run(code, len, frame, sizeof(frame));
+		if (got != want)
+			pf_error("internal error: the program gives 0x%x, "
+				 "the rules 0x%x", got, want);
+	}
+}
 
-	/* .... but only for our current VLAN */
-	pfilter_logic2(R_CLASS(0), FRAME_FOR_CPU, AND, FRAME_OUR_VLAN);
+static void pfilter_output(char *fname, uint64_t *code, int len)
+{
+	uint32_t v1, v2;
+	int i;
+	FILE *f;
 
-	/*
-	 * And route these build-time selected vlans to fabric 7 and 6.
-	 * Class 7 is etherbone and class 6 is streamer or nic (or whatever).
-	 * We get all broadcast and all frames for our mac.
-	 *
-	 * We reuse FRAME_OUR_VLAN, even if it's not OUR as in "this CPU"
-	 */
-	pfilter_logic2(R_TMP, FRAME_MAC_OK, OR, FRAME_BROADCAST);
+	f = fopen(fname, "w");
+	if (!f) {
+		fprintf(stderr, "%s: %s: %s\n", prgname, fname, strerror(errno));
+		exit(1);
+	}
 
-	pfilter_cmp(7, CONFIG_VLAN_1_FOR_CLASS7, 0x0fff, MOV, FRAME_OUR_VLAN);
-	pfilter_cmp(7, CONFIG_VLAN_2_FOR_CLASS7, 0x0fff, OR, FRAME_OUR_VLAN);
-	pfilter_logic2(R_CLASS(7), R_TMP, AND, FRAME_OUR_VLAN);
+	/* First write a magic word, so the target can check endianness */
+	v1 = PFILTER_MAGIC;
+	fwrite(&v1, sizeof(v1), 1, f);
 
-	pfilter_cmp(7, CONFIG_VLAN_FOR_CLASS6, 0x0fff, MOV, FRAME_OUR_VLAN);
-	pfilter_logic2(R_CLASS(6), R_TMP, AND, FRAME_OUR_VLAN);
+	for (i = 0; i < len; i++) {
+		/* Explicitly write the LSB first */
+		v1 = code[i];
+		v2 = code[i] >> 32;
+		fwrite(&v1, sizeof(v1), 1, f);
+		fwrite(&v2, sizeof(v2), 1, f);
+	}
+	fclose(f);
+}
 
-	pfilter_output(fname);
+static void help(void)
+{
+	fprintf(stderr, "%s [options] <rules>\n", prgname);
+	fprintf(stderr, "  -o <file>      output file (default: the rules "
+		"file name, with .bin, here)\n");
+	fprintf(stderr, "  -v             report the size of the program\n");
 }
 
-int main(int argc, char **argv) /* no arguments used currently */
+int main(int argc, char **argv)
 {
+	struct pf_insn *by_pc[PFILTER_MAX_CODE_SIZE] = {NULL,};
+	uint64_t code[PFILTER_MAX_CODE_SIZE];
+	int out_nodes[PFILTER_R_CLASS(8)];
+	int c, i, len, regs, verbose = 0;
+	char *out = NULL, *s;
+
 	prgname = argv[0];
+	while ((c = getopt(argc, argv, "o:v")) != -1) {
+		switch (c) {
+		case 'o':
+			out = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			help();
+			exit(1);
+		}
+	}
+	if (optind + 1 != argc) {
+		help();
+		exit(1);
+	}
+	parse_file(argv[optind]);
+	if (!out) {
+		s = strrchr(argv[optind], '/');
+		out = malloc(strlen(argv[optind]) + 5);
+		strcpy(out, s ? s + 1 : argv[optind]);
+		if ((s = strrchr(out, '.')))
+			*s = '\0';
+		strcat(out, ".bin");
+	}
 
-	pfilter_init_novlan("rules-novlan.bin");
-	pfilter_init_vlan("rules-vlan.bin");
+	memcpy(out_nodes, outputs, sizeof(outputs));
+	for (i = 0; i < PFILTER_R_CLASS(8); i++)
+		if (outputs[i])
+			count_uses(outputs[i] - 1);
+	for (i = 0; i < n_nodes; i++)
+		if (nodes[i].uses && nodes[i].special == S_MAC0)
+			break;
+	if (i == n_nodes)
+		pf_error("the rules must use \"dst == local\": "
+			 "the firmware checks it");
+	merge_nodes();
+	gen_outputs();
+
+	len = schedule();
+	if (len >= PFILTER_MAX_CODE_SIZE)
+		pf_error("the program needs %i instructions, max is %i", len,
+			 PFILTER_MAX_CODE_SIZE - 1);
+	regs = allocate();
+	for (i = 0; i < n_insns; i++)
+		by_pc[insns[i].pc] = insns + i;
+	chain_ops(by_pc, len);
+	for (i = 0; i < len; i++)
+		code[i] = by_pc[i] ? encode(by_pc[i]) : PFILTER_LOGIC; /* NOP */
+	code[len++] = PFILTER_FIN;
+
+	if (pfilter_check(code, len) != len - 1)
+		pf_error("internal error: invalid program");
+	self_test(code, len, out_nodes);
+	pfilter_output(out, code, len);
+	if (verbose)
+		fprintf(stderr, "%s: %i instructions (max %i), registers "
+			"up to %i\n", out, len, PFILTER_MAX_CODE_SIZE, regs);
 	exit(0);
 }
@@ -0,0 +1,391 @@
+/*
+ * Runs a packet-filter rule-set (rules-*.bin, by pfilter-builder) over
+ * the frames of a pcap file, with the model of lib/pfilter.c, to tell
+ * which classes each frame gets. It can patch the placeholders like
+ * dev/ep_pfilter.c does, and check the classes against what is expected.
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+
+#include <endpoint.h>
+#include <pfilter.h>
+
+#define SIM_MAX_FRAME	65536
+#define SIM_MAX_EXPECT	4096
+
+static char *prgname;
+static uint64_t code[PFILTER_MAX_CODE_SIZE];
+static int code_len;
+
+/* Expected classes: per frame, from -e, or for all frames, from -c */
+static struct expect {
+	unsigned long frame;
+	int classes;
+} expect[SIM_MAX_EXPECT];
+static int n_expect, all_classes = -1;
+
+static uint32_t swap32(uint32_t v)
+{
+	return __builtin_bswap32(v);
+}
+
+static void load_rules(char *fname)
+{
+	uint32_t v[2 * PFILTER_MAX_CODE_SIZE + 1];
+	int i, n, swap;
+	FILE *f;
+
+	f = fopen(fname, "r");
+	if (!f) {
+		fprintf(stderr, "%s: %s: %s\n", prgname, fname, strerror(errno));
+		exit(1);
+	}
+	n = fread(v, sizeof(v[0]), sizeof(v) / sizeof(v[0]), f);
+	fclose(f);
+	/* the magic number tells the byte order of the builder */
+	swap = n > 0 && v[0] == swap32(PFILTER_MAGIC);
+	if (n < 3 || (v[0] != PFILTER_MAGIC && !swap) || !(n & 1)) {
+		fprintf(stderr, "%s: %s: not a rule-set\n", prgname, fname);
+		exit(1);
+	}
+	for (i = 0; i < n / 2; i++) {
+		if (swap)
+			code[i] = swap32(v[2 * i + 1]) | (uint64_t)swap32(v[2 * i + 2]) << 32;
+		else
+			code[i] = v[2 * i + 1] | (uint64_t)v[2 * i + 2] << 32;
+	}
+	code_len = pfilter_check(code, n / 2);
+	if (code_len < 0) {
+		fprintf(stderr, "%s: %s: invalid instruction at %i\n",
+			prgname, fname, -1 - code_len);
+		exit(1);
+	}
+}
+
+static void set_value(int pc, int value)
+{
+	code[pc] &= ~(0xffffULL << 13);
+	code[pc] |= (uint64_t)value << 13;
+}
+
+/* Like ep_pfilter.c: the MAC address, the latency ethtype and the vlan */
+static void patch_rules(uint8_t *mac, int ethtype, int vlan)
+{
+	uint64_t ir;
+	int i;
+
+	if (mac) {
+		for (i = 0; i < 3; i++) {
+			if (i + 1 >= code_len
+			    || PFILTER_CMP_VALUE(code[i + 1])
+			    != (int []){PFILTER_MAC_0, PFILTER_MAC_1,
+					PFILTER_MAC_2}[i]) {
+				fprintf(stderr, "%s: no MAC address to patch\n",
+					prgname);
+				exit(1);
+			}
+			set_value(i + 1, mac[2 * i] << 8 | mac[2 * i + 1]);
+		}
+	}
+	for (i = 0; i < code_len; i++) {
+		ir = code[i];
+		if (ir & PFILTER_LOGIC)
+			continue;
+		if (ethtype >= 0 && PFILTER_CMP_VALUE(ir) == PFILTER_LATENCY_TYPE
+		    && PFILTER_OP(ir) == OR)
+			set_value(i, ethtype);
+		if (vlan >= 0 && PFILTER_CMP_VALUE(ir) == PFILTER_VLAN_NR
+		    && PFILTER_CMP_OFFSET(ir) == PFILTER_VLAN_OFFSET)
+			set_value(i, vlan);
+	}
+}
+
+/* The shell commands to upload the rule-set, before any patching */
+static void shell_commands(void)
+{
+	uint32_t v[PFILTER_MAX_WORDS];
+	int i, j, n = 2 * code_len + 3;
+
+	v[0] = PFILTER_MAGIC;
+	for (i = 0; i <= code_len; i++) {
+		v[2 * i + 1] = code[i];
+		v[2 * i + 2] = code[i] >> 32;
+	}
+	printf("pfilter new\n");
+	for (i = 0; i < n; i += 6) {
+		printf("pfilter word %i", i);
+		for (j = i; j < n && j < i + 6; j++)
+			printf(" %x", v[j]);
+		printf("\n");
+	}
+	printf("pfilter apply\n");
+}
+
+static void disassemble(void)
+{
+	static char *ops[] = {"and", "or", "xor", "mov", "nand", "nor",
+			      "xnor", "not"};
+	uint64_t ir;
+	int pc, i, mask;
+
+	for (pc = 0; pc <= code_len; pc++) {
+		ir = code[pc];
+		printf("%02i: %x.%08x  ", pc, (unsigned)(ir >> 32),
+		       (unsigned)ir);
+		if (ir & PFILTER_FIN) {
+			printf("fin\n");
+		} else if (ir == PFILTER_LOGIC) {
+			printf("nop\n");
+		} else if (ir & PFILTER_LOGIC) {
+			printf("r%i = (r%i %s r%i) %s r%i\n",
+			       PFILTER_LOGIC_RD(ir), PFILTER_LOGIC_RA(ir),
+			       ops[PFILTER_OP(ir)], PFILTER_LOGIC_RB(ir),
+			       ops[PFILTER_LOGIC_OP2(ir)], PFILTER_LOGIC_RC(ir));
+		} else {
+			for (i = 0, mask = 0; i < 4; i++)
+				if (PFILTER_CMP_NIBBLES(ir) & (1 << i))
+					mask |= 0xf << (4 * i);
+			printf("r%i = r%i %s (w%i/%04x == %04x)\n",
+			       PFILTER_CMP_RD(ir), PFILTER_CMP_RD(ir),
+			       ops[PFILTER_OP(ir)], PFILTER_CMP_OFFSET(ir),
+			       mask, PFILTER_CMP_VALUE(ir) & mask);
+		}
+	}
+}
+
+/* Classes as a bit mask, or "drop" */
+static int parse_classes(char *s)
+{
+	char *end;
+	int v;
+
+	if (!strcmp(s, "drop"))
+		return PFILTER_DROP;
+	v = strtol(s, &end, 0);
+	if (*end || v < 0 || v > 0xff)
+		return -1;
+	return v;
+}
+
+static void load_expect(char *fname)
+{
+	char line[128], cls[32];
+	unsigned long frame;
+	int n = 0;
+	FILE *f;
+
+	f = fopen(fname, "r");
+	if (!f) {
+		fprintf(stderr, "%s: %s: %s\n", prgname, fname, strerror(errno));
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		n++;
+		if (line[0] == '#' || line[strspn(line, " \t\n")] == '\0')
+			continue;
+		if (n_expect == SIM_MAX_EXPECT) {
+			fprintf(stderr, "%s: %s: too many frames\n", prgname,
+				fname);
+			exit(1);
+		}
+		if (sscanf(line, "%lu %31s", &frame, cls) != 2
+		    || parse_classes(cls) < 0) {
+			fprintf(stderr, "%s: %s:%i: expected "
+				"\"<frame> <classes>|drop\"\n",
+				prgname, fname, n);
+			exit(1);
+		}
+		expect[n_expect].frame = frame;
+		expect[n_expect++].classes = parse_classes(cls);
+	}
+	fclose(f);
+}
+
+/* What is expected of a frame, -1 if nothing */
+static int expected(unsigned long frame)
+{
+	int i;
+
+	for (i = 0; i < n_expect; i++)
+		if (expect[i].frame == frame)
+			return expect[i].classes;
+	return all_classes;
+}
+
+static void print_classes(int classes)
+{
+	if (classes & PFILTER_DROP)
+		printf("drop");
+	else
+		printf("0x%02x", classes);
+}
+
+static void help(void)
+{
+	fprintf(stderr, "%s [options] <rules.bin> [<file.pcap>]\n", prgname);
+	fprintf(stderr, "  -d             disassemble the rule-set\n");
+	fprintf(stderr, "  -s             print the shell commands to "
+		"upload it\n");
+	fprintf(stderr, "  -m <mac>       MAC address to patch in "
+		"(aa:bb:cc:dd:ee:ff)\n");
+	fprintf(stderr, "  -v <vlan>      vlan number to patch in\n");
+	fprintf(stderr, "  -l <ethtype>   latency ethtype to patch in\n");
+	fprintf(stderr, "  -p             print the classes of each frame\n");
+	fprintf(stderr, "  -e <file>      expected classes: lines of "
+		"\"<frame> <mask>|drop\"\n");
+	fprintf(stderr, "  -c <mask>|drop expected classes of all frames\n");
+	fprintf(stderr, "Frames with class bits 0x0f go to the CPU, the others "
+		"to the fabric;\nframes are numbered from 1\n");
+}
+
+int main(int argc, char *argv[])
+{
+	uint8_t macaddr[6], *mac = NULL, *frame;
+	uint32_t hdr[6], rec[4];
+	unsigned long n = 0, dropped = 0, cpu = 0, fabric = 0, errors = 0;
+	unsigned long hits[8] = {0,};
+	int c, i, swap, got, want, len;
+	int dis = 0, shell = 0, print = 0, vlan = -1, ethtype = -1;
+	FILE *f;
+
+	prgname = argv[0];
+	while ((c = getopt(argc, argv, "dsm:v:l:pe:c:")) != -1) {
+		switch (c) {
+		case 'd':
+			dis = 1;
+			break;
+		case 's':
+			shell = 1;
+			break;
+		case 'm':
+			if (sscanf(optarg, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+				   macaddr, macaddr + 1, macaddr + 2,
+				   macaddr + 3, macaddr + 4, macaddr + 5) != 6) {
+				fprintf(stderr, "%s: wrong MAC \"%s\"\n",
+					prgname, optarg);
+				exit(1);
+			}
+			mac = macaddr;
+			break;
+		case 'v':
+			vlan = strtol(optarg, NULL, 0) & 0xfff;
+			break;
+		case 'l':
+			ethtype = strtol(optarg, NULL, 0) & 0xffff;
+			break;
+		case 'p':
+			print = 1;
+			break;
+		case 'e':
+			load_expect(optarg);
+			break;
+		case 'c':
+			all_classes = parse_classes(optarg);
+			if (all_classes < 0) {
+				help();
+				exit(1);
+			}
+			break;
+		default:
+			help();
+			exit(1);
+		}
+	}
+	if (optind >= argc || optind + 2 < argc
+	    || (optind + 1 == argc && !dis && !shell)) {
+		help();
+		exit(1);
+	}
+	load_rules(argv[optind]);
+	if (shell)
+		shell_commands();
+	patch_rules(mac, ethtype, vlan);
+	if (dis)
+		disassemble();
+	if (optind + 1 == argc)
+		exit(0);
+
+	f = fopen(argv[optind + 1], "r");
+	if (!f) {
+		fprintf(stderr, "%s: %s: %s\n", prgname, argv[optind + 1],
+			strerror(errno));
+		exit(1);
+	}
+	/* classic pcap, microseconds or nanoseconds, any byte order */
+	if (fread(hdr, sizeof(hdr), 1, f) != 1) {
+		fprintf(stderr, "%s: %s: short file\n", prgname,
+			argv[optind + 1]);
+		exit(1);
+	}
+	swap = hdr[0] == 0xd4c3b2a1 || hdr[0] == 0x4d3cb2a1;
+	if (!swap && hdr[0] != 0xa1b2c3d4 && hdr[0] != 0xa1b23c4d) {
+		fprintf(stderr, "%s: %s: not a pcap file\n", prgname,
+			argv[optind + 1]);
+		exit(1);
+	}
+	if ((swap ? swap32(hdr[5]) : hdr[5]) != 1 /* ethernet */) {
+		fprintf(stderr, "%s: %s: not an ethernet capture\n", prgname,
+			argv[optind + 1]);
+		exit(1);
+	}
+	frame = malloc(SIM_MAX_FRAME);
+	if (!frame) {
+		perror("malloc");
+		exit(1);
+	}
+
+	while (fread(rec, sizeof(rec), 1, f) == 1) {
+		len = swap ? swap32(rec[2]) : rec[2]; /* captured length */
+		if (len > SIM_MAX_FRAME || fread(frame, 1, len, f) != len) {
+			fprintf(stderr, "%s: %s: truncated frame %lu\n",
+				prgname, argv[optind + 1], n + 1);
+			break;
+		}
+		n++;
+		got = pfilter_run(code, code_len, frame, len);
+		if (got & PFILTER_DROP) {
+			got = PFILTER_DROP; /* the classes don't matter */
+			dropped++;
+		} else {
+			for (i = 0; i < 8; i++)
+				if (got & (1 << i))
+					hits[i]++;
+			/* the MUX: the CPU first, the fabric is the default */
+			if (got & 0x0f)
+				cpu++;
+			else
+				fabric++;
+		}
+		want = expected(n);
+		if (print || (want >= 0 && want != got)) {
+			printf("%6lu: ", n);
+			print_classes(got);
+			if (!(got & PFILTER_DROP))
+				printf(got & 0x0f ? " cpu" : " fabric");
+			if (want >= 0 && want != got) {
+				printf(", expected ");
+				print_classes(want);
+				errors++;
+			}
+			printf("\n");
+		}
+	}
+	fclose(f);
+	free(frame);
+
+	printf("frames: %lu, dropped: %lu, to cpu: %lu, to fabric: %lu\n",
+	       n, dropped, cpu, fabric);
+	for (i = 0; i < 8; i++)
+		if (hits[i])
+			printf("class %i: %lu\n", i, hits[i]);
+	if (n_expect || all_classes >= 0)
+		printf("mismatches: %lu\n", errors);
+	exit(errors ? 1 : 0);
+}
@@ -0,0 +1,217 @@
+/*
+ * Lock time versus jitter of a SoftPLL loop, using the PI controller and
+ * the lock detector of softpll/spll_common.c on a simple model: a VCXO
+ * whose frequency follows the DAC, and a phase detector with white noise.
+ * One sample is one tag (2^HPLL_N reference cycles); phases are in DMTD
+ * units (1/2^HPLL_N of a reference period).
+ *
+ * For each number of gain-scheduling stages, the loop is started many
+ * times with a random frequency offset and phase, and the tool reports
+ * the lock time and the phase error once locked.
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "softpll_ng.h"
+
+/* What spll_common.c needs, apart from the PI and the lock detector */
+volatile struct SPLL_WB *SPLL;
+int spll_n_chan_ref;
+
+void __debug_printf(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+/* The gains and lock detectors of spll_helper.c and spll_main.c (node) */
+static struct loop {
+	char *name;
+	int kp, ki, bias, y_min, y_max, clamp;
+	int threshold, lock_samples, delock_samples;
+} loops[] = {
+	{"helper", -150, -2, 5, 5, (1 << DAC_BITS) - 5, HELPER_ERROR_CLAMP,
+	 200, 10000, 100},
+	{"main", -1100, -30, 30000, 5, 65530, 0,
+	 1200, 1000, 100},
+};
+
+/* Model parameters */
+static double pull_ppm = 20;	/* +- tuning range of the VCXO */
+static double offset_ppm = 10;	/* +- initial frequency offset */
+static double noise = 2;	/* phase detector noise, rms units */
+static double tag_hz = REF_CLOCK_FREQ_HZ / (1 << HPLL_N);
+static int trials = 200, track = 20000, timeout = 2000000;
+
+/* Units per sample for 1 ppm of frequency error */
+#define PPM_UNITS (1e-6 * (1 << HPLL_N) * (1 << HPLL_N))
+
+static double gauss(void)
+{
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+struct result {
+	int lock;	/* samples, -1 if never locked */
+	double rms;	/* phase error after lock, units */
+	double pk;	/* peak phase error after lock, units */
+};
+
+static void run(struct loop *l, int stages, struct result *r)
+{
+	spll_pi_t pi;
+	spll_lock_det_t ld;
+	/* the VCXO runs at offset + kv * (y - bias), in units per sample */
+	double kv = pull_ppm * 2 / (1 << DAC_BITS) * PPM_UNITS;
+	double offset, phase, e2 = 0;
+	int n, err, y, locked_at = -1;
+
+	memset(&pi, 0, sizeof(pi));
+	memset(&ld, 0, sizeof(ld));
+	pi.kp = l->kp;
+	pi.ki = l->ki;
+	pi.bias = l->bias;
+	pi.y_min = l->y_min;
+	pi.y_max = l->y_max;
+	pi.anti_windup = 1;
+	ld.threshold = l->threshold;
+	ld.lock_samples = l->lock_samples;
+	ld.delock_samples = l->delock_samples;
+	pi_set_stages(&pi, &ld, stages);
+	pi_init(&pi);
+	ld_init(&ld);
+
+	if (l->kp < 0)
+		kv = -kv;
+	/* the helper starts at the end of the range, like helper_start() */
+	offset = (2.0 * rand() / RAND_MAX - 1) * offset_ppm * PPM_UNITS;
+	if (l->bias == l->y_min)
+		offset -= kv * (1 << (DAC_BITS - 1));
+	phase = (double)rand() / RAND_MAX * (1 << HPLL_N);
+	y = pi.y;
+
+	r->pk = 0;
+	for (n = 0; n < timeout; n++) {
+		phase += offset + kv * (y - l->bias);
+		err = lrint(phase + noise * gauss());
+		if (l->clamp && err > l->clamp)
+			err = l->clamp;
+		if (l->clamp && err < -l->clamp)
+			err = -l->clamp;
+		/* error = reference - output: the VCXO moves "phase" away */
+		pi_schedule(&pi, &ld);
+		y = pi_update(&pi, -err);
+		ld_update(&ld, -err);
+		if (locked_at < 0) {
+			if (ld.locked)
+				locked_at = n;
+			continue;
+		}
+		e2 += phase * phase;
+		if (fabs(phase) > r->pk)
+			r->pk = fabs(phase);
+		if (n - locked_at >= track)
+			break;
+	}
+	r->lock = locked_at;
+	r->rms = locked_at < 0 ? 0 : sqrt(e2 / track);
+}
+
+static void help(char *prog)
+{
+	fprintf(stderr, "%s [options] helper|main\n", prog);
+	fprintf(stderr, "  -s <stages>    only this number of stages\n");
+	fprintf(stderr, "  -n <trials>    runs for each case (default %i)\n",
+		trials);
+	fprintf(stderr, "  -f <ppm>       max initial frequency offset (%g)\n",
+		offset_ppm);
+	fprintf(stderr, "  -p <ppm>       VCXO pull range, +- (%g)\n",
+		pull_ppm);
+	fprintf(stderr, "  -j <units>     phase detector noise, rms (%g)\n",
+		noise);
+	fprintf(stderr, "  -r <seed>      random seed\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct loop *l = NULL;
+	struct result r;
+	int c, i, s, smin = 0, smax = SPLL_PI_MAX_STAGES, fail;
+	double lsum, lmax, rms, pk, unit_ps;
+
+	while ((c = getopt(argc, argv, "s:n:f:p:j:r:h")) != -1) {
+		switch (c) {
+		case 's':
+			smin = smax = atoi(optarg);
+			break;
+		case 'n':
+			trials = atoi(optarg);
+			break;
+		case 'f':
+			offset_ppm = atof(optarg);
+			break;
+		case 'p':
+			pull_ppm = atof(optarg);
+			break;
+		case 'j':
+			noise = atof(optarg);
+			break;
+		case 'r':
+			srand(atoi(optarg));
+			break;
+		default:
+			help(argv[0]);
+			exit(1);
+		}
+	}
+	for (i = 0; optind < argc && i < sizeof(loops) / sizeof(loops[0]); i++)
+		if (!strcmp(argv[optind], loops[i].name))
+			l = loops + i;
+	if (optind + 1 != argc || !l) {
+		help(argv[0]);
+		exit(1);
+	}
+	unit_ps = (double)REF_CLOCK_PERIOD_PS / (1 << HPLL_N);
+
+	printf("%s loop: kp %i ki %i, lock after %i samples within +-%i\n",
+	       l->name, l->kp, l->ki, l->lock_samples, l->threshold);
+	printf("stages   lock ms (avg/max)   fail   rms ps   peak ps\n");
+	for (s = smin; s <= smax; s++) {
+		lsum = lmax = rms = pk = 0;
+		fail = 0;
+		for (i = 0; i < trials; i++) {
+			run(l, s, &r);
+			if (r.lock < 0) {
+				fail++;
+				continue;
+			}
+			lsum += r.lock;
+			if (r.lock > lmax)
+				lmax = r.lock;
+			rms += r.rms;
+			if (r.pk > pk)
+				pk = r.pk;
+		}
+		if (fail == trials) {
+			printf("%6i   never locked\n", s);
+			continue;
+		}
+		i = trials - fail;
+		printf("%6i   %8.1f %8.1f   %4i   %6.2f   %7.2f\n", s,
+		       lsum / i * 1000 / tag_hz, lmax * 1000 / tag_hz, fail,
+		       rms / i * unit_ps, pk * unit_ps);
+	}
+	return 0;
+}
@@ -0,0 +1,312 @@
+/*
+ * Reference switchover of the SoftPLL in slave mode, simulated with the
+ * helper and main loops of softpll/spll_helper.c and spll_main.c, and
+ * spll_switch_reference() of softpll_ng.c, on register stubs: two
+ * reference channels from the same grandmaster, with a random phase
+ * offset between them, and two VCXOs (DMTD and output) whose frequency
+ * follows their DAC. One sample is one tag (2^HPLL_N reference cycles);
+ * phases are in DMTD units (1/2^HPLL_N of a reference period).
+ *
+ * Once locked to channel 0, the PLL moves to channel 1 either with
+ * spll_switch_reference() (hitless) or by locking again from scratch, as
+ * after spll_init() (relock), and the tool reports the time error of the
+ * output against its phase before the switch: the peak over the window
+ * and the value at its end.
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "softpll_ng.h"
+
+#define OUT_CHANNEL 2
+
+/* What softpll_ng.c and the loops need from the rest of the firmware */
+static struct SPLL_WB spll_regs;
+#ifndef BASE_SOFTPLL /* wrc: found through SDB, wrs: fixed addresses */
+unsigned char *BASE_SOFTPLL, *BASE_PPS_GEN;
+#endif
+extern volatile struct softpll_state softpll;
+static struct softpll_state *sp = (struct softpll_state *)&softpll;
+struct spll_stats stats;
+uint32_t telemetry_mask;
+static int verbose;
+
+static struct model {
+	double dmtd, out;	/* phase of the VCXOs */
+	double ref[OUT_CHANNEL];
+	double off_dmtd, off_out; /* free-running frequency */
+	double kv_dmtd, kv_out;	/* units per sample per DAC step */
+	long n;
+} m;
+
+void disable_irq(void)
+{
+}
+
+void enable_irq(void)
+{
+}
+
+uint32_t timer_get_tics(void)
+{
+	return m.n * TICS_PER_SECOND / (REF_CLOCK_FREQ_HZ >> HPLL_N);
+}
+
+void __telemetry_put(int channel, int32_t value)
+{
+}
+
+uint32_t __div64_32(uint64_t *n, uint32_t base)
+{
+	uint32_t rem = *n % base;
+
+	*n /= base;
+	return rem;
+}
+
+void __debug_printf(const char *fmt, ...)
+{
+	va_list args;
+
+	if (!verbose)
+		return;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+int pp_printf(const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	ret = vprintf(fmt, args);
+	va_end(args);
+	return ret;
+}
+
+/* Model parameters */
+static double pull_ppm = 20;	/* +- tuning range of the VCXOs */
+static double offset_ppm = 10;	/* +- frequency offset of the VCXOs */
+static double noise = 2;	/* phase detector noise, rms units */
+static double tag_hz = REF_CLOCK_FREQ_HZ / (1 << HPLL_N);
+static int trials = 50, window_ms = 2000, timeout = 2000000;
+
+/* Units per sample for 1 ppm of frequency error */
+#define PPM_UNITS (1e-6 * (1 << HPLL_N) * (1 << HPLL_N))
+
+static double gauss(void)
+{
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static int tag(double phase)
+{
+	return lrint(m.n * (1 << HPLL_N) + m.dmtd - phase + noise * gauss())
+		& ((1 << TAG_BITS) - 1);
+}
+
+/* One sample: the tags of the enabled channels, like _irq_entry() */
+static void step(void)
+{
+	int i, t;
+
+	for (i = 0; i <= OUT_CHANNEL; i++) {
+		if (i < OUT_CHANNEL && !(SPLL->RCER & (1 << i)))
+			continue;
+		if (i == OUT_CHANNEL && !(SPLL->OCER & 1))
+			continue;
+		t = tag(i < OUT_CHANNEL ? m.ref[i] : m.out);
+		helper_update(&sp->helper, t, i);
+		if (sp->helper.ld.locked)
+			mpll_update(&sp->mpll, t, i);
+	}
+	m.dmtd += m.off_dmtd + m.kv_dmtd * (sp->helper.pi.y - (1 << 15));
+	if (sp->mpll.enabled)
+		m.out += m.off_out + m.kv_out * (sp->mpll.pi.y - (1 << 15));
+	else
+		m.out += m.off_out + m.kv_out * (sp->mpll.pi.bias - (1 << 15));
+	m.n++;
+}
+
+/*
+ * spll_init() and the sequencing: helper first, then the main loop. The
+ * sequencer of _irq_entry() reads the tag FIFO, so it is replayed here.
+ */
+static int relock(int ref)
+{
+	int n;
+
+	SPLL->RCER = SPLL->OCER = 0;
+	sp->mode = SPLL_MODE_SLAVE;
+	sp->seq_state = SEQ_START_HELPER;
+	helper_init(&sp->helper, ref);
+	mpll_init(&sp->mpll, ref, OUT_CHANNEL);
+	helper_start(&sp->helper);
+	for (n = 0; n < timeout && !sp->helper.ld.locked; n++)
+		step();
+	mpll_start(&sp->mpll);
+	for (; n < timeout && !sp->mpll.ld.locked; n++)
+		step();
+	if (n >= timeout)
+		return -1;
+	sp->seq_state = SEQ_READY;
+	return n;
+}
+
+struct result {
+	int lock;	/* samples to lock after the switch, -1 if never */
+	double pk;	/* peak time error, units */
+	double end;	/* time error at the end of the window, units */
+};
+
+static int run(int hitless, struct result *r)
+{
+	double kv = pull_ppm * 2 / (1 << DAC_BITS) * PPM_UNITS;
+	double te0, te;
+	int n, window = window_ms * tag_hz / 1000;
+
+	memset(&m, 0, sizeof(m));
+	memset(r, 0, sizeof(*r));
+	m.off_dmtd = (2.0 * rand() / RAND_MAX - 1) * offset_ppm * PPM_UNITS;
+	m.off_out = (2.0 * rand() / RAND_MAX - 1) * offset_ppm * PPM_UNITS;
+	m.ref[1] = (double)rand() / RAND_MAX * (1 << HPLL_N);
+	m.out = (double)rand() / RAND_MAX * (1 << HPLL_N);
+
+	/* the sign of the loop gain depends on the board (see mpll_init) */
+	helper_init(&sp->helper, 0);
+	mpll_init(&sp->mpll, 0, OUT_CHANNEL);
+	m.kv_dmtd = sp->helper.pi.kp < 0 ? kv : -kv;
+	m.kv_out = sp->mpll.pi.kp < 0 ? kv : -kv;
+
+	if (relock(0) < 0)
+		return -1;
+	for (n = 0; n < window; n++)
+		step();
+	te0 = m.out - m.ref[0];
+
+	if (hitless && spll_switch_reference(1) < 0)
+		return -1;
+	if (!hitless)
+		r->lock = relock(1);
+	for (n = 0; n < window || !sp->mpll.ld.locked; n++) {
+		if (n > timeout)
+			break;
+		if (hitless && r->lock == 0 && !sp->mpll.ld.locked)
+			r->lock = -1;
+		step();
+		te = m.out - m.ref[0] - te0;
+		if (fabs(te) > r->pk)
+			r->pk = fabs(te);
+	}
+	r->end = te;
+	return 0;
+}
+
+static void help(char *prog)
+{
+	fprintf(stderr, "%s [options]\n", prog);
+	fprintf(stderr, "  -n <trials>    runs for each case (default %i)\n",
+		trials);
+	fprintf(stderr, "  -w <ms>        window after the switch (%i)\n",
+		window_ms);
+	fprintf(stderr, "  -f <ppm>       max VCXO frequency offset (%g)\n",
+		offset_ppm);
+	fprintf(stderr, "  -p <ppm>       VCXO pull range, +- (%g)\n",
+		pull_ppm);
+	fprintf(stderr, "  -j <units>     phase detector noise, rms (%g)\n",
+		noise);
+	fprintf(stderr, "  -r <seed>      random seed\n");
+	fprintf(stderr, "  -v             print pll_verbose() messages\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static char *names[] = {"relock", "hitless"};
+	struct result r;
+	int c, i, h, fail, delock;
+	double lsum, lmax, pk, pksum, end, unit_ps;
+
+	while ((c = getopt(argc, argv, "n:w:f:p:j:r:vh")) != -1) {
+		switch (c) {
+		case 'n':
+			trials = atoi(optarg);
+			break;
+		case 'w':
+			window_ms = atoi(optarg);
+			break;
+		case 'f':
+			offset_ppm = atof(optarg);
+			break;
+		case 'p':
+			pull_ppm = atof(optarg);
+			break;
+		case 'j':
+			noise = atof(optarg);
+			break;
+		case 'r':
+			srand(atoi(optarg));
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			help(argv[0]);
+			exit(1);
+		}
+	}
+	if (optind != argc) {
+		help(argv[0]);
+		exit(1);
+	}
+	unit_ps = (double)REF_CLOCK_PERIOD_PS / (1 << HPLL_N);
+	SPLL = &spll_regs;
+	spll_n_chan_ref = OUT_CHANNEL;
+	spll_n_chan_out = 1; /* no aux loops */
+
+	printf("switch from channel 0 to 1, %i ms window, %i trials\n",
+	       window_ms, trials);
+	printf("mode      lock ms (avg/max)  delock  peak ps (avg/max)"
+	       "   end ps (max)\n");
+	for (h = 0; h < 2; h++) {
+		lsum = lmax = pk = pksum = end = 0;
+		fail = delock = 0;
+		for (i = 0; i < trials; i++) {
+			if (run(h, &r) < 0) {
+				fail++;
+				continue;
+			}
+			if (r.lock < 0)
+				delock++;
+			lsum += r.lock > 0 ? r.lock : 0;
+			if (r.lock > lmax)
+				lmax = r.lock;
+			pksum += r.pk;
+			if (r.pk > pk)
+				pk = r.pk;
+			if (fabs(r.end) > end)
+				end = fabs(r.end);
+		}
+		if (fail)
+			printf("%-8s  %i runs never locked to channel 0\n",
+			       names[h], fail);
+		if (fail == trials)
+			continue;
+		i = trials - fail;
+		printf("%-8s  %8.1f %8.1f   %5i   %8.1f %8.1f   %10.1f\n",
+		       names[h], lsum / i * 1000 / tag_hz,
+		       lmax * 1000 / tag_hz, delock,
+		       pksum / i * unit_ps, pk * unit_ps, end * unit_ps);
+	}
+	return 0;
+}
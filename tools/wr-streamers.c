@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <getopt.h>
@@ -32,10 +33,30 @@ static char *stats_mesg[][2] = {
 	 "frame were lost (probably CRC error) since reset", "rx_cnt_lost_blk"},
 };
 
+static uint64_t u64(uint32_t lsw, uint32_t msw)
+{
+	return ((uint64_t)msw << 32) | lsw;
+}
+
+/*
+ * Freeze the statistics and copy the registers up to them in one go
+ * (dev_snapshot() reads as wide as the bus allows); the caller releases
+ * the snapshot with SSCR1.
+ */
+static void snapshot_regs(struct WR_STREAMERS_WB *r)
+{
+	volatile struct WR_STREAMERS_WB *ptr =
+		(volatile struct WR_STREAMERS_WB *)wrstm->base;
+
+	ptr->SSCR1 = iomemw32(wrstm->is_be, WR_STREAMERS_SSCR1_SNAPSHOT_STATS);
+	dev_snapshot(wrstm, 0, offsetof(struct WR_STREAMERS_WB, TX_CFG0), r);
+}
+
 int read_stats(struct cmd_desc *cmdd, struct atom *atoms)
 {
 	volatile struct WR_STREAMERS_WB *ptr =
 		(volatile struct WR_STREAMERS_WB *)wrstm->base;
+	struct WR_STREAMERS_WB r;
 	int val, overflow;
 	double max_lat, min_lat, avg_lat;
 	uint64_t acc_lat, cnt_lat;
@@ -56,90 +77,69 @@ int read_stats(struct cmd_desc *cmdd, struct atom *atoms)
 	val = -1; // all stats
 	if (atoms->type == Numeric)
 		val = atoms->val; // specific stats
-	//snapshot stats
-	ptr->SSCR1 = iomemw32(wrstm->is_be, WR_STREAMERS_SSCR1_SNAPSHOT_STATS);
+	snapshot_regs(&r);
+	//release snapshot, we have the copy
+	ptr->SSCR1 = 0;
 
 	switch(val) {
 	case -1: //all stats
-		max_lat = WR_STREAMERS_RX_STAT0_RX_LATENCY_MAX_R(
-			  iomemr32(wrstm->is_be, ptr->RX_STAT0));
+		max_lat = WR_STREAMERS_RX_STAT0_RX_LATENCY_MAX_R(r.RX_STAT0);
 		max_lat = (max_lat * 8) / 1000.0;
-		min_lat = WR_STREAMERS_RX_STAT1_RX_LATENCY_MIN_R(
-			  iomemr32(wrstm->is_be, ptr->RX_STAT1));
+		min_lat = WR_STREAMERS_RX_STAT1_RX_LATENCY_MIN_R(r.RX_STAT1);
 		min_lat = (min_lat * 8) / 1000.0;
-		overflow = WR_STREAMERS_SSCR1_RX_LATENCY_ACC_OVERFLOW &
-		           iomemr32(wrstm->is_be, ptr->SSCR1);
+		overflow = WR_STREAMERS_SSCR1_RX_LATENCY_ACC_OVERFLOW & r.SSCR1;
 		//put it all together
-		acc_lat = ((uint64_t)iomemr32(wrstm->is_be, ptr->RX_STAT11)
-			  << 32) |iomemr32(wrstm->is_be, ptr->RX_STAT10);
-		cnt_lat = ((uint64_t)iomemr32(wrstm->is_be, ptr->RX_STAT13)
-			  << 32) | iomemr32(wrstm->is_be, ptr->RX_STAT12);
+		acc_lat = u64(r.RX_STAT10, r.RX_STAT11);
+		cnt_lat = u64(r.RX_STAT12, r.RX_STAT13);
 		avg_lat = (((double)acc_lat) * 8 / 1000) / (double)cnt_lat;
 		fprintf(stderr, "Latency [us]    : min=%10g max=%10g avg =%10g "
 			"(0x%x, 0x%x, %lu=%u << 32 | %u)*8/1000 us, "
 			"cnt =%lu overflow =%d)\n",
 			min_lat, max_lat, avg_lat,
-			iomemr32(wrstm->is_be, ptr->RX_STAT1),
-			iomemr32(wrstm->is_be, ptr->RX_STAT0),
-			acc_lat, iomemr32(wrstm->is_be, ptr->RX_STAT11),
-			iomemr32(wrstm->is_be, ptr->RX_STAT10),
+			r.RX_STAT1, r.RX_STAT0,
+			acc_lat, r.RX_STAT11, r.RX_STAT10,
 			cnt_lat, overflow);
 		fprintf(stderr, "Frames  [number]: tx =%lu rx =%lu lost=%lu "
 			"(lost blocks =%lu)\n",
-			((uint64_t)iomemr32(wrstm->is_be, ptr->TX_STAT3)
-			<< 32) | iomemr32(wrstm->is_be, ptr->TX_STAT2),
-			((uint64_t)iomemr32(wrstm->is_be, ptr->RX_STAT5)
-			<< 32) | iomemr32(wrstm->is_be, ptr->RX_STAT4),
-			((uint64_t)iomemr32(wrstm->is_be, ptr->RX_STAT7)
-			<< 32) | iomemr32(wrstm->is_be, ptr->RX_STAT6),
-			((uint64_t)iomemr32(wrstm->is_be, ptr->RX_STAT9)
-			<< 32) | iomemr32(wrstm->is_be, ptr->RX_STAT8));
+			u64(r.TX_STAT2, r.TX_STAT3),
+			u64(r.RX_STAT4, r.RX_STAT5),
+			u64(r.RX_STAT6, r.RX_STAT7),
+			u64(r.RX_STAT8, r.RX_STAT9));
 		break;
 	case 0:
 		fprintf(stderr, "%s:%lu\n", stats_mesg[0][1],
-			((uint64_t)iomemr32(wrstm->is_be, ptr->TX_STAT3)
-			<< 32) | iomemr32(wrstm->is_be, ptr->TX_STAT2));
+			u64(r.TX_STAT2, r.TX_STAT3));
 		break;
 	case 1:
 		fprintf(stderr, "%s:%lu\n", stats_mesg[1][1],
-			((uint64_t)iomemr32(wrstm->is_be, ptr->RX_STAT5)
-			<< 32) | iomemr32(wrstm->is_be, ptr->RX_STAT4));
+			u64(r.RX_STAT4, r.RX_STAT5));
 		break;
 	case 2:
 		fprintf(stderr, "%s:%lu\n", stats_mesg[2][1],
-			((uint64_t)iomemr32(wrstm->is_be, ptr->RX_STAT7)
-			<< 32) | iomemr32(wrstm->is_be, ptr->RX_STAT6));
+			u64(r.RX_STAT6, r.RX_STAT7));
 		break;
 	case 3:
 		fprintf(stderr, "%s: 0x%x\n", stats_mesg[3][1],
-			WR_STREAMERS_RX_STAT0_RX_LATENCY_MAX_R(
-			iomemr32(wrstm->is_be, ptr->RX_STAT0)));
+			WR_STREAMERS_RX_STAT0_RX_LATENCY_MAX_R(r.RX_STAT0));
 		break;
 	case 4:
 		fprintf(stderr, "%s: 0x%x\n", stats_mesg[4][1],
-			WR_STREAMERS_RX_STAT1_RX_LATENCY_MIN_R(
-				iomemr32(wrstm->is_be, ptr->RX_STAT1)));
+			WR_STREAMERS_RX_STAT1_RX_LATENCY_MIN_R(r.RX_STAT1));
 		break;
 	case 5:
 		fprintf(stderr, "%s:%lu\n", stats_mesg[5][1],
-			((uint64_t)iomemr32(wrstm->is_be, ptr->RX_STAT11)
-			<< 32) | iomemr32(wrstm->is_be, ptr->RX_STAT10));
+			u64(r.RX_STAT10, r.RX_STAT11));
 		break;
 	case 6:
 		fprintf(stderr, "%s:%lu\n", stats_mesg[6][1],
-			((uint64_t)iomemr32(wrstm->is_be, ptr->RX_STAT13)
-			<< 32) | iomemr32(wrstm->is_be, ptr->RX_STAT12));
+			u64(r.RX_STAT12, r.RX_STAT13));
 		break;
 	case 7:
 		fprintf(stderr, "%s:%lu\n", stats_mesg[7][1],
-			((uint64_t)iomemr32(wrstm->is_be, ptr->RX_STAT9)
-			<< 32) | iomemr32(wrstm->is_be, ptr->RX_STAT8));
+			u64(r.RX_STAT8, r.RX_STAT9));
 		break;
 	}
 
-	//release snapshot
-	ptr->SSCR1 = 0;
-
 	return 1;
 }
 
@@ -644,6 +644,224 @@ struct cmd_desc wrstm_cmd[WRSTM_CMD_NB + 1] = {
 	{0, },
 };
 
+/*
+ * Sampling mode (-s): snapshot the statistics at a fixed rate and log the
+ * values of each interval, as CSV on stdout or as a binary log (-b, read
+ * back with -d). Counters are 64 bits, so deltas between snapshots are
+ * exact; min/max latency are since the last reset, unless the counters are
+ * reset after each snapshot (-r): then they are per interval, but a few
+ * frames between the snapshot and the reset are not counted.
+ */
+struct wrstm_stats {
+	uint64_t tx, rx, lost, lost_blk, lat_acc, lat_cnt;
+	uint32_t lat_min, lat_max; /* ref clock cycles */
+	int overflow;
+};
+
+#define WRSTM_LOG_MAGIC		"WRSTMLOG"
+#define WRSTM_LOG_VERSION	1
+
+/* Flags of a sample */
+#define WRSTM_SAMPLE_OVERFLOW	0x01 /* latency accumulator overflow */
+#define WRSTM_SAMPLE_RESTART	0x02 /* counters reset: deltas from 0 */
+#define WRSTM_SAMPLE_LOST_ALARM	0x04
+#define WRSTM_SAMPLE_LAT_ALARM	0x08
+
+/* The binary log: this header, then samples, in host byte order */
+struct wrstm_log_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t period_ms;
+};
+
+struct wrstm_sample {
+	uint64_t time_ns;	/* host time (CLOCK_REALTIME) */
+	uint64_t tx, rx, lost, lost_blk; /* in the interval */
+	uint64_t lat_acc, lat_cnt; /* in the interval */
+	uint32_t lat_min, lat_max; /* ref clock cycles */
+	uint32_t flags;
+	uint32_t reserved;
+};
+
+static void snapshot_stats(struct wrstm_stats *s, int reset)
+{
+	volatile struct WR_STREAMERS_WB *ptr =
+		(volatile struct WR_STREAMERS_WB *)wrstm->base;
+	struct WR_STREAMERS_WB r;
+
+	snapshot_regs(&r);
+	/* release the snapshot, or reset the counters */
+	ptr->SSCR1 = reset ? iomemw32(wrstm->is_be,
+				      WR_STREAMERS_SSCR1_RST_STATS) : 0;
+	s->tx = u64(r.TX_STAT2, r.TX_STAT3);
+	s->rx = u64(r.RX_STAT4, r.RX_STAT5);
+	s->lost = u64(r.RX_STAT6, r.RX_STAT7);
+	s->lost_blk = u64(r.RX_STAT8, r.RX_STAT9);
+	s->lat_acc = u64(r.RX_STAT10, r.RX_STAT11);
+	s->lat_cnt = u64(r.RX_STAT12, r.RX_STAT13);
+	s->lat_max = WR_STREAMERS_RX_STAT0_RX_LATENCY_MAX_R(r.RX_STAT0);
+	s->lat_min = WR_STREAMERS_RX_STAT1_RX_LATENCY_MIN_R(r.RX_STAT1);
+	s->overflow = !!(WR_STREAMERS_SSCR1_RX_LATENCY_ACC_OVERFLOW & r.SSCR1);
+}
+
+static double cycles_to_us(double c)
+{
+	return c * 8 / 1000;
+}
+
+static void print_sample_csv(FILE *f, struct wrstm_sample *s)
+{
+	fprintf(f, "%" PRIu64 ".%06" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%"
+		PRIu64 ",%" PRIu64 ",%" PRIu64 ",",
+		s->time_ns / 1000000000, s->time_ns % 1000000000 / 1000,
+		s->tx, s->rx, s->lost, s->lost_blk, s->lat_cnt);
+	/* no mean if no frames, or if the accumulator overflowed */
+	if (s->lat_cnt && !(s->flags & WRSTM_SAMPLE_OVERFLOW))
+		fprintf(f, "%.3f", cycles_to_us((double)s->lat_acc
+						 / s->lat_cnt));
+	fprintf(f, ",%.3f,%.3f,0x%02x\n", cycles_to_us(s->lat_min),
+		cycles_to_us(s->lat_max), s->flags);
+}
+
+static void print_csv_header(FILE *f)
+{
+	fprintf(f, "time,tx,rx,lost,lost_blk,lat_cnt,lat_mean_us,"
+		"lat_min_us,lat_max_us,flags\n");
+}
+
+static uint64_t delta(uint64_t cur, uint64_t prev)
+{
+	return cur >= prev ? cur - prev : cur;
+}
+
+struct wrstm_sampler {
+	int period_ms, count, reset;
+	char *log_name;
+	long long lost_alarm;	/* lost frames per interval, -1 = off */
+	double lat_alarm_us;	/* max latency, 0 = off */
+};
+
+static int run_sampler(struct wrstm_sampler *cfg)
+{
+	struct wrstm_stats prev, cur;
+	struct wrstm_sample s;
+	struct wrstm_log_header h;
+	struct timespec next, now;
+	FILE *log = NULL;
+	int n;
+
+	if (cfg->log_name) {
+		log = fopen(cfg->log_name, "w");
+		if (!log) {
+			fprintf(stderr, "%s: %s\n", cfg->log_name,
+				strerror(errno));
+			return -1;
+		}
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, WRSTM_LOG_MAGIC, sizeof(h.magic));
+		h.version = WRSTM_LOG_VERSION;
+		h.period_ms = cfg->period_ms;
+		fwrite(&h, sizeof(h), 1, log);
+	} else {
+		print_csv_header(stdout);
+	}
+
+	/* the baseline: with -r, start the first interval from 0 */
+	snapshot_stats(&prev, cfg->reset);
+	if (cfg->reset || prev.overflow) {
+		if (prev.overflow && !cfg->reset)
+			snapshot_stats(&prev, 1);
+		memset(&prev, 0, sizeof(prev));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (n = 0; !cfg->count || n < cfg->count; n++) {
+		next.tv_nsec += cfg->period_ms * 1000000L;
+		while (next.tv_nsec >= 1000000000L) {
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		snapshot_stats(&cur, cfg->reset);
+		clock_gettime(CLOCK_REALTIME, &now);
+		memset(&s, 0, sizeof(s));
+		s.time_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+		if (cur.rx < prev.rx || cur.lat_cnt < prev.lat_cnt)
+			s.flags |= WRSTM_SAMPLE_RESTART;
+		s.tx = delta(cur.tx, prev.tx);
+		s.rx = delta(cur.rx, prev.rx);
+		s.lost = delta(cur.lost, prev.lost);
+		s.lost_blk = delta(cur.lost_blk, prev.lost_blk);
+		s.lat_acc = delta(cur.lat_acc, prev.lat_acc);
+		s.lat_cnt = delta(cur.lat_cnt, prev.lat_cnt);
+		s.lat_min = cur.lat_min;
+		s.lat_max = cur.lat_max;
+
+		prev = cur;
+		if (cur.overflow) {
+			/*
+			 * The accumulator is no longer valid: reset the
+			 * counters (unless -r just did) and start over.
+			 */
+			s.flags |= WRSTM_SAMPLE_OVERFLOW;
+			if (!cfg->reset)
+				snapshot_stats(&cur, 1);
+			memset(&prev, 0, sizeof(prev));
+		} else if (cfg->reset) {
+			memset(&prev, 0, sizeof(prev));
+		}
+
+		if (cfg->lost_alarm >= 0 && s.lost > cfg->lost_alarm)
+			s.flags |= WRSTM_SAMPLE_LOST_ALARM;
+		if (cfg->lat_alarm_us && s.lat_cnt
+		    && cycles_to_us(s.lat_max) > cfg->lat_alarm_us)
+			s.flags |= WRSTM_SAMPLE_LAT_ALARM;
+		if (s.flags & (WRSTM_SAMPLE_LOST_ALARM | WRSTM_SAMPLE_LAT_ALARM
+			       | WRSTM_SAMPLE_OVERFLOW)) {
+			fprintf(stderr, "ALARM: ");
+			print_sample_csv(stderr, &s);
+		}
+
+		if (log) {
+			fwrite(&s, sizeof(s), 1, log);
+			fflush(log);
+		} else {
+			print_sample_csv(stdout, &s);
+			fflush(stdout);
+		}
+	}
+	if (log)
+		fclose(log);
+	return 0;
+}
+
+/* -d: print a binary log as CSV */
+static int decode_log(char *name)
+{
+	struct wrstm_log_header h;
+	struct wrstm_sample s;
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		return -1;
+	}
+	if (fread(&h, sizeof(h), 1, f) != 1
+	    || memcmp(h.magic, WRSTM_LOG_MAGIC, sizeof(h.magic))
+	    || h.version != WRSTM_LOG_VERSION) {
+		fprintf(stderr, "%s: not a wr-streamers log\n", name);
+		fclose(f);
+		return -1;
+	}
+	print_csv_header(stdout);
+	while (fread(&s, sizeof(s), 1, f) == 1)
+		print_sample_csv(stdout, &s);
+	fclose(f);
+	return 0;
+}
+
 void print_version(void)
 {
 	fprintf(stderr, "Built in wrpc-sw repo ver:%s, by %s on %s %s\n",
@@ -654,6 +872,16 @@ static void wrstm_help(char *prog)
 {
 	fprintf(stderr, "%s [options]\n", prog);
 	fprintf(stderr, "%s\n", dev_mapping_help());
+	fprintf(stderr, "Sampling mode, instead of the command prompt:\n"
+		"\t-s <ms>      snapshot the statistics every <ms>\n"
+		"\t-n <count>   number of samples (default: forever)\n"
+		"\t-r           reset the counters at each snapshot, for\n"
+		"\t             per-interval min/max latency\n"
+		"\t-b <file>    binary log instead of CSV on stdout\n"
+		"\t-l <frames>  alarm when more frames are lost in an"
+		" interval\n"
+		"\t-L <us>      alarm when the max latency is higher\n"
+		"\t-d <file>    print a binary log as CSV (no device)\n");
 	print_version();
 }
 
@@ -681,8 +909,36 @@ static int verify_reg_version()
 
 int main(int argc, char *argv[])
 {
-	int ret;
+	int ret, c;
 	struct mapping_args *map_args;
+	struct wrstm_sampler sampler = {.lost_alarm = -1};
+
+	/* our options; dev_parse_mapping_args() then sees all of them */
+	while ((c = getopt(argc, argv, "o:f:s:n:rb:l:L:d:")) != -1) {
+		switch (c) {
+		case 's':
+			sampler.period_ms = atoi(optarg);
+			break;
+		case 'n':
+			sampler.count = atoi(optarg);
+			break;
+		case 'r':
+			sampler.reset = 1;
+			break;
+		case 'b':
+			sampler.log_name = optarg;
+			break;
+		case 'l':
+			sampler.lost_alarm = atoll(optarg);
+			break;
+		case 'L':
+			sampler.lat_alarm_us = atof(optarg);
+			break;
+		case 'd':
+			return decode_log(optarg) ? -1 : 0;
+		}
+	}
+	optind = 1;
 
 	map_args = dev_parse_mapping_args(argc, argv);
 	if (!map_args) {
@@ -705,6 +961,12 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 	
+	if (sampler.period_ms > 0) {
+		ret = run_sampler(&sampler);
+		dev_unmap(wrstm);
+		return ret;
+	}
+
 	ret = extest_register_user_cmd(wrstm_cmd, WRSTM_CMD_NB);
 	if (ret) {
 		dev_unmap(wrstm);
@@ -0,0 +1,326 @@
+/*
+ * Decode the binary log of a WR node (see include/binlog.h): the format
+ * strings are read from the .binlog section of the ELF file, and "%s"
+ * arguments from the loaded sections.
+ *
+ * Records are read as "@BL" lines of hex words (uart or syslog sink,
+ * other lines are copied unchanged), as a stream of big-endian words
+ * (-b, e.g. saved udp payloads) or directly from udp (-u).
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <elf.h>
+#include <byteswap.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <binlog.h>
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static unsigned char *elf;
+static long elf_size;
+static int elf_swap;		/* ELF byte order differs from host */
+static Elf32_Shdr *bl_sect;	/* the format strings */
+static Elf32_Shdr *sections;
+static int nsections;
+static int bl_newline = 1;	/* the previous message ended a line */
+
+static uint32_t e32(uint32_t x)
+{
+	return elf_swap ? bswap_32(x) : x;
+}
+
+static uint16_t e16(uint16_t x)
+{
+	return elf_swap ? bswap_16(x) : x;
+}
+
+static void elf_load(char *prog, char *fname)
+{
+	Elf32_Ehdr *eh;
+	Elf32_Shdr *sh;
+	FILE *f;
+	char *names;
+	int i;
+
+	f = fopen(fname, "r");
+	if (!f) {
+		fprintf(stderr, "%s: %s: %s\n", prog, fname, strerror(errno));
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	elf_size = ftell(f);
+	rewind(f);
+	elf = malloc(elf_size);
+	if (!elf || fread(elf, 1, elf_size, f) != elf_size) {
+		fprintf(stderr, "%s: %s: can't read\n", prog, fname);
+		exit(1);
+	}
+	fclose(f);
+
+	eh = (void *)elf;
+	if (elf_size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG)
+	    || eh->e_ident[EI_CLASS] != ELFCLASS32) {
+		fprintf(stderr, "%s: %s: not a 32-bit ELF file\n", prog, fname);
+		exit(1);
+	}
+	elf_swap = (eh->e_ident[EI_DATA] == ELFDATA2MSB)
+		!= (__BYTE_ORDER == __BIG_ENDIAN);
+	sections = (void *)(elf + e32(eh->e_shoff));
+	nsections = e16(eh->e_shnum);
+	names = (char *)elf + e32(sections[e16(eh->e_shstrndx)].sh_offset);
+	for (i = 0, sh = sections; i < nsections; i++, sh++)
+		if (!strcmp(names + e32(sh->sh_name), ".binlog"))
+			bl_sect = sh;
+	if (!bl_sect) {
+		fprintf(stderr, "%s: %s: no .binlog section\n", prog, fname);
+		exit(1);
+	}
+}
+
+/* Find a string by its address in a loaded section, or by its id */
+static char *elf_string(Elf32_Shdr *sh, uint32_t addr)
+{
+	int i;
+
+	for (i = 0; !sh && i < nsections; i++) {
+		if (!(e32(sections[i].sh_flags) & SHF_ALLOC))
+			continue;
+		if (e32(sections[i].sh_type) != SHT_PROGBITS)
+			continue;
+		if (addr - e32(sections[i].sh_addr) < e32(sections[i].sh_size))
+			sh = sections + i;
+	}
+	if (!sh || addr - e32(sh->sh_addr) >= e32(sh->sh_size))
+		return NULL;
+	/* the string must end within the section */
+	if (!memchr(elf + e32(sh->sh_offset) + addr - e32(sh->sh_addr), 0,
+		    e32(sh->sh_size) - (addr - e32(sh->sh_addr))))
+		return NULL;
+	return (char *)elf + e32(sh->sh_offset) + addr - e32(sh->sh_addr);
+}
+
+/* Print like printf, but every argument is a 32-bit word */
+static void bl_printf(FILE *f, char *fmt, uint32_t *args, int nargs)
+{
+	char spec[32], *s;
+	int n;
+
+	while (*fmt) {
+		if (*fmt != '%') {
+			fputc(*fmt++, f);
+			continue;
+		}
+		if (fmt[1] == '%') {
+			fputc('%', f);
+			fmt += 2;
+			continue;
+		}
+		/* copy flags, width and precision; drop length modifiers */
+		n = strspn(fmt + 1, "-+ #0123456789.") + 1;
+		if (n > sizeof(spec) - 2)
+			n = sizeof(spec) - 2;
+		memcpy(spec, fmt, n);
+		fmt += n;
+		fmt += strspn(fmt, "hlLqjzt");
+		if (!*fmt)
+			break;
+		spec[n] = *fmt;
+		spec[n + 1] = '\0';
+		if (!nargs) {
+			fprintf(f, "<?>");
+			fmt++;
+			continue;
+		}
+		switch (*fmt++) {
+		case 'd':
+		case 'i':
+		case 'c':
+			fprintf(f, spec, (int32_t)*args);
+			break;
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+			fprintf(f, spec, *args);
+			break;
+		case 'p':
+			fprintf(f, "0x%08x", *args);
+			break;
+		case 's':
+			s = elf_string(NULL, *args);
+			if (s)
+				fprintf(f, spec, s);
+			else
+				fprintf(f, "<0x%08x>", *args);
+			break;
+		default:
+			fprintf(f, "<%s?>", spec);
+			break;
+		}
+		args++;
+		nargs--;
+	}
+}
+
+/* One record: header, tics, arguments */
+static void bl_record(FILE *f, uint32_t *w, int len)
+{
+	uint32_t id = w[0] & BINLOG_ID_MASK;
+	char *fmt;
+
+	if (bl_newline)
+		fprintf(f, "%10.3f ", w[1] / 1000.0);
+	if (id == BINLOG_ID_LOST && len > 2) {
+		fprintf(f, "<%u records lost>\n", w[2]);
+		bl_newline = 1;
+		return;
+	}
+	fmt = elf_string(bl_sect, e32(bl_sect->sh_addr) + id);
+	if (!fmt) {
+		fprintf(f, "<unknown format 0x%06x>\n", id);
+		bl_newline = 1;
+		return;
+	}
+	bl_printf(f, fmt, w + 2, len - 2);
+	bl_newline = fmt[0] && fmt[strlen(fmt) - 1] == '\n';
+}
+
+/* A stream of records, in host order: returns the number of words used */
+static int bl_words(FILE *f, uint32_t *w, int n)
+{
+	int len, done = 0;
+
+	while (done + 2 <= n) {
+		len = 2 + (w[done] >> BINLOG_NARGS_SHIFT);
+		if (done + len > n)
+			break;
+		bl_record(f, w + done, len);
+		done += len;
+	}
+	return done;
+}
+
+static void help(char *prog)
+{
+	fprintf(stderr, "%s [options] <elf-file> [<input-file>]\n", prog);
+	fprintf(stderr, "  -b             input is big-endian binary records\n");
+	fprintf(stderr, "  -u <port>      receive records by udp "
+		"(default port %i)\n", BINLOG_PORT);
+	fprintf(stderr, "  -o <file>      output file (default stdout)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in addr;
+	static uint32_t w[4096];
+	char line[1024], *p, *end;
+	int c, n, len, binary = 0, port = 0, sock, done;
+	FILE *in = stdin, *f = stdout;
+
+	while ((c = getopt(argc, argv, "bu:o:h")) != -1) {
+		switch (c) {
+		case 'b':
+			binary = 1;
+			break;
+		case 'u':
+			port = atoi(optarg);
+			break;
+		case 'o':
+			f = fopen(optarg, "w");
+			if (!f) {
+				fprintf(stderr, "%s: %s: %s\n", argv[0],
+					optarg, strerror(errno));
+				exit(1);
+			}
+			break;
+		default:
+			help(argv[0]);
+			exit(1);
+		}
+	}
+	if (optind >= argc || optind + 2 < argc) {
+		help(argv[0]);
+		exit(1);
+	}
+	elf_load(argv[0], argv[optind]);
+	if (argv[optind + 1]) {
+		in = fopen(argv[optind + 1], "r");
+		if (!in) {
+			fprintf(stderr, "%s: %s: %s\n", argv[0],
+				argv[optind + 1], strerror(errno));
+			exit(1);
+		}
+	}
+
+	if (port) {
+		sock = socket(AF_INET, SOCK_DGRAM, 0);
+		if (sock < 0) {
+			perror("socket");
+			exit(1);
+		}
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_port = htons(port);
+		if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			perror("bind");
+			exit(1);
+		}
+		while ((len = recv(sock, w, sizeof(w), 0)) >= 0 ||
+		       errno == EINTR) {
+			if (len < 0)
+				continue;
+			n = len / sizeof(w[0]);
+			for (c = 0; c < n; c++)
+				w[c] = ntohl(w[c]);
+			bl_words(f, w, n);
+			fflush(f);
+		}
+		perror("recv");
+		exit(1);
+	}
+
+	if (binary) {
+		/* records may span reads: keep the leftover */
+		n = 0;
+		while ((len = fread(w + n, sizeof(w[0]),
+				    ARRAY_SIZE(w) - n, in)) > 0) {
+			for (c = n; c < n + len; c++)
+				w[c] = ntohl(w[c]);
+			n += len;
+			done = bl_words(f, w, n);
+			memmove(w, w + done, (n - done) * sizeof(w[0]));
+			n -= done;
+		}
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), in)) {
+		p = strstr(line, "@BL ");
+		if (!p) {
+			fputs(line, f);
+			continue;
+		}
+		for (n = 0, p += 3; n < ARRAY_SIZE(w); n++, p = end) {
+			w[n] = strtoul(p, &end, 16);
+			if (end == p)
+				break;
+		}
+		if (n >= 2 && n == 2 + (w[0] >> BINLOG_NARGS_SHIFT))
+			bl_record(f, w, n);
+		else
+			fprintf(f, "<bad record> %s", line);
+	}
+	return 0;
+}
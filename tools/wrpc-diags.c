@@ -11,8 +11,16 @@
 #include <extest.h>
 
 #include <hw/wrc_diags_regs.h>
+#include <arch/lm32/crt0.h>
+#include <wrc_diags.h>
+
+#define WRPC_RAM_SIZE (128 * 1024)
 
 static struct mapping_desc *wrcdiag = NULL;
+static volatile struct WRC_DIAGS_WB *regs;
+/* The copy in wrpc memory (-r), NULL if we use the registers */
+static volatile struct wrc_diags_shm *shm;
+static int shm_swap; /* memory words are byte-swapped */
 
 static void unlock_diag(volatile struct WRC_DIAGS_WB *ptr)
 {
@@ -39,6 +47,69 @@ static int lock_diag(volatile struct WRC_DIAGS_WB *ptr)
 	return 1;
 }
 
+static uint32_t shm_read(volatile uint32_t *p)
+{
+	uint32_t val = iomemr32(wrcdiag->is_be, *p);
+
+	return shm_swap ? __builtin_bswap32(val) : val;
+}
+
+/*
+ * The copy in memory is under a sequence counter (see wrc_diags.h): the
+ * firmware never waits for us, we retry if it was updating meanwhile.
+ * The sequence is the first word, so the snapshot reads it first.
+ */
+static int read_shm(struct wrc_diags_shm *d)
+{
+	uint32_t *words = (uint32_t *)d;
+	int i, tries;
+
+	for (tries = 0; tries < 1000; tries++) {
+		dev_snapshot(wrcdiag, (void *)shm - wrcdiag->base,
+			     sizeof(*d), d);
+		__sync_synchronize();
+		for (i = 0; shm_swap && i < sizeof(*d) / 4; i++)
+			words[i] = __builtin_bswap32(words[i]);
+		if (d->sequence & 1)
+			continue;
+		if (shm_read(&shm->sequence) == d->sequence)
+			return 0;
+	}
+	fprintf(stderr, "the firmware never completed an update of the "
+		"diagnostics\n");
+	return 1;
+}
+
+/* The registers, with the snapshot/valid handshake */
+static int read_regs(struct wrc_diags_shm *d)
+{
+	struct WRC_DIAGS_WB r;
+
+	if (lock_diag(regs))
+		return 1;
+	dev_snapshot(wrcdiag, (void *)regs - wrcdiag->base, sizeof(r), &r);
+	unlock_diag(regs);
+	d->sstat = r.WDIAG_SSTAT;
+	d->pstat = r.WDIAG_PSTAT;
+	d->ptpstat = r.WDIAG_PTPSTAT;
+	d->astat = r.WDIAG_ASTAT;
+	d->txfcnt = r.WDIAG_TXFCNT;
+	d->rxfcnt = r.WDIAG_RXFCNT;
+	d->sec_msb = r.WDIAG_SEC_MSB;
+	d->sec_lsb = r.WDIAG_SEC_LSB;
+	d->ns = r.WDIAG_NS;
+	d->mu_msb = r.WDIAG_MU_MSB;
+	d->mu_lsb = r.WDIAG_MU_LSB;
+	d->dms_msb = r.WDIAG_DMS_MSB;
+	d->dms_lsb = r.WDIAG_DMS_LSB;
+	d->asym = r.WDIAG_ASYM;
+	d->cko = r.WDIAG_CKO;
+	d->setp = r.WDIAG_SETP;
+	d->ucnt = r.WDIAG_UCNT;
+	d->temp = r.WDIAG_TEMP;
+	return 0;
+}
+
 static void print_servo_status(uint32_t val)
 {
 	static char *sstat_str[] = {
@@ -187,8 +258,7 @@ enum wrcdiag_cmd_id{
 
 static int read_diags(struct cmd_desc *cmdd, struct atom *atoms)
 {
-	volatile struct WRC_DIAGS_WB *ptr =
-		(volatile struct WRC_DIAGS_WB *)wrcdiag->base;
+	struct wrc_diags_shm d;
 	int res;
 
 	if (atoms == (struct atom *)VERBOSE_HELP) {
@@ -196,7 +266,7 @@ static int read_diags(struct cmd_desc *cmdd, struct atom *atoms)
 		return 1;
 	}
 
-	res = lock_diag(ptr);
+	res = shm ? read_shm(&d) : read_regs(&d);
 	if (res) {
 		fprintf(stderr, "Cmd is not executed\n");
 		return 1;
@@ -204,83 +274,65 @@ static int read_diags(struct cmd_desc *cmdd, struct atom *atoms)
 
 	switch (cmdd->id) {
 	case WRCDIAG_CMD_DIAGS:
-		print_servo_status(iomemr32(wrcdiag->is_be, ptr->WDIAG_SSTAT));
-		print_port_status(iomemr32(wrcdiag->is_be, ptr->WDIAG_PSTAT));
-		print_ptp_state(iomemr32(wrcdiag->is_be, ptr->WDIAG_PTPSTAT));
-		print_aux_state(iomemr32(wrcdiag->is_be, ptr->WDIAG_ASTAT));
-		print_tx_frame_count(iomemr32(wrcdiag->is_be, ptr->WDIAG_TXFCNT));
-		print_rx_frame_count(iomemr32(wrcdiag->is_be, ptr->WDIAG_RXFCNT));
-		print_local_time(iomemr32(wrcdiag->is_be, ptr->WDIAG_SEC_MSB),
-				 iomemr32(wrcdiag->is_be, ptr->WDIAG_SEC_LSB),
-				 iomemr32(wrcdiag->is_be, ptr->WDIAG_NS));
-		print_roundtrip_time(iomemr32(wrcdiag->is_be, ptr->WDIAG_MU_MSB),
-				     iomemr32(wrcdiag->is_be, ptr->WDIAG_MU_LSB));
-		print_master_slave_delay(iomemr32(wrcdiag->is_be,
-						  ptr->WDIAG_DMS_MSB),
-					 iomemr32(wrcdiag->is_be,
-					 	  ptr->WDIAG_DMS_LSB));
-		print_link_asym(iomemr32(wrcdiag->is_be, ptr->WDIAG_ASYM));
-		print_clock_offset(iomemr32(wrcdiag->is_be, ptr->WDIAG_CKO));
-		print_phase_setpoint(iomemr32(wrcdiag->is_be, ptr->WDIAG_SETP));
-		print_update_counter(iomemr32(wrcdiag->is_be, ptr->WDIAG_UCNT));
-		print_board_temp(iomemr32(wrcdiag->is_be, ptr->WDIAG_TEMP));
+		print_servo_status(d.sstat);
+		print_port_status(d.pstat);
+		print_ptp_state(d.ptpstat);
+		print_aux_state(d.astat);
+		print_tx_frame_count(d.txfcnt);
+		print_rx_frame_count(d.rxfcnt);
+		print_local_time(d.sec_msb, d.sec_lsb, d.ns);
+		print_roundtrip_time(d.mu_msb, d.mu_lsb);
+		print_master_slave_delay(d.dms_msb, d.dms_lsb);
+		print_link_asym(d.asym);
+		print_clock_offset(d.cko);
+		print_phase_setpoint(d.setp);
+		print_update_counter(d.ucnt);
+		print_board_temp(d.temp);
 		break;
 	case WRCDIAG_CMD_SSTAT:
-		print_servo_status(iomemr32(wrcdiag->is_be, ptr->WDIAG_SSTAT));
+		print_servo_status(d.sstat);
 		break;
 	case WRCDIAG_CMD_PSTAT:
-		print_port_status(iomemr32(wrcdiag->is_be, ptr->WDIAG_PSTAT));
+		print_port_status(d.pstat);
 		break;
 	case WRCDIAG_CMD_PTPSTAT:
-		print_ptp_state(iomemr32(wrcdiag->is_be, ptr->WDIAG_PTPSTAT));
+		print_ptp_state(d.ptpstat);
 		break;
 	case WRCDIAG_CMD_ASTAT:
-		print_aux_state(iomemr32(wrcdiag->is_be, ptr->WDIAG_ASTAT));
+		print_aux_state(d.astat);
 		break;
 	case WRCDIAG_CMD_TXFCNT:
-		print_tx_frame_count(iomemr32(wrcdiag->is_be,
-					      ptr->WDIAG_TXFCNT));
+		print_tx_frame_count(d.txfcnt);
 		break;
 	case WRCDIAG_CMD_RXFCNT:
-		print_rx_frame_count(iomemr32(wrcdiag->is_be,
-					      ptr->WDIAG_RXFCNT));
+		print_rx_frame_count(d.rxfcnt);
 		break;
 	case WRCDIAG_CMD_LTIME:
-		print_local_time(iomemr32(wrcdiag->is_be, ptr->WDIAG_SEC_MSB),
-				 iomemr32(wrcdiag->is_be, ptr->WDIAG_SEC_LSB),
-				 iomemr32(wrcdiag->is_be, ptr->WDIAG_NS));
+		print_local_time(d.sec_msb, d.sec_lsb, d.ns);
 		break;
 	case WRCDIAG_CMD_RTTIME:
-		print_roundtrip_time(iomemr32(wrcdiag->is_be,
-					      ptr->WDIAG_MU_MSB),
-			             iomemr32(wrcdiag->is_be,
-				     	      ptr->WDIAG_MU_LSB));
+		print_roundtrip_time(d.mu_msb, d.mu_lsb);
 		break;
 	case WRCDIAG_CMD_MSTRSLAVEDELAY:
-		print_master_slave_delay(iomemr32(wrcdiag->is_be,
-						  ptr->WDIAG_DMS_MSB),
-			                 iomemr32(wrcdiag->is_be,
-					   	  ptr->WDIAG_DMS_LSB));
+		print_master_slave_delay(d.dms_msb, d.dms_lsb);
 		break;
 	case WRCDIAG_CMD_LINKASYM:
-		print_link_asym(iomemr32(wrcdiag->is_be, ptr->WDIAG_ASYM));
+		print_link_asym(d.asym);
 		break;
 	case WRCDIAG_CMD_CKOFFSET:
-		print_clock_offset(iomemr32(wrcdiag->is_be, ptr->WDIAG_CKO));
+		print_clock_offset(d.cko);
 		break;
 	case WRCDIAG_CMD_PHASESETPOINT:
-		print_phase_setpoint(iomemr32(wrcdiag->is_be, ptr->WDIAG_SETP));
+		print_phase_setpoint(d.setp);
 		break;
 	case WRCDIAG_CMD_UPDATECNT:
-		print_update_counter(iomemr32(wrcdiag->is_be, ptr->WDIAG_UCNT));
+		print_update_counter(d.ucnt);
 		break;
 	case WRCDIAG_CMD_TEMP:
-		print_board_temp(iomemr32(wrcdiag->is_be, ptr->WDIAG_TEMP));
+		print_board_temp(d.temp);
 		break;
 	}
 
-	unlock_diag(ptr);
-
 	return 1;
 }
 
@@ -294,17 +346,18 @@ static void wrcdiag_help(char *prog)
 {
 	fprintf(stderr, "%s [options]\n", prog);
 	fprintf(stderr, "%s\n", dev_mapping_help());
+	fprintf(stderr, "  -r 0x<offset>  offset of the wrpc memory: read the\n"
+		"                 diagnostics there, without the snapshot"
+		" handshake\n");
 	print_version();
 }
 
 static void sig_hndl()
 {
-	volatile struct WRC_DIAGS_WB *ptr =
-		(volatile struct WRC_DIAGS_WB *)wrcdiag->base;
-
 	// Signal occured: free resource and exit
 	fprintf(stderr, "Handle signal: free resource and exit.\n");
-	unlock_diag(ptr); // clean snapshot
+	if (!shm)
+		unlock_diag(regs); // clean snapshot
 	dev_unmap(wrcdiag);
 	exit(1);
 }
@@ -346,10 +399,8 @@ struct cmd_desc wrcdiag_cmd[WRCDIAG_CMD_NB + 1] = {
 
 static int verify_reg_version()
 {
-	volatile struct WRC_DIAGS_WB *ptr =
-		(volatile struct WRC_DIAGS_WB *)wrcdiag->base;
 	uint32_t ver = 0;
-	ver = iomemr32(wrcdiag->is_be, ptr->VER);
+	ver = iomemr32(wrcdiag->is_be, regs->VER);
 	fprintf(stderr, "Wishbone register version: in FPGA = 0x%x |"
 		" in SW = 0x%x\n", ver, WBGEN2_WRC_DIAGS_VERSION);
 	if(ver != WBGEN2_WRC_DIAGS_VERSION)
@@ -358,10 +409,56 @@ static int verify_reg_version()
 		return 0;
 }
 
+/*
+ * Find wrc_diags through the crt0 pointer; keep the registers if the
+ * binary has none (no CONFIG_WR_DIAG, or older than the pointer).
+ */
+static void find_shm(volatile void *ram)
+{
+	volatile uint32_t *crt0 = ram;
+	uint32_t off;
+
+	/* the int after the "WRPC----" mark tells the byte order */
+	shm_swap = 0;
+	if (iomemr32(wrcdiag->is_be, crt0[WRPC_MARK / 4 + 2]) != 0x01234567)
+		shm_swap = 1;
+	if (shm_read(crt0 + WRPC_MARK / 4 + 2) != 0x01234567) {
+		fprintf(stderr, "No wrpc binary in memory, using the registers\n");
+		return;
+	}
+	off = shm_read(crt0 + DIAGS_PADDR / 4);
+	if (!off || off + sizeof(*shm) > WRPC_RAM_SIZE) {
+		fprintf(stderr, "No diagnostics in wrpc memory, using the "
+			"registers\n");
+		return;
+	}
+	shm = ram + off;
+	if (shm_read(&shm->ver) != WRC_DIAGS_SHM_VER) {
+		fprintf(stderr, "Diagnostics in memory have version %i, not %i;"
+			" using the registers\n", shm_read(&shm->ver),
+			WRC_DIAGS_SHM_VER);
+		shm = NULL;
+	}
+}
+
 int main(int argc, char *argv[])
 {
-	int ret;
+	int ret, c, use_ram = 0;
 	struct mapping_args *map_args;
+	unsigned long ram_off = 0, diag_off, lo, hi;
+
+	/* our option; dev_parse_mapping_args() then sees all of them */
+	opterr = 0;
+	while ((c = getopt(argc, argv, "o:f:r:")) != -1) {
+		if (c != 'r')
+			continue;
+		if (sscanf(optarg, "0x%lx", &ram_off) != 1) {
+			wrcdiag_help(argv[0]);
+			return -1;
+		}
+		use_ram = 1;
+	}
+	optind = 1;
 
 	map_args = dev_parse_mapping_args(argc, argv);
 	if (!map_args) {
@@ -369,13 +466,26 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	wrcdiag = dev_map(map_args, sizeof(struct WRC_DIAGS_WB));
+	/* one window over the registers and, with -r, the memory */
+	diag_off = lo = map_args->offset;
+	hi = diag_off + sizeof(struct WRC_DIAGS_WB);
+	if (use_ram) {
+		if (ram_off < lo)
+			lo = ram_off;
+		if (ram_off + WRPC_RAM_SIZE > hi)
+			hi = ram_off + WRPC_RAM_SIZE;
+	}
+	map_args->offset = lo;
+	wrcdiag = dev_map(map_args, hi - lo);
 	if (!wrcdiag) {
 		fprintf(stderr, "%s: wrcdiag mmap() failed: %s\n", argv[0],
 			strerror(errno));
 		free(map_args);
 		return -1;
 	}
+	regs = wrcdiag->base + (diag_off - lo);
+	if (use_ram)
+		find_shm(wrcdiag->base + (ram_off - lo));
 
 	ret = verify_reg_version();
 	if (ret) {
@@ -6,6 +6,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <time.h>
+#include <math.h> /* isfinite */
+#include <getopt.h>
 #include <arpa/inet.h> /* ntohl */
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -17,6 +20,7 @@
 #include <arch/lm32/crt0.h>
 
 #include <dump-info.h>
+#include <libdevmap.h>
 /* We have a problem: ppsi is built for wrpc, so it has ntoh[sl] wrong */
 #undef ntohl
 #undef ntohs
@@ -26,6 +30,51 @@
 #define ntohll(x) __do_not_use
 
 uint32_t endian_flag; /* from dump_info[0], lazily */
+
+#define WRPC_MEM_SIZE (128 * 1024)
+
+/*
+ * The image we read from: the mapped file, or with --follow a snapshot of
+ * the device memory, where only the regions being dumped are copied.
+ */
+static void *image;
+static unsigned long image_size;
+static volatile uint32_t *dev_mem;
+static int spec_order; /* memory words are byte-swapped (WRPC_SPEC) */
+
+static void snapshot(unsigned long off, unsigned long len)
+{
+	uint32_t *dst = image;
+	unsigned long i, end;
+
+	if (!dev_mem)
+		return;
+	end = (off + len + 3) / 4;
+	if (end > image_size / 4)
+		end = image_size / 4;
+	for (i = off / 4; i < end; i++)
+		dst[i] = dev_mem[i];
+}
+
+/*
+ * Returns the field at "p" in the image, in the target byte order. With
+ * spec order, only the words the field spans are swapped, into "buf".
+ */
+static void *wrpc_field(void *p, int size, uint32_t *buf)
+{
+	unsigned long off = p - image;
+	uint32_t *src = image;
+	int i, n;
+
+	if (!spec_order)
+		return p;
+	if (off + size > image_size)
+		size = image_size - off;
+	n = ((off & 3) + size + 3) / 4;
+	for (i = 0; i < n; i++)
+		buf[i] = __bswap_32(src[off / 4 + i]);
+	return (void *)buf + (off & 3);
+}
 /*
  * This picks items from memory, converting as needed. No ntohl any more.
  * Next, we'll detect the byte order from the code itself.
@@ -75,117 +124,204 @@ static uint8_t wrpc_get_8(void *p)
 	return *p8;
 }
 
-void dump_one_field(void *addr, struct dump_info *info)
+/*
+ * The dump_info table is compiled at startup into a plan per structure:
+ * the fields to print, with offset, size and printer already converted,
+ * so each dump (or each sample with --follow) only runs the plan.
+ */
+#define FIELD_MAX 256 /* bytes read for a field, and size of its text */
+
+struct plan_field;
+/*
+ * Printers format a field into "out"; they return non-zero for numbers,
+ * FIELD_NONFINITE for a nan or an infinity, that json can't represent.
+ */
+#define FIELD_NONFINITE 2
+typedef int (*field_printer)(char *out, int len, void *p,
+			     struct plan_field *f);
+
+struct plan_field {
+	char *name;
+	unsigned long off;	/* from the start of the structure */
+	int size;		/* bytes to read, at most FIELD_MAX */
+	field_printer print;
+};
+
+struct dump_plan {
+	char *s_name;
+	uint32_t endian_flag;	/* of dump_info, for the wrpc_get_ helpers */
+	unsigned long first, end; /* the bytes covered by the fields */
+	int n;
+	struct plan_field *f;
+	long seq;		/* offset of "sequence" (a seqlock), or -1 */
+};
+
+static int print_string(char *out, int len, void *p, struct plan_field *f)
+{
+	snprintf(out, len, "\"%.*s\"", f->size, (char *)p);
+	return 0;
+}
+
+/* MAC-like: binary data, IP addresses and clock identities */
+static int print_bytes(char *out, int len, void *p, struct plan_field *f)
+{
+	int i, pos = 0;
+
+	for (i = 0; i < f->size && pos < len; i++)
+		pos += snprintf(out + pos, len - pos, "%02x%s",
+				((unsigned char *)p)[i],
+				i == f->size - 1 ? "" : ":");
+	return 0;
+}
+
+static int print_64(char *out, int len, void *p, struct plan_field *f)
+{
+	snprintf(out, len, "%lld", wrpc_get_64(p));
+	return 1;
+}
+
+static int print_x32(char *out, int len, void *p, struct plan_field *f)
+{
+	snprintf(out, len, "0x%08lx", wrpc_get_l32(p));
+	return 0;
+}
+
+static int print_i32(char *out, int len, void *p, struct plan_field *f)
+{
+	snprintf(out, len, "%i", wrpc_get_i32(p));
+	return 1;
+}
+
+static int print_u32(char *out, int len, void *p, struct plan_field *f)
+{
+	snprintf(out, len, "%li", wrpc_get_l32(p));
+	return 1;
+}
+
+static int print_8(char *out, int len, void *p, struct plan_field *f)
+{
+	snprintf(out, len, "%i", wrpc_get_8(p));
+	return 1;
+}
+
+static int print_16(char *out, int len, void *p, struct plan_field *f)
+{
+	snprintf(out, len, "%i", wrpc_get_16(p));
+	return 1;
+}
+
+static int print_double(char *out, int len, void *p, struct plan_field *f)
+{
+	double d = *(double *)p;
+
+	snprintf(out, len, "%lf", d);
+	return isfinite(d) ? 1 : FIELD_NONFINITE;
+}
+
+static int print_float(char *out, int len, void *p, struct plan_field *f)
+{
+	float x = *(float *)p;
+
+	snprintf(out, len, "%f", x);
+	return isfinite(x) ? 1 : FIELD_NONFINITE;
+}
+
+static int print_pointer(char *out, int len, void *p, struct plan_field *f)
+{
+	if (f->size == 4)
+		snprintf(out, len, "%08lx", wrpc_get_l32(p));
+	else
+		snprintf(out, len, "%016llx", wrpc_get_64(p));
+	return 0;
+}
+
+static int print_pp_time(char *out, int len, void *p, struct plan_field *f)
 {
-	void *p = addr + wrpc_get_i32(&info->offset);
 	struct pp_time *t = p;
+	struct pp_time localt;
+
+	localt.secs = wrpc_get_64(&t->secs);
+	localt.scaled_nsecs = wrpc_get_64(&t->scaled_nsecs);
+	snprintf(out, len, "correct %i: %10lli.%09li:0x%04x",
+		 !is_incorrect(&localt),
+		 (long long)localt.secs,
+		 (long)(localt.scaled_nsecs >> 16),
+		 (int)(localt.scaled_nsecs & 0xffff));
+	return 0;
+}
+
+/* Same as a clock identity, plus port */
+static int print_port_id(char *out, int len, void *p, struct plan_field *f)
+{
 	struct PortIdentity *pi = p;
+	unsigned char *c = p;
+	int i, pos = 0;
+
+	for (i = 0; i < sizeof(ClockIdentity); i++)
+		pos += snprintf(out + pos, len - pos, "%02x%c", c[i],
+				i == sizeof(ClockIdentity) - 1 ? '.' : ':');
+	snprintf(out + pos, len - pos, "%04x (%i)", pi->portNumber,
+		 pi->portNumber);
+	return 0;
+}
+
+static int print_quality(char *out, int len, void *p, struct plan_field *f)
+{
 	struct ClockQuality *cq = p;
-	char format[16];
-	char localname[64];
-	int i, type, size;
-
-	/* now, info may be in wrong-endian. so fix it */
-	type = wrpc_get_i32(&info->type);
-	size = wrpc_get_i32(&info->size);
-	sprintf(localname, "%s:", info->name);
-	printf("        %-30s ", localname);
-	switch(type) {
-	case dump_type_char:
-		sprintf(format,"\"%%.%is\"\n", size);
-		printf(format, (char *)p);
-		break;
-	case dump_type_bina:
-		for (i = 0; i < size; i++)
-			printf("%02x%c", ((unsigned char *)p)[i],
-			       i == size - 1 ? '\n' : ':');
-		break;
-	case dump_type_UInteger64:
-		printf("%lld\n", wrpc_get_64(p));
-		break;
-	case dump_type_Integer64:
-		printf("%lld\n", wrpc_get_64(p));
-		break;
-	case dump_type_uint32_t:
-		printf("0x%08lx\n", wrpc_get_l32(p));
-		break;
-	case dump_type_Integer32:
-	case dump_type_int:
-		printf("%i\n", wrpc_get_i32(p));
-		break;
-	case dump_type_UInteger32:
-	case dump_type_unsigned_long:
-		printf("%li\n", wrpc_get_l32(p));
-		break;
-	case dump_type_unsigned_char:
-	case dump_type_UInteger8:
-	case dump_type_Integer8:
-	case dump_type_Enumeration8:
-	case dump_type_Boolean:
-	case dump_type_uint8_t:
-		printf("%i\n", *(unsigned char *)p);
-		break;
-	case dump_type_UInteger16:
-	case dump_type_uint16_t:
-	case dump_type_unsigned_short:
-		printf("%i\n", wrpc_get_16(p));
-		break;
-	case dump_type_double:
-		printf("%lf\n", *(double *)p);
-		break;
-	case dump_type_float:
-		printf("%f\n", *(float *)p);
-		break;
-	case dump_type_pointer:
-		if (size == 4)
-			printf("%08lx\n", wrpc_get_l32(p));
-		else
-			printf("%016llx\n", wrpc_get_64(p));
-		break;
-	case dump_type_Integer16:
-		printf("%i\n", wrpc_get_16(p));
-		break;
-	case dump_type_pp_time:
-	{
-		struct pp_time localt;
-		localt.secs = wrpc_get_64(&t->secs);
-		localt.scaled_nsecs = wrpc_get_64(&t->scaled_nsecs);
-
-		printf("correct %i: %10lli.%09li:0x%04x\n",
-		       !is_incorrect(&localt),
-		       (long long)localt.secs,
-		       (long)(localt.scaled_nsecs >> 16),
-		       (int)(localt.scaled_nsecs & 0xffff));
-		break;
-	}
 
-	case dump_type_ip_address:
-		for (i = 0; i < 4; i++)
-			printf("%02x%c", ((unsigned char *)p)[i],
-			       i == 3 ? '\n' : ':');
-		break;
-
-	case dump_type_ClockIdentity: /* Same as binary */
-		for (i = 0; i < sizeof(ClockIdentity); i++)
-			printf("%02x%c", ((unsigned char *)p)[i],
-			       i == sizeof(ClockIdentity) - 1 ? '\n' : ':');
-		break;
-
-	case dump_type_PortIdentity: /* Same as above plus port */
-		for (i = 0; i < sizeof(ClockIdentity); i++)
-			printf("%02x%c", ((unsigned char *)p)[i],
-			       i == sizeof(ClockIdentity) - 1 ? '.' : ':');
-		printf("%04x (%i)\n", pi->portNumber, pi->portNumber);
-		break;
-
-	case dump_type_ClockQuality:
-		printf("class %i, accuracy %02x (%i), logvariance %i\n",
-		       cq->clockClass, cq->clockAccuracy, cq->clockAccuracy,
-		       wrpc_get_16(&cq->offsetScaledLogVariance));
-		break;
-	}
+	snprintf(out, len, "class %i, accuracy %02x (%i), logvariance %i",
+		 cq->clockClass, cq->clockAccuracy, cq->clockAccuracy,
+		 wrpc_get_16(&cq->offsetScaledLogVariance));
+	return 0;
+}
+
+static int print_none(char *out, int len, void *p, struct plan_field *f)
+{
+	*out = '\0';
+	return 0;
+}
+
+static field_printer printers[] = {
+	[dump_type_char] = print_string,
+	[dump_type_bina] = print_bytes,
+	[dump_type_uint8_t] = print_8,
+	[dump_type_uint32_t] = print_x32,
+	[dump_type_uint16_t] = print_16,
+	[dump_type_int] = print_i32,
+	[dump_type_unsigned_long] = print_u32,
+	[dump_type_unsigned_char] = print_8,
+	[dump_type_unsigned_short] = print_16,
+	[dump_type_double] = print_double,
+	[dump_type_float] = print_float,
+	[dump_type_pointer] = print_pointer,
+	[dump_type_UInteger64] = print_64,
+	[dump_type_Integer64] = print_64,
+	[dump_type_UInteger32] = print_u32,
+	[dump_type_Integer32] = print_i32,
+	[dump_type_UInteger16] = print_16,
+	[dump_type_Integer16] = print_16,
+	[dump_type_UInteger8] = print_8,
+	[dump_type_Integer8] = print_8,
+	[dump_type_Enumeration8] = print_8,
+	[dump_type_Boolean] = print_8,
+	[dump_type_ClockIdentity] = print_bytes,
+	[dump_type_PortIdentity] = print_port_id,
+	[dump_type_ClockQuality] = print_quality,
+	[dump_type_pp_time] = print_pp_time,
+	[dump_type_ip_address] = print_bytes,
+};
+
+/* Runs one field of a plan on the structure at "base" */
+static int plan_print(void *base, struct plan_field *f, char *value)
+{
+	uint32_t buf[(FIELD_MAX + 8) / 4];
+
+	return f->print(value, FIELD_MAX, wrpc_field(base + f->off, f->size,
+						     buf), f);
 }
-void dump_many_fields(void *addr, char *name)
+
+/* The header of a structure, with the endian flag set from it */
+static struct dump_info *dump_find(char *name)
 {
 	struct dump_info *p = dump_info;
 
@@ -196,33 +332,32 @@ void dump_many_fields(void *addr, char *name)
 
 	if (!strcmp(p->name, "end")) {
 		fprintf(stderr, "structure \"%s\" not described\n", name);
-		return;
+		return NULL;
 	}
-
 	endian_flag = p->endian_flag;
-	for (p++; p->endian_flag == 0; p++)
-		dump_one_field(addr, p);
+	return p;
 }
-unsigned long wrpc_get_pointer(void *base, char *s_name, char *f_name)
+
+static unsigned long wrpc_read_l32(unsigned long offset)
 {
-	struct dump_info *p = dump_info;
-	int offset;
+	uint32_t buf[2];
 
-	for (; strcmp(p->name, "end"); p++)
-		if (!strcmp(p->name, s_name))
-			break;
+	if (offset + 4 > image_size)
+		return 0;
+	snapshot(offset, 4);
+	return wrpc_get_l32(wrpc_field(image + offset, 4, buf));
+}
 
-	if (!strcmp(p->name, "end")) {
-		fprintf(stderr, "structure \"%s\" not described\n", s_name);
+unsigned long wrpc_get_pointer(unsigned long base, char *s_name, char *f_name)
+{
+	struct dump_info *p = dump_find(s_name);
+
+	if (!p)
 		return 0;
-	}
-	endian_flag = p->endian_flag;
 	/* Look for the field: we find the offset,  */
 	for (p++; p->endian_flag == 0; p++) {
-		if (!strcmp(p->name, f_name)) {
-			offset = wrpc_get_i32(&p->offset);
-			return wrpc_get_l32(base + offset);
-		}
+		if (!strcmp(p->name, f_name))
+			return wrpc_read_l32(base + wrpc_get_i32(&p->offset));
 	}
 	fprintf(stderr, "can't find \"%s\" in \"%s\"\n", f_name, s_name);
 	return 0;
@@ -237,100 +372,473 @@ void print_version(void)
 	fprintf(stderr, "Supported PPSI structures version %d\n",
 		WRS_PPSI_SHMEM_VERSION);
 }
+
+/* Field filter (--fields): "field" or "struct.field" */
+static char **filter;
+static int n_filter, *filter_used;
+
+static int field_selected(char *s_name, char *f_name)
+{
+	int i, l = strlen(s_name), found = 0;
+
+	for (i = 0; i < n_filter; i++) {
+		if (strcmp(filter[i], f_name)
+		    && (strncmp(filter[i], s_name, l) || filter[i][l] != '.'
+			|| strcmp(filter[i] + l + 1, f_name)))
+			continue;
+		filter_used[i]++;
+		found = 1;
+	}
+	return found || !n_filter;
+}
+
+#define MAX_PLANS 16
+static struct dump_plan plans[MAX_PLANS];
+static int n_plans;
+
+/* Compiles the plan of a structure, once; NULL if not described */
+static struct dump_plan *plan_get(char *s_name)
+{
+	struct dump_plan *plan;
+	struct dump_info *p, *info;
+	struct plan_field *f;
+	int n, type;
+
+	for (plan = plans; plan < plans + n_plans; plan++)
+		if (!strcmp(plan->s_name, s_name))
+			return plan;
+	info = dump_find(s_name);
+	if (!info || n_plans == MAX_PLANS)
+		return NULL;
+	for (n = 0, p = info + 1; p->endian_flag == 0; p++)
+		n++;
+	plan = plans + n_plans++;
+	plan->s_name = s_name;
+	plan->endian_flag = info->endian_flag;
+	plan->f = calloc(n, sizeof(*plan->f));
+	if (!plan->f) {
+		perror("calloc");
+		exit(1);
+	}
+	plan->first = ~0UL;
+	plan->seq = -1;
+	for (p = info + 1; p->endian_flag == 0; p++) {
+		if (!strcmp(p->name, "sequence"))
+			plan->seq = wrpc_get_i32(&p->offset);
+		if (!field_selected(s_name, p->name))
+			continue;
+		f = plan->f + plan->n++;
+		f->name = p->name;
+		/* now, info may be in wrong-endian. so fix it */
+		f->off = wrpc_get_i32(&p->offset);
+		f->size = wrpc_get_i32(&p->size);
+		if (f->size > FIELD_MAX)
+			f->size = FIELD_MAX;
+		type = wrpc_get_i32(&p->type);
+		f->print = NULL;
+		if (type >= 0 && type < ARRAY_SIZE(printers))
+			f->print = printers[type];
+		if (!f->print)
+			f->print = print_none;
+		if (f->off < plan->first)
+			plan->first = f->off;
+		if (f->off + f->size > plan->end)
+			plan->end = f->off + f->size;
+	}
+	if (!plan->n)
+		plan->first = 0;
+	return plan;
+}
+
+/* What to dump: a structure at an offset, with a title line if any */
+struct dump_view {
+	char *title;
+	struct dump_plan *plan;
+	unsigned long off;
+	char label[32];		/* for --follow */
+};
+
+#define MAX_VIEWS (FIFO_LOG_LEN + 16)
+static struct dump_view views[MAX_VIEWS];
+static int n_views;
+
+static struct dump_view *add_view(char *title, char *s_name,
+				  unsigned long off)
+{
+	struct dump_view *v = views + n_views;
+
+	if (!off || n_views == MAX_VIEWS)
+		return NULL;
+	v->plan = plan_get(s_name);
+	if (!v->plan)
+		return NULL;
+	v->title = title;
+	v->off = off;
+	strcpy(v->label, s_name);
+	n_views++;
+	return v;
+}
+
+static void dump_views(void)
+{
+	struct dump_view *v;
+	struct plan_field *f;
+	char localname[64], value[FIELD_MAX];
+
+	for (v = views; v < views + n_views; v++) {
+		if (!v->plan->n)
+			continue;
+		if (v->title)
+			printf("%s at 0x%lx\n", v->title, v->off);
+		endian_flag = v->plan->endian_flag;
+		for (f = v->plan->f; f < v->plan->f + v->plan->n; f++) {
+			plan_print(image + v->off, f, value);
+			sprintf(localname, "%s:", f->name);
+			printf("        %-30s %s\n", localname, value);
+		}
+	}
+}
+
+/*
+ * A quoted json string of "len" bytes, ending the object. Bytes outside
+ * of printable ascii are escaped, so the line is valid utf-8 in any case.
+ */
+static void json_string(char *s, int len)
+{
+	int i;
+
+	putchar('"');
+	for (i = 0; i < len; i++) {
+		if (s[i] == '"' || s[i] == '\\')
+			printf("\\%c", s[i]);
+		else if ((unsigned char)s[i] < 0x20
+			 || (unsigned char)s[i] >= 0x7f)
+			printf("\\u%04x", (unsigned char)s[i]);
+		else
+			putchar(s[i]);
+	}
+	printf("\"}\n");
+}
+
+/*
+ * Copy the bytes of a view. If the structure has a sequence counter, the
+ * firmware makes it odd while updating (see include/wrc_diags.h): copy
+ * again until the counter is even and the same before and after.
+ */
+static void snapshot_view(struct dump_view *v)
+{
+	unsigned long first = v->plan->first, end = v->plan->end;
+	uint32_t buf[2];
+	long seq = v->plan->seq;
+	int seq0, tries;
+
+	if (seq < 0 || v->off + seq + 4 > image_size) {
+		snapshot(v->off + first, end - first);
+		return;
+	}
+	endian_flag = v->plan->endian_flag;
+	if (seq < first)
+		first = seq;
+	if (seq + 4 > end)
+		end = seq + 4;
+	for (tries = 0; tries < 1000; tries++) {
+		snapshot(v->off + seq, 4);
+		seq0 = wrpc_get_i32(wrpc_field(image + v->off + seq, 4, buf));
+		if (seq0 & 1)
+			continue;
+		__sync_synchronize();
+		snapshot(v->off + first, end - first);
+		__sync_synchronize();
+		snapshot(v->off + seq, 4);
+		if (seq0 == wrpc_get_i32(wrpc_field(image + v->off + seq, 4,
+						    buf)))
+			return;
+	}
+	fprintf(stderr, "%s: sequence never stable, data may be torn\n",
+		v->label);
+	snapshot(v->off + first, end - first);
+}
+
+/*
+ * Live mode: every "interval" ms, copy the bytes covered by the plans and
+ * print the fields that changed (all of them the first time), with a
+ * timestamp, as text or as one json object per line.
+ */
+static void follow_views(int interval_ms, int json)
+{
+	struct dump_view *v;
+	struct plan_field *f;
+	struct timespec next, now;
+	unsigned long off, len;
+	char value[FIELD_MAX], *s;
+	uint32_t buf[(FIELD_MAX + 8) / 4];
+	void *old;
+	int numeric, first = 1;
+
+	old = calloc(1, image_size);
+	if (!old) {
+		perror("calloc");
+		exit(1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (;;) {
+		for (v = views; v < views + n_views; v++)
+			snapshot_view(v);
+		clock_gettime(CLOCK_REALTIME, &now);
+
+		for (v = views; v < views + n_views; v++) {
+			endian_flag = v->plan->endian_flag;
+			for (f = v->plan->f; f < v->plan->f + v->plan->n; f++) {
+				off = v->off + f->off;
+				if (off + f->size > image_size)
+					continue;
+				/* raw bytes: no need to swap to compare */
+				if (!first && !memcmp(image + off, old + off,
+						      f->size))
+					continue;
+				numeric = plan_print(image + v->off, f, value);
+				if (!json) {
+					printf("%li.%06li %s.%s %s\n",
+					       (long)now.tv_sec,
+					       now.tv_nsec / 1000, v->label,
+					       f->name, value);
+					continue;
+				}
+				printf("{\"time\":%li.%06li,\"struct\":\"%s\","
+				       "\"field\":\"%s\",\"value\":",
+				       (long)now.tv_sec, now.tv_nsec / 1000,
+				       v->label, f->name);
+				if (numeric == FIELD_NONFINITE) {
+					printf("null}\n");
+				} else if (numeric) {
+					printf("%s}\n", value);
+				} else if (f->print == print_string) {
+					/* raw bytes: may have no trailing 0 */
+					s = wrpc_field(image + off, f->size,
+						       buf);
+					json_string(s, strnlen(s, f->size));
+				} else {
+					json_string(value, strlen(value));
+				}
+			}
+		}
+		for (v = views; v < views + n_views; v++) {
+			off = v->off + v->plan->first;
+			len = v->plan->end - v->plan->first;
+			if (off + len > image_size)
+				len = off < image_size ? image_size - off : 0;
+			memcpy(old + off, image + off, len);
+		}
+		fflush(stdout);
+		first = 0;
+
+		next.tv_nsec += interval_ms * 1000 * 1000;
+		while (next.tv_nsec >= 1000 * 1000 * 1000) {
+			next.tv_nsec -= 1000 * 1000 * 1000;
+			next.tv_sec++;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > next.tv_sec || (now.tv_sec == next.tv_sec
+						 && now.tv_nsec > next.tv_nsec))
+			next = now; /* late: don't try to catch up */
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+}
+
+static void help(char *prog)
+{
+	fprintf(stderr, "%s: use \"%s [options] <file> [<offset> <name>]\"\n",
+		prog, prog);
+	fprintf(stderr,
+		"\"name\" is one of pll, fifo, ppg, ppi, servo_state,"
+		" stats, boot, diags or ds for data-sets. \"ds\" gets a ppg"
+		" offset\n");
+	fprintf(stderr, "But with a new binary, just pass <file>\n");
+	fprintf(stderr, "Options:\n"
+		"  -F, --follow <ms>    map the device (e.g. resource0) and\n"
+		"                       print changed fields every <ms>\n"
+		"  -j, --json           with --follow, one json object per"
+		" line\n"
+		"  -o, --offset 0x<n>   with --follow, offset of the wrpc"
+		" memory\n"
+		"  -f, --fields <list>  only these fields, comma-separated:"
+		" \"field\"\n"
+		"                       or \"struct.field\"\n\n");
+	print_version();
+}
+
 /* all of these are 0 by default */
 unsigned long spll_off, fifo_off, ppi_off, ppg_off, servo_off, ds_off,
-	      stats_off;
+	      stats_off, boot_off, diags_off;
 
 /* Use:  wrs_dump_memory <file> <hex-offset> <name> */
 int main(int argc, char **argv)
 {
-	int fd;
+	static struct option long_options[] = {
+		{"follow", required_argument, 0, 'F'},
+		{"json", no_argument, 0, 'j'},
+		{"offset", required_argument, 0, 'o'},
+		{"fields", required_argument, 0, 'f'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+	struct mapping_args *map_args;
+	struct mapping_desc *desc = NULL;
+	int i, fd, opt, nargs, interval_ms = 0, json = 0;
 	void *mapaddr;
-	unsigned long offset;
+	unsigned long offset, dev_offset = 0;
 	struct stat st;
-	char *dumpname = "";
+	char *dumpname = "", *fname, *tok;
 	char c;
 	uint8_t version_wrpc, version_ppsi;
+	uint32_t buf[4];
+
+	while ((opt = getopt_long(argc, argv, "F:jo:f:h", long_options,
+				  NULL)) != -1) {
+		switch (opt) {
+		case 'F':
+			interval_ms = atoi(optarg);
+			if (interval_ms <= 0) {
+				fprintf(stderr, "%s: invalid interval \"%s\"\n",
+					argv[0], optarg);
+				exit(1);
+			}
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 'f':
+			for (tok = strtok(optarg, ","); tok;
+			     tok = strtok(NULL, ",")) {
+				filter = realloc(filter, (n_filter + 1)
+						 * sizeof(*filter));
+				if (!filter) {
+					perror("realloc");
+					exit(1);
+				}
+				filter[n_filter++] = tok;
+			}
+			break;
+		case 'o':
+			if (sscanf(optarg, "%lx%c", &dev_offset, &c) != 1) {
+				fprintf(stderr, "%s: \"%s\" not a hex offset\n",
+					argv[0], optarg);
+				exit(1);
+			}
+			break;
+		default:
+			help(argv[0]);
+			exit(1);
+		}
+	}
+	nargs = argc - optind;
+	filter_used = calloc(n_filter + 1, sizeof(*filter_used));
+	if (nargs != 3 && nargs != 1) {
+		help(argv[0]);
+		exit(1);
+	}
+	fname = argv[optind];
 
-	if (argc != 4 && argc != 2) {
-		fprintf(stderr, "%s: use \"%s <file> <offset> <name>\n",
-			argv[0], argv[0]);
-		fprintf(stderr,
-			"\"name\" is one of pll, fifo, ppg, ppi, servo_state"
-			" or ds for data-sets. \"ds\" gets a ppg offset\n");
-		fprintf(stderr, "But with a new binary, just pass <file>\n\n");
-		print_version();
+	if (nargs == 3 && sscanf(argv[optind + 1], "%lx%c", &offset, &c) != 1) {
+		fprintf(stderr, "%s: \"%s\" not a hex offset\n", argv[0],
+			argv[optind + 1]);
 		exit(1);
 	}
 
-	fd = open(argv[1], O_RDONLY | O_SYNC);
+	if (interval_ms) {
+		/* Live: map the device, read it into a private image */
+		map_args = calloc(1, sizeof(*map_args));
+		if (!map_args) {
+			perror("calloc");
+			exit(1);
+		}
+		map_args->resource_file = fname;
+		map_args->offset = dev_offset;
+		desc = dev_map(map_args, WRPC_MEM_SIZE);
+		if (!desc) {
+			fprintf(stderr, "%s: %s: %s\n",
+				argv[0], fname, strerror(errno));
+			free(map_args);
+			exit(1);
+		}
+		dev_mem = (volatile uint32_t *)desc->base;
+		image_size = WRPC_MEM_SIZE;
+		image = calloc(1, image_size);
+		if (!image) {
+			perror("calloc");
+			exit(1);
+		}
+		snapshot(0, VERSION_PPSI_ADDR + 4); /* the header in crt0 */
+		mapaddr = image;
+		goto mapped;
+	}
+
+	fd = open(fname, O_RDONLY | O_SYNC);
 	if (fd < 0) {
 		fprintf(stderr, "%s: %s: %s\n",
-			argv[0], argv[1], strerror(errno));
+			argv[0], fname, strerror(errno));
 		exit(1);
 	}
 	if (fstat(fd, &st) < 0) {
 		fprintf(stderr, "%s: stat(%s): %s\n",
-			argv[0], argv[1], strerror(errno));
+			argv[0], fname, strerror(errno));
 		exit(1);
 	}
-	if (!S_ISREG(st.st_mode)) { /* FIXME: support memory */
+	if (!S_ISREG(st.st_mode)) { /* devices: use --follow */
 		fprintf(stderr, "%s: %s not a regular file\n",
-			argv[0], argv[1]);
+			argv[0], fname);
 		exit(1);
 	}
-	if (st.st_size > 128 * 1024) /* support /sys/..../resource0 */
-		st.st_size = 128 * 1024;
+	if (st.st_size > WRPC_MEM_SIZE) /* support /sys/..../resource0 */
+		st.st_size = WRPC_MEM_SIZE;
 
-	if (argc == 4 && sscanf(argv[2], "%lx%c", &offset, &c) != 1) {
-		fprintf(stderr, "%s: \"%s\" not a hex offset\n", argv[0],
-			argv[2]);
-		exit(1);
-	}
-	mapaddr = mmap(0, st.st_size, PROT_READ | PROT_WRITE,
+	mapaddr = mmap(0, st.st_size, PROT_READ,
 		       MAP_FILE | MAP_PRIVATE, fd, 0);
 	if (mapaddr == MAP_FAILED) {
 		fprintf(stderr, "%s: mmap(%s): %s\n",
-			argv[0], argv[1], strerror(errno));
+			argv[0], fname, strerror(errno));
 		exit(1);
 	}
+	image = mapaddr;
+	image_size = st.st_size;
 
+mapped:
 	/* In case we have a "new" binary file, use such information */
 	if (!strncmp(mapaddr + WRPC_MARK, "CPRW", 4))
 		setenv("WRPC_SPEC", "yes", 1);
 
-	/* If the dump file needs "spec" byte order, fix it all */
-	if (getenv("WRPC_SPEC")) {
-		uint32_t *p = mapaddr;
-		int i;
+	/* If the memory has "spec" byte order, fix the fields we read */
+	if (getenv("WRPC_SPEC"))
+		spec_order = 1;
 
-		for (i = 0; i < st.st_size / 4; i++, p++)
-			*p = __bswap_32(*p);
-	}
-
-	if (argc == 4)
-		dumpname = argv[3];
+	if (nargs == 3)
+		dumpname = argv[optind + 2];
 
 	/* If we have a new binary file, pick the pointers
 	 * Magic numbers are taken from crt0.S or disassembly of wrc.bin */
-	if (!strncmp(mapaddr + WRPC_MARK, "WRPC----", 8)) {
-
-		spll_off = wrpc_get_l32(mapaddr + SOFTPLL_PADDR);
-		fifo_off = wrpc_get_l32(mapaddr + FIFO_LOG_PADDR);
-		ppi_off = wrpc_get_l32(mapaddr + PPI_STATIC_PADDR);
-		stats_off = wrpc_get_l32(mapaddr + STATS_PADDR);
+	if (!strncmp(wrpc_field(mapaddr + WRPC_MARK, 8, buf), "WRPC----", 8)) {
+
+		spll_off = wrpc_read_l32(SOFTPLL_PADDR);
+		fifo_off = wrpc_read_l32(FIFO_LOG_PADDR);
+		ppi_off = wrpc_read_l32(PPI_STATIC_PADDR);
+		stats_off = wrpc_read_l32(STATS_PADDR);
+		boot_off = wrpc_read_l32(BOOT_PADDR); /* 0 if old */
+		diags_off = wrpc_read_l32(DIAGS_PADDR); /* 0 if none */
 		if (ppi_off) { /* This is 0 for wrs */
-			ppg_off = wrpc_get_pointer(mapaddr + ppi_off,
+			ppg_off = wrpc_get_pointer(ppi_off,
 				   "pp_instance", "glbs");
-			servo_off = wrpc_get_pointer(mapaddr + ppg_off,
+			servo_off = wrpc_get_pointer(ppg_off,
 				    "pp_globals", "global_ext_data");
 			ds_off = ppg_off;
 		}
 	}
 
 	/* Check the version of wrpc and ppsi structures */
-	version_wrpc = wrpc_get_8(mapaddr + VERSION_WRPC_ADDR);
-	version_ppsi = wrpc_get_8(mapaddr + VERSION_PPSI_ADDR);
+	version_wrpc = wrpc_get_8(wrpc_field(mapaddr + VERSION_WRPC_ADDR, 1,
+					     buf));
+	version_ppsi = wrpc_get_8(wrpc_field(mapaddr + VERSION_PPSI_ADDR, 1,
+					     buf));
 	if (version_wrpc != WRPC_SHMEM_VERSION) {
 		printf("Unsupported version of WRPC structures! Expected %d, "
 		       "but read %d\n", WRPC_SHMEM_VERSION, version_wrpc);
@@ -342,78 +850,70 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	#define ARRAY_AND_SIZE(x) (x), ARRAY_SIZE(x)
-
 	/* Now check the "name" to be dumped  */
 	if (!strcmp(dumpname, "pll"))
 		spll_off = offset;
-	if (spll_off) {
-		printf("pll at 0x%lx\n", spll_off);
-		dump_many_fields(mapaddr + spll_off, "softpll");
-	}
+	add_view("pll", "softpll", spll_off);
 	if (!strcmp(dumpname, "fifo"))
 		fifo_off = offset;
 	if (fifo_off) {
-		int i;
+		struct dump_view *v;
 
-		printf("fifo log at 0x%lx\n", fifo_off);
-		for (i = 0; i < FIFO_LOG_LEN; i++)
-			dump_many_fields(mapaddr + fifo_off
-					 + i * sizeof(struct spll_fifo_log),
-					 "pll_fifo");
+		for (i = 0; i < FIFO_LOG_LEN; i++) {
+			v = add_view(i ? NULL : "fifo log", "pll_fifo",
+				     fifo_off + i * sizeof(struct spll_fifo_log));
+			if (v)
+				sprintf(v->label, "pll_fifo[%i]", i);
+		}
 	}
 	if (!strcmp(dumpname, "ppg"))
 		ppg_off = offset;
-	if (ppg_off) {
-		printf("ppg at 0x%lx\n", ppg_off);
-		dump_many_fields(mapaddr + ppg_off, "pp_globals");
-	}
+	add_view("ppg", "pp_globals", ppg_off);
 	if (!strcmp(dumpname, "ppi"))
 		ppi_off = offset;
-	if (ppi_off) {
-		printf("ppi at 0x%lx\n", ppi_off);
-		dump_many_fields(mapaddr + ppi_off, "pp_instance");
-	}
+	add_view("ppi", "pp_instance", ppi_off);
 	if (!strcmp(dumpname, "servo_state"))
 		servo_off = offset;
-	if (servo_off) {
-		printf("servo_state at 0x%lx\n", servo_off);
-		dump_many_fields(mapaddr + servo_off, "servo_state");
-	}
+	add_view("servo_state", "servo_state", servo_off);
 
 	/* This "all" gets the ppg pointer. It's not really all: no pll */
 	if (!strcmp(dumpname, "ds"))
 		ds_off = offset;
 	if (ds_off) {
-		unsigned long newoffset;
-
 		ppg_off = ds_off;
-		newoffset = wrpc_get_pointer(mapaddr + ppg_off,
-					     "pp_globals", "defaultDS");
-		printf("DSDefault at 0x%lx\n", newoffset);
-		dump_many_fields(mapaddr + newoffset, "DSDefault");
-
-		newoffset = wrpc_get_pointer(mapaddr + ppg_off,
-					     "pp_globals", "currentDS");
-		printf("DSCurrent at 0x%lx\n", newoffset);
-		dump_many_fields(mapaddr + newoffset, "DSCurrent");
-
-		newoffset = wrpc_get_pointer(mapaddr + ppg_off,
-					     "pp_globals", "parentDS");
-		dump_many_fields(mapaddr + newoffset, "DSParent");
-
-		newoffset = wrpc_get_pointer(mapaddr + ppg_off,
-					     "pp_globals", "timePropertiesDS");
-		printf("DSTimeProperties at 0x%lx\n", newoffset);
-		dump_many_fields(mapaddr + newoffset, "DSTimeProperties");
+		add_view("DSDefault", "DSDefault", wrpc_get_pointer(ppg_off,
+				"pp_globals", "defaultDS"));
+		add_view("DSCurrent", "DSCurrent", wrpc_get_pointer(ppg_off,
+				"pp_globals", "currentDS"));
+		add_view(NULL, "DSParent", wrpc_get_pointer(ppg_off,
+				"pp_globals", "parentDS"));
+		add_view("DSTimeProperties", "DSTimeProperties",
+			 wrpc_get_pointer(ppg_off, "pp_globals",
+					  "timePropertiesDS"));
 	}
 
 	if (!strcmp(dumpname, "stats"))
 		stats_off = offset;
-	if (stats_off) {
-		printf("stats at 0x%lx\n", stats_off);
-		dump_many_fields(mapaddr + stats_off, "stats");
+	add_view("stats", "stats", stats_off);
+
+	if (!strcmp(dumpname, "boot"))
+		boot_off = offset;
+	add_view("boot", "boot", boot_off);
+
+	if (!strcmp(dumpname, "diags"))
+		diags_off = offset;
+	add_view("diags", "diags", diags_off);
+
+	for (i = 0; i < n_filter; i++) {
+		if (filter_used[i])
+			continue;
+		fprintf(stderr, "%s: no field \"%s\" in the structures"
+			" being dumped\n", argv[0], filter[i]);
+		exit(1);
 	}
 
+	if (interval_ms)
+		follow_views(interval_ms, json);
+	dump_views();
 	exit(0);
 }
@@ -0,0 +1,605 @@
+/*
+ * Export the state of a WR PTP Core to Prometheus, in OpenMetrics text
+ * format. The device (or a file with the same layout) is mapped with
+ * libdevmap and polled every -i ms: the diagnostics, the streamers
+ * counters and the SoftPLL stats are rendered into a buffer, and a scrape
+ * of /metrics only sends the last buffer, so it never touches the device.
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <libdevmap.h>
+
+#include <hw/wrc_diags_regs.h>
+#undef PACKED
+#include <hw/wr_streamers.h>
+#include <arch/lm32/crt0.h>
+#include <wrc_diags.h>
+#include <softpll_export.h>
+
+#define WRPC_RAM_SIZE (128 * 1024)
+#define SPLL_STATS_MAGIC 0x5b1157a7
+#define STM_NS_PER_CYCLE 8
+
+static char *resource;
+static struct mapping_desc *diag_map, *stm_map, *mem_map;
+static int mem_swap; /* memory words are byte-swapped */
+static int interval_ms = 1000;
+
+/* The last rendering, served as is */
+static char *metrics;
+static size_t metrics_len;
+static uint64_t n_polls;
+
+static struct mapping_desc *map_block(char *name, unsigned long off,
+				      unsigned long len)
+{
+	struct mapping_args *args = calloc(1, sizeof(*args));
+	struct mapping_desc *desc;
+
+	if (!args) {
+		perror("calloc");
+		exit(1);
+	}
+	args->resource_file = resource;
+	args->offset = off;
+	desc = dev_map(args, len);
+	if (!desc) {
+		fprintf(stderr, "wrpc-exporter: %s at 0x%lx: %s\n", name, off,
+			strerror(errno));
+		free(args);
+		exit(1);
+	}
+	return desc;
+}
+
+static uint32_t rd(struct mapping_desc *desc, volatile uint32_t *p)
+{
+	return iomemr32(desc->is_be, *p);
+}
+
+static uint32_t mem_rd(unsigned long off)
+{
+	volatile uint32_t *p = mem_map->base + off;
+	uint32_t val = rd(mem_map, p);
+
+	return mem_swap ? __builtin_bswap32(val) : val;
+}
+
+/*
+ * A structure in wrpc memory with a sequence counter (see wrc_diags.h):
+ * copy it again until the counter is even and unchanged.
+ */
+static int mem_copy_seq(unsigned long off, int seq_off, uint32_t *dst,
+			int words)
+{
+	int i, tries;
+
+	if (off + words * 4 > WRPC_RAM_SIZE)
+		return -1;
+	for (tries = 0; tries < 1000; tries++) {
+		dev_snapshot(mem_map, off, words * 4, dst);
+		__sync_synchronize();
+		for (i = 0; mem_swap && i < words; i++)
+			dst[i] = __builtin_bswap32(dst[i]);
+		if (dst[seq_off / 4] & 1)
+			continue;
+		if (mem_rd(off + seq_off) == dst[seq_off / 4])
+			return 0;
+	}
+	return -1;
+}
+
+/* Pointer from crt0, 0 if there's no wrpc binary or no such structure */
+static unsigned long mem_pointer(int paddr)
+{
+	/* the int after the "WRPC----" mark tells the byte order */
+	mem_swap = 0;
+	if (mem_rd(WRPC_MARK + 8) != 0x01234567)
+		mem_swap = 1;
+	if (mem_rd(WRPC_MARK + 8) != 0x01234567)
+		return 0;
+	return mem_rd(paddr);
+}
+
+/* The diagnostics: the copy in memory if any, else the registers */
+static int read_diags(struct wrc_diags_shm *d)
+{
+	volatile struct WRC_DIAGS_WB *regs;
+	struct WRC_DIAGS_WB r;
+	unsigned long off;
+	int loop = 10;
+
+	if (mem_map && (off = mem_pointer(DIAGS_PADDR))) {
+		if (!mem_copy_seq(off, offsetof(struct wrc_diags_shm, sequence),
+				  (uint32_t *)d, sizeof(*d) / 4)
+		    && d->ver == WRC_DIAGS_SHM_VER)
+			return 0;
+	}
+	if (!diag_map)
+		return -1;
+
+	regs = diag_map->base;
+	if (rd(diag_map, &regs->VER) != WBGEN2_WRC_DIAGS_VERSION)
+		return -1;
+	regs->CTRL |= iomemw32(diag_map->is_be, WRC_DIAGS_CTRL_DATA_SNAPSHOT);
+	while (!(rd(diag_map, &regs->CTRL) & WRC_DIAGS_CTRL_DATA_VALID)) {
+		if (!--loop) {
+			regs->CTRL &= iomemw32(diag_map->is_be, 0x1);
+			return -1;
+		}
+		usleep(1000);
+	}
+	dev_snapshot(diag_map, 0, sizeof(r), &r);
+	regs->CTRL &= iomemw32(diag_map->is_be, 0x1);
+	d->sstat = r.WDIAG_SSTAT;
+	d->pstat = r.WDIAG_PSTAT;
+	d->ptpstat = r.WDIAG_PTPSTAT;
+	d->astat = r.WDIAG_ASTAT;
+	d->txfcnt = r.WDIAG_TXFCNT;
+	d->rxfcnt = r.WDIAG_RXFCNT;
+	d->sec_msb = r.WDIAG_SEC_MSB;
+	d->sec_lsb = r.WDIAG_SEC_LSB;
+	d->ns = r.WDIAG_NS;
+	d->mu_msb = r.WDIAG_MU_MSB;
+	d->mu_lsb = r.WDIAG_MU_LSB;
+	d->dms_msb = r.WDIAG_DMS_MSB;
+	d->dms_lsb = r.WDIAG_DMS_LSB;
+	d->asym = r.WDIAG_ASYM;
+	d->cko = r.WDIAG_CKO;
+	d->setp = r.WDIAG_SETP;
+	d->ucnt = r.WDIAG_UCNT;
+	d->temp = r.WDIAG_TEMP;
+	return 0;
+}
+
+static int read_spll_stats(struct spll_stats *s)
+{
+	unsigned long off;
+
+	if (!mem_map || !(off = mem_pointer(STATS_PADDR)))
+		return -1;
+	if (mem_copy_seq(off, offsetof(struct spll_stats, sequence),
+			 (uint32_t *)s, sizeof(*s) / 4))
+		return -1;
+	return s->magic == SPLL_STATS_MAGIC && s->ver == SPLL_STATS_VER ?
+		0 : -1;
+}
+
+struct stm_stats {
+	uint64_t tx, rx, lost, lost_blk, lat_acc, lat_cnt;
+	uint32_t lat_min, lat_max; /* ref clock cycles */
+	int overflow;
+};
+
+static uint64_t stm_u64(uint32_t lsw, uint32_t msw)
+{
+	return ((uint64_t)msw << 32) | lsw;
+}
+
+/* Like snapshot_stats() in wr-streamers, without reset */
+static int read_stm(struct stm_stats *s)
+{
+	volatile struct WR_STREAMERS_WB *ptr = stm_map->base;
+	struct WR_STREAMERS_WB r;
+
+	if (rd(stm_map, &ptr->VER) != WBGEN2_WR_STREAMERS_VERSION)
+		return -1;
+	ptr->SSCR1 = iomemw32(stm_map->is_be,
+			      WR_STREAMERS_SSCR1_SNAPSHOT_STATS);
+	dev_snapshot(stm_map, 0, offsetof(struct WR_STREAMERS_WB, TX_CFG0), &r);
+	ptr->SSCR1 = 0;
+	s->tx = stm_u64(r.TX_STAT2, r.TX_STAT3);
+	s->rx = stm_u64(r.RX_STAT4, r.RX_STAT5);
+	s->lost = stm_u64(r.RX_STAT6, r.RX_STAT7);
+	s->lost_blk = stm_u64(r.RX_STAT8, r.RX_STAT9);
+	s->lat_acc = stm_u64(r.RX_STAT10, r.RX_STAT11);
+	s->lat_cnt = stm_u64(r.RX_STAT12, r.RX_STAT13);
+	s->lat_max = WR_STREAMERS_RX_STAT0_RX_LATENCY_MAX_R(r.RX_STAT0);
+	s->lat_min = WR_STREAMERS_RX_STAT1_RX_LATENCY_MIN_R(r.RX_STAT1);
+	s->overflow = !!(WR_STREAMERS_SSCR1_RX_LATENCY_ACC_OVERFLOW & r.SSCR1);
+	return 0;
+}
+
+/* OpenMetrics output: counters get "_total" on the sample only */
+static void header(FILE *f, char *name, char *type, char *help)
+{
+	fprintf(f, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+static void gauge(FILE *f, char *name, char *help, double val)
+{
+	header(f, name, "gauge", help);
+	fprintf(f, "%s %.12g\n", name, val);
+}
+
+static void counter(FILE *f, char *name, char *help, uint64_t val)
+{
+	header(f, name, "counter", help);
+	fprintf(f, "%s_total %" PRIu64 "\n", name, val);
+}
+
+static double ps(uint32_t msw, uint32_t lsw)
+{
+	return (int64_t)((uint64_t)msw << 32 | lsw) * 1e-12;
+}
+
+static void render_diags(FILE *f, struct wrc_diags_shm *d)
+{
+	int i;
+
+	gauge(f, "wrpc_servo_state", "WR servo state, 0 to 5 (see ppsi)",
+	      WRC_DIAGS_WDIAG_SSTAT_SERVOSTATE_R(d->sstat));
+	gauge(f, "wrpc_servo_wr_mode", "1 if the servo is in WR mode",
+	      !!(d->sstat & WRC_DIAGS_WDIAG_SSTAT_WR_MODE));
+	gauge(f, "wrpc_link_up", "1 if the link is up",
+	      !!(d->pstat & WRC_DIAGS_WDIAG_PSTAT_LINK));
+	gauge(f, "wrpc_pll_locked", "1 if the SoftPLL is locked",
+	      !!(d->pstat & WRC_DIAGS_WDIAG_PSTAT_LOCKED));
+	gauge(f, "wrpc_ptp_state", "PTP state of the port (see ppsi)",
+	      WRC_DIAGS_WDIAG_PTPSTAT_PTPSTATE_R(d->ptpstat));
+	header(f, "wrpc_aux_channel_enabled", "gauge",
+	       "1 if the auxiliary clock channel is enabled");
+	for (i = 0; i < 8; i++)
+		fprintf(f, "wrpc_aux_channel_enabled{channel=\"%i\"} %i\n",
+			i, !!(d->astat & (1 << i)));
+	counter(f, "wrpc_ptp_tx_frames", "PTP frames sent", d->txfcnt);
+	counter(f, "wrpc_ptp_rx_frames", "PTP frames received", d->rxfcnt);
+	gauge(f, "wrpc_tai_seconds", "Local TAI time",
+	      ((uint64_t)d->sec_msb << 32 | d->sec_lsb) + d->ns * 1e-9);
+	gauge(f, "wrpc_round_trip_seconds", "Round trip time",
+	      ps(d->mu_msb, d->mu_lsb));
+	gauge(f, "wrpc_master_slave_delay_seconds", "Master to slave delay",
+	      ps(d->dms_msb, d->dms_lsb));
+	gauge(f, "wrpc_link_asymmetry_seconds", "Total link asymmetry",
+	      (int32_t)d->asym * 1e-12);
+	gauge(f, "wrpc_clock_offset_seconds", "Clock offset",
+	      (int32_t)d->cko * 1e-12);
+	gauge(f, "wrpc_phase_setpoint_seconds", "Phase setpoint of the slave",
+	      (int32_t)d->setp * 1e-12);
+	counter(f, "wrpc_servo_updates", "Servo updates", d->ucnt);
+	gauge(f, "wrpc_board_temperature_celsius", "Board temperature",
+	      (int32_t)d->temp / 65536.0);
+}
+
+/* A string of the target (big-endian words), as a label value */
+static void label_string(FILE *f, char *name, int *words, int len)
+{
+	int i, c;
+
+	fprintf(f, "%s=\"", name);
+	for (i = 0; i < len; i++) {
+		c = (words[i / 4] >> (24 - 8 * (i & 3))) & 0xff;
+		if (!c)
+			break;
+		if (c == '"' || c == '\\')
+			fputc('\\', f);
+		if (c >= ' ' && c < 0x7f)
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+static void render_spll(FILE *f, struct spll_stats *s)
+{
+	gauge(f, "wrpc_spll_mode", "SoftPLL mode", s->mode);
+	counter(f, "wrpc_spll_irqs", "SoftPLL interrupts", (uint32_t)s->irq_cnt);
+	gauge(f, "wrpc_spll_seq_state", "SoftPLL sequencer state",
+	      s->seq_state);
+	gauge(f, "wrpc_spll_align_state", "SoftPLL external alignment state",
+	      s->align_state);
+	gauge(f, "wrpc_spll_helper_locked", "1 if the helper PLL is locked",
+	      s->H_lock);
+	gauge(f, "wrpc_spll_main_locked", "1 if the main PLL is locked",
+	      s->M_lock);
+	gauge(f, "wrpc_spll_helper_dac", "DAC value of the helper PLL",
+	      s->H_y);
+	gauge(f, "wrpc_spll_main_dac", "DAC value of the main PLL", s->M_y);
+	counter(f, "wrpc_spll_delocks", "SoftPLL loss of lock events",
+		(uint32_t)s->del_cnt);
+	counter(f, "wrpc_spll_starts", "SoftPLL starts",
+		(uint32_t)s->start_cnt);
+	header(f, "wrpc_build", "info", "Firmware build");
+	fprintf(f, "wrpc_build_info{");
+	label_string(f, "commit_id", (int *)s->commit_id,
+		     sizeof(s->commit_id));
+	fputc(',', f);
+	label_string(f, "build_date", (int *)s->build_date,
+		     sizeof(s->build_date));
+	fputc(',', f);
+	label_string(f, "build_by", (int *)s->build_by, sizeof(s->build_by));
+	fprintf(f, "} 1\n");
+}
+
+static void render_stm(FILE *f, struct stm_stats *s)
+{
+	double cyc = STM_NS_PER_CYCLE * 1e-9;
+
+	counter(f, "wrpc_streamer_tx_frames", "Streamer frames sent", s->tx);
+	counter(f, "wrpc_streamer_rx_frames", "Streamer frames received",
+		s->rx);
+	counter(f, "wrpc_streamer_rx_lost_frames", "Streamer frames lost",
+		s->lost);
+	counter(f, "wrpc_streamer_rx_lost_blocks",
+		"Streamer blocks of lost frames", s->lost_blk);
+	header(f, "wrpc_streamer_rx_latency_seconds", "summary",
+	       "Streamer latency");
+	fprintf(f, "wrpc_streamer_rx_latency_seconds_sum %.12g\n",
+		s->lat_acc * cyc);
+	fprintf(f, "wrpc_streamer_rx_latency_seconds_count %" PRIu64 "\n",
+		s->lat_cnt);
+	gauge(f, "wrpc_streamer_rx_latency_min_seconds",
+	      "Minimum streamer latency", s->lat_min * cyc);
+	gauge(f, "wrpc_streamer_rx_latency_max_seconds",
+	      "Maximum streamer latency", s->lat_max * cyc);
+	gauge(f, "wrpc_streamer_rx_latency_overflow",
+	      "1 if the latency accumulator overflowed", s->overflow);
+}
+
+/* Read everything from the device and replace the rendering */
+static void poll_device(void)
+{
+	struct wrc_diags_shm d;
+	struct spll_stats s;
+	struct stm_stats stm;
+	struct timespec now;
+	char *buf;
+	size_t len;
+	FILE *f;
+	int up_diags = -1, up_spll = -1, up_stm = -1;
+
+	f = open_memstream(&buf, &len);
+	if (!f) {
+		perror("open_memstream");
+		exit(1);
+	}
+	if (diag_map || mem_map) {
+		up_diags = !read_diags(&d);
+		if (up_diags)
+			render_diags(f, &d);
+	}
+	if (mem_map) {
+		up_spll = !read_spll_stats(&s);
+		if (up_spll)
+			render_spll(f, &s);
+	}
+	if (stm_map) {
+		up_stm = !read_stm(&stm);
+		if (up_stm)
+			render_stm(f, &stm);
+	}
+
+	n_polls++;
+	clock_gettime(CLOCK_REALTIME, &now);
+	header(f, "wrpc_exporter_source_up", "gauge",
+	       "1 if the last poll could read the source");
+	if (up_diags >= 0)
+		fprintf(f, "wrpc_exporter_source_up{source=\"diags\"} %i\n",
+			up_diags);
+	if (up_spll >= 0)
+		fprintf(f, "wrpc_exporter_source_up{source=\"spll\"} %i\n",
+			up_spll);
+	if (up_stm >= 0)
+		fprintf(f, "wrpc_exporter_source_up{source=\"streamers\"} %i\n",
+			up_stm);
+	counter(f, "wrpc_exporter_polls", "Polls of the device", n_polls);
+	header(f, "wrpc_exporter_last_poll_seconds", "gauge",
+	       "Time of the last poll");
+	fprintf(f, "wrpc_exporter_last_poll_seconds %li.%03li\n",
+		(long)now.tv_sec, now.tv_nsec / 1000000);
+	fprintf(f, "# EOF\n");
+	fclose(f);
+
+	free(metrics);
+	metrics = buf;
+	metrics_len = len;
+}
+
+static void reply(int fd, char *status, char *type, char *body, size_t len)
+{
+	char hdr[256];
+	int n;
+
+	n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 %s\r\nContent-Type: %s\r\n"
+		     "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+		     status, type, len);
+	if (send(fd, hdr, n, MSG_NOSIGNAL) == n)
+		send(fd, body, len, MSG_NOSIGNAL);
+}
+
+/* One request per connection; a slow client only delays the next poll */
+static void serve(int fd)
+{
+	struct timeval tv = {1, 0};
+	char req[2048];
+	int n, len = 0;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	while (len < sizeof(req) - 1) {
+		n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+		if (n <= 0)
+			break;
+		len += n;
+		req[len] = '\0';
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+			break;
+	}
+	req[len] = '\0';
+	if (!strncmp(req, "GET /metrics ", 13)
+	    || !strncmp(req, "GET /metrics?", 13))
+		reply(fd, "200 OK", "application/openmetrics-text; "
+		      "version=1.0.0; charset=utf-8", metrics, metrics_len);
+	else if (!strncmp(req, "GET ", 4))
+		reply(fd, "404 Not Found", "text/plain", "try /metrics\n", 13);
+	else
+		reply(fd, "400 Bad Request", "text/plain", "", 0);
+	close(fd);
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static int run_server(char *addr, int port)
+{
+	struct sockaddr_in sin = {.sin_family = AF_INET};
+	struct timeval tv;
+	uint64_t next, now;
+	fd_set set;
+	int sock, fd, one = 1;
+
+	sin.sin_port = htons(port);
+	if (!inet_aton(addr, &sin.sin_addr)) {
+		fprintf(stderr, "wrpc-exporter: invalid address \"%s\"\n",
+			addr);
+		return -1;
+	}
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) {
+		perror("socket");
+		return -1;
+	}
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) < 0
+	    || listen(sock, 8) < 0) {
+		fprintf(stderr, "wrpc-exporter: %s:%i: %s\n", addr, port,
+			strerror(errno));
+		return -1;
+	}
+
+	next = now_ms();
+	for (;;) {
+		now = now_ms();
+		if (now >= next) {
+			poll_device();
+			next += interval_ms;
+			if (next <= now) /* we were late: don't catch up */
+				next = now + interval_ms;
+		}
+		tv.tv_sec = (next - now) / 1000;
+		tv.tv_usec = (next - now) % 1000 * 1000;
+		FD_ZERO(&set);
+		FD_SET(sock, &set);
+		if (select(sock + 1, &set, NULL, NULL, &tv) <= 0)
+			continue;
+		fd = accept(sock, NULL, NULL);
+		if (fd >= 0)
+			serve(fd);
+	}
+	return 0;
+}
+
+static void help(char *prog)
+{
+	fprintf(stderr, "%s [options] -f <resource>\n", prog);
+	fprintf(stderr, "  -f <file>      device resource (or a file with the"
+		" same layout)\n");
+	fprintf(stderr, "  -d 0x<offset>  diagnostics registers\n");
+	fprintf(stderr, "  -m 0x<offset>  wrpc memory: SoftPLL stats, and"
+		" diagnostics\n"
+		"                 without the register handshake\n");
+	fprintf(stderr, "  -s 0x<offset>  streamers registers\n");
+	fprintf(stderr, "  -i <ms>        poll interval (default %i)\n",
+		interval_ms);
+	fprintf(stderr, "  -a <address>   listen address (default"
+		" 127.0.0.1)\n");
+	fprintf(stderr, "  -p <port>      listen port (default 9190)\n");
+	fprintf(stderr, "  -1             poll once, print the metrics and"
+		" exit\n");
+}
+
+static unsigned long parse_offset(char *prog, char *s)
+{
+	unsigned long off;
+	char c;
+
+	if (sscanf(s, "0x%lx%c", &off, &c) != 1) {
+		fprintf(stderr, "%s: \"%s\" not a hex offset\n", prog, s);
+		exit(1);
+	}
+	return off;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long diag_off = 0, mem_off = 0, stm_off = 0;
+	int c, once = 0, port = 9190;
+	int diag = 0, mem = 0, stm = 0;
+	char *addr = "127.0.0.1";
+
+	while ((c = getopt(argc, argv, "f:d:m:s:i:a:p:1h")) != -1) {
+		switch (c) {
+		case 'f':
+			resource = optarg;
+			break;
+		case 'd':
+			diag_off = parse_offset(argv[0], optarg);
+			diag = 1;
+			break;
+		case 'm':
+			mem_off = parse_offset(argv[0], optarg);
+			mem = 1;
+			break;
+		case 's':
+			stm_off = parse_offset(argv[0], optarg);
+			stm = 1;
+			break;
+		case 'i':
+			interval_ms = atoi(optarg);
+			break;
+		case 'a':
+			addr = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case '1':
+			once = 1;
+			break;
+		default:
+			help(argv[0]);
+			exit(1);
+		}
+	}
+	if (!resource || optind != argc || !(diag || mem || stm)
+	    || interval_ms <= 0) {
+		help(argv[0]);
+		exit(1);
+	}
+
+	if (diag)
+		diag_map = map_block("diagnostics", diag_off,
+				     sizeof(struct WRC_DIAGS_WB));
+	if (mem)
+		mem_map = map_block("memory", mem_off, WRPC_RAM_SIZE);
+	if (stm)
+		stm_map = map_block("streamers", stm_off,
+				    sizeof(struct WR_STREAMERS_WB));
+
+	if (once) {
+		poll_device();
+		fwrite(metrics, 1, metrics_len, stdout);
+		return 0;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	return run_server(addr, port) ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Compile an init script for the "wr-init" sdb file (see include/initblob.h),
+ * e.g. before running gensdbfs, or decode a compiled one (-d). The
+ * script is one command per line, or separated by ';' like the
+ * build-time CONFIG_INIT_COMMAND.
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+
+#include <initblob.h>
+
+static void help(char *prog)
+{
+	fprintf(stderr, "%s [options] [<script>]\n", prog);
+	fprintf(stderr, "  -o <file>      output file (default stdout)\n");
+	fprintf(stderr, "  -s <size>      size of the sdb file (default %i)\n",
+		INITBLOB_MAX_SIZE);
+	fprintf(stderr, "  -d             decode a compiled script\n");
+}
+
+static void decode(FILE *f, uint8_t *buf, int len)
+{
+	int pos, op, n, i;
+	char *data;
+
+	if (!initblob_is_compiled(buf, len)) {
+		fprintf(stderr, "not a compiled init script\n");
+		exit(1);
+	}
+	n = (buf[0] << 8) | buf[1];
+	if (INITBLOB_HDR + n < len)
+		len = INITBLOB_HDR + n;
+	for (pos = INITBLOB_HDR; pos + 2 <= len; pos += 2 + n) {
+		op = buf[pos];
+		n = buf[pos + 1];
+		if (op == INITBLOB_END || pos + 2 + n > len)
+			break;
+		data = (char *)buf + pos + 2;
+		if (op == INITBLOB_TEXT) {
+			fprintf(f, "%.*s\t# text\n", n, data);
+			continue;
+		}
+		fprintf(f, "%s", initblob_name(op) ? initblob_name(op) : "?");
+		for (i = 0; i < n; i += strlen(data + i) + 1)
+			fprintf(f, " %s", data + i);
+		fprintf(f, "\n");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	static char text[64 * 1024];
+	static uint8_t out[INITBLOB_MAX_SIZE];
+	int c, len, tlen, size = INITBLOB_MAX_SIZE, dec = 0;
+	FILE *in = stdin, *f = stdout;
+
+	while ((c = getopt(argc, argv, "o:s:dh")) != -1) {
+		switch (c) {
+		case 'o':
+			f = fopen(optarg, "w");
+			if (!f) {
+				fprintf(stderr, "%s: %s: %s\n", argv[0],
+					optarg, strerror(errno));
+				exit(1);
+			}
+			break;
+		case 's':
+			size = atoi(optarg);
+			if (size < INITBLOB_HDR || size > INITBLOB_MAX_SIZE) {
+				fprintf(stderr, "%s: size must be %i to %i\n",
+					argv[0], INITBLOB_HDR,
+					INITBLOB_MAX_SIZE);
+				exit(1);
+			}
+			break;
+		case 'd':
+			dec = 1;
+			break;
+		default:
+			help(argv[0]);
+			exit(1);
+		}
+	}
+	if (optind + 1 < argc) {
+		help(argv[0]);
+		exit(1);
+	}
+	if (argv[optind]) {
+		in = fopen(argv[optind], "r");
+		if (!in) {
+			fprintf(stderr, "%s: %s: %s\n", argv[0],
+				argv[optind], strerror(errno));
+			exit(1);
+		}
+	}
+	tlen = fread(text, 1, sizeof(text), in);
+
+	if (dec) {
+		decode(f, (uint8_t *)text, tlen);
+		return 0;
+	}
+	len = initblob_compile(text, tlen, out, size);
+	if (len < 0) {
+		fprintf(stderr, "%s: the script doesn't fit in %i bytes\n",
+			argv[0], size);
+		exit(1);
+	}
+	if (fwrite(out, 1, len, f) != len) {
+		fprintf(stderr, "%s: write error\n", argv[0]);
+		exit(1);
+	}
+	fprintf(stderr, "%i bytes of text, %i compiled\n",
+		tlen, len);
+	return 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * Receive the telemetry stream of a WR node (the "telemetry" command)
+ * and save it as CSV (default) or as raw packets for later analysis.
+ * Both the plain and the packed ("telemetry pack on") formats are decoded.
+ *
+ * Released according to the GNU GPL, version 2 or any later version.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <telemetry.h>
+
+static char *tlm_names[] = TLM_CHANNEL_NAMES;
+
+static void help(char *prog)
+{
+	int i;
+
+	fprintf(stderr, "%s [options]\n", prog);
+	fprintf(stderr, "  -p <port>      UDP port (default %i)\n", TLM_PORT);
+	fprintf(stderr, "  -o <file>      output file (default stdout)\n");
+	fprintf(stderr, "  -b             binary output: raw packets\n");
+	fprintf(stderr, "  -c <channel>   only save this channel "
+		"(may be repeated)\n");
+	fprintf(stderr, "  -n <count>     exit after <count> packets\n");
+	fprintf(stderr, "Channels:");
+	for (i = 0; i < TLM_NCHANNELS; i++)
+		fprintf(stderr, " %s", tlm_names[i]);
+	fprintf(stderr, "\n");
+}
+
+static int tlm_stop;
+
+static void tlm_sigint(int sig)
+{
+	tlm_stop = 1;
+}
+
+/* Returns the value of a varint, or -1 if the packet ends before it */
+static int64_t tlm_varint(uint8_t **pp, uint8_t *end)
+{
+	uint8_t *p = *pp;
+	uint32_t v = 0;
+	int shift;
+
+	for (shift = 0; p < end && shift < 35; shift += 7) {
+		v |= (uint32_t)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80)) {
+			*pp = p;
+			return v;
+		}
+	}
+	return -1;
+}
+
+/* Decode the byte stream of a packed packet, see <telemetry.h> */
+static int tlm_unpack(uint8_t *p, uint8_t *end, int n,
+		      struct telemetry_sample *s)
+{
+	uint16_t index[TLM_NCHANNELS], step[TLM_NCHANNELS];
+	int32_t value[TLM_NCHANNELS];
+	uint32_t seen = 0;
+	int64_t v;
+	int i, ch, zz;
+
+	for (i = 0; i < n; i++, s++) {
+		if (p >= end)
+			return -1;
+		ch = *p & TLM_PK_CHANNEL;
+		zz = (*p & TLM_PK_DELTA) >> TLM_PK_DELTA_SHIFT;
+		if (ch >= TLM_NCHANNELS)
+			return -1;
+		if (!(seen & (1 << ch)) && !(*p & TLM_PK_INDEX))
+			return -1;
+		if (*p++ & TLM_PK_INDEX) {
+			if ((v = tlm_varint(&p, end)) < 0)
+				return -1;
+			if (!(seen & (1 << ch))) {
+				seen |= 1 << ch;
+				index[ch] = v;
+				step[ch] = 0;
+				value[ch] = 0;
+			} else {
+				step[ch] = v;
+				index[ch] += v;
+			}
+		} else {
+			index[ch] += step[ch];
+		}
+		if (zz == TLM_PK_DELTA_VARINT) {
+			if ((v = tlm_varint(&p, end)) < 0)
+				return -1;
+			zz += v;
+		}
+		value[ch] += tlm_unzigzag(zz);
+		s->channel = ch;
+		s->index = index[ch];
+		s->value = value[ch];
+	}
+	return 0;
+}
+
+/*
+ * Convert the header in place and the samples to host order in s[],
+ * return the number of samples or -1. The size of the valid part of
+ * the packet is returned in *size.
+ */
+static int tlm_check(void *buf, int len, struct telemetry_sample *s,
+		     int *size)
+{
+	struct telemetry_hdr *h = buf;
+	struct telemetry_sample *raw = (void *)(h + 1);
+	int i, n, version;
+
+	if (len < sizeof(*h) || ntohl(h->magic) != TLM_MAGIC)
+		return -1;
+	version = ntohs(h->version);
+	n = ntohs(h->nsamples);
+	switch (version) {
+	case TLM_VERSION:
+		*size = sizeof(*h) + n * sizeof(*s);
+		if (len < *size)
+			return -1;
+		for (i = 0; i < n; i++, s++, raw++) {
+			s->channel = raw->channel;
+			s->index = ntohs(raw->index);
+			s->value = ntohl(raw->value);
+		}
+		break;
+	case TLM_VERSION_PACKED:
+		*size = len;
+		if (tlm_unpack((void *)raw, (uint8_t *)buf + len, n, s) < 0)
+			return -1;
+		break;
+	default:
+		return -1;
+	}
+
+	h->version = version;
+	h->nsamples = n;
+	h->sequence = ntohl(h->sequence);
+	h->dropped = ntohl(h->dropped);
+	h->ticks = ntohl(h->ticks);
+	h->tai_sec = ntohl(h->tai_sec);
+	h->tai_nsec = ntohl(h->tai_nsec);
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in addr;
+	struct telemetry_hdr *h;
+	struct telemetry_sample *s;
+	static struct telemetry_sample samples[8192];
+	static uint32_t buf[2048], raw[2048];
+	uint32_t mask = 0, expected = 0;
+	int port = TLM_PORT, binary = 0, count = -1, started = 0;
+	int c, i, n, len, size, sock;
+	unsigned long npackets = 0, nsamples = 0, nbytes = 0;
+	struct sigaction sa = {.sa_handler = tlm_sigint};
+	FILE *f = stdout;
+
+	while ((c = getopt(argc, argv, "p:o:bc:n:h")) != -1) {
+		switch (c) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'o':
+			f = fopen(optarg, "w");
+			if (!f) {
+				fprintf(stderr, "%s: %s: %s\n", argv[0],
+					optarg, strerror(errno));
+				exit(1);
+			}
+			break;
+		case 'b':
+			binary = 1;
+			break;
+		case 'c':
+			for (i = 0; i < TLM_NCHANNELS; i++)
+				if (!strcmp(optarg, tlm_names[i]))
+					break;
+			if (i == TLM_NCHANNELS) {
+				fprintf(stderr, "%s: unknown channel \"%s\"\n",
+					argv[0], optarg);
+				exit(1);
+			}
+			mask |= 1 << i;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		default:
+			help(argv[0]);
+			exit(1);
+		}
+	}
+	if (!mask)
+		mask = ~0;
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		perror("socket");
+		exit(1);
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		exit(1);
+	}
+
+	if (!binary)
+		fprintf(f, "sequence,tai_sec,tai_nsec,ticks,channel,"
+			"index,value\n");
+
+	/* no SA_RESTART: interrupt recv() to print the summary */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	while (count && !tlm_stop) {
+		len = recv(sock, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("recv");
+			exit(1);
+		}
+		if (binary)
+			memcpy(raw, buf, len);
+		n = tlm_check(buf, len, samples, &size);
+		if (n < 0) {
+			fprintf(stderr, "discarding invalid packet (%i bytes)\n",
+				len);
+			continue;
+		}
+		h = (void *)buf;
+		if (started && h->sequence != expected)
+			fprintf(stderr, "lost %i packets before %u\n",
+				h->sequence - expected, h->sequence);
+		expected = h->sequence + 1;
+		started = 1;
+		if (count > 0)
+			count--;
+		npackets++;
+		nsamples += n;
+		nbytes += size - sizeof(*h);
+		/* binary output keeps the packet as received (big endian) */
+		if (binary) {
+			fwrite(raw, 1, size, f);
+			fflush(f);
+			continue;
+		}
+
+		s = samples;
+		for (i = 0; i < n; i++, s++) {
+			if (s->channel >= TLM_NCHANNELS)
+				continue;
+			if (!(mask & (1 << s->channel)))
+				continue;
+			fprintf(f, "%u,%u,%u,%u,%s,%u,%i\n", h->sequence,
+				h->tai_sec, h->tai_nsec, h->ticks,
+				tlm_names[s->channel], s->index, s->value);
+		}
+		fflush(f);
+	}
+	fclose(f);
+
+	/* the raw format is the reference for the compression ratio */
+	if (nbytes)
+		fprintf(stderr, "%lu packets, %lu samples, %lu bytes of data, "
+			"ratio %.2f\n", npackets, nsamples, nbytes,
+			(double)nsamples * sizeof(*s) / nbytes);
+	return 0;
+}
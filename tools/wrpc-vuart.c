@@ -11,10 +11,17 @@
 #include <termios.h>
 #include <getopt.h>
 #include <errno.h>
+#include <time.h>
 
 #include <hw/wb_uart.h>
 #include <libdevmap.h>
 
+#define VUART_BUF_SIZE		4096
+#define VUART_POLL_MIN_US	500	/* first poll after the output stops */
+#define VUART_POLL_MAX_US	20000	/* when idle */
+#define VUART_BATCH_TIMEOUT_MS	2000
+#define VUART_PROMPT		"wrc# "
+
 static void wrpc_vuart_help(char *prog)
 {
 	const char *mapping_help_str;
@@ -23,21 +30,11 @@ static void wrpc_vuart_help(char *prog)
 	fprintf(stderr, "%s [options]\n", prog);
 	fprintf(stderr, "%s\n", mapping_help_str);
 	fprintf(stderr, "Vuart specific option: [-k(keep terminal)]\n");
-}
-
-/**
- * It receives a single byte
- * @param[in] vuart token from dev_map()
- *
- *
- */
-static int8_t wr_vuart_rx(struct mapping_desc *vuart)
-{
-	int rdr = ((volatile struct UART_WB *)vuart->base)->HOST_RDR;
-	if (vuart->is_be)
-		rdr = ntohl(rdr);
-
-	return (rdr & UART_HOST_RDR_RDY) ? UART_HOST_RDR_DATA_R(rdr) : -1;
+	fprintf(stderr, "  -b <file>  batch: send the commands in <file> (- for"
+		" stdin), one per\n"
+		"             line, and print the output until the prompt\n");
+	fprintf(stderr, "  -t <ms>    batch: max wait for the output of a command"
+		" (default %i)\n", VUART_BATCH_TIMEOUT_MS);
 }
 
 /**
@@ -58,25 +55,36 @@ static void wr_vuart_tx(struct mapping_desc *vuart, char data)
 }
 
 /**
- * It reads a number of bytes and it stores them in a given buffer
+ * It reads a number of bytes and it stores them in a given buffer. Each
+ * read of HOST_RDR pops a byte and, if the core has it, the FIFO count:
+ * when it says this was the last byte, we skip the read that would find
+ * the FIFO empty.
  * @param[in] vuart token from dev_map()
  * @param[out] buf destination for read bytes
  * @param[in] size numeber of bytes to read
+ * @param[out] more set if the buffer filled up first (may be NULL)
  *
  * @return the number of read bytes
  */
-static size_t wr_vuart_read(struct mapping_desc *vuart, char *buf, size_t size)
+static size_t wr_vuart_read(struct mapping_desc *vuart, char *buf, size_t size,
+			    int *more)
 {
-	size_t s = size, n_rx = 0;
-	int8_t c;
+	volatile struct UART_WB *ptr = (volatile struct UART_WB *)vuart->base;
+	size_t n_rx = 0;
+	uint32_t rdr;
 
-	while(s--) {
-		c =  wr_vuart_rx(vuart);
-		if(c < 0)
+	if (more)
+		*more = 0;
+	while (n_rx < size) {
+		rdr = iomemr32(vuart->is_be, ptr->HOST_RDR);
+		if (!(rdr & UART_HOST_RDR_RDY))
+			return n_rx;
+		buf[n_rx++] = UART_HOST_RDR_DATA_R(rdr);
+		if (UART_HOST_RDR_COUNT_R(rdr) == 1)
 			return n_rx;
-		*buf++ = c;
-		n_rx ++;
 	}
+	if (more)
+		*more = 1;
 	return n_rx;
 }
 
@@ -99,14 +107,46 @@ static size_t wr_vuart_write(struct mapping_desc *vuart, char *buf, size_t size)
 	return size;
 }
 
+/**
+ * It copies to stdout what the FIFO has now, with one write
+ * @param[in] vuart token from dev_map()
+ * @param[out] more set if the FIFO was not empty yet
+ *
+ * @return the number of bytes
+ */
+static size_t wr_vuart_drain(struct mapping_desc *vuart, int *more)
+{
+	static char buf[VUART_BUF_SIZE];
+	size_t n;
+
+	n = wr_vuart_read(vuart, buf, sizeof(buf), more);
+	if (n) {
+		fwrite(buf, 1, n, stdout);
+		fflush(stdout);
+	}
+	return n;
+}
+
+/* Next poll: at once while data flows, then back off up to the max */
+static int next_poll_us(int poll_us, size_t n_rx, int more)
+{
+	if (more)
+		return 0;
+	if (n_rx)
+		return VUART_POLL_MIN_US;
+	poll_us = poll_us ? poll_us * 2 : VUART_POLL_MIN_US;
+	return poll_us > VUART_POLL_MAX_US ? VUART_POLL_MAX_US : poll_us;
+}
+
 static void wrpc_vuart_term_main(struct mapping_desc *vuart, int keep_term)
 {
 	struct termios oldkey, newkey;
 	//above is place for old and new port settings for keyboard teletype
 	int need_exit = 0;
 	fd_set fds;
-	int ret;
-	char rx, tx;
+	int ret, i, more = 0, poll_us = VUART_POLL_MAX_US;
+	char tx[64];
+	size_t n_rx;
 
 	fprintf(stderr, "[press C-a to exit]\n");
 
@@ -122,7 +162,7 @@ static void wrpc_vuart_term_main(struct mapping_desc *vuart, int keep_term)
 		tcsetattr(STDIN_FILENO,TCSANOW,&newkey);
 	}
 	while(!need_exit) {
-		struct timeval tv = {0, 10000};
+		struct timeval tv = {0, poll_us};
 
 		FD_ZERO(&fds);
 		FD_SET(STDIN_FILENO, &fds);
@@ -141,41 +181,144 @@ static void wrpc_vuart_term_main(struct mapping_desc *vuart, int keep_term)
 		default:
 			if(!FD_ISSET(STDIN_FILENO, &fds))
 				break;
-			/* The user wrote something */
+			/* The user wrote something (maybe a paste) */
 			do {
-				ret = read(STDIN_FILENO, &tx, 1);
+				ret = read(STDIN_FILENO, tx, sizeof(tx));
 			} while (ret < 0 && errno == EINTR);
-			if (ret != 1) {
+			if (ret <= 0) {
 				fprintf(stderr, "nothing to read. Port disconnected?\n");
 				need_exit = 1; /* kill */
+				break;
 			}
 			/* If the user character is C-a, then kill */
-			if(tx == '\x01')
+			for (i = 0; i < ret; i++)
+				if (tx[i] == '\x01')
+					break;
+			if (i < ret)
 				need_exit = 1;
 
-			ret = wr_vuart_write(vuart, &tx, 1);
-			if (ret != 1) {
-				fprintf(stderr, "Unable to write (errno: %d)\n", errno);
-				need_exit = 1;
-			}
+			wr_vuart_write(vuart, tx, i);
+			/* the echo is coming */
+			poll_us = VUART_POLL_MIN_US;
 			break;
 		}
 
 		/* Print all the incoming charactes */
-		while((wr_vuart_read(vuart, &rx, 1)) == 1)
-			fprintf(stderr,"%c", rx);
-
+		n_rx = wr_vuart_drain(vuart, &more);
+		poll_us = next_poll_us(poll_us, n_rx, more);
 	}
 
 	if(!keep_term)
 		tcsetattr(STDIN_FILENO, TCSANOW, &oldkey);
 }
 
+static unsigned long vuart_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * It prints the output until the shell prompt, or until nothing arrives
+ * for a while
+ * @param[in] vuart token from dev_map()
+ * @param[in] timeout_ms max time without output
+ *
+ * @return 0 if the prompt arrived, -1 on timeout
+ */
+static int wr_vuart_wait_prompt(struct mapping_desc *vuart, int timeout_ms)
+{
+	static char buf[VUART_BUF_SIZE];
+	/* the end of the output, to find the prompt across reads */
+	char tail[2 * sizeof(VUART_PROMPT)] = "";
+	unsigned long last = vuart_ms();
+	int more, poll_us = 0, len = sizeof(VUART_PROMPT) - 1, t = 0, m;
+	size_t n;
+
+	for (;;) {
+		n = wr_vuart_read(vuart, buf, sizeof(buf), &more);
+		if (n) {
+			fwrite(buf, 1, n, stdout);
+			last = vuart_ms();
+			m = n > len ? len : n;
+			memcpy(tail + t, buf + n - m, m);
+			t += m;
+			if (t > len) {
+				memmove(tail, tail + t - len, len);
+				t = len;
+			}
+			tail[t] = '\0';
+			if (!more && !strcmp(tail, VUART_PROMPT))
+				break;
+		} else if (vuart_ms() - last > timeout_ms) {
+			fflush(stdout);
+			return -1;
+		}
+		poll_us = next_poll_us(poll_us, n, more);
+		if (poll_us)
+			usleep(poll_us);
+	}
+	fflush(stdout);
+	return 0;
+}
+
+/**
+ * It runs the commands of a file, one per line, and prints the output
+ * @param[in] vuart token from dev_map()
+ * @param[in] name the file, "-" for stdin
+ * @param[in] timeout_ms max time without output for each command
+ *
+ * @return 0 on success, -1 if a file is missing or a command timed out
+ */
+static int wrpc_vuart_batch(struct mapping_desc *vuart, char *name,
+			    int timeout_ms)
+{
+	static char junk[VUART_BUF_SIZE];
+	char line[256];
+	FILE *f = stdin;
+	int len, ret = 0;
+
+	if (strcmp(name, "-")) {
+		f = fopen(name, "r");
+		if (!f) {
+			fprintf(stderr, "%s: %s\n", name, strerror(errno));
+			return -1;
+		}
+	}
+	/* old output is not ours; then get a fresh prompt */
+	while (wr_vuart_read(vuart, junk, sizeof(junk), NULL))
+		;
+	wr_vuart_write(vuart, "\r", 1);
+	if (wr_vuart_wait_prompt(vuart, timeout_ms) < 0) {
+		fprintf(stderr, "no shell prompt from the core\n");
+		ret = -1;
+	}
+	while (ret == 0 && fgets(line, sizeof(line), f)) {
+		len = strcspn(line, "\r\n");
+		if (!len || line[0] == '#')
+			continue;
+		line[len++] = '\r'; /* KEY_ENTER for the shell */
+		wr_vuart_write(vuart, line, len);
+		if (wr_vuart_wait_prompt(vuart, timeout_ms) < 0) {
+			fprintf(stderr, "\ntimeout: no prompt after \"%.*s\"\n",
+				len - 1, line);
+			ret = -1;
+		}
+	}
+	printf("\n");
+	if (f != stdin)
+		fclose(f);
+	return ret;
+}
+
 
 int main(int argc, char *argv[])
 {
 	char c;
-	int keep_term = 0;
+	int keep_term = 0, timeout_ms = VUART_BATCH_TIMEOUT_MS, ret;
+	char *batch = NULL;
 	struct mapping_args *map_args;
 	struct mapping_desc *vuart = NULL;
 
@@ -186,11 +329,17 @@ int main(int argc, char *argv[])
 	}
 
 	/* Parse specific args */
-	while ((c = getopt (argc, argv, "k")) != -1) {
+	while ((c = getopt (argc, argv, "kb:t:")) != -1) {
 		switch (c) {
 		case 'k':
 			keep_term = 1;
 			break;
+		case 'b':
+			batch = optarg;
+			break;
+		case 't':
+			timeout_ms = atoi(optarg);
+			break;
 		case 'h':
 			wrpc_vuart_help(argv[0]);
 			break;
@@ -206,6 +355,11 @@ int main(int argc, char *argv[])
 		goto out;
 	}
 
+	if (batch) {
+		ret = wrpc_vuart_batch(vuart, batch, timeout_ms);
+		dev_unmap(vuart);
+		return ret;
+	}
 	wrpc_vuart_term_main(vuart, keep_term);
 	dev_unmap(vuart);
 
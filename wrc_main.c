@@ -30,6 +30,7 @@
 #include "lib/ipv4.h"
 #include "rxts_calibrator.h"
 #include "flash.h"
+#include "boot.h"
 
 #include "wrc_ptp.h"
 #include "system_checks.h"
@@ -61,11 +62,14 @@ static void wrc_initialize(void)
 	pp_printf("WR Core: starting up...\n");
 
 	timer_init(1);
+	boot_mark(BOOT_START);
 	get_hw_name(wrc_hw_name);
 	storage_read_hdl_cfg();
 	wrpc_w1_init();
 	wrpc_w1_bus.detail = ONEWIRE_PORT;
-	w1_scan_bus(&wrpc_w1_bus);
+	/* With fast boot, scan when storage needs it, or later */
+	if (!IS_FAST_BOOT)
+		boot_w1_scan();
 
 	/*initialize flash*/
 	flash_init();
@@ -73,6 +77,7 @@ static void wrc_initialize(void)
 	mi2c_init(WRPC_FMC_I2C);
 	/*init storage (Flash / W1 EEPROM / I2C EEPROM*/
 	storage_init(WRPC_FMC_I2C, FMC_EEPROM_ADR);
+	boot_mark(BOOT_STORAGE);
 
 	if (get_persistent_mac(ONEWIRE_PORT, mac_addr) == -1) {
 		pp_printf("Unable to determine MAC address\n");
@@ -83,6 +88,7 @@ static void wrc_initialize(void)
 		mac_addr[4] = 0x66;	*
 		mac_addr[5] = 0x77;	*/
 	}
+	boot_mark(BOOT_MAC);
 
 	pp_printf("Local MAC address: %02x:%02x:%02x:%02x:%02x:%02x\n",
 		mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3],
@@ -91,15 +97,20 @@ static void wrc_initialize(void)
 	net_rst();
 	ep_init(mac_addr);
 	/* Sleep for 1s to make sure WRS v4.2 always realizes that
-	 * the link is down */
-	timer_delay_ms(200);
-	ep_enable(1, 1);
+	 * the link is down. With fast boot, the boot task waits instead */
+	if (!IS_FAST_BOOT) {
+		timer_delay_ms(200);
+		ep_enable(1, 1);
+		boot_mark(BOOT_ENDPOINT);
+	}
 
 	minic_init();
 	shw_pps_gen_init();
 	wrc_ptp_init();
+	boot_mark(BOOT_PTP);
 	/* try reading t24 phase transition from EEPROM */
 	calib_t24p(WRC_MODE_MASTER, &cal_phase_transition);
+	boot_mark(BOOT_CALIB);
 	spll_very_init();
 	usleep_init();
 	shell_init();
@@ -109,6 +120,7 @@ static void wrc_initialize(void)
 
 	wrc_ptp_set_mode(WRC_MODE_SLAVE);
 	wrc_ptp_start();
+	boot_mark(BOOT_INIT);
 	shw_pps_gen_get_time(NULL, &prev_nanos_for_profile);
 	/* get tics */
 	prev_ticks_for_profile = timer_get_tics();
@@ -133,6 +145,7 @@ static int wrc_check_link(void)
 		sfp_match();
 		wrc_ptp_start();
 		link_status = LINK_WENT_UP;
+		boot_mark(BOOT_LINK);
 		rv = 1;
 	} else if (prev_state && !state) {
 		wrc_verbose("Link down.\n");
@@ -212,9 +225,16 @@ DEFINE_WRC_TASK(ptp) = {
 	.name = "ptp",
 	.job = wrc_ptp_update,
 };
+static void wrc_boot_script(void)
+{
+	/* with fast boot, the boot task runs it one line at a time */
+	if (!IS_FAST_BOOT)
+		shell_boot_script();
+}
+
 DEFINE_WRC_TASK(shell) = {
 	.name = "shell+gui",
-	.init = shell_boot_script,
+	.init = wrc_boot_script,
 	.job = ui_update,
 };
 DEFINE_WRC_TASK(spll) = {
@@ -279,6 +299,8 @@ static void wrc_run_task(struct wrc_task *t)
 
 	if (!t->job) /* idle task, just count iterations */
 		t->nrun++;
+	else if (t->flags & WRC_TASK_LATE_INIT)
+		; /* fast boot: not initialized yet */
 	else if (!t->enable || *t->enable) {
 		/* either enabled or without a check variable */
 		done_sth = t->job();
@@ -295,9 +317,14 @@ int main(void)
 	check_reset();
 
 	/* initialization of individual tasks */
-	for_each_task(t)
+	for_each_task(t) {
+		if (IS_FAST_BOOT && (t->flags & WRC_TASK_LATE_INIT))
+			continue;
+		t->flags &= ~WRC_TASK_LATE_INIT;
 		if (t->init)
 			t->init();
+	}
+	boot_mark(BOOT_TASKS);
 
 	for (;;) {
 		for_each_task(t)